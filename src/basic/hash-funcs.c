@@ -4,6 +4,7 @@
 
 #include "hash-funcs.h"
 #include "path-util.h"
+#include "unaligned.h"
 
 void string_hash_func(const char *p, struct siphash *state) {
         siphash24_compress(p, strlen(p) + 1, state);
@@ -84,6 +85,28 @@ const struct hash_ops trivial_hash_ops_free_free = {
         .free_value = free,
 };
 
+uint64_t trusted_pointer_hash_func(const void *p, const uint8_t key[static 16]) {
+        uint64_t h;
+
+        /* The finalizer of MurmurHash3, keyed by XORing in the hash key. All bits of the pointer end up
+         * affecting the low bits of the result, which are the ones that select the bucket. */
+
+        h = (uint64_t) (uintptr_t) p ^ unaligned_read_ne64(key);
+        h ^= h >> 33;
+        h *= UINT64_C(0xff51afd7ed558ccd);
+        h ^= h >> 33;
+        h *= UINT64_C(0xc4ceb9fe1a85ec53);
+        h ^= h >> 33;
+
+        return h;
+}
+
+const struct hash_ops trusted_pointer_hash_ops = {
+        .hash = trivial_hash_func,
+        .compare = trivial_compare_func,
+        .trusted_hash = trusted_pointer_hash_func,
+};
+
 void uint64_hash_func(const uint64_t *p, struct siphash *state) {
         siphash24_compress(p, sizeof(uint64_t), state);
 }
@@ -7,12 +7,18 @@
 
 typedef void (*hash_func_t)(const void *p, struct siphash *state);
 typedef int (*compare_func_t)(const void *a, const void *b);
+typedef uint64_t (*trusted_hash_func_t)(const void *p, const uint8_t key[static 16]);
 
 struct hash_ops {
         hash_func_t hash;
         compare_func_t compare;
         free_func_t free_key;
         free_func_t free_value;
+
+        /* Optional. A cheaper keyed hash used instead of .hash, for keys that cannot be chosen by an untrusted
+         * party, for example pointers to objects we allocated ourselves. Unlike SipHash it is not meant to
+         * resist collision attacks, hence never use it for strings, user/group IDs, PIDs or suchlike. */
+        trusted_hash_func_t trusted_hash;
 };
 
 #define _DEFINE_HASH_OPS(uq, name, type, hash_func, compare_func, free_key_func, free_value_func, scope) \
@@ -91,6 +97,10 @@ extern const struct hash_ops trivial_hash_ops;
 extern const struct hash_ops trivial_hash_ops_free;
 extern const struct hash_ops trivial_hash_ops_free_free;
 
+/* Like trivial_hash_ops, but hashes the pointers with trusted_pointer_hash_func() */
+uint64_t trusted_pointer_hash_func(const void *p, const uint8_t key[static 16]) _pure_;
+extern const struct hash_ops trusted_pointer_hash_ops;
+
 /* 32bit values we can always just embed in the pointer itself, but in order to support 32bit archs we need store 64bit
  * values indirectly, since they don't fit in a pointer. */
 void uint64_hash_func(const uint64_t *p, struct siphash *state);
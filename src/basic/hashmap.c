@@ -34,6 +34,9 @@
  * Probe sequence: linear
  *   - though theoretically worse than random probing/uniform hashing/double
  *     hashing, it is good for cache locality.
+ * Number of buckets: always a power of two
+ *   - so that hash values are mapped to buckets and probes wrap around with
+ *     a mask instead of an integer division.
  *
  * References:
  * Celis, P. 1986. Robin Hood Hashing.
@@ -175,9 +178,14 @@ struct direct_storage {
         uint8_t storage[sizeof(struct indirect_storage)];
 };
 
-#define DIRECT_BUCKETS(entry_t) \
+#define _DIRECT_BUCKETS(entry_t) \
         (sizeof(struct direct_storage) / (sizeof(entry_t) + sizeof(dib_raw_t)))
 
+/* Rounded down to a power of two, like the number of buckets of indirect storage. */
+#define DIRECT_BUCKETS(entry_t)                                         \
+        (_DIRECT_BUCKETS(entry_t) >= 4 ? 4U :                           \
+         _DIRECT_BUCKETS(entry_t) >= 2 ? 2U : _DIRECT_BUCKETS(entry_t))
+
 /* We should be able to store at least one entry directly. */
 assert_cc(DIRECT_BUCKETS(struct ordered_hashmap_entry) >= 1);
 
@@ -279,9 +287,8 @@ _destructor_ static void cleanup_pools(void) {
 
         /* Be nice to valgrind */
 
-        /* The pool is only allocated by the main thread, but the memory can
-         * be passed to other threads. Let's clean up if we are the main thread
-         * and no other threads are live. */
+        /* The pool is shared between threads. Let's clean up if we are the
+         * main thread and no other threads are live. */
         /* We build our own is_main_thread() here, which doesn't use C11
          * TLS based caching of the result. That's because valgrind apparently
          * doesn't like malloc() (which C11 TLS internally uses) to be called
@@ -336,13 +343,17 @@ static unsigned base_bucket_hash(HashmapBase *h, const void *p) {
         struct siphash state;
         uint64_t hash;
 
-        siphash24_init(&state, hash_key(h));
+        if (h->hash_ops->trusted_hash)
+                hash = h->hash_ops->trusted_hash(p, hash_key(h));
+        else {
+                siphash24_init(&state, hash_key(h));
 
-        h->hash_ops->hash(p, &state);
+                h->hash_ops->hash(p, &state);
 
-        hash = siphash24_finalize(&state);
+                hash = siphash24_finalize(&state);
+        }
 
-        return (unsigned) (hash % n_buckets(h));
+        return (unsigned) hash & (n_buckets(h) - 1U);
 }
 #define bucket_hash(h, p) base_bucket_hash(HASHMAP_BASE(h), p)
 
@@ -410,8 +421,7 @@ static dib_raw_t* dib_raw_ptr(HashmapBase *h) {
 }
 
 static unsigned bucket_distance(HashmapBase *h, unsigned idx, unsigned from) {
-        return idx >= from ? idx - from
-                           : n_buckets(h) + idx - from;
+        return (idx - from) & (n_buckets(h) - 1U);
 }
 
 static unsigned bucket_calculate_dib(HashmapBase *h, unsigned idx, dib_raw_t raw_dib) {
@@ -495,11 +505,11 @@ static void bucket_move_entry(HashmapBase *h, struct swap_entries *swap,
 }
 
 static unsigned next_idx(HashmapBase *h, unsigned idx) {
-        return (idx + 1U) % n_buckets(h);
+        return (idx + 1U) & (n_buckets(h) - 1U);
 }
 
 static unsigned prev_idx(HashmapBase *h, unsigned idx) {
-        return (n_buckets(h) + idx - 1U) % n_buckets(h);
+        return (idx - 1U) & (n_buckets(h) - 1U);
 }
 
 static void* entry_value(HashmapBase *h, struct hashmap_base_entry *e) {
@@ -865,11 +875,9 @@ static void hashmap_free_no_clear(HashmapBase *h) {
         assert_se(pthread_mutex_unlock(&hashmap_debug_list_mutex) == 0);
 #endif
 
-        if (h->from_pool) {
-                /* Ensure that the object didn't get migrated between threads. */
-                assert_se(is_main_thread());
+        if (h->from_pool)
                 mempool_free_tile(hashmap_type_info[h->type].mempool, h);
-        } else
+        else
                 free(h);
 }
 
@@ -1091,13 +1099,17 @@ static int resize_buckets(HashmapBase *h, unsigned entries_add) {
         if (_likely_(new_n_buckets <= old_n_buckets))
                 return 0;
 
-        new_shift = log2u_round_up(MAX(
-                        new_n_buckets * (hi->entry_size + sizeof(dib_raw_t)),
-                        2 * sizeof(struct direct_storage)));
+        /* Both the old and the new number of buckets are powers of two, hence this at least doubles it. */
+        new_shift = log2u_round_up(new_n_buckets);
+        /* Rounding up might overflow the bucket count, and shifting by the full width is undefined */
+        if (_unlikely_(new_shift >= sizeof(unsigned) * 8))
+                return -ENOMEM;
+        if (_unlikely_((1U << new_shift) > UINT_MAX / (hi->entry_size + sizeof(dib_raw_t))))
+                return -ENOMEM;
 
         /* Realloc storage (buckets and DIB array). */
         new_storage = realloc(h->has_indirect ? h->indirect.storage : NULL,
-                              1U << new_shift);
+                              (1U << new_shift) * (hi->entry_size + sizeof(dib_raw_t)));
         if (!new_storage)
                 return -ENOMEM;
 
@@ -1117,8 +1129,7 @@ static int resize_buckets(HashmapBase *h, unsigned entries_add) {
 
         h->has_indirect = true;
         h->indirect.storage = new_storage;
-        h->indirect.n_buckets = (1U << new_shift) /
-                                (hi->entry_size + sizeof(dib_raw_t));
+        h->indirect.n_buckets = 1U << new_shift;
 
         old_dibs = (dib_raw_t*)((uint8_t*) new_storage + hi->entry_size * old_n_buckets);
         new_dibs = dib_raw_ptr(h);
@@ -1,5 +1,7 @@
 /* SPDX-License-Identifier: LGPL-2.1-or-later */
 
+#include <errno.h>
+#include <pthread.h>
 #include <stdint.h>
 #include <stdlib.h>
 
@@ -7,31 +9,116 @@
 #include "macro.h"
 #include "memory-util.h"
 #include "mempool.h"
-#include "process-util.h"
 #include "util.h"
 
+/* Tiles are handed out from per-thread magazines, which only hit the shared depot (and its lock) once every
+ * MAGAZINE_SIZE allocations or frees. */
+#define MAGAZINE_SIZE 32U
+
 struct pool {
         struct pool *next;
         size_t n_tiles;
         size_t n_used;
 };
 
-void* mempool_alloc_tile(struct mempool *mp) {
-        size_t i;
+static pthread_mutex_t depot_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t depot_once = PTHREAD_ONCE_INIT;
+static pthread_key_t magazines_key;
+static bool magazines_key_valid = false;
+static thread_local struct mempool_magazine *thread_magazines = NULL;
 
-        /* When a tile is released we add it to the list and simply
-         * place the next pointer at its offset 0. */
+static void depot_lock(void) {
+        assert_se(pthread_mutex_lock(&depot_mutex) == 0);
+}
 
-        assert(mp->tile_size >= sizeof(void*));
-        assert(mp->at_least > 0);
+static void depot_unlock(void) {
+        assert_se(pthread_mutex_unlock(&depot_mutex) == 0);
+}
+
+static void* tile_next(void *p) {
+        return *(void**) p;
+}
+
+static void tile_set_next(void *p, void *next) {
+        *(void**) p = next;
+}
+
+static void* magazine_next(void *p) {
+        return ((void**) p)[1];
+}
+
+static void magazine_set_next(void *p, void *next) {
+        ((void**) p)[1] = next;
+}
+
+static void chain_flush(struct mempool *mp, void **chain) {
+        /* Must be called with the depot lock taken */
+
+        while (*chain) {
+                void *t = *chain;
+
+                *chain = tile_next(t);
+                tile_set_next(t, mp->freelist);
+                mp->freelist = t;
+        }
+}
+
+static void magazine_flush(struct mempool_magazine *m) {
+        /* Hands all tiles of the magazine back to the depot, as loose tiles */
 
-        if (mp->freelist) {
-                void *r;
+        depot_lock();
+        chain_flush(m->mempool, &m->loaded);
+        chain_flush(m->mempool, &m->previous);
+        depot_unlock();
 
-                r = mp->freelist;
-                mp->freelist = * (void**) mp->freelist;
-                return r;
+        m->n_loaded = m->n_previous = 0;
+}
+
+static void thread_magazines_flush(void *userdata) {
+        struct mempool_magazine *m;
+
+        /* Called when a thread which used any pool exits, so that the tiles it cached are not lost */
+
+        while ((m = thread_magazines)) {
+                thread_magazines = m->next_in_thread;
+
+                magazine_flush(m);
+                m->mempool = NULL;
+                m->next_in_thread = NULL;
         }
+}
+
+static void depot_init(void) {
+        /* If we fork while another thread holds the depot lock, the child would never be able to take it */
+        (void) pthread_atfork(depot_lock, depot_unlock, depot_unlock);
+
+        magazines_key_valid = pthread_key_create(&magazines_key, thread_magazines_flush) == 0;
+}
+
+static struct mempool_magazine* mempool_get_magazine(struct mempool *mp) {
+        struct mempool_magazine *m;
+
+        m = mp->magazine();
+        if (_unlikely_(!m->mempool)) {
+                /* First use of this pool in this thread, make sure the magazine is flushed on thread exit. If
+                 * we cannot arrange for that, the tiles cached by the thread are simply lost when it exits. */
+                assert_se(pthread_once(&depot_once, depot_init) == 0);
+
+                m->mempool = mp;
+                m->next_in_thread = thread_magazines;
+                thread_magazines = m;
+
+                if (magazines_key_valid)
+                        (void) pthread_setspecific(magazines_key, &thread_magazines);
+        }
+
+        return m;
+}
+
+static void* pool_take_tile(struct mempool *mp) {
+        size_t i, tile_size = ALIGN(mp->tile_size);
+
+        /* Must be called with the depot lock taken */
 
         if (_unlikely_(!mp->first_pool) ||
             _unlikely_(mp->first_pool->n_used >= mp->first_pool->n_tiles)) {
@@ -40,8 +127,8 @@ void* mempool_alloc_tile(struct mempool *mp) {
 
                 n = mp->first_pool ? mp->first_pool->n_tiles : 0;
                 n = MAX(mp->at_least, n * 2);
-                size = PAGE_ALIGN(ALIGN(sizeof(struct pool)) + n*mp->tile_size);
-                n = (size - ALIGN(sizeof(struct pool))) / mp->tile_size;
+                size = PAGE_ALIGN(ALIGN(sizeof(struct pool)) + n*tile_size);
+                n = (size - ALIGN(sizeof(struct pool))) / tile_size;
 
                 p = malloc(size);
                 if (!p)
@@ -56,7 +143,76 @@ void* mempool_alloc_tile(struct mempool *mp) {
 
         i = mp->first_pool->n_used++;
 
-        return ((uint8_t*) mp->first_pool) + ALIGN(sizeof(struct pool)) + i*mp->tile_size;
+        return ((uint8_t*) mp->first_pool) + ALIGN(sizeof(struct pool)) + i*tile_size;
+}
+
+static int magazine_refill(struct mempool_magazine *m) {
+        struct mempool *mp = m->mempool;
+        int r = 0;
+
+        assert(m->n_loaded == 0);
+        assert(m->n_previous == 0);
+
+        depot_lock();
+
+        /* Prefer a full magazine somebody else returned, then loose tiles, then fresh ones */
+        if (mp->full) {
+                m->loaded = mp->full;
+                m->n_loaded = MAGAZINE_SIZE;
+                mp->full = magazine_next(mp->full);
+                goto finish;
+        }
+
+        while (m->n_loaded < MAGAZINE_SIZE) {
+                void *t;
+
+                if (mp->freelist) {
+                        t = mp->freelist;
+                        mp->freelist = tile_next(t);
+                } else {
+                        t = pool_take_tile(mp);
+                        if (!t)
+                                break;
+                }
+
+                tile_set_next(t, m->loaded);
+                m->loaded = t;
+                m->n_loaded++;
+        }
+
+        if (m->n_loaded == 0)
+                r = -ENOMEM;
+
+finish:
+        depot_unlock();
+        return r;
+}
+
+void* mempool_alloc_tile(struct mempool *mp) {
+        struct mempool_magazine *m;
+        void *r;
+
+        /* When a tile is released we add it to the magazine and simply place the next pointer at its offset
+         * 0. Full magazines are chained up in the depot through offset 1. */
+
+        assert(mp->tile_size >= 2 * sizeof(void*));
+        assert(mp->at_least > 0);
+
+        m = mempool_get_magazine(mp);
+
+        if (_unlikely_(m->n_loaded == 0)) {
+                if (m->n_previous > 0) {
+                        SWAP_TWO(m->loaded, m->previous);
+                        SWAP_TWO(m->n_loaded, m->n_previous);
+                } else if (magazine_refill(m) < 0)
+                        return NULL;
+        }
+
+        r = m->loaded;
+        m->loaded = tile_next(r);
+        m->n_loaded--;
+
+        return r;
 }
 
 void* mempool_alloc0_tile(struct mempool *mp) {
@@ -69,32 +225,67 @@ void* mempool_alloc0_tile(struct mempool *mp) {
 }
 
 void mempool_free_tile(struct mempool *mp, void *p) {
-        * (void**) p = mp->freelist;
-        mp->freelist = p;
+        struct mempool_magazine *m;
+
+        /* Tiles may be freed by a different thread than the one that allocated them, they simply end up in
+         * the magazine of the freeing thread. */
+
+        m = mempool_get_magazine(mp);
+
+        if (_unlikely_(m->n_loaded >= MAGAZINE_SIZE)) {
+                if (m->n_previous > 0) {
+                        depot_lock();
+                        magazine_set_next(m->previous, mp->full);
+                        mp->full = m->previous;
+                        depot_unlock();
+                }
+
+                m->previous = m->loaded;
+                m->n_previous = m->n_loaded;
+                m->loaded = NULL;
+                m->n_loaded = 0;
+        }
+
+        tile_set_next(p, m->loaded);
+        m->loaded = p;
+        m->n_loaded++;
 }
 
-bool mempool_enabled(void) {
-        static int b = -1;
+static bool enabled = false;
 
-        if (!is_main_thread())
-                return false;
+static void mempool_enabled_init(void) {
+        int b;
 
-        if (!mempool_use_allowed)
-                b = false;
-        if (b < 0)
-                b = getenv_bool("SYSTEMD_MEMPOOL") != 0;
+        /* Where pools are not allowed by default (i.e. in libsystemd, whose memory should be returned to the
+         * application's allocator) they may still be turned on explicitly. */
+        b = getenv_bool("SYSTEMD_MEMPOOL");
+        enabled = mempool_use_allowed ? b != 0 : b > 0;
+}
+
+bool mempool_enabled(void) {
+        static pthread_once_t once = PTHREAD_ONCE_INIT;
 
-        return b;
+        assert_se(pthread_once(&once, mempool_enabled_init) == 0);
+
+        return enabled;
 }
 
 #if VALGRIND
 void mempool_drop(struct mempool *mp) {
+        struct mempool_magazine *m = mp->magazine();
         struct pool *p = mp->first_pool;
+
         while (p) {
                 struct pool *n;
                 n = p->next;
                 free(p);
                 p = n;
         }
+
+        mp->first_pool = NULL;
+        mp->freelist = mp->full = NULL;
+
+        m->loaded = m->previous = NULL;
+        m->n_loaded = m->n_previous = 0;
 }
 #endif
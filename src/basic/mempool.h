@@ -4,13 +4,27 @@
 #include <stdbool.h>
 #include <stddef.h>
 
+#include "macro.h"
+
 struct pool;
+struct mempool;
+
+/* A per-thread cache of free tiles of one mempool. Both chains are linked through the first word of each
+ * tile. 'previous' is either empty or holds exactly one full magazine. */
+struct mempool_magazine {
+        struct mempool *mempool;
+        struct mempool_magazine *next_in_thread;
+        void *loaded, *previous;
+        unsigned n_loaded, n_previous;
+};
 
 struct mempool {
         struct pool *first_pool;
-        void *freelist;
+        void *freelist;     /* loose tiles, handed back by exiting threads */
+        void *full;         /* full magazines, linked through the second word of their first tile */
         size_t tile_size;
         unsigned at_least;
+        struct mempool_magazine* (*magazine)(void);
 };
 
 void* mempool_alloc_tile(struct mempool *mp);
@@ -18,9 +32,14 @@ void* mempool_alloc0_tile(struct mempool *mp);
 void mempool_free_tile(struct mempool *mp, void *p);
 
 #define DEFINE_MEMPOOL(pool_name, tile_type, alloc_at_least) \
+static thread_local struct mempool_magazine pool_name##_magazine; \
+static struct mempool_magazine* pool_name##_get_magazine(void) { \
+        return &pool_name##_magazine; \
+} \
 static struct mempool pool_name = { \
         .tile_size = sizeof(tile_type), \
         .at_least = alloc_at_least, \
+        .magazine = pool_name##_get_magazine, \
 }
 
 extern const bool mempool_use_allowed;
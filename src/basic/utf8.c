@@ -162,6 +162,12 @@ char *utf8_is_valid_n(const char *str, size_t len_bytes) {
                 if (_unlikely_(*p == '\0') && len_bytes != (size_t) -1)
                         return NULL; /* embedded NUL */
 
+                /* Plain ASCII is by far the most common case, skip over it quickly */
+                if ((signed char) *p > 0) {
+                        p++;
+                        continue;
+                }
+
                 len = utf8_encoded_valid_unichar(p,
                                                  len_bytes != (size_t) -1 ? len_bytes - (p - str) : (size_t) -1);
                 if (_unlikely_(len < 0))
@@ -73,14 +73,211 @@ bool unit_has_host_root_cgroup(Unit *u) {
         return unit_has_name(u, SPECIAL_ROOT_SLICE);
 }
 
-static int set_attribute_and_warn(Unit *u, const char *controller, const char *attribute, const char *value) {
+typedef struct CGroupAttribute {
+        CGroupController controller;
+        char *value;
+        char name[];
+} CGroupAttribute;
+
+DEFINE_PRIVATE_HASH_OPS_WITH_VALUE_DESTRUCTOR(cgroup_attribute_hash_ops, char, string_hash_func, string_compare_func,
+                                              CGroupAttribute, free);
+
+static void unit_invalidate_cgroup_attributes(Unit *u, CGroupMask mask) {
+        CGroupAttribute *a;
+
+        assert(u);
+
+        /* Forgets what we wrote to the attributes of the specified controllers, for example because the
+         * cgroup was recreated in their hierarchies, and the kernel reset them to the defaults */
+
+        if (mask == _CGROUP_MASK_ALL) {
+                u->cgroup_attribute_cache = hashmap_free(u->cgroup_attribute_cache);
+                return;
+        }
+
+        HASHMAP_FOREACH(a, u->cgroup_attribute_cache)
+                if (FLAGS_SET(mask, CGROUP_CONTROLLER_TO_MASK(a->controller)))
+                        free(hashmap_remove(u->cgroup_attribute_cache, a->name));
+}
+
+static int unit_remember_cgroup_attribute(Unit *u, const char *controller, const char *attribute, const char *value) {
+        _cleanup_free_ CGroupAttribute *n = NULL;
+        CGroupAttribute *a;
+        CGroupController c;
+        char *v;
+        int r;
+
+        assert(u);
+
+        c = cgroup_controller_from_string(controller);
+        if (c < 0)
+                return -EINVAL;
+
+        v = strdup(value);
+        if (!v)
+                return -ENOMEM;
+
+        a = hashmap_get(u->cgroup_attribute_cache, attribute);
+        if (a) {
+                free_and_replace(a->value, v);
+                return 0;
+        }
+
+        n = malloc(offsetof(CGroupAttribute, name) + strlen(attribute) + 1);
+        if (!n) {
+                free(v);
+                return -ENOMEM;
+        }
+
+        n->controller = c;
+        n->value = v;
+        strcpy(n->name, attribute);
+
+        r = hashmap_ensure_allocated(&u->cgroup_attribute_cache, &cgroup_attribute_hash_ops);
+        if (r < 0)
+                goto fail;
+
+        r = hashmap_put(u->cgroup_attribute_cache, n->name, n);
+        if (r < 0)
+                goto fail;
+
+        TAKE_PTR(n);
+        return 0;
+
+fail:
+        free(n->value);
+        return r;
+}
+
+static void manager_cgroup_write_batch_begin(Manager *m) {
+        assert(m);
+
+        if (m->cgroup_write_batch_depth++ == 0)
+                m->cgroup_realize_pass++;
+}
+
+static void manager_cgroup_write_batch_end(Manager *m) {
+        void *fd;
+
+        assert(m);
+        assert(m->cgroup_write_batch_depth > 0);
+
+        if (--m->cgroup_write_batch_depth > 0)
+                return;
+
+        HASHMAP_FOREACH(fd, m->cgroup_write_dir_fds)
+                safe_close(PTR_TO_FD(fd));
+
+        m->cgroup_write_dir_fds = hashmap_free(m->cgroup_write_dir_fds);
+}
+
+static int manager_cgroup_write_batch_get_dir(Manager *m, const char *controller, const char *path, bool reopen, int *ret) {
+        _cleanup_free_ char *p = NULL;
+        _cleanup_close_ int fd = -1;
+        void *v;
         int r;
 
-        r = cg_set_attribute(controller, u->cgroup_path, attribute, value);
+        assert(m);
+        assert(ret);
+
+        r = cg_get_path(controller, path, NULL, &p);
         if (r < 0)
+                return r;
+
+        v = hashmap_get(m->cgroup_write_dir_fds, p);
+        if (v) {
+                _cleanup_free_ char *k = NULL;
+
+                if (!reopen) {
+                        *ret = PTR_TO_FD(v);
+                        return 0;
+                }
+
+                /* The cgroup might have been removed and created again since we opened it */
+                safe_close(PTR_TO_FD(hashmap_remove2(m->cgroup_write_dir_fds, p, (void**) &k)));
+        }
+
+        fd = open(p, O_PATH|O_DIRECTORY|O_CLOEXEC);
+        if (fd < 0)
+                return -errno;
+
+        r = hashmap_ensure_allocated(&m->cgroup_write_dir_fds, &path_hash_ops_free);
+        if (r < 0)
+                return r;
+
+        r = hashmap_put(m->cgroup_write_dir_fds, p, FD_TO_PTR(fd));
+        if (r < 0)
+                return r;
+
+        TAKE_PTR(p);
+        *ret = TAKE_FD(fd);
+        return 0;
+}
+
+static int manager_cgroup_write_attribute(Manager *m, const char *controller, const char *path, const char *attribute, const char *value) {
+        int r;
+
+        assert(m);
+        assert(attribute);
+        assert(value);
+
+        m->n_cgroup_attribute_writes++;
+
+        if (m->cgroup_write_batch_depth == 0)
+                return cg_set_attribute(controller, path, attribute, value);
+
+        for (bool reopen = false;; reopen = true) {
+                _cleanup_fclose_ FILE *f = NULL;
+                _cleanup_close_ int fd = -1;
+                int dir_fd;
+
+                r = manager_cgroup_write_batch_get_dir(m, controller, path, reopen, &dir_fd);
+                if (r < 0)
+                        return r;
+
+                fd = openat(dir_fd, attribute, O_WRONLY|O_CLOEXEC|O_NOCTTY);
+                if (fd < 0) {
+                        if (errno == ENOENT && !reopen)
+                                continue;
+
+                        return -errno;
+                }
+
+                f = take_fdopen(&fd, "w");
+                if (!f)
+                        return -errno;
+
+                return write_string_stream(f, value, WRITE_STRING_FILE_DISABLE_BUFFER);
+        }
+}
+
+static int set_attribute_and_warn(Unit *u, const char *controller, const char *attribute, const char *value) {
+        CGroupAttribute *a;
+        int r;
+
+        /* Writing an attribute is idempotent, hence if we already wrote the very same value before, we can
+         * skip it. Only we write these attributes, hence the cached value is what the kernel has. */
+        a = hashmap_get(u->cgroup_attribute_cache, attribute);
+        if (a && streq(a->value, value)) {
+                u->manager->n_cgroup_attribute_writes_skipped++;
+                return 0;
+        }
+
+        r = manager_cgroup_write_attribute(u->manager, controller, u->cgroup_path, attribute, value);
+        if (r < 0) {
                 log_unit_full_errno(u, LOG_LEVEL_CGROUP_WRITE(r), r, "Failed to set '%s' attribute on '%s' to '%.*s': %m",
                                     strna(attribute), isempty(u->cgroup_path) ? "/" : u->cgroup_path, (int) strcspn(value, NEWLINE), value);
 
+                /* Who knows what the attribute is set to now */
+                if (a)
+                        free(hashmap_remove(u->cgroup_attribute_cache, attribute));
+
+                return r;
+        }
+
+        if (unit_remember_cgroup_attribute(u, controller, attribute, value) < 0 && a)
+                free(hashmap_remove(u->cgroup_attribute_cache, attribute));
+
         return r;
 }
 
@@ -1528,10 +1725,9 @@ CGroupMask unit_get_members_mask(Unit *u) {
         u->cgroup_members_mask = 0;
 
         if (u->type == UNIT_SLICE) {
-                void *v;
                 Unit *member;
 
-                HASHMAP_FOREACH_KEY(v, member, u->dependencies[UNIT_BEFORE])
+                UNIT_FOREACH_DEPENDENCY(member, u, UNIT_BEFORE)
                         if (UNIT_DEREF(member->slice) == u)
                                 u->cgroup_members_mask |= unit_get_subtree_mask(member); /* note that this calls ourselves again, for the children */
         }
@@ -1866,6 +2062,9 @@ static int unit_update_cgroup(
                 return log_unit_error_errno(u, r, "Failed to create cgroup %s: %m", u->cgroup_path);
         created = r;
 
+        /* If the cgroup was (re)created in some hierarchy, the kernel reset its attributes there */
+        unit_invalidate_cgroup_attributes(u, created ? _CGROUP_MASK_ALL : u->cgroup_realized_mask ^ target_mask);
+
         /* Start watching it */
         (void) unit_watch_cgroup(u);
         (void) unit_watch_cgroup_memory(u);
@@ -2163,6 +2362,12 @@ static int unit_realize_cgroup_now_enable(Unit *u, ManagerState state) {
 
         assert(u);
 
+        /* Siblings processed in the same pass over the realize queue share their ancestors, and nothing
+         * changes their masks within the pass. Hence if we got here for this slice already, we are done. */
+        if (u->manager->cgroup_write_batch_depth > 0 &&
+            u->cgroup_enable_pass == u->manager->cgroup_realize_pass)
+                return 0;
+
         /* First go deal with this unit's parent, or we won't be able to enable
          * any new controllers at this layer. */
         if (UNIT_ISSET(u->slice)) {
@@ -2176,27 +2381,30 @@ static int unit_realize_cgroup_now_enable(Unit *u, ManagerState state) {
 
         /* We can only enable in this direction, don't try to disable anything.
          */
-        if (unit_has_mask_enables_realized(u, target_mask, enable_mask))
-                return 0;
+        if (!unit_has_mask_enables_realized(u, target_mask, enable_mask)) {
+                new_target_mask = u->cgroup_realized_mask | target_mask;
+                new_enable_mask = u->cgroup_enabled_mask | enable_mask;
 
-        new_target_mask = u->cgroup_realized_mask | target_mask;
-        new_enable_mask = u->cgroup_enabled_mask | enable_mask;
+                r = unit_update_cgroup(u, new_target_mask, new_enable_mask, state);
+                if (r < 0)
+                        return r;
+        }
 
-        return unit_update_cgroup(u, new_target_mask, new_enable_mask, state);
+        u->cgroup_enable_pass = u->manager->cgroup_realize_pass;
+        return 0;
 }
 
 /* Controllers can only be disabled depth-first, from the leaves of the
  * hierarchy upwards to the unit in question. */
 static int unit_realize_cgroup_now_disable(Unit *u, ManagerState state) {
         Unit *m;
-        void *v;
 
         assert(u);
 
         if (u->type != UNIT_SLICE)
                 return 0;
 
-        HASHMAP_FOREACH_KEY(v, m, u->dependencies[UNIT_BEFORE]) {
+        UNIT_FOREACH_DEPENDENCY(m, u, UNIT_BEFORE) {
                 CGroupMask target_mask, enable_mask, new_target_mask, new_enable_mask;
                 int r;
 
@@ -2314,6 +2522,7 @@ static int unit_realize_cgroup_now(Unit *u, ManagerState state) {
 }
 
 unsigned manager_dispatch_cgroup_realize_queue(Manager *m) {
+        uint64_t n_writes, n_skipped;
         ManagerState state;
         unsigned n = 0;
         Unit *i;
@@ -2321,8 +2530,18 @@ unsigned manager_dispatch_cgroup_realize_queue(Manager *m) {
 
         assert(m);
 
+        if (!m->cgroup_realize_queue)
+                return 0;
+
         state = manager_state(m);
 
+        /* Realize all queued units in one batch, so that we look at ancestors shared between them only
+         * once, and keep the cgroup directories we write to open */
+        manager_cgroup_write_batch_begin(m);
+
+        n_writes = m->n_cgroup_attribute_writes;
+        n_skipped = m->n_cgroup_attribute_writes_skipped;
+
         while ((i = m->cgroup_realize_queue)) {
                 assert(i->in_cgroup_realize_queue);
 
@@ -2339,6 +2558,12 @@ unsigned manager_dispatch_cgroup_realize_queue(Manager *m) {
                 n++;
         }
 
+        manager_cgroup_write_batch_end(m);
+
+        if (m->n_cgroup_attribute_writes_skipped > n_skipped)
+                log_debug("Realized %u queued cgroups, wrote %" PRIu64 " cgroup attributes, skipped %" PRIu64 " unchanged ones.",
+                          n, m->n_cgroup_attribute_writes - n_writes, m->n_cgroup_attribute_writes_skipped - n_skipped);
+
         return n;
 }
 
@@ -2361,12 +2586,11 @@ void unit_add_family_to_cgroup_realize_queue(Unit *u) {
 
         do {
                 Unit *m;
-                void *v;
 
                 /* Children of u likely changed when we're called */
                 u->cgroup_members_mask_valid = false;
 
-                HASHMAP_FOREACH_KEY(v, m, u->dependencies[UNIT_BEFORE]) {
+                UNIT_FOREACH_DEPENDENCY(m, u, UNIT_BEFORE) {
                         /* Skip units that have a dependency on the slice but aren't actually in it. */
                         if (UNIT_DEREF(m->slice) != u)
                                 continue;
@@ -2396,6 +2620,8 @@ void unit_add_family_to_cgroup_realize_queue(Unit *u) {
 }
 
 int unit_realize_cgroup(Unit *u) {
+        int r;
+
         assert(u);
 
         if (!UNIT_HAS_CGROUP_CONTEXT(u))
@@ -2414,7 +2640,11 @@ int unit_realize_cgroup(Unit *u) {
                 unit_add_family_to_cgroup_realize_queue(UNIT_DEREF(u->slice));
 
         /* And realize this one now (and apply the values) */
-        return unit_realize_cgroup_now(u, manager_state(u->manager));
+        manager_cgroup_write_batch_begin(u->manager);
+        r = unit_realize_cgroup_now(u, manager_state(u->manager));
+        manager_cgroup_write_batch_end(u->manager);
+
+        return r;
 }
 
 void unit_release_cgroup(Unit *u) {
@@ -2428,6 +2658,9 @@ void unit_release_cgroup(Unit *u) {
                 u->cgroup_path = mfree(u->cgroup_path);
         }
 
+        unit_invalidate_cgroup_attributes(u, _CGROUP_MASK_ALL);
+        unit_invalidate_accounting_cache(u);
+
         if (u->cgroup_control_inotify_wd >= 0) {
                 if (inotify_rm_watch(u->manager->cgroup_inotify_fd, u->cgroup_control_inotify_wd) < 0)
                         log_unit_debug_errno(u, errno, "Failed to remove cgroup control inotify watch %i for %s, ignoring: %m", u->cgroup_control_inotify_wd, u->id);
@@ -2492,6 +2725,9 @@ void unit_prune_cgroup(Unit *u) {
                  * on error, continue cleanup. */
                 log_unit_full_errno(u, r == -EBUSY ? LOG_DEBUG : LOG_WARNING, r, "Failed to destroy cgroup %s, ignoring: %m", u->cgroup_path);
 
+        /* Even if that failed, the cgroup might have gone from some of the hierarchies */
+        unit_invalidate_cgroup_attributes(u, _CGROUP_MASK_ALL);
+
         if (is_root_slice)
                 return;
 
@@ -3235,7 +3471,87 @@ int manager_notify_cgroup_empty(Manager *m, const char *cgroup) {
         return 1;
 }
 
-int unit_get_memory_current(Unit *u, uint64_t *ret) {
+/* Reads an attribute of the unit's cgroup. If 'dir_fds' is non-NULL, the controller directories are opened on
+ * first use and kept open there, so that reading several attributes of the same cgroup does not resolve the
+ * cgroupfs path over and over again. */
+static int unit_cgroup_read_attribute(
+                Unit *u,
+                int *dir_fds,
+                const char *controller,
+                const char *attribute,
+                char **ret) {
+
+        _cleanup_free_ char *p = NULL;
+        CGroupController c;
+        int r;
+
+        assert(u);
+        assert(u->cgroup_path);
+        assert(controller);
+        assert(attribute);
+        assert(ret);
+
+        if (!dir_fds) {
+                r = cg_get_path(controller, u->cgroup_path, attribute, &p);
+                if (r < 0)
+                        return r;
+
+                return read_full_file(p, ret, NULL);
+        }
+
+        /* On the unified hierarchy all attributes live in the same directory */
+        r = cg_all_unified();
+        if (r < 0)
+                return r;
+        if (r > 0)
+                c = 0;
+        else {
+                c = cgroup_controller_from_string(controller);
+                assert(c >= 0);
+        }
+
+        if (dir_fds[c] < 0) {
+                r = cg_get_path(controller, u->cgroup_path, NULL, &p);
+                if (r < 0)
+                        return r;
+
+                dir_fds[c] = open(p, O_PATH|O_DIRECTORY|O_CLOEXEC);
+                if (dir_fds[c] < 0)
+                        return -errno;
+        }
+
+        return read_full_file_full(dir_fds[c], attribute, UINT64_MAX, SIZE_MAX, 0, NULL, ret, NULL);
+}
+
+static int unit_cgroup_read_attribute_as_uint64(
+                Unit *u,
+                int *dir_fds,
+                const char *controller,
+                const char *attribute,
+                uint64_t *ret) {
+
+        _cleanup_free_ char *value = NULL;
+        int r;
+
+        assert(ret);
+
+        r = unit_cgroup_read_attribute(u, dir_fds, controller, attribute, &value);
+        if (r == -ENOENT)
+                return -ENODATA;
+        if (r < 0)
+                return r;
+
+        value[strcspn(value, NEWLINE)] = 0;
+
+        if (streq(value, "max")) {
+                *ret = CGROUP_LIMIT_MAX;
+                return 0;
+        }
+
+        return safe_atou64(value, ret);
+}
+
+static int unit_get_memory_current_full(Unit *u, int *dir_fds, uint64_t *ret) {
         int r;
 
         assert(u);
@@ -3258,10 +3574,14 @@ int unit_get_memory_current(Unit *u, uint64_t *ret) {
         if (r < 0)
                 return r;
 
-        return cg_get_attribute_as_uint64("memory", u->cgroup_path, r > 0 ? "memory.current" : "memory.usage_in_bytes", ret);
+        return unit_cgroup_read_attribute_as_uint64(u, dir_fds, "memory", r > 0 ? "memory.current" : "memory.usage_in_bytes", ret);
 }
 
-int unit_get_tasks_current(Unit *u, uint64_t *ret) {
+int unit_get_memory_current(Unit *u, uint64_t *ret) {
+        return unit_get_memory_current_full(u, NULL, ret);
+}
+
+static int unit_get_tasks_current_full(Unit *u, int *dir_fds, uint64_t *ret) {
         assert(u);
         assert(ret);
 
@@ -3278,11 +3598,17 @@ int unit_get_tasks_current(Unit *u, uint64_t *ret) {
         if ((u->cgroup_realized_mask & CGROUP_MASK_PIDS) == 0)
                 return -ENODATA;
 
-        return cg_get_attribute_as_uint64("pids", u->cgroup_path, "pids.current", ret);
+        return unit_cgroup_read_attribute_as_uint64(u, dir_fds, "pids", "pids.current", ret);
+}
+
+int unit_get_tasks_current(Unit *u, uint64_t *ret) {
+        return unit_get_tasks_current_full(u, NULL, ret);
 }
 
-static int unit_get_cpu_usage_raw(Unit *u, nsec_t *ret) {
-        uint64_t ns;
+static int unit_get_cpu_usage_raw(Unit *u, int *dir_fds, nsec_t *ret) {
+        _cleanup_free_ char *contents = NULL;
+        const char *p;
+        uint64_t us;
         int r;
 
         assert(u);
@@ -3302,29 +3628,37 @@ static int unit_get_cpu_usage_raw(Unit *u, nsec_t *ret) {
         r = cg_all_unified();
         if (r < 0)
                 return r;
-        if (r > 0) {
-                _cleanup_free_ char *val = NULL;
-                uint64_t us;
+        if (r == 0)
+                return unit_cgroup_read_attribute_as_uint64(u, dir_fds, "cpuacct", "cpuacct.usage", ret);
 
-                r = cg_get_keyed_attribute("cpu", u->cgroup_path, "cpu.stat", STRV_MAKE("usage_usec"), &val);
-                if (IN_SET(r, -ENOENT, -ENXIO))
-                        return -ENODATA;
-                if (r < 0)
-                        return r;
+        r = unit_cgroup_read_attribute(u, dir_fds, "cpu", "cpu.stat", &contents);
+        if (r == -ENOENT)
+                return -ENODATA;
+        if (r < 0)
+                return r;
 
-                r = safe_atou64(val, &us);
-                if (r < 0)
-                        return r;
+        for (p = contents; *p; p += strspn(p, NEWLINE)) {
+                const char *w;
 
-                ns = us * NSEC_PER_USEC;
-        } else
-                return cg_get_attribute_as_uint64("cpuacct", u->cgroup_path, "cpuacct.usage", ret);
+                w = first_word(p, "usage_usec");
+                if (w) {
+                        w = strndupa(w, strcspn(w, NEWLINE));
 
-        *ret = ns;
-        return 0;
+                        r = safe_atou64(w, &us);
+                        if (r < 0)
+                                return r;
+
+                        *ret = us * NSEC_PER_USEC;
+                        return 0;
+                }
+
+                p += strcspn(p, NEWLINE);
+        }
+
+        return -ENODATA;
 }
 
-int unit_get_cpu_usage(Unit *u, nsec_t *ret) {
+static int unit_get_cpu_usage_full(Unit *u, int *dir_fds, nsec_t *ret) {
         nsec_t ns;
         int r;
 
@@ -3337,7 +3671,7 @@ int unit_get_cpu_usage(Unit *u, nsec_t *ret) {
         if (!UNIT_CGROUP_BOOL(u, cpu_accounting))
                 return -ENODATA;
 
-        r = unit_get_cpu_usage_raw(u, &ns);
+        r = unit_get_cpu_usage_raw(u, dir_fds, &ns);
         if (r == -ENODATA && u->cpu_usage_last != NSEC_INFINITY) {
                 /* If we can't get the CPU usage anymore (because the cgroup was already removed, for example), use our
                  * cached value. */
@@ -3361,6 +3695,10 @@ int unit_get_cpu_usage(Unit *u, nsec_t *ret) {
         return 0;
 }
 
+int unit_get_cpu_usage(Unit *u, nsec_t *ret) {
+        return unit_get_cpu_usage_full(u, NULL, ret);
+}
+
 int unit_get_ip_accounting(
                 Unit *u,
                 CGroupIPAccountingMetric metric,
@@ -3399,7 +3737,11 @@ int unit_get_ip_accounting(
         return r;
 }
 
-static int unit_get_io_accounting_raw(Unit *u, uint64_t ret[static _CGROUP_IO_ACCOUNTING_METRIC_MAX]) {
+static int unit_get_io_accounting_raw(
+                Unit *u,
+                int *dir_fds,
+                uint64_t ret[static _CGROUP_IO_ACCOUNTING_METRIC_MAX]) {
+
         static const char *const field_names[_CGROUP_IO_ACCOUNTING_METRIC_MAX] = {
                 [CGROUP_IO_READ_BYTES]       = "rbytes=",
                 [CGROUP_IO_WRITE_BYTES]      = "wbytes=",
@@ -3407,8 +3749,8 @@ static int unit_get_io_accounting_raw(Unit *u, uint64_t ret[static _CGROUP_IO_AC
                 [CGROUP_IO_WRITE_OPERATIONS] = "wios=",
         };
         uint64_t acc[_CGROUP_IO_ACCOUNTING_METRIC_MAX] = {};
-        _cleanup_free_ char *path = NULL;
-        _cleanup_fclose_ FILE *f = NULL;
+        _cleanup_free_ char *contents = NULL;
+        const char *q;
         int r;
 
         assert(u);
@@ -3428,19 +3770,15 @@ static int unit_get_io_accounting_raw(Unit *u, uint64_t ret[static _CGROUP_IO_AC
         if (!FLAGS_SET(u->cgroup_realized_mask, CGROUP_MASK_IO))
                 return -ENODATA;
 
-        r = cg_get_path("io", u->cgroup_path, "io.stat", &path);
+        r = unit_cgroup_read_attribute(u, dir_fds, "io", "io.stat", &contents);
         if (r < 0)
                 return r;
 
-        f = fopen(path, "re");
-        if (!f)
-                return -errno;
-
-        for (;;) {
+        for (q = contents;;) {
                 _cleanup_free_ char *line = NULL;
                 const char *p;
 
-                r = read_line(f, LONG_LINE_MAX, &line);
+                r = extract_first_word(&q, &line, NEWLINE, 0);
                 if (r < 0)
                         return r;
                 if (r == 0)
@@ -3482,8 +3820,9 @@ static int unit_get_io_accounting_raw(Unit *u, uint64_t ret[static _CGROUP_IO_AC
         return 0;
 }
 
-int unit_get_io_accounting(
+static int unit_get_io_accounting_full(
                 Unit *u,
+                int *dir_fds,
                 CGroupIOAccountingMetric metric,
                 bool allow_cache,
                 uint64_t *ret) {
@@ -3499,7 +3838,7 @@ int unit_get_io_accounting(
         if (allow_cache && u->io_accounting_last[metric] != UINT64_MAX)
                 goto done;
 
-        r = unit_get_io_accounting_raw(u, raw);
+        r = unit_get_io_accounting_raw(u, dir_fds, raw);
         if (r == -ENODATA && u->io_accounting_last[metric] != UINT64_MAX)
                 goto done;
         if (r < 0)
@@ -3520,6 +3859,95 @@ done:
         return 0;
 }
 
+int unit_get_io_accounting(
+                Unit *u,
+                CGroupIOAccountingMetric metric,
+                bool allow_cache,
+                uint64_t *ret) {
+
+        return unit_get_io_accounting_full(u, NULL, metric, allow_cache, ret);
+}
+
+int unit_get_accounting(Unit *u, bool allow_cache, UnitAccounting *ret) {
+        int dir_fds[_CGROUP_CONTROLLER_MAX];
+        UnitAccounting a = {
+                .cpu_usage = NSEC_INFINITY,
+                .memory_current = UINT64_MAX,
+                .tasks_current = UINT64_MAX,
+        };
+        usec_t n;
+        int r;
+
+        assert(u);
+        assert(ret);
+
+        /* Reads all accounting counters of the unit in one go. Every attribute file is opened relative to the
+         * cgroup directory, which is opened only once per controller. The result is cached for a short time,
+         * so that clients querying the properties one by one, or many units in a row, don't make us re-read
+         * the same files over and over again. Counters that are not available are set to UINT64_MAX. */
+
+        n = now(CLOCK_MONOTONIC);
+
+        if (allow_cache &&
+            u->accounting_cache &&
+            u->accounting_cache->timestamp + UNIT_ACCOUNTING_CACHE_USEC > n) {
+                *ret = *u->accounting_cache;
+                return 0;
+        }
+
+        for (size_t i = 0; i < ELEMENTSOF(dir_fds); i++)
+                dir_fds[i] = -1;
+
+        r = unit_get_cpu_usage_full(u, dir_fds, &a.cpu_usage);
+        if (r < 0 && r != -ENODATA)
+                log_unit_warning_errno(u, r, "Failed to get CPU usage: %m");
+
+        r = unit_get_memory_current_full(u, dir_fds, &a.memory_current);
+        if (r < 0 && r != -ENODATA)
+                log_unit_warning_errno(u, r, "Failed to get memory usage: %m");
+
+        r = unit_get_tasks_current_full(u, dir_fds, &a.tasks_current);
+        if (r < 0 && r != -ENODATA)
+                log_unit_warning_errno(u, r, "Failed to get number of tasks: %m");
+
+        /* One readout of io.stat yields all IO counters, the remaining ones are then taken from the cache */
+        for (CGroupIOAccountingMetric i = 0; i < _CGROUP_IO_ACCOUNTING_METRIC_MAX; i++) {
+                a.io[i] = UINT64_MAX;
+
+                r = unit_get_io_accounting_full(u, dir_fds, i, i > 0, &a.io[i]);
+                if (r < 0 && r != -ENODATA)
+                        log_unit_debug_errno(u, r, "Failed to get IO accounting data, ignoring: %m");
+        }
+
+        for (CGroupIPAccountingMetric i = 0; i < _CGROUP_IP_ACCOUNTING_METRIC_MAX; i++) {
+                a.ip[i] = UINT64_MAX;
+
+                r = unit_get_ip_accounting(u, i, &a.ip[i]);
+                if (r < 0 && r != -ENODATA)
+                        log_unit_debug_errno(u, r, "Failed to get IP accounting data, ignoring: %m");
+        }
+
+        close_many(dir_fds, ELEMENTSOF(dir_fds));
+
+        a.timestamp = n;
+
+        if (!u->accounting_cache) {
+                u->accounting_cache = new(UnitAccounting, 1);
+                if (!u->accounting_cache)
+                        return -ENOMEM;
+        }
+
+        *u->accounting_cache = a;
+        *ret = a;
+        return 0;
+}
+
+void unit_invalidate_accounting_cache(Unit *u) {
+        assert(u);
+
+        u->accounting_cache = mfree(u->accounting_cache);
+}
+
 int unit_reset_cpu_accounting(Unit *u) {
         int r;
 
@@ -3527,7 +3955,9 @@ int unit_reset_cpu_accounting(Unit *u) {
 
         u->cpu_usage_last = NSEC_INFINITY;
 
-        r = unit_get_cpu_usage_raw(u, &u->cpu_usage_base);
+        unit_invalidate_accounting_cache(u);
+
+        r = unit_get_cpu_usage_raw(u, NULL, &u->cpu_usage_base);
         if (r < 0) {
                 u->cpu_usage_base = 0;
                 return r;
@@ -3548,6 +3978,7 @@ int unit_reset_ip_accounting(Unit *u) {
                 q = bpf_firewall_reset_accounting(u->ip_accounting_egress_map_fd);
 
         zero(u->ip_accounting_extra);
+        unit_invalidate_accounting_cache(u);
 
         return r < 0 ? r : q;
 }
@@ -3560,7 +3991,9 @@ int unit_reset_io_accounting(Unit *u) {
         for (CGroupIOAccountingMetric i = 0; i < _CGROUP_IO_ACCOUNTING_METRIC_MAX; i++)
                 u->io_accounting_last[i] = UINT64_MAX;
 
-        r = unit_get_io_accounting_raw(u, u->io_accounting_base);
+        unit_invalidate_accounting_cache(u);
+
+        r = unit_get_io_accounting_raw(u, NULL, u->io_accounting_base);
         if (r < 0) {
                 zero(u->io_accounting_base);
                 return r;
@@ -3620,9 +4053,8 @@ void unit_invalidate_cgroup_bpf(Unit *u) {
          * list of our children includes our own. */
         if (u->type == UNIT_SLICE) {
                 Unit *member;
-                void *v;
 
-                HASHMAP_FOREACH_KEY(v, member, u->dependencies[UNIT_BEFORE])
+                UNIT_FOREACH_DEPENDENCY(member, u, UNIT_BEFORE)
                         if (UNIT_DEREF(member->slice) == u)
                                 unit_invalidate_cgroup_bpf(member);
         }
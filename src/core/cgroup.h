@@ -186,6 +186,19 @@ typedef enum CGroupIOAccountingMetric {
         _CGROUP_IO_ACCOUNTING_METRIC_INVALID = -1,
 } CGroupIOAccountingMetric;
 
+/* All accounting counters of a unit, as read in one go by unit_get_accounting() */
+typedef struct UnitAccounting {
+        usec_t timestamp; /* CLOCK_MONOTONIC time of the readout */
+        nsec_t cpu_usage;
+        uint64_t memory_current;
+        uint64_t tasks_current;
+        uint64_t io[_CGROUP_IO_ACCOUNTING_METRIC_MAX];
+        uint64_t ip[_CGROUP_IP_ACCOUNTING_METRIC_MAX];
+} UnitAccounting;
+
+/* For how long a readout is served from the cache */
+#define UNIT_ACCOUNTING_CACHE_USEC (250 * USEC_PER_MSEC)
+
 typedef struct Unit Unit;
 typedef struct Manager Manager;
 
@@ -260,6 +273,8 @@ int unit_get_tasks_current(Unit *u, uint64_t *ret);
 int unit_get_cpu_usage(Unit *u, nsec_t *ret);
 int unit_get_io_accounting(Unit *u, CGroupIOAccountingMetric metric, bool allow_cache, uint64_t *ret);
 int unit_get_ip_accounting(Unit *u, CGroupIPAccountingMetric metric, uint64_t *ret);
+int unit_get_accounting(Unit *u, bool allow_cache, UnitAccounting *ret);
+void unit_invalidate_accounting_cache(Unit *u);
 
 int unit_reset_cpu_accounting(Unit *u);
 int unit_reset_ip_accounting(Unit *u);
@@ -2,6 +2,7 @@
 
 #include "core-varlink.h"
 #include "mkdir.h"
+#include "selinux-access.h"
 #include "strv.h"
 #include "user-util.h"
 #include "varlink.h"
@@ -192,6 +193,110 @@ static int vl_method_subscribe_managed_oom_cgroups(
         return varlink_notify(m->managed_oom_varlink_request, v);
 }
 
+static int build_unit_accounting_json(Unit *u, JsonVariant **ret) {
+        UnitAccounting a;
+        int r;
+
+        assert(u);
+        assert(ret);
+
+        r = unit_get_accounting(u, /* allow_cache= */ true, &a);
+        if (r < 0)
+                return r;
+
+        return json_build(ret, JSON_BUILD_OBJECT(
+                                 JSON_BUILD_PAIR("name", JSON_BUILD_STRING(u->id)),
+                                 JSON_BUILD_PAIR_CONDITION(a.cpu_usage != NSEC_INFINITY, "cpuUsageNSec", JSON_BUILD_UNSIGNED(a.cpu_usage)),
+                                 JSON_BUILD_PAIR_CONDITION(a.memory_current != UINT64_MAX, "memoryCurrent", JSON_BUILD_UNSIGNED(a.memory_current)),
+                                 JSON_BUILD_PAIR_CONDITION(a.tasks_current != UINT64_MAX, "tasksCurrent", JSON_BUILD_UNSIGNED(a.tasks_current)),
+                                 JSON_BUILD_PAIR_CONDITION(a.io[CGROUP_IO_READ_BYTES] != UINT64_MAX, "ioReadBytes", JSON_BUILD_UNSIGNED(a.io[CGROUP_IO_READ_BYTES])),
+                                 JSON_BUILD_PAIR_CONDITION(a.io[CGROUP_IO_WRITE_BYTES] != UINT64_MAX, "ioWriteBytes", JSON_BUILD_UNSIGNED(a.io[CGROUP_IO_WRITE_BYTES])),
+                                 JSON_BUILD_PAIR_CONDITION(a.io[CGROUP_IO_READ_OPERATIONS] != UINT64_MAX, "ioReadOperations", JSON_BUILD_UNSIGNED(a.io[CGROUP_IO_READ_OPERATIONS])),
+                                 JSON_BUILD_PAIR_CONDITION(a.io[CGROUP_IO_WRITE_OPERATIONS] != UINT64_MAX, "ioWriteOperations", JSON_BUILD_UNSIGNED(a.io[CGROUP_IO_WRITE_OPERATIONS])),
+                                 JSON_BUILD_PAIR_CONDITION(a.ip[CGROUP_IP_INGRESS_BYTES] != UINT64_MAX, "ipIngressBytes", JSON_BUILD_UNSIGNED(a.ip[CGROUP_IP_INGRESS_BYTES])),
+                                 JSON_BUILD_PAIR_CONDITION(a.ip[CGROUP_IP_INGRESS_PACKETS] != UINT64_MAX, "ipIngressPackets", JSON_BUILD_UNSIGNED(a.ip[CGROUP_IP_INGRESS_PACKETS])),
+                                 JSON_BUILD_PAIR_CONDITION(a.ip[CGROUP_IP_EGRESS_BYTES] != UINT64_MAX, "ipEgressBytes", JSON_BUILD_UNSIGNED(a.ip[CGROUP_IP_EGRESS_BYTES])),
+                                 JSON_BUILD_PAIR_CONDITION(a.ip[CGROUP_IP_EGRESS_PACKETS] != UINT64_MAX, "ipEgressPackets", JSON_BUILD_UNSIGNED(a.ip[CGROUP_IP_EGRESS_PACKETS]))));
+}
+
+static int vl_method_get_units_accounting(Varlink *link, JsonVariant *parameters, VarlinkMethodFlags flags, void *userdata) {
+
+        static const JsonDispatch dispatch_table[] = {
+                { "units", JSON_VARIANT_ARRAY, json_dispatch_strv, 0, 0 },
+                {}
+        };
+
+        _cleanup_(json_variant_unrefp) JsonVariant *v = NULL, *arr = NULL;
+        _cleanup_strv_free_ char **names = NULL;
+        Manager *m = userdata;
+        char **name;
+        int r;
+
+        assert(parameters);
+        assert(m);
+
+        /* Anyone can call this method, subject to the same check as GetUnitsAccounting() on the bus */
+
+        r = mac_selinux_varlink_access_check(link, "status");
+        if (r < 0)
+                return varlink_error_errno(link, r);
+
+        r = json_dispatch(parameters, dispatch_table, NULL, 0, &names);
+        if (r < 0)
+                return r;
+
+        r = json_build(&arr, JSON_BUILD_EMPTY_ARRAY);
+        if (r < 0)
+                return r;
+
+        /* Same semantics as GetUnitsAccounting() on the bus: no names means all units with a cgroup, and
+         * units that aren't loaded are skipped */
+        if (strv_isempty(names)) {
+                const char *k;
+                Unit *u;
+
+                HASHMAP_FOREACH_KEY(u, k, m->units) {
+                        _cleanup_(json_variant_unrefp) JsonVariant *e = NULL;
+
+                        if (k != u->id)
+                                continue;
+
+                        if (!UNIT_HAS_CGROUP_CONTEXT(u) || !u->cgroup_path)
+                                continue;
+
+                        r = build_unit_accounting_json(u, &e);
+                        if (r < 0)
+                                return r;
+
+                        r = json_variant_append_array(&arr, e);
+                        if (r < 0)
+                                return r;
+                }
+        } else
+                STRV_FOREACH(name, names) {
+                        _cleanup_(json_variant_unrefp) JsonVariant *e = NULL;
+                        Unit *u;
+
+                        u = manager_get_unit(m, *name);
+                        if (!u || !UNIT_HAS_CGROUP_CONTEXT(u))
+                                continue;
+
+                        r = build_unit_accounting_json(u, &e);
+                        if (r < 0)
+                                return r;
+
+                        r = json_variant_append_array(&arr, e);
+                        if (r < 0)
+                                return r;
+                }
+
+        r = json_build(&v, JSON_BUILD_OBJECT(JSON_BUILD_PAIR("units", JSON_BUILD_VARIANT(arr))));
+        if (r < 0)
+                return r;
+
+        return varlink_reply(link, v);
+}
+
 static int vl_method_get_user_record(Varlink *link, JsonVariant *parameters, VarlinkMethodFlags flags, void *userdata) {
 
         static const JsonDispatch dispatch_table[] = {
@@ -443,7 +548,8 @@ int manager_varlink_init(Manager *m) {
                         "io.systemd.UserDatabase.GetUserRecord",  vl_method_get_user_record,
                         "io.systemd.UserDatabase.GetGroupRecord", vl_method_get_group_record,
                         "io.systemd.UserDatabase.GetMemberships", vl_method_get_memberships,
-                        "io.systemd.ManagedOOM.SubscribeManagedOOMCGroups",  vl_method_subscribe_managed_oom_cgroups);
+                        "io.systemd.ManagedOOM.SubscribeManagedOOMCGroups",  vl_method_subscribe_managed_oom_cgroups,
+                        "io.systemd.Manager.GetUnitsAccounting", vl_method_get_units_accounting);
         if (r < 0)
                 return log_error_errno(r, "Failed to register varlink methods: %m");
 
@@ -461,6 +567,10 @@ int manager_varlink_init(Manager *m) {
                 r = varlink_server_listen_address(s, VARLINK_ADDR_PATH_MANAGED_OOM, 0666);
                 if (r < 0)
                         return log_error_errno(r, "Failed to bind to varlink socket: %m");
+
+                r = varlink_server_listen_address(s, VARLINK_ADDR_PATH_MANAGER, 0666);
+                if (r < 0)
+                        return log_error_errno(r, "Failed to bind to varlink socket: %m");
         }
 
         r = varlink_server_attach_event(s, m->event, SD_EVENT_PRIORITY_NORMAL);
@@ -4,6 +4,7 @@
 
 #include "alloc-util.h"
 #include "bus-get-properties.h"
+#include "bus-objects.h"
 #include "bus-util.h"
 #include "dbus-job.h"
 #include "dbus-unit.h"
@@ -221,7 +222,7 @@ static int send_new_signal(sd_bus *bus, void *userdata) {
         return sd_bus_send(bus, m, NULL);
 }
 
-static int send_changed_signal(sd_bus *bus, void *userdata) {
+static int new_changed_signal(sd_bus *bus, void *userdata, sd_bus_message **ret) {
         _cleanup_free_ char *p = NULL;
         Job *j = userdata;
 
@@ -232,7 +233,7 @@ static int send_changed_signal(sd_bus *bus, void *userdata) {
         if (!p)
                 return -ENOMEM;
 
-        return sd_bus_emit_properties_changed(bus, p, "org.freedesktop.systemd1.Job", "State", NULL);
+        return bus_message_new_properties_changed(bus, p, "org.freedesktop.systemd1.Job", STRV_MAKE("State"), ret);
 }
 
 void bus_job_send_change_signal(Job *j) {
@@ -248,7 +249,10 @@ void bus_job_send_change_signal(Job *j) {
                 j->in_dbus_queue = false;
         }
 
-        r = bus_foreach_bus(j->manager, j->bus_track, j->sent_dbus_new_signal ? send_changed_signal : send_new_signal, j);
+        if (j->sent_dbus_new_signal)
+                r = bus_foreach_bus_message(j->manager, j->bus_track, new_changed_signal, j);
+        else
+                r = bus_foreach_bus(j->manager, j->bus_track, send_new_signal, j);
         if (r < 0)
                 log_debug_errno(r, "Failed to send job change signal for %u: %m", j->id);
 
@@ -810,6 +810,99 @@ static int method_list_units_by_names(sd_bus_message *message, void *userdata, s
         return sd_bus_send(NULL, reply, NULL);
 }
 
+static int reply_unit_accounting(sd_bus_message *reply, Unit *u) {
+        UnitAccounting a;
+        int r;
+
+        assert(reply);
+        assert(u);
+
+        r = unit_get_accounting(u, /* allow_cache= */ true, &a);
+        if (r < 0)
+                return r;
+
+        return sd_bus_message_append(
+                        reply, "(sttttttttttt)",
+                        u->id,
+                        a.cpu_usage,
+                        a.memory_current,
+                        a.tasks_current,
+                        a.io[CGROUP_IO_READ_BYTES],
+                        a.io[CGROUP_IO_WRITE_BYTES],
+                        a.io[CGROUP_IO_READ_OPERATIONS],
+                        a.io[CGROUP_IO_WRITE_OPERATIONS],
+                        a.ip[CGROUP_IP_INGRESS_BYTES],
+                        a.ip[CGROUP_IP_INGRESS_PACKETS],
+                        a.ip[CGROUP_IP_EGRESS_BYTES],
+                        a.ip[CGROUP_IP_EGRESS_PACKETS]);
+}
+
+static int method_get_units_accounting(sd_bus_message *message, void *userdata, sd_bus_error *error) {
+        _cleanup_(sd_bus_message_unrefp) sd_bus_message *reply = NULL;
+        _cleanup_strv_free_ char **names = NULL;
+        Manager *m = userdata;
+        char **name;
+        int r;
+
+        assert(message);
+        assert(m);
+
+        /* Anyone can call this method */
+
+        r = mac_selinux_access_check(message, "status", error);
+        if (r < 0)
+                return r;
+
+        r = sd_bus_message_read_strv(message, &names);
+        if (r < 0)
+                return r;
+
+        r = sd_bus_message_new_method_return(message, &reply);
+        if (r < 0)
+                return r;
+
+        r = sd_bus_message_open_container(reply, 'a', "(sttttttttttt)");
+        if (r < 0)
+                return r;
+
+        if (strv_isempty(names)) {
+                const char *k;
+                Unit *u;
+
+                /* No names specified? Then return the data of all units that currently have a cgroup */
+                HASHMAP_FOREACH_KEY(u, k, m->units) {
+                        if (k != u->id)
+                                continue;
+
+                        if (!UNIT_HAS_CGROUP_CONTEXT(u) || !u->cgroup_path)
+                                continue;
+
+                        r = reply_unit_accounting(reply, u);
+                        if (r < 0)
+                                return r;
+                }
+        } else
+                STRV_FOREACH(name, names) {
+                        Unit *u;
+
+                        /* Units that aren't loaded have no counters, skip them rather than failing the
+                         * whole request */
+                        u = manager_get_unit(m, *name);
+                        if (!u || !UNIT_HAS_CGROUP_CONTEXT(u))
+                                continue;
+
+                        r = reply_unit_accounting(reply, u);
+                        if (r < 0)
+                                return r;
+                }
+
+        r = sd_bus_message_close_container(reply);
+        if (r < 0)
+                return r;
+
+        return sd_bus_send(NULL, reply, NULL);
+}
+
 static int method_get_unit_processes(sd_bus_message *message, void *userdata, sd_bus_error *error) {
         /* Don't load a unit (since it won't have any processes if it's not loaded), but don't insist on the
          * unit being loaded (because even improperly loaded units might still have processes around */
@@ -2789,6 +2882,13 @@ const sd_bus_vtable bus_manager_vtable[] = {
                                  SD_BUS_PARAM(processes),
                                  method_get_unit_processes,
                                  SD_BUS_VTABLE_UNPRIVILEGED),
+        SD_BUS_METHOD_WITH_NAMES("GetUnitsAccounting",
+                                 "as",
+                                 SD_BUS_PARAM(names),
+                                 "a(sttttttttttt)",
+                                 SD_BUS_PARAM(units),
+                                 method_get_units_accounting,
+                                 SD_BUS_VTABLE_UNPRIVILEGED),
         SD_BUS_METHOD_WITH_NAMES("AttachProcessesToUnit",
                                  "ssau",
                                  SD_BUS_PARAM(unit_name)
@@ -3218,6 +3318,14 @@ const sd_bus_vtable bus_manager_log_control_vtable[] = {
         SD_BUS_WRITABLE_PROPERTY("LogLevel", "s", bus_property_get_log_level, property_set_log_level, 0, 0),
         SD_BUS_WRITABLE_PROPERTY("LogTarget", "s", bus_property_get_log_target, property_set_log_target, 0, 0),
         SD_BUS_PROPERTY("SyslogIdentifier", "s", bus_property_get_syslog_identifier, 0, 0),
+        SD_BUS_WRITABLE_PROPERTY("EventLoopProfiling", "b", bus_property_get_event_loop_profiling, bus_property_set_event_loop_profiling, 0, 0),
+
+        SD_BUS_METHOD_WITH_NAMES("GetEventSourceStatistics",
+                                 NULL,,
+                                 "a(sstttt)",
+                                 SD_BUS_PARAM(statistics),
+                                 bus_method_get_event_source_statistics,
+                                 0),
 
         SD_BUS_VTABLE_END,
 };
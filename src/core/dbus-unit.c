@@ -6,6 +6,7 @@
 #include "bpf-firewall.h"
 #include "bus-common-errors.h"
 #include "bus-get-properties.h"
+#include "bus-objects.h"
 #include "bus-polkit.h"
 #include "cgroup-util.h"
 #include "condition.h"
@@ -155,21 +156,23 @@ static int property_get_dependencies(
                 void *userdata,
                 sd_bus_error *error) {
 
-        Hashmap **h = userdata;
-        Unit *u;
-        void *v;
+        Unit *u = userdata, *other;
+        UnitDependency d;
         int r;
 
         assert(bus);
         assert(reply);
-        assert(h);
+        assert(u);
+
+        d = unit_dependency_from_string(property);
+        assert_se(d >= 0);
 
         r = sd_bus_message_open_container(reply, 'a', "s");
         if (r < 0)
                 return r;
 
-        HASHMAP_FOREACH_KEY(v, u, *h) {
-                r = sd_bus_message_append(reply, "s", u->id);
+        UNIT_FOREACH_DEPENDENCY(other, u, d) {
+                r = sd_bus_message_append(reply, "s", other->id);
                 if (r < 0)
                         return r;
         }
@@ -844,26 +847,26 @@ const sd_bus_vtable bus_unit_vtable[] = {
         SD_BUS_PROPERTY("Id", "s", NULL, offsetof(Unit, id), SD_BUS_VTABLE_PROPERTY_CONST),
         SD_BUS_PROPERTY("Names", "as", property_get_names, 0, SD_BUS_VTABLE_PROPERTY_CONST),
         SD_BUS_PROPERTY("Following", "s", property_get_following, 0, 0),
-        SD_BUS_PROPERTY("Requires", "as", property_get_dependencies, offsetof(Unit, dependencies[UNIT_REQUIRES]), SD_BUS_VTABLE_PROPERTY_CONST),
-        SD_BUS_PROPERTY("Requisite", "as", property_get_dependencies, offsetof(Unit, dependencies[UNIT_REQUISITE]), SD_BUS_VTABLE_PROPERTY_CONST),
-        SD_BUS_PROPERTY("Wants", "as", property_get_dependencies, offsetof(Unit, dependencies[UNIT_WANTS]), SD_BUS_VTABLE_PROPERTY_CONST),
-        SD_BUS_PROPERTY("BindsTo", "as", property_get_dependencies, offsetof(Unit, dependencies[UNIT_BINDS_TO]), SD_BUS_VTABLE_PROPERTY_CONST),
-        SD_BUS_PROPERTY("PartOf", "as", property_get_dependencies, offsetof(Unit, dependencies[UNIT_PART_OF]), SD_BUS_VTABLE_PROPERTY_CONST),
-        SD_BUS_PROPERTY("RequiredBy", "as", property_get_dependencies, offsetof(Unit, dependencies[UNIT_REQUIRED_BY]), SD_BUS_VTABLE_PROPERTY_CONST),
-        SD_BUS_PROPERTY("RequisiteOf", "as", property_get_dependencies, offsetof(Unit, dependencies[UNIT_REQUISITE_OF]), SD_BUS_VTABLE_PROPERTY_CONST),
-        SD_BUS_PROPERTY("WantedBy", "as", property_get_dependencies, offsetof(Unit, dependencies[UNIT_WANTED_BY]), SD_BUS_VTABLE_PROPERTY_CONST),
-        SD_BUS_PROPERTY("BoundBy", "as", property_get_dependencies, offsetof(Unit, dependencies[UNIT_BOUND_BY]), SD_BUS_VTABLE_PROPERTY_CONST),
-        SD_BUS_PROPERTY("ConsistsOf", "as", property_get_dependencies, offsetof(Unit, dependencies[UNIT_CONSISTS_OF]), SD_BUS_VTABLE_PROPERTY_CONST),
-        SD_BUS_PROPERTY("Conflicts", "as", property_get_dependencies, offsetof(Unit, dependencies[UNIT_CONFLICTS]), SD_BUS_VTABLE_PROPERTY_CONST),
-        SD_BUS_PROPERTY("ConflictedBy", "as", property_get_dependencies, offsetof(Unit, dependencies[UNIT_CONFLICTED_BY]), SD_BUS_VTABLE_PROPERTY_CONST),
-        SD_BUS_PROPERTY("Before", "as", property_get_dependencies, offsetof(Unit, dependencies[UNIT_BEFORE]), SD_BUS_VTABLE_PROPERTY_CONST),
-        SD_BUS_PROPERTY("After", "as", property_get_dependencies, offsetof(Unit, dependencies[UNIT_AFTER]), SD_BUS_VTABLE_PROPERTY_CONST),
-        SD_BUS_PROPERTY("OnFailure", "as", property_get_dependencies, offsetof(Unit, dependencies[UNIT_ON_FAILURE]), SD_BUS_VTABLE_PROPERTY_CONST),
-        SD_BUS_PROPERTY("Triggers", "as", property_get_dependencies, offsetof(Unit, dependencies[UNIT_TRIGGERS]), SD_BUS_VTABLE_PROPERTY_CONST),
-        SD_BUS_PROPERTY("TriggeredBy", "as", property_get_dependencies, offsetof(Unit, dependencies[UNIT_TRIGGERED_BY]), SD_BUS_VTABLE_PROPERTY_CONST),
-        SD_BUS_PROPERTY("PropagatesReloadTo", "as", property_get_dependencies, offsetof(Unit, dependencies[UNIT_PROPAGATES_RELOAD_TO]), SD_BUS_VTABLE_PROPERTY_CONST),
-        SD_BUS_PROPERTY("ReloadPropagatedFrom", "as", property_get_dependencies, offsetof(Unit, dependencies[UNIT_RELOAD_PROPAGATED_FROM]), SD_BUS_VTABLE_PROPERTY_CONST),
-        SD_BUS_PROPERTY("JoinsNamespaceOf", "as", property_get_dependencies, offsetof(Unit, dependencies[UNIT_JOINS_NAMESPACE_OF]), SD_BUS_VTABLE_PROPERTY_CONST),
+        SD_BUS_PROPERTY("Requires", "as", property_get_dependencies, 0, SD_BUS_VTABLE_PROPERTY_CONST),
+        SD_BUS_PROPERTY("Requisite", "as", property_get_dependencies, 0, SD_BUS_VTABLE_PROPERTY_CONST),
+        SD_BUS_PROPERTY("Wants", "as", property_get_dependencies, 0, SD_BUS_VTABLE_PROPERTY_CONST),
+        SD_BUS_PROPERTY("BindsTo", "as", property_get_dependencies, 0, SD_BUS_VTABLE_PROPERTY_CONST),
+        SD_BUS_PROPERTY("PartOf", "as", property_get_dependencies, 0, SD_BUS_VTABLE_PROPERTY_CONST),
+        SD_BUS_PROPERTY("RequiredBy", "as", property_get_dependencies, 0, SD_BUS_VTABLE_PROPERTY_CONST),
+        SD_BUS_PROPERTY("RequisiteOf", "as", property_get_dependencies, 0, SD_BUS_VTABLE_PROPERTY_CONST),
+        SD_BUS_PROPERTY("WantedBy", "as", property_get_dependencies, 0, SD_BUS_VTABLE_PROPERTY_CONST),
+        SD_BUS_PROPERTY("BoundBy", "as", property_get_dependencies, 0, SD_BUS_VTABLE_PROPERTY_CONST),
+        SD_BUS_PROPERTY("ConsistsOf", "as", property_get_dependencies, 0, SD_BUS_VTABLE_PROPERTY_CONST),
+        SD_BUS_PROPERTY("Conflicts", "as", property_get_dependencies, 0, SD_BUS_VTABLE_PROPERTY_CONST),
+        SD_BUS_PROPERTY("ConflictedBy", "as", property_get_dependencies, 0, SD_BUS_VTABLE_PROPERTY_CONST),
+        SD_BUS_PROPERTY("Before", "as", property_get_dependencies, 0, SD_BUS_VTABLE_PROPERTY_CONST),
+        SD_BUS_PROPERTY("After", "as", property_get_dependencies, 0, SD_BUS_VTABLE_PROPERTY_CONST),
+        SD_BUS_PROPERTY("OnFailure", "as", property_get_dependencies, 0, SD_BUS_VTABLE_PROPERTY_CONST),
+        SD_BUS_PROPERTY("Triggers", "as", property_get_dependencies, 0, SD_BUS_VTABLE_PROPERTY_CONST),
+        SD_BUS_PROPERTY("TriggeredBy", "as", property_get_dependencies, 0, SD_BUS_VTABLE_PROPERTY_CONST),
+        SD_BUS_PROPERTY("PropagatesReloadTo", "as", property_get_dependencies, 0, SD_BUS_VTABLE_PROPERTY_CONST),
+        SD_BUS_PROPERTY("ReloadPropagatedFrom", "as", property_get_dependencies, 0, SD_BUS_VTABLE_PROPERTY_CONST),
+        SD_BUS_PROPERTY("JoinsNamespaceOf", "as", property_get_dependencies, 0, SD_BUS_VTABLE_PROPERTY_CONST),
         SD_BUS_PROPERTY("RequiresMountsFor", "as", property_get_requires_mounts_for, offsetof(Unit, requires_mounts_for), SD_BUS_VTABLE_PROPERTY_CONST),
         SD_BUS_PROPERTY("Documentation", "as", NULL, offsetof(Unit, documentation), SD_BUS_VTABLE_PROPERTY_CONST),
         SD_BUS_PROPERTY("Description", "s", property_get_description, 0, SD_BUS_VTABLE_PROPERTY_CONST),
@@ -1068,7 +1071,7 @@ static int property_get_current_memory(
                 void *userdata,
                 sd_bus_error *error) {
 
-        uint64_t sz = (uint64_t) -1;
+        UnitAccounting a;
         Unit *u = userdata;
         int r;
 
@@ -1076,11 +1079,11 @@ static int property_get_current_memory(
         assert(reply);
         assert(u);
 
-        r = unit_get_memory_current(u, &sz);
-        if (r < 0 && r != -ENODATA)
-                log_unit_warning_errno(u, r, "Failed to get memory.usage_in_bytes attribute: %m");
+        r = unit_get_accounting(u, /* allow_cache= */ true, &a);
+        if (r < 0)
+                return r;
 
-        return sd_bus_message_append(reply, "t", sz);
+        return sd_bus_message_append(reply, "t", a.memory_current);
 }
 
 static int property_get_current_tasks(
@@ -1092,7 +1095,7 @@ static int property_get_current_tasks(
                 void *userdata,
                 sd_bus_error *error) {
 
-        uint64_t cn = (uint64_t) -1;
+        UnitAccounting a;
         Unit *u = userdata;
         int r;
 
@@ -1100,11 +1103,11 @@ static int property_get_current_tasks(
         assert(reply);
         assert(u);
 
-        r = unit_get_tasks_current(u, &cn);
-        if (r < 0 && r != -ENODATA)
-                log_unit_warning_errno(u, r, "Failed to get pids.current attribute: %m");
+        r = unit_get_accounting(u, /* allow_cache= */ true, &a);
+        if (r < 0)
+                return r;
 
-        return sd_bus_message_append(reply, "t", cn);
+        return sd_bus_message_append(reply, "t", a.tasks_current);
 }
 
 static int property_get_cpu_usage(
@@ -1116,7 +1119,7 @@ static int property_get_cpu_usage(
                 void *userdata,
                 sd_bus_error *error) {
 
-        nsec_t ns = (nsec_t) -1;
+        UnitAccounting a;
         Unit *u = userdata;
         int r;
 
@@ -1124,11 +1127,11 @@ static int property_get_cpu_usage(
         assert(reply);
         assert(u);
 
-        r = unit_get_cpu_usage(u, &ns);
-        if (r < 0 && r != -ENODATA)
-                log_unit_warning_errno(u, r, "Failed to get cpuacct.usage attribute: %m");
+        r = unit_get_accounting(u, /* allow_cache= */ true, &a);
+        if (r < 0)
+                return r;
 
-        return sd_bus_message_append(reply, "t", ns);
+        return sd_bus_message_append(reply, "t", a.cpu_usage);
 }
 
 static int property_get_cpuset_cpus(
@@ -1364,9 +1367,10 @@ static int property_get_ip_counter(
                 [CGROUP_IP_EGRESS_PACKETS]  = "IPEgressPackets",
         };
 
-        uint64_t value = UINT64_MAX;
+        UnitAccounting a;
         Unit *u = userdata;
         ssize_t metric;
+        int r;
 
         assert(bus);
         assert(reply);
@@ -1374,8 +1378,12 @@ static int property_get_ip_counter(
         assert(u);
 
         assert_se((metric = string_table_lookup(table, ELEMENTSOF(table), property)) >= 0);
-        (void) unit_get_ip_accounting(u, metric, &value);
-        return sd_bus_message_append(reply, "t", value);
+
+        r = unit_get_accounting(u, /* allow_cache= */ true, &a);
+        if (r < 0)
+                return r;
+
+        return sd_bus_message_append(reply, "t", a.ip[metric]);
 }
 
 static int property_get_io_counter(
@@ -1394,9 +1402,10 @@ static int property_get_io_counter(
                 [CGROUP_IO_WRITE_OPERATIONS] = "IOWriteOperations",
         };
 
-        uint64_t value = UINT64_MAX;
+        UnitAccounting a;
         Unit *u = userdata;
         ssize_t metric;
+        int r;
 
         assert(bus);
         assert(reply);
@@ -1404,8 +1413,12 @@ static int property_get_io_counter(
         assert(u);
 
         assert_se((metric = string_table_lookup(table, ELEMENTSOF(table), property)) >= 0);
-        (void) unit_get_io_accounting(u, metric, false, &value);
-        return sd_bus_message_append(reply, "t", value);
+
+        r = unit_get_accounting(u, /* allow_cache= */ true, &a);
+        if (r < 0)
+                return r;
+
+        return sd_bus_message_append(reply, "t", a.io[metric]);
 }
 
 int bus_unit_method_attach_processes(sd_bus_message *message, void *userdata, sd_bus_error *error) {
@@ -1585,10 +1598,9 @@ static int send_new_signal(sd_bus *bus, void *userdata) {
         return sd_bus_send(bus, m, NULL);
 }
 
-static int send_changed_signal(sd_bus *bus, void *userdata) {
+static int new_changed_signal_type(sd_bus *bus, void *userdata, sd_bus_message **ret) {
         _cleanup_free_ char *p = NULL;
         Unit *u = userdata;
-        int r;
 
         assert(bus);
         assert(u);
@@ -1597,21 +1609,38 @@ static int send_changed_signal(sd_bus *bus, void *userdata) {
         if (!p)
                 return -ENOMEM;
 
+        return bus_message_new_properties_changed(bus, p, unit_dbus_interface_from_type(u->type), NULL, ret);
+}
+
+static int new_changed_signal_unit(sd_bus *bus, void *userdata, sd_bus_message **ret) {
+        _cleanup_free_ char *p = NULL;
+        Unit *u = userdata;
+
+        assert(bus);
+        assert(u);
+
+        p = unit_dbus_path(u);
+        if (!p)
+                return -ENOMEM;
+
+        return bus_message_new_properties_changed(bus, p, "org.freedesktop.systemd1.Unit", NULL, ret);
+}
+
+static int send_changed_signal(Unit *u) {
+        int r;
+
+        assert(u);
+
         /* Send a properties changed signal. First for the specific
          * type, then for the generic unit. The clients may rely on
-         * this order to get atomic behavior if needed. */
+         * this order to get atomic behavior if needed. Each message
+         * is built once and then enqueued on all buses. */
 
-        r = sd_bus_emit_properties_changed_strv(
-                        bus, p,
-                        unit_dbus_interface_from_type(u->type),
-                        NULL);
+        r = bus_foreach_bus_message(u->manager, u->bus_track, new_changed_signal_type, u);
         if (r < 0)
                 return r;
 
-        return sd_bus_emit_properties_changed_strv(
-                        bus, p,
-                        "org.freedesktop.systemd1.Unit",
-                        NULL);
+        return bus_foreach_bus_message(u->manager, u->bus_track, new_changed_signal_unit, u);
 }
 
 void bus_unit_send_change_signal(Unit *u) {
@@ -1626,7 +1655,10 @@ void bus_unit_send_change_signal(Unit *u) {
         if (!u->id)
                 return;
 
-        r = bus_foreach_bus(u->manager, u->bus_track, u->sent_dbus_new_signal ? send_changed_signal : send_new_signal, u);
+        if (u->sent_dbus_new_signal)
+                r = send_changed_signal(u);
+        else
+                r = bus_foreach_bus(u->manager, u->bus_track, send_new_signal, u);
         if (r < 0)
                 log_unit_debug_errno(u, r, "Failed to send unit change signal for %s: %m", u->id);
 
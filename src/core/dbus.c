@@ -724,6 +724,14 @@ static int bus_on_connection(sd_event_source *s, int fd, uint32_t revents, void
                 return 0;
         }
 
+        /* Replies to ListUnits() and friends can get large, let's hand them out as memfds if the client
+         * agrees */
+        r = sd_bus_negotiate_memfd(bus, true);
+        if (r < 0) {
+                log_warning_errno(r, "Failed to enable memfd passing for new connection: %m");
+                return 0;
+        }
+
         r = sd_bus_set_sender(bus, "org.freedesktop.systemd1");
         if (r < 0) {
                 log_warning_errno(r, "Failed to set direct connection sender: %m");
@@ -1128,6 +1136,64 @@ int bus_foreach_bus(
         return ret;
 }
 
+int bus_foreach_bus_message(
+                Manager *m,
+                sd_bus_track *subscribed2,
+                int (*new_message)(sd_bus *bus, void *userdata, sd_bus_message **ret),
+                void *userdata) {
+
+        _cleanup_(sd_bus_message_unrefp) sd_bus_message *msg = NULL, *msg_memfd = NULL;
+        sd_bus *b;
+        int r, ret = 0;
+
+        /* Like bus_foreach_bus(), but builds the message only once, and then enqueues it on all direct
+         * buses. With many clients connected this saves us from collecting the same properties over and
+         * over again. The API bus gets its own copy, since the direct buses patch our well-known name in as
+         * sender.
+         *
+         * Once sealed, a message is sent as it is, and whether a large body is passed as memfd is decided
+         * by the bus it is sealed for. Hence buses which agreed to memfd bodies and those which didn't each
+         * get their own copy. */
+
+        SET_FOREACH(b, m->private_buses) {
+                sd_bus_message **shared;
+
+                if (sd_bus_is_ready(b) <= 0)
+                        continue;
+
+                shared = b->can_memfd ? &msg_memfd : &msg;
+
+                if (!*shared) {
+                        r = new_message(b, userdata, shared);
+                        if (r < 0)
+                                return r;
+                        if (!*shared) /* Nothing to send */
+                                return 0;
+                }
+
+                r = sd_bus_send(b, *shared, NULL);
+                if (r < 0)
+                        ret = r;
+        }
+
+        if (m->api_bus &&
+            (sd_bus_track_count(m->subscribed) > 0 ||
+             sd_bus_track_count(subscribed2) > 0)) {
+                msg = sd_bus_message_unref(msg);
+
+                r = new_message(m->api_bus, userdata, &msg);
+                if (r < 0)
+                        return r;
+                if (msg) {
+                        r = sd_bus_send(m->api_bus, msg, NULL);
+                        if (r < 0)
+                                ret = r;
+                }
+        }
+
+        return ret;
+}
+
 void bus_track_serialize(sd_bus_track *t, FILE *f, const char *prefix) {
         const char *n;
 
@@ -0,0 +1,1214 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+
+#include "alloc-util.h"
+#include "cpu-set-util.h"
+#include "escape.h"
+#include "execute-serialize.h"
+#include "extract-word.h"
+#include "fd-util.h"
+#include "fileio.h"
+#include "hexdecoct.h"
+#include "io-util.h"
+#include "namespace.h"
+#include "parse-util.h"
+#include "rlimit-util.h"
+#include "serialize.h"
+#include "stdio-util.h"
+#include "string-util.h"
+#include "strv.h"
+#include "user-util.h"
+
+typedef enum ExecFieldType {
+        EXEC_FIELD_STRING,
+        EXEC_FIELD_STRV,
+        EXEC_FIELD_BOOL,
+        EXEC_FIELD_INT,
+        EXEC_FIELD_UNSIGNED,
+        EXEC_FIELD_ULONG,
+        EXEC_FIELD_UINT64,
+} ExecFieldType;
+
+typedef struct ExecField {
+        const char *name;
+        ExecFieldType type;
+        size_t offset;
+} ExecField;
+
+/* All enums are serialized as plain int */
+assert_cc(sizeof(ExecInput) == sizeof(int));
+assert_cc(sizeof(ExecOutput) == sizeof(int));
+assert_cc(sizeof(ExecKeyringMode) == sizeof(int));
+assert_cc(sizeof(ExecUtmpMode) == sizeof(int));
+assert_cc(sizeof(ProtectProc) == sizeof(int));
+assert_cc(sizeof(ProcSubset) == sizeof(int));
+assert_cc(sizeof(ProtectSystem) == sizeof(int));
+assert_cc(sizeof(ProtectHome) == sizeof(int));
+assert_cc(sizeof(ExecPreserveMode) == sizeof(int));
+assert_cc(sizeof(mode_t) == sizeof(unsigned));
+
+#define EXEC_FIELD(n, t, f) { n, EXEC_FIELD_##t, offsetof(ExecContext, f) }
+
+/* The plain fields of ExecContext. Bitfields and anything more complex are handled explicitly below. */
+static const ExecField exec_context_fields[] = {
+        EXEC_FIELD("environment",                  STRV,     environment),
+        EXEC_FIELD("environment-file",             STRV,     environment_files),
+        EXEC_FIELD("pass-environment",             STRV,     pass_environment),
+        EXEC_FIELD("unset-environment",            STRV,     unset_environment),
+        EXEC_FIELD("working-directory",            STRING,   working_directory),
+        EXEC_FIELD("root-directory",               STRING,   root_directory),
+        EXEC_FIELD("root-image",                   STRING,   root_image),
+        EXEC_FIELD("root-verity",                  STRING,   root_verity),
+        EXEC_FIELD("root-hash-path",               STRING,   root_hash_path),
+        EXEC_FIELD("root-hash-sig-path",           STRING,   root_hash_sig_path),
+        EXEC_FIELD("same-pgrp",                    BOOL,     same_pgrp),
+        EXEC_FIELD("cpu-sched-reset-on-fork",      BOOL,     cpu_sched_reset_on_fork),
+        EXEC_FIELD("non-blocking",                 BOOL,     non_blocking),
+        EXEC_FIELD("umask",                        UNSIGNED, umask),
+        EXEC_FIELD("oom-score-adjust",             INT,      oom_score_adjust),
+        EXEC_FIELD("nice",                         INT,      nice),
+        EXEC_FIELD("ioprio",                       INT,      ioprio),
+        EXEC_FIELD("cpu-sched-policy",             INT,      cpu_sched_policy),
+        EXEC_FIELD("cpu-sched-priority",           INT,      cpu_sched_priority),
+        EXEC_FIELD("coredump-filter",              UINT64,   coredump_filter),
+        EXEC_FIELD("cpu-affinity-from-numa",       BOOL,     cpu_affinity_from_numa),
+        EXEC_FIELD("std-input",                    INT,      std_input),
+        EXEC_FIELD("std-output",                   INT,      std_output),
+        EXEC_FIELD("std-error",                    INT,      std_error),
+        EXEC_FIELD("stdio-as-fds",                 BOOL,     stdio_as_fds),
+        EXEC_FIELD("stdin-fdname",                 STRING,   stdio_fdname[STDIN_FILENO]),
+        EXEC_FIELD("stdout-fdname",                STRING,   stdio_fdname[STDOUT_FILENO]),
+        EXEC_FIELD("stderr-fdname",                STRING,   stdio_fdname[STDERR_FILENO]),
+        EXEC_FIELD("stdin-file",                   STRING,   stdio_file[STDIN_FILENO]),
+        EXEC_FIELD("stdout-file",                  STRING,   stdio_file[STDOUT_FILENO]),
+        EXEC_FIELD("stderr-file",                  STRING,   stdio_file[STDERR_FILENO]),
+        EXEC_FIELD("timer-slack-nsec",             UINT64,   timer_slack_nsec),
+        EXEC_FIELD("tty-path",                     STRING,   tty_path),
+        EXEC_FIELD("tty-reset",                    BOOL,     tty_reset),
+        EXEC_FIELD("tty-vhangup",                  BOOL,     tty_vhangup),
+        EXEC_FIELD("tty-vt-disallocate",           BOOL,     tty_vt_disallocate),
+        EXEC_FIELD("ignore-sigpipe",               BOOL,     ignore_sigpipe),
+        EXEC_FIELD("keyring-mode",                 INT,      keyring_mode),
+        EXEC_FIELD("user",                         STRING,   user),
+        EXEC_FIELD("group",                        STRING,   group),
+        EXEC_FIELD("supplementary-group",          STRV,     supplementary_groups),
+        EXEC_FIELD("pam-name",                     STRING,   pam_name),
+        EXEC_FIELD("utmp-id",                      STRING,   utmp_id),
+        EXEC_FIELD("utmp-mode",                    INT,      utmp_mode),
+        EXEC_FIELD("no-new-privileges",            BOOL,     no_new_privileges),
+        EXEC_FIELD("selinux-context-ignore",       BOOL,     selinux_context_ignore),
+        EXEC_FIELD("apparmor-profile-ignore",      BOOL,     apparmor_profile_ignore),
+        EXEC_FIELD("smack-process-label-ignore",   BOOL,     smack_process_label_ignore),
+        EXEC_FIELD("selinux-context",              STRING,   selinux_context),
+        EXEC_FIELD("apparmor-profile",             STRING,   apparmor_profile),
+        EXEC_FIELD("smack-process-label",          STRING,   smack_process_label),
+        EXEC_FIELD("read-write-path",              STRV,     read_write_paths),
+        EXEC_FIELD("read-only-path",               STRV,     read_only_paths),
+        EXEC_FIELD("inaccessible-path",            STRV,     inaccessible_paths),
+        EXEC_FIELD("mount-flags",                  ULONG,    mount_flags),
+        EXEC_FIELD("capability-bounding-set",      UINT64,   capability_bounding_set),
+        EXEC_FIELD("capability-ambient-set",       UINT64,   capability_ambient_set),
+        EXEC_FIELD("secure-bits",                  INT,      secure_bits),
+        EXEC_FIELD("syslog-priority",              INT,      syslog_priority),
+        EXEC_FIELD("syslog-level-prefix",          BOOL,     syslog_level_prefix),
+        EXEC_FIELD("syslog-identifier",            STRING,   syslog_identifier),
+        EXEC_FIELD("log-ratelimit-interval-usec",  UINT64,   log_ratelimit_interval_usec),
+        EXEC_FIELD("log-ratelimit-burst",          UNSIGNED, log_ratelimit_burst),
+        EXEC_FIELD("log-level-max",                INT,      log_level_max),
+        EXEC_FIELD("log-namespace",                STRING,   log_namespace),
+        EXEC_FIELD("protect-proc",                 INT,      protect_proc),
+        EXEC_FIELD("proc-subset",                  INT,      proc_subset),
+        EXEC_FIELD("private-tmp",                  BOOL,     private_tmp),
+        EXEC_FIELD("private-network",              BOOL,     private_network),
+        EXEC_FIELD("private-devices",              BOOL,     private_devices),
+        EXEC_FIELD("private-users",                BOOL,     private_users),
+        EXEC_FIELD("private-mounts",               BOOL,     private_mounts),
+        EXEC_FIELD("protect-kernel-tunables",      BOOL,     protect_kernel_tunables),
+        EXEC_FIELD("protect-kernel-modules",       BOOL,     protect_kernel_modules),
+        EXEC_FIELD("protect-kernel-logs",          BOOL,     protect_kernel_logs),
+        EXEC_FIELD("protect-clock",                BOOL,     protect_clock),
+        EXEC_FIELD("protect-control-groups",       BOOL,     protect_control_groups),
+        EXEC_FIELD("protect-system",               INT,      protect_system),
+        EXEC_FIELD("protect-home",                 INT,      protect_home),
+        EXEC_FIELD("protect-hostname",             BOOL,     protect_hostname),
+        EXEC_FIELD("mount-apivfs",                 BOOL,     mount_apivfs),
+        EXEC_FIELD("dynamic-user",                 BOOL,     dynamic_user),
+        EXEC_FIELD("remove-ipc",                   BOOL,     remove_ipc),
+        EXEC_FIELD("memory-deny-write-execute",    BOOL,     memory_deny_write_execute),
+        EXEC_FIELD("restrict-realtime",            BOOL,     restrict_realtime),
+        EXEC_FIELD("restrict-suid-sgid",           BOOL,     restrict_suid_sgid),
+        EXEC_FIELD("lock-personality",             BOOL,     lock_personality),
+        EXEC_FIELD("personality",                  ULONG,    personality),
+        EXEC_FIELD("restrict-namespaces",          ULONG,    restrict_namespaces),
+        EXEC_FIELD("syscall-errno",                INT,      syscall_errno),
+        EXEC_FIELD("network-namespace-path",       STRING,   network_namespace_path),
+        EXEC_FIELD("runtime-directory-preserve",   INT,      runtime_directory_preserve_mode),
+        EXEC_FIELD("timeout-clean-usec",           UINT64,   timeout_clean_usec),
+        EXEC_FIELD("load-credential",              STRV,     load_credentials),
+};
+
+static int exec_field_serialize(FILE *f, const ExecField *field, const void *base) {
+        const uint8_t *p = (const uint8_t*) base + field->offset;
+
+        switch (field->type) {
+
+        case EXEC_FIELD_STRING:
+                return serialize_item_escaped(f, field->name, *(char* const*) p);
+
+        case EXEC_FIELD_STRV:
+                return serialize_strv(f, field->name, *(char** const*) p);
+
+        case EXEC_FIELD_BOOL:
+                return serialize_bool(f, field->name, *(const bool*) p);
+
+        case EXEC_FIELD_INT:
+                return serialize_item_format(f, field->name, "%i", *(const int*) p);
+
+        case EXEC_FIELD_UNSIGNED:
+                return serialize_item_format(f, field->name, "%u", *(const unsigned*) p);
+
+        case EXEC_FIELD_ULONG:
+                return serialize_item_format(f, field->name, "%lu", *(const unsigned long*) p);
+
+        case EXEC_FIELD_UINT64:
+                return serialize_item_format(f, field->name, "%" PRIu64, *(const uint64_t*) p);
+
+        default:
+                assert_not_reached("Unknown field type");
+        }
+}
+
+static int exec_field_deserialize(const ExecField *field, void *base, const char *value) {
+        uint8_t *p = (uint8_t*) base + field->offset;
+        int r;
+
+        switch (field->type) {
+
+        case EXEC_FIELD_STRING: {
+                char *s;
+
+                r = cunescape(value, 0, &s);
+                if (r < 0)
+                        return r;
+
+                return free_and_replace(*(char**) p, s);
+        }
+
+        case EXEC_FIELD_STRV: {
+                char *s;
+
+                r = cunescape(value, 0, &s);
+                if (r < 0)
+                        return r;
+
+                return strv_consume((char***) p, s);
+        }
+
+        case EXEC_FIELD_BOOL:
+                r = parse_boolean(value);
+                if (r < 0)
+                        return r;
+
+                *(bool*) p = r;
+                return 0;
+
+        case EXEC_FIELD_INT:
+                return safe_atoi(value, (int*) p);
+
+        case EXEC_FIELD_UNSIGNED:
+                return safe_atou(value, (unsigned*) p);
+
+        case EXEC_FIELD_ULONG:
+                return safe_atolu(value, (unsigned long*) p);
+
+        case EXEC_FIELD_UINT64:
+                return safe_atou64(value, (uint64_t*) p);
+
+        default:
+                assert_not_reached("Unknown field type");
+        }
+}
+
+static int serialize_hex(FILE *f, const char *key, const void *data, size_t size) {
+        _cleanup_free_ char *hex = NULL;
+
+        if (size == 0)
+                return 0;
+
+        hex = hexmem(data, size);
+        if (!hex)
+                return -ENOMEM;
+
+        return serialize_item(f, key, hex);
+}
+
+static int serialize_pointer_set(FILE *f, const char *key, Set *s) {
+        void *p;
+        int r;
+
+        SET_FOREACH(p, s) {
+                r = serialize_item_format(f, key, "%" PRIu64, PTR_TO_UINT64(p));
+                if (r < 0)
+                        return r;
+        }
+
+        return 0;
+}
+
+static int serialize_pointer_map(FILE *f, const char *key, Hashmap *h) {
+        void *k, *v;
+        int r;
+
+        HASHMAP_FOREACH_KEY(v, k, h) {
+                r = serialize_item_format(f, key, "%" PRIu64 " %" PRIu64, PTR_TO_UINT64(k), PTR_TO_UINT64(v));
+                if (r < 0)
+                        return r;
+        }
+
+        return 0;
+}
+
+static int serialize_mount_options(FILE *f, const char *key, MountOptions *options) {
+        MountOptions *o;
+        int r;
+
+        LIST_FOREACH(mount_options, o, options) {
+                _cleanup_free_ char *escaped = NULL;
+
+                escaped = cescape(o->options);
+                if (!escaped)
+                        return -ENOMEM;
+
+                r = serialize_item_format(f, key, "%i %s", o->partition_designator, escaped);
+                if (r < 0)
+                        return r;
+        }
+
+        return 0;
+}
+
+static int serialize_cpu_set(FILE *f, const char *key, const CPUSet *s) {
+        _cleanup_free_ uint8_t *bits = NULL;
+        size_t n;
+        int r;
+
+        if (!s->set)
+                return 0;
+
+        r = cpu_set_to_dbus(s, &bits, &n);
+        if (r < 0)
+                return r;
+
+        return serialize_hex(f, key, bits, n);
+}
+
+static int exec_context_serialize(FILE *f, const ExecContext *c) {
+        const BindMount *bm;
+        const TemporaryFileSystem *t;
+        const MountImage *mi;
+        const ExecSetCredential *sc;
+        int r;
+
+        for (size_t i = 0; i < ELEMENTSOF(exec_context_fields); i++) {
+                r = exec_field_serialize(f, exec_context_fields + i, c);
+                if (r < 0)
+                        return r;
+        }
+
+        (void) serialize_bool(f, "working-directory-missing-ok", c->working_directory_missing_ok);
+        (void) serialize_bool(f, "working-directory-home", c->working_directory_home);
+        (void) serialize_bool(f, "oom-score-adjust-set", c->oom_score_adjust_set);
+        (void) serialize_bool(f, "coredump-filter-set", c->coredump_filter_set);
+        (void) serialize_bool(f, "nice-set", c->nice_set);
+        (void) serialize_bool(f, "ioprio-set", c->ioprio_set);
+        (void) serialize_bool(f, "cpu-sched-set", c->cpu_sched_set);
+        (void) serialize_bool(f, "mount-apivfs-set", c->mount_apivfs_set);
+        (void) serialize_bool(f, "syscall-allow-list", c->syscall_allow_list);
+        (void) serialize_bool(f, "syscall-log-allow-list", c->syscall_log_allow_list);
+        (void) serialize_bool(f, "address-families-allow-list", c->address_families_allow_list);
+
+        for (int i = 0; i < _RLIMIT_MAX; i++)
+                if (c->rlimit[i])
+                        (void) serialize_item_format(f, "rlimit", "%s %" PRIu64 " %" PRIu64,
+                                                     rlimit_to_string(i),
+                                                     (uint64_t) c->rlimit[i]->rlim_cur,
+                                                     (uint64_t) c->rlimit[i]->rlim_max);
+
+        r = serialize_hex(f, "root-hash", c->root_hash, c->root_hash_size);
+        if (r < 0)
+                return r;
+        r = serialize_hex(f, "root-hash-sig", c->root_hash_sig, c->root_hash_sig_size);
+        if (r < 0)
+                return r;
+        r = serialize_hex(f, "stdin-data", c->stdin_data, c->stdin_data_size);
+        if (r < 0)
+                return r;
+
+        r = serialize_mount_options(f, "root-image-option", c->root_image_options);
+        if (r < 0)
+                return r;
+
+        r = serialize_cpu_set(f, "cpu-set", &c->cpu_set);
+        if (r < 0)
+                return r;
+        (void) serialize_item_format(f, "numa-policy", "%i", c->numa_policy.type);
+        r = serialize_cpu_set(f, "numa-nodes", &c->numa_policy.nodes);
+        if (r < 0)
+                return r;
+
+        for (bm = c->bind_mounts; bm < c->bind_mounts + c->n_bind_mounts; bm++) {
+                _cleanup_free_ char *s = NULL, *d = NULL;
+
+                s = cescape(bm->source);
+                d = cescape(bm->destination);
+                if (!s || !d)
+                        return -ENOMEM;
+
+                r = serialize_item_format(f, "bind-mount", "%i %i %i %i %s %s",
+                                          bm->read_only, bm->nosuid, bm->recursive, bm->ignore_enoent, s, d);
+                if (r < 0)
+                        return r;
+        }
+
+        for (t = c->temporary_filesystems; t < c->temporary_filesystems + c->n_temporary_filesystems; t++) {
+                _cleanup_free_ char *p = NULL, *o = NULL;
+
+                p = cescape(t->path);
+                o = cescape(strempty(t->options));
+                if (!p || !o)
+                        return -ENOMEM;
+
+                r = serialize_item_format(f, "temporary-filesystem", "%s %s", p, o);
+                if (r < 0)
+                        return r;
+        }
+
+        /* The options of a mount image follow it */
+        for (mi = c->mount_images; mi < c->mount_images + c->n_mount_images; mi++) {
+                _cleanup_free_ char *s = NULL, *d = NULL;
+
+                s = cescape(mi->source);
+                d = cescape(mi->destination);
+                if (!s || !d)
+                        return -ENOMEM;
+
+                r = serialize_item_format(f, "mount-image", "%i %s %s", mi->ignore_enoent, s, d);
+                if (r < 0)
+                        return r;
+
+                r = serialize_mount_options(f, "mount-image-option", mi->mount_options);
+                if (r < 0)
+                        return r;
+        }
+
+        for (size_t i = 0; i < c->n_log_extra_fields; i++) {
+                r = serialize_hex(f, "log-extra-field", c->log_extra_fields[i].iov_base, c->log_extra_fields[i].iov_len);
+                if (r < 0)
+                        return r;
+        }
+
+        r = serialize_pointer_map(f, "syscall-filter", c->syscall_filter);
+        if (r < 0)
+                return r;
+        r = serialize_pointer_map(f, "syscall-log", c->syscall_log);
+        if (r < 0)
+                return r;
+        r = serialize_pointer_set(f, "syscall-arch", c->syscall_archs);
+        if (r < 0)
+                return r;
+        r = serialize_pointer_set(f, "address-family", c->address_families);
+        if (r < 0)
+                return r;
+
+        for (ExecDirectoryType dt = 0; dt < _EXEC_DIRECTORY_TYPE_MAX; dt++) {
+                char **d;
+
+                (void) serialize_item_format(f, "directory-mode", "%s %o",
+                                             exec_directory_type_to_string(dt), c->directories[dt].mode);
+
+                STRV_FOREACH(d, c->directories[dt].paths) {
+                        _cleanup_free_ char *e = NULL;
+
+                        e = cescape(*d);
+                        if (!e)
+                                return -ENOMEM;
+
+                        r = serialize_item_format(f, "directory", "%s %s", exec_directory_type_to_string(dt), e);
+                        if (r < 0)
+                                return r;
+                }
+        }
+
+        HASHMAP_FOREACH(sc, c->set_credentials) {
+                _cleanup_free_ char *id = NULL, *data = NULL;
+
+                id = cescape(sc->id);
+                data = hexmem(sc->data, sc->size);
+                if (!id || !data)
+                        return -ENOMEM;
+
+                r = serialize_item_format(f, "set-credential", "%s %s", id, data);
+                if (r < 0)
+                        return r;
+        }
+
+        return 0;
+}
+
+static int deserialize_hex(const char *value, void **data, size_t *size) {
+        void *p;
+        size_t n;
+        int r;
+
+        r = unhexmem(value, strlen(value), &p, &n);
+        if (r < 0)
+                return r;
+
+        free_and_replace(*data, p);
+        *size = n;
+        return 0;
+}
+
+static int deserialize_cpu_set(const char *value, CPUSet *s) {
+        _cleanup_free_ void *bits = NULL;
+        size_t n;
+        int r;
+
+        r = unhexmem(value, strlen(value), &bits, &n);
+        if (r < 0)
+                return r;
+
+        cpu_set_reset(s);
+        return cpu_set_from_dbus(bits, n, s);
+}
+
+static int deserialize_mount_option(const char *value, MountOptions **options) {
+        _cleanup_free_ char *designator = NULL, *o = NULL;
+        MountOptions *m;
+        int d, r;
+
+        r = extract_many_words(&value, " ", EXTRACT_CUNESCAPE, &designator, &o, NULL);
+        if (r < 0)
+                return r;
+        if (r != 2)
+                return -EINVAL;
+
+        r = safe_atoi(designator, &d);
+        if (r < 0)
+                return r;
+
+        m = new(MountOptions, 1);
+        if (!m)
+                return -ENOMEM;
+
+        *m = (MountOptions) {
+                .partition_designator = d,
+                .options = TAKE_PTR(o),
+        };
+
+        LIST_APPEND(mount_options, *options, m);
+        return 0;
+}
+
+static int deserialize_pointer(const char **value, void **ret) {
+        _cleanup_free_ char *word = NULL;
+        uint64_t u;
+        int r;
+
+        r = extract_first_word(value, &word, " ", 0);
+        if (r < 0)
+                return r;
+        if (r == 0)
+                return -EINVAL;
+
+        r = safe_atou64(word, &u);
+        if (r < 0)
+                return r;
+
+        *ret = UINT64_TO_PTR(u);
+        return 0;
+}
+
+static int deserialize_pointer_map(const char *value, Hashmap **h) {
+        void *k, *v;
+        int r;
+
+        r = deserialize_pointer(&value, &k);
+        if (r < 0)
+                return r;
+        r = deserialize_pointer(&value, &v);
+        if (r < 0)
+                return r;
+
+        r = hashmap_ensure_allocated(h, NULL);
+        if (r < 0)
+                return r;
+
+        return hashmap_put(*h, k, v);
+}
+
+static int deserialize_pointer_set(const char *value, Set **s) {
+        void *p;
+        int r;
+
+        r = deserialize_pointer(&value, &p);
+        if (r < 0)
+                return r;
+
+        return set_ensure_put(s, NULL, p);
+}
+
+static int exec_context_deserialize_item(ExecContext *c, const char *key, const char *value) {
+        int r;
+
+        /* Returns > 0 if the key was known */
+
+        for (size_t i = 0; i < ELEMENTSOF(exec_context_fields); i++)
+                if (streq(key, exec_context_fields[i].name)) {
+                        r = exec_field_deserialize(exec_context_fields + i, c, value);
+                        return r < 0 ? r : 1;
+                }
+
+#define BITFIELD(k, field)                                              \
+        if (streq(key, k)) {                                            \
+                r = parse_boolean(value);                               \
+                if (r < 0)                                              \
+                        return r;                                       \
+                c->field = r;                                           \
+                return 1;                                               \
+        }
+
+        BITFIELD("working-directory-missing-ok", working_directory_missing_ok);
+        BITFIELD("working-directory-home", working_directory_home);
+        BITFIELD("oom-score-adjust-set", oom_score_adjust_set);
+        BITFIELD("coredump-filter-set", coredump_filter_set);
+        BITFIELD("nice-set", nice_set);
+        BITFIELD("ioprio-set", ioprio_set);
+        BITFIELD("cpu-sched-set", cpu_sched_set);
+        BITFIELD("mount-apivfs-set", mount_apivfs_set);
+        BITFIELD("syscall-allow-list", syscall_allow_list);
+        BITFIELD("syscall-log-allow-list", syscall_log_allow_list);
+        BITFIELD("address-families-allow-list", address_families_allow_list);
+#undef BITFIELD
+
+        if (streq(key, "rlimit")) {
+                _cleanup_free_ char *name = NULL, *cur = NULL, *max = NULL;
+                uint64_t rcur, rmax;
+                int i;
+
+                r = extract_many_words(&value, " ", 0, &name, &cur, &max, NULL);
+                if (r < 0)
+                        return r;
+                if (r != 3)
+                        return -EINVAL;
+
+                i = rlimit_from_string(name);
+                if (i < 0)
+                        return -EINVAL;
+
+                r = safe_atou64(cur, &rcur);
+                if (r < 0)
+                        return r;
+                r = safe_atou64(max, &rmax);
+                if (r < 0)
+                        return r;
+
+                if (!c->rlimit[i]) {
+                        c->rlimit[i] = new(struct rlimit, 1);
+                        if (!c->rlimit[i])
+                                return -ENOMEM;
+                }
+
+                *c->rlimit[i] = (struct rlimit) {
+                        .rlim_cur = rcur,
+                        .rlim_max = rmax,
+                };
+
+        } else if (streq(key, "root-hash"))
+                r = deserialize_hex(value, &c->root_hash, &c->root_hash_size);
+        else if (streq(key, "root-hash-sig"))
+                r = deserialize_hex(value, &c->root_hash_sig, &c->root_hash_sig_size);
+        else if (streq(key, "stdin-data"))
+                r = deserialize_hex(value, &c->stdin_data, &c->stdin_data_size);
+        else if (streq(key, "root-image-option"))
+                r = deserialize_mount_option(value, &c->root_image_options);
+        else if (streq(key, "cpu-set"))
+                r = deserialize_cpu_set(value, &c->cpu_set);
+        else if (streq(key, "numa-policy"))
+                r = safe_atoi(value, &c->numa_policy.type);
+        else if (streq(key, "numa-nodes"))
+                r = deserialize_cpu_set(value, &c->numa_policy.nodes);
+        else if (streq(key, "bind-mount")) {
+                _cleanup_free_ char *ro = NULL, *nosuid = NULL, *rec = NULL, *ign = NULL, *s = NULL, *d = NULL;
+
+                r = extract_many_words(&value, " ", EXTRACT_CUNESCAPE, &ro, &nosuid, &rec, &ign, &s, &d, NULL);
+                if (r < 0)
+                        return r;
+                if (r != 6)
+                        return -EINVAL;
+
+                r = bind_mount_add(&c->bind_mounts, &c->n_bind_mounts,
+                                   &(BindMount) {
+                                           .source = s,
+                                           .destination = d,
+                                           .read_only = streq(ro, "1"),
+                                           .nosuid = streq(nosuid, "1"),
+                                           .recursive = streq(rec, "1"),
+                                           .ignore_enoent = streq(ign, "1"),
+                                   });
+
+        } else if (streq(key, "temporary-filesystem")) {
+                _cleanup_free_ char *p = NULL, *o = NULL;
+
+                r = extract_many_words(&value, " ", EXTRACT_CUNESCAPE|EXTRACT_RETAIN_ESCAPE, &p, &o, NULL);
+                if (r < 0)
+                        return r;
+                if (r < 1)
+                        return -EINVAL;
+
+                r = temporary_filesystem_add(&c->temporary_filesystems, &c->n_temporary_filesystems, p, empty_to_null(o));
+
+        } else if (streq(key, "mount-image")) {
+                _cleanup_free_ char *ign = NULL, *s = NULL, *d = NULL;
+
+                r = extract_many_words(&value, " ", EXTRACT_CUNESCAPE, &ign, &s, &d, NULL);
+                if (r < 0)
+                        return r;
+                if (r != 3)
+                        return -EINVAL;
+
+                r = mount_image_add(&c->mount_images, &c->n_mount_images,
+                                    &(MountImage) {
+                                            .source = s,
+                                            .destination = d,
+                                            .ignore_enoent = streq(ign, "1"),
+                                    });
+
+        } else if (streq(key, "mount-image-option")) {
+                if (c->n_mount_images == 0)
+                        return -EINVAL;
+
+                r = deserialize_mount_option(value, &c->mount_images[c->n_mount_images - 1].mount_options);
+
+        } else if (streq(key, "log-extra-field")) {
+                struct iovec *a;
+                void *p;
+                size_t n;
+
+                r = unhexmem(value, strlen(value), &p, &n);
+                if (r < 0)
+                        return r;
+
+                a = reallocarray(c->log_extra_fields, c->n_log_extra_fields + 1, sizeof(struct iovec));
+                if (!a) {
+                        free(p);
+                        return -ENOMEM;
+                }
+
+                c->log_extra_fields = a;
+                c->log_extra_fields[c->n_log_extra_fields++] = IOVEC_MAKE(p, n);
+
+        } else if (streq(key, "syscall-filter"))
+                r = deserialize_pointer_map(value, &c->syscall_filter);
+        else if (streq(key, "syscall-log"))
+                r = deserialize_pointer_map(value, &c->syscall_log);
+        else if (streq(key, "syscall-arch"))
+                r = deserialize_pointer_set(value, &c->syscall_archs);
+        else if (streq(key, "address-family"))
+                r = deserialize_pointer_set(value, &c->address_families);
+        else if (STR_IN_SET(key, "directory-mode", "directory")) {
+                _cleanup_free_ char *type = NULL, *v = NULL;
+                ExecDirectoryType dt;
+
+                r = extract_many_words(&value, " ", EXTRACT_CUNESCAPE, &type, &v, NULL);
+                if (r < 0)
+                        return r;
+                if (r != 2)
+                        return -EINVAL;
+
+                dt = exec_directory_type_from_string(type);
+                if (dt < 0)
+                        return -EINVAL;
+
+                if (streq(key, "directory-mode"))
+                        r = parse_mode(v, &c->directories[dt].mode);
+                else
+                        r = strv_consume(&c->directories[dt].paths, TAKE_PTR(v));
+
+        } else if (streq(key, "set-credential")) {
+                _cleanup_(exec_set_credential_freep) ExecSetCredential *sc = NULL;
+                _cleanup_free_ char *id = NULL, *data = NULL;
+
+                r = extract_many_words(&value, " ", EXTRACT_CUNESCAPE, &id, &data, NULL);
+                if (r < 0)
+                        return r;
+                if (r != 2)
+                        return -EINVAL;
+
+                sc = new0(ExecSetCredential, 1);
+                if (!sc)
+                        return -ENOMEM;
+
+                sc->id = TAKE_PTR(id);
+
+                r = unhexmem(data, strlen(data), &sc->data, &sc->size);
+                if (r < 0)
+                        return r;
+
+                r = hashmap_ensure_allocated(&c->set_credentials, &exec_set_credential_hash_ops);
+                if (r < 0)
+                        return r;
+
+                r = hashmap_put(c->set_credentials, sc->id, sc);
+                if (r < 0)
+                        return r;
+
+                TAKE_PTR(sc);
+        } else
+                return 0;
+
+        return r < 0 ? r : 1;
+}
+
+bool exec_invocation_supported(const ExecParameters *params) {
+        assert(params);
+
+        /* Asking for confirmation needs the full manager object, to list the jobs, hence this is never
+         * passed on. For tools/check-exec-serialize.py:
+         * Not needed by systemd-executor: ExecParameters.confirm_spawn */
+        return !params->confirm_spawn;
+}
+
+static int serialize_dynamic_user(FILE *f, FDSet *fds, const char *key, const DynamicUser *d) {
+        const char *k;
+        int r;
+
+        if (!d)
+                return 0;
+
+        r = serialize_item(f, key, d->name);
+        if (r < 0)
+                return r;
+
+        k = strjoina(key, "-storage-socket");
+        for (size_t i = 0; i < 2; i++) {
+                r = serialize_fd(f, fds, k, d->storage_socket[i]);
+                if (r < 0)
+                        return r;
+        }
+
+        return 0;
+}
+
+int exec_invocation_serialize(
+                FILE *f,
+                FDSet *fds,
+                const Unit *unit,
+                const ExecCommand *command,
+                const ExecContext *context,
+                const ExecParameters *params,
+                const ExecRuntime *runtime,
+                const DynamicCreds *dcreds,
+                char **files_env,
+                int user_lookup_fd) {
+
+        int r;
+
+        assert(f);
+        assert(fds);
+        assert(unit);
+        assert(command);
+        assert(context);
+        assert(params);
+        assert(exec_invocation_supported(params));
+
+        (void) serialize_item(f, "version", STRINGIFY(PROJECT_VERSION));
+        (void) serialize_item_format(f, "log-level", "%i", log_get_max_level());
+        (void) serialize_item(f, "log-target", log_target_to_string(log_get_target()));
+
+        (void) serialize_bool(f, "manager-system", MANAGER_IS_SYSTEM(unit->manager));
+        (void) serialize_item(f, "unit-id", unit->id);
+        if (!sd_id128_is_null(unit->invocation_id))
+                (void) serialize_item(f, "unit-invocation-id", unit->invocation_id_string);
+
+        (void) serialize_item_escaped(f, "command-path", command->path);
+        r = serialize_strv(f, "command-argv", command->argv);
+        if (r < 0)
+                return r;
+        (void) serialize_item_format(f, "command-flags", "%i", command->flags);
+
+        r = exec_context_serialize(f, context);
+        if (r < 0)
+                return r;
+
+        r = serialize_strv(f, "param-environment", params->environment);
+        if (r < 0)
+                return r;
+        for (size_t i = 0; i < params->n_socket_fds + params->n_storage_fds; i++) {
+                r = serialize_fd(f, fds, "param-fd", params->fds[i]);
+                if (r < 0)
+                        return r;
+        }
+        r = serialize_strv(f, "param-fd-name", params->fd_names);
+        if (r < 0)
+                return r;
+        (void) serialize_item_format(f, "param-n-socket-fds", "%zu", params->n_socket_fds);
+        (void) serialize_item_format(f, "param-n-storage-fds", "%zu", params->n_storage_fds);
+        (void) serialize_item_format(f, "param-flags", "%i", params->flags);
+        (void) serialize_bool(f, "param-selinux-context-net", params->selinux_context_net);
+        (void) serialize_item_format(f, "param-cgroup-supported", "%i", params->cgroup_supported);
+        (void) serialize_item_escaped(f, "param-cgroup-path", params->cgroup_path);
+        if (params->prefix)
+                for (ExecDirectoryType dt = 0; dt < _EXEC_DIRECTORY_TYPE_MAX; dt++)
+                        (void) serialize_item_escaped(f, "param-prefix", strempty(params->prefix[dt]));
+        (void) serialize_item_escaped(f, "param-received-credentials", params->received_credentials);
+        (void) serialize_item_format(f, "param-watchdog-usec", USEC_FMT, params->watchdog_usec);
+        if (params->idle_pipe)
+                for (size_t i = 0; i < 4; i++) {
+                        r = serialize_fd(f, fds, "param-idle-pipe", params->idle_pipe[i]);
+                        if (r < 0)
+                                return r;
+                }
+        (void) serialize_fd(f, fds, "param-stdin-fd", params->stdin_fd);
+        (void) serialize_fd(f, fds, "param-stdout-fd", params->stdout_fd);
+        (void) serialize_fd(f, fds, "param-stderr-fd", params->stderr_fd);
+        (void) serialize_fd(f, fds, "param-exec-fd", params->exec_fd);
+
+        if (runtime) {
+                (void) serialize_item(f, "runtime-id", runtime->id);
+                (void) serialize_item_escaped(f, "runtime-tmp-dir", runtime->tmp_dir);
+                (void) serialize_item_escaped(f, "runtime-var-tmp-dir", runtime->var_tmp_dir);
+                for (size_t i = 0; i < 2; i++) {
+                        r = serialize_fd(f, fds, "runtime-netns-storage-socket", runtime->netns_storage_socket[i]);
+                        if (r < 0)
+                                return r;
+                }
+        }
+
+        if (dcreds) {
+                r = serialize_dynamic_user(f, fds, "dcreds-user", dcreds->user);
+                if (r < 0)
+                        return r;
+
+                if (dcreds->group && dcreds->group == dcreds->user)
+                        (void) serialize_bool(f, "dcreds-group-is-user", true);
+                else {
+                        r = serialize_dynamic_user(f, fds, "dcreds-group", dcreds->group);
+                        if (r < 0)
+                                return r;
+                }
+        }
+
+        r = serialize_strv(f, "files-env", files_env);
+        if (r < 0)
+                return r;
+        r = serialize_fd(f, fds, "user-lookup-fd", user_lookup_fd);
+        if (r < 0)
+                return r;
+
+        return fflush_and_check(f);
+}
+
+static int deserialize_fd_from_set(FDSet *fds, const char *value, int *ret) {
+        int fd;
+
+        if (safe_atoi(value, &fd) < 0 || fd < 0 || !fdset_contains(fds, fd))
+                return -EBADF;
+
+        *ret = fdset_remove(fds, fd);
+        return 0;
+}
+
+static int deserialize_dynamic_user(FDSet *fds, const char *key, const char *value, DynamicUser **d) {
+        int fd, r;
+
+        if (streq(key, "")) {
+                DynamicUser *n;
+
+                if (*d || !valid_user_group_name(value, 0))
+                        return -EINVAL;
+
+                n = malloc(offsetof(DynamicUser, name) + strlen(value) + 1);
+                if (!n)
+                        return -ENOMEM;
+
+                *n = (DynamicUser) {
+                        .n_ref = 1,
+                        .storage_socket = { -1, -1 },
+                };
+                strcpy(n->name, value);
+
+                *d = n;
+                return 0;
+        }
+
+        assert(streq(key, "-storage-socket"));
+
+        if (!*d)
+                return -EINVAL;
+
+        r = deserialize_fd_from_set(fds, value, &fd);
+        if (r < 0)
+                return r;
+
+        if ((*d)->storage_socket[0] < 0)
+                (*d)->storage_socket[0] = fd;
+        else if ((*d)->storage_socket[1] < 0)
+                (*d)->storage_socket[1] = fd;
+        else {
+                safe_close(fd);
+                return -EINVAL;
+        }
+
+        return 0;
+}
+
+static int deserialize_fd_array(FDSet *fds, const char *value, int **array, size_t *n) {
+        int fd, *a, r;
+
+        r = deserialize_fd_from_set(fds, value, &fd);
+        if (r < 0)
+                return r;
+
+        a = reallocarray(*array, *n + 1, sizeof(int));
+        if (!a) {
+                safe_close(fd);
+                return -ENOMEM;
+        }
+
+        a[(*n)++] = fd;
+        *array = a;
+        return 0;
+}
+
+static int exec_invocation_deserialize_item(ExecInvocation *i, FDSet *fds, const char *key, const char *value) {
+        ExecParameters *p = &i->params;
+        const char *k;
+        int r;
+
+        if (streq(key, "version")) {
+                if (!streq(value, STRINGIFY(PROJECT_VERSION)))
+                        return log_error_errno(SYNTHETIC_ERRNO(EPROTONOSUPPORT),
+                                               "Serialization of version %s not supported by version %s.",
+                                               value, STRINGIFY(PROJECT_VERSION));
+                return 0;
+        }
+
+        if (streq(key, "log-level"))
+                r = safe_atoi(value, &i->log_level);
+        else if (streq(key, "log-target")) {
+                i->log_target = log_target_from_string(value);
+                r = i->log_target < 0 ? -EINVAL : 0;
+        } else if (streq(key, "manager-system")) {
+                r = parse_boolean(value);
+                if (r >= 0)
+                        i->manager.unit_file_scope = r ? UNIT_FILE_SYSTEM : UNIT_FILE_USER;
+        } else if (streq(key, "unit-id"))
+                r = free_and_strdup(&i->unit.id, value);
+        else if (streq(key, "unit-invocation-id")) {
+                r = sd_id128_from_string(value, &i->unit.invocation_id);
+                if (r >= 0)
+                        sd_id128_to_string(i->unit.invocation_id, i->unit.invocation_id_string);
+        } else if (streq(key, "command-path"))
+                r = cunescape(value, 0, &i->command.path);
+        else if (streq(key, "command-argv")) {
+                char *s;
+
+                r = cunescape(value, 0, &s);
+                if (r >= 0)
+                        r = strv_consume(&i->command.argv, s);
+        } else if (streq(key, "command-flags"))
+                r = safe_atoi(value, (int*) &i->command.flags);
+        else if (streq(key, "param-environment"))
+                r = deserialize_environment(value, &i->environment);
+        else if (streq(key, "param-fd"))
+                r = deserialize_fd_array(fds, value, &i->fds, &i->n_fds);
+        else if (streq(key, "param-fd-name")) {
+                char *s;
+
+                r = cunescape(value, 0, &s);
+                if (r >= 0)
+                        r = strv_consume(&i->fd_names, s);
+        } else if (streq(key, "param-n-socket-fds"))
+                r = safe_atozu(value, &p->n_socket_fds);
+        else if (streq(key, "param-n-storage-fds"))
+                r = safe_atozu(value, &p->n_storage_fds);
+        else if (streq(key, "param-flags"))
+                r = safe_atoi(value, (int*) &p->flags);
+        else if (streq(key, "param-selinux-context-net")) {
+                r = parse_boolean(value);
+                if (r >= 0)
+                        p->selinux_context_net = r;
+        } else if (streq(key, "param-cgroup-supported"))
+                r = safe_atoi(value, (int*) &p->cgroup_supported);
+        else if (streq(key, "param-cgroup-path"))
+                r = cunescape(value, 0, &i->cgroup_path);
+        else if (streq(key, "param-prefix")) {
+                char *s;
+
+                r = cunescape(value, 0, &s);
+                if (r >= 0)
+                        r = strv_consume(&i->prefix, s);
+        } else if (streq(key, "param-received-credentials"))
+                r = cunescape(value, 0, &i->received_credentials);
+        else if (streq(key, "param-watchdog-usec"))
+                r = safe_atou64(value, &p->watchdog_usec);
+        else if (streq(key, "param-idle-pipe")) {
+                int *a = i->idle_pipe;
+                size_t n = 0;
+
+                while (n < 4 && a[n] >= 0)
+                        n++;
+                if (n >= 4)
+                        return -EINVAL;
+
+                r = deserialize_fd_from_set(fds, value, a + n);
+                i->have_idle_pipe = true;
+        } else if (streq(key, "param-stdin-fd"))
+                r = deserialize_fd_from_set(fds, value, &p->stdin_fd);
+        else if (streq(key, "param-stdout-fd"))
+                r = deserialize_fd_from_set(fds, value, &p->stdout_fd);
+        else if (streq(key, "param-stderr-fd"))
+                r = deserialize_fd_from_set(fds, value, &p->stderr_fd);
+        else if (streq(key, "param-exec-fd"))
+                r = deserialize_fd_from_set(fds, value, &p->exec_fd);
+        else if (streq(key, "runtime-id")) {
+                i->have_runtime = true;
+                r = free_and_strdup(&i->runtime.id, value);
+        } else if (streq(key, "runtime-tmp-dir"))
+                r = cunescape(value, 0, &i->runtime.tmp_dir);
+        else if (streq(key, "runtime-var-tmp-dir"))
+                r = cunescape(value, 0, &i->runtime.var_tmp_dir);
+        else if (streq(key, "runtime-netns-storage-socket")) {
+                int *s = i->runtime.netns_storage_socket;
+
+                r = deserialize_fd_from_set(fds, value, s[0] < 0 ? s : s + 1);
+        } else if ((k = startswith(key, "dcreds-user")))
+                r = deserialize_dynamic_user(fds, k, value, &i->dcreds.user);
+        else if (streq(key, "dcreds-group-is-user")) {
+                if (!i->dcreds.user)
+                        return -EINVAL;
+
+                i->dcreds.group = i->dcreds.user;
+                r = 0;
+        } else if ((k = startswith(key, "dcreds-group")))
+                r = deserialize_dynamic_user(fds, k, value, &i->dcreds.group);
+        else if (streq(key, "files-env"))
+                r = deserialize_environment(value, &i->files_env);
+        else if (streq(key, "user-lookup-fd"))
+                r = deserialize_fd_from_set(fds, value, &i->user_lookup_fd);
+        else {
+                r = exec_context_deserialize_item(&i->context, key, value);
+                if (r == 0)
+                        log_debug("Unknown serialization item '%s', ignoring.", key);
+        }
+
+        return r < 0 ? r : 0;
+}
+
+int exec_invocation_deserialize(FILE *f, FDSet *fds, ExecInvocation *ret) {
+        _cleanup_(exec_invocation_done) ExecInvocation i = EXEC_INVOCATION_NULL;
+        int r;
+
+        assert(f);
+        assert(fds);
+        assert(ret);
+
+        i.manager.unit_file_scope = UNIT_FILE_SYSTEM;
+        exec_context_init(&i.context);
+
+        for (;;) {
+                _cleanup_free_ char *line = NULL;
+                char *value;
+
+                r = read_line(f, LONG_LINE_MAX, &line);
+                if (r < 0)
+                        return log_error_errno(r, "Failed to read serialization: %m");
+                if (r == 0)
+                        break;
+
+                value = strchr(line, '=');
+                if (!value)
+                        continue;
+                *value++ = 0;
+
+                r = exec_invocation_deserialize_item(&i, fds, line, value);
+                if (r < 0)
+                        return log_error_errno(r, "Failed to deserialize '%s': %m", line);
+        }
+
+        if (!i.unit.id || !i.command.path || (i.prefix && strv_length(i.prefix) != _EXEC_DIRECTORY_TYPE_MAX) ||
+            i.n_fds != i.params.n_socket_fds + i.params.n_storage_fds)
+                return log_error_errno(SYNTHETIC_ERRNO(EBADMSG), "Serialization is incomplete.");
+
+        /* Now that everything is in place, wire up the pointers between the objects */
+        if (i.manager.unit_file_scope == UNIT_FILE_SYSTEM) {
+                i.manager.unit_log_field = "UNIT=";
+                i.manager.unit_log_format_string = "UNIT=%s";
+                i.manager.invocation_log_field = "INVOCATION_ID=";
+                i.manager.invocation_log_format_string = "INVOCATION_ID=%s";
+        } else {
+                i.manager.unit_log_field = "USER_UNIT=";
+                i.manager.unit_log_format_string = "USER_UNIT=%s";
+                i.manager.invocation_log_field = "USER_INVOCATION_ID=";
+                i.manager.invocation_log_format_string = "USER_INVOCATION_ID=%s";
+        }
+
+        i.params.environment = i.environment;
+        i.params.fds = i.fds;
+        i.params.fd_names = i.fd_names;
+        i.params.cgroup_path = i.cgroup_path;
+        i.params.prefix = i.prefix;
+        i.params.received_credentials = i.received_credentials;
+
+        *ret = i;
+        ret->unit.manager = &ret->manager;
+        if (ret->have_idle_pipe)
+                ret->params.idle_pipe = ret->idle_pipe;
+
+        i = EXEC_INVOCATION_NULL;
+        return 0;
+}
+
+static DynamicUser* dynamic_user_close(DynamicUser *d) {
+        if (!d)
+                return NULL;
+
+        safe_close_pair(d->storage_socket);
+        return mfree(d);
+}
+
+void exec_invocation_done(ExecInvocation *i) {
+        assert(i);
+
+        free(i->unit.id);
+
+        free(i->command.path);
+        strv_free(i->command.argv);
+
+        exec_context_done(&i->context);
+
+        strv_free(i->environment);
+        close_many(i->fds, i->n_fds);
+        free(i->fds);
+        strv_free(i->fd_names);
+        strv_free(i->prefix);
+        free(i->cgroup_path);
+        free(i->received_credentials);
+        close_many(i->idle_pipe, ELEMENTSOF(i->idle_pipe));
+        safe_close(i->params.stdin_fd);
+        safe_close(i->params.stdout_fd);
+        safe_close(i->params.stderr_fd);
+        safe_close(i->params.exec_fd);
+
+        free(i->runtime.id);
+        free(i->runtime.tmp_dir);
+        free(i->runtime.var_tmp_dir);
+        safe_close_pair(i->runtime.netns_storage_socket);
+
+        if (i->dcreds.group != i->dcreds.user)
+                dynamic_user_close(i->dcreds.group);
+        dynamic_user_close(i->dcreds.user);
+
+        strv_free(i->files_env);
+        safe_close(i->user_lookup_fd);
+}
@@ -0,0 +1,77 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+#pragma once
+
+#include <stdio.h>
+
+#include "dynamic-user.h"
+#include "execute.h"
+#include "fdset.h"
+#include "manager.h"
+#include "unit.h"
+
+/* Everything exec_invoke() needs to set up the execution environment of a command and execute it. Instead
+ * of forking off PID 1 we may serialize all of this into a memfd, and spawn the small systemd-executor
+ * binary with CLONE_VM|CLONE_VFORK, which deserializes it and calls exec_invoke() in turn. The objects here
+ * are stripped down copies, carrying only what exec_invoke() looks at. */
+typedef struct ExecInvocation {
+        Manager manager;
+        Unit unit;
+        ExecCommand command;
+        ExecContext context;
+        ExecParameters params;
+        ExecRuntime runtime;
+        bool have_runtime;
+        DynamicCreds dcreds;
+
+        char **files_env;
+        int user_lookup_fd;
+
+        int log_level;
+        LogTarget log_target;
+
+        /* Backing storage for the fields of 'params' */
+        int *fds;
+        size_t n_fds;
+        char **fd_names;
+        char **environment;
+        char **prefix;
+        char *cgroup_path;
+        char *received_credentials;
+        int idle_pipe[4];
+        bool have_idle_pipe;
+} ExecInvocation;
+
+#define EXEC_INVOCATION_NULL                                            \
+        (ExecInvocation) {                                              \
+                .params = {                                             \
+                        .stdin_fd = -1,                                 \
+                        .stdout_fd = -1,                                \
+                        .stderr_fd = -1,                                \
+                        .exec_fd = -1,                                  \
+                },                                                      \
+                .runtime = {                                            \
+                        .n_ref = 1,                                     \
+                        .netns_storage_socket = { -1, -1 },             \
+                },                                                      \
+                .user_lookup_fd = -1,                                   \
+                .log_level = -1,                                        \
+                .log_target = _LOG_TARGET_INVALID,                      \
+                .idle_pipe = { -1, -1, -1, -1 },                        \
+        }
+
+bool exec_invocation_supported(const ExecParameters *params);
+
+int exec_invocation_serialize(
+                FILE *f,
+                FDSet *fds,
+                const Unit *unit,
+                const ExecCommand *command,
+                const ExecContext *context,
+                const ExecParameters *params,
+                const ExecRuntime *runtime,
+                const DynamicCreds *dcreds,
+                char **files_env,
+                int user_lookup_fd);
+
+int exec_invocation_deserialize(FILE *f, FDSet *fds, ExecInvocation *ret);
+void exec_invocation_done(ExecInvocation *i);
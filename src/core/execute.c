@@ -3,6 +3,7 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <poll.h>
+#include <sched.h>
 #include <sys/eventfd.h>
 #include <sys/ioctl.h>
 #include <sys/mman.h>
@@ -50,9 +51,11 @@
 #include "env-file.h"
 #include "env-util.h"
 #include "errno-list.h"
+#include "execute-serialize.h"
 #include "execute.h"
 #include "exit-status.h"
 #include "fd-util.h"
+#include "fdset.h"
 #include "fileio.h"
 #include "format-util.h"
 #include "fs-util.h"
@@ -81,11 +84,13 @@
 #endif
 #include "securebits-util.h"
 #include "selinux-util.h"
+#include "serialize.h"
 #include "signal-util.h"
 #include "smack-util.h"
 #include "socket-util.h"
 #include "special.h"
 #include "stat-util.h"
+#include "stdio-util.h"
 #include "string-table.h"
 #include "string-util.h"
 #include "strv.h"
@@ -4608,6 +4613,227 @@ static int exec_child(
 static int exec_context_load_environment(const Unit *unit, const ExecContext *c, char ***l);
 static int exec_context_named_iofds(const ExecContext *c, const ExecParameters *p, int named_iofds[static 3]);
 
+static int exec_parameters_get_fds(
+                const Unit *unit,
+                const ExecContext *context,
+                const ExecParameters *params,
+                int *ret_socket_fd,
+                int **ret_fds,
+                size_t *ret_n_socket_fds,
+                size_t *ret_n_storage_fds) {
+
+        if (context->std_input == EXEC_INPUT_SOCKET ||
+            context->std_output == EXEC_OUTPUT_SOCKET ||
+            context->std_error == EXEC_OUTPUT_SOCKET) {
+
+                if (params->n_socket_fds > 1)
+                        return log_unit_error_errno(unit, SYNTHETIC_ERRNO(EINVAL), "Got more than one socket.");
+
+                if (params->n_socket_fds == 0)
+                        return log_unit_error_errno(unit, SYNTHETIC_ERRNO(EINVAL), "Got no socket.");
+
+                *ret_socket_fd = params->fds[0];
+                *ret_fds = NULL;
+                *ret_n_socket_fds = *ret_n_storage_fds = 0;
+        } else {
+                *ret_socket_fd = -1;
+                *ret_fds = params->fds;
+                *ret_n_socket_fds = params->n_socket_fds;
+                *ret_n_storage_fds = params->n_storage_fds;
+        }
+
+        return 0;
+}
+
+int exec_invoke(
+                Unit *unit,
+                const ExecCommand *command,
+                const ExecContext *context,
+                const ExecParameters *params,
+                ExecRuntime *runtime,
+                DynamicCreds *dcreds,
+                char **files_env,
+                int user_lookup_fd) {
+
+        int socket_fd, r, named_iofds[3] = { -1, -1, -1 }, *fds, exit_status = EXIT_SUCCESS;
+        size_t n_socket_fds, n_storage_fds;
+
+        assert(unit);
+        assert(command);
+        assert(context);
+        assert(params);
+
+        /* Runs in the child process, either forked off the manager directly, or in systemd-executor. Sets up
+         * the execution environment and executes the command. Only returns on failure, with the exit status
+         * to exit with. */
+
+        r = exec_parameters_get_fds(unit, context, params, &socket_fd, &fds, &n_socket_fds, &n_storage_fds);
+        if (r < 0)
+                exit_status = EXIT_FDS;
+        else {
+                r = exec_context_named_iofds(context, params, named_iofds);
+                if (r < 0) {
+                        log_unit_error_errno(unit, r, "Failed to load a named file descriptor: %m");
+                        exit_status = EXIT_FDS;
+                }
+        }
+        if (r >= 0)
+                r = exec_child(unit,
+                               command,
+                               context,
+                               params,
+                               runtime,
+                               dcreds,
+                               socket_fd,
+                               named_iofds,
+                               fds,
+                               n_socket_fds,
+                               n_storage_fds,
+                               files_env,
+                               user_lookup_fd,
+                               &exit_status);
+
+        if (r < 0) {
+                const char *status =
+                        exit_status_to_string(exit_status,
+                                              EXIT_STATUS_LIBC | EXIT_STATUS_SYSTEMD);
+
+                log_struct_errno(LOG_ERR, r,
+                                 "MESSAGE_ID=" SD_MESSAGE_SPAWN_FAILED_STR,
+                                 LOG_UNIT_ID(unit),
+                                 LOG_UNIT_INVOCATION_ID(unit),
+                                 LOG_UNIT_MESSAGE(unit, "Failed at step %s spawning %s: %m",
+                                                  status, command->path),
+                                 "EXECUTABLE=%s", command->path);
+        }
+
+        return exit_status;
+}
+
+typedef struct ExecutorChild {
+        int executor_fd;
+        const int *fds;
+        size_t n_fds;
+        char **argv;
+        int error;
+} ExecutorChild;
+
+static int executor_child(void *userdata) {
+        ExecutorChild *c = userdata;
+
+        /* We share the address space and are running on a stack of our own, with the manager suspended until we
+         * call execve(). Hence only async-signal-safe calls here, and no allocations. */
+
+        for (size_t i = 0; i < c->n_fds; i++)
+                if (fd_cloexec(c->fds[i], false) < 0) {
+                        c->error = errno;
+                        _exit(EXIT_FDS);
+                }
+
+        (void) fexecve(c->executor_fd, c->argv, environ);
+
+        c->error = errno;
+        _exit(EXIT_EXEC);
+}
+
+#define EXECUTOR_STACK_SIZE (64U*1024U)
+
+static int exec_spawn_executor(
+                Unit *unit,
+                ExecCommand *command,
+                const ExecContext *context,
+                const ExecParameters *params,
+                ExecRuntime *runtime,
+                DynamicCreds *dcreds,
+                char **files_env,
+                pid_t *ret) {
+
+        _cleanup_fdset_free_ FDSet *fdset = NULL;
+        _cleanup_close_ int serialization_fd = -1;
+        _cleanup_fclose_ FILE *f = NULL;
+        _cleanup_free_ int *fds = NULL;
+        _cleanup_free_ void *stack = NULL;
+        char fd_string[DECIMAL_STR_MAX(int)];
+        sigset_t all, saved;
+        ExecutorChild c;
+        size_t n_fds = 0;
+        int fileno_f, fd, r;
+        pid_t pid;
+
+        /* Instead of fork()ing off the manager, which gets ever more expensive the more memory the manager
+         * has mapped, serialize the parameters and spawn systemd-executor, sharing the address space until
+         * execve(). Returns 0 if this is not possible and the caller should fork() instead, > 0 on success. */
+
+        if (unit->manager->executor_fd < 0 || !exec_invocation_supported(params))
+                return 0;
+
+        fdset = fdset_new();
+        if (!fdset)
+                return log_oom();
+
+        serialization_fd = open_serialization_fd("executor");
+        if (serialization_fd < 0)
+                return log_unit_error_errno(unit, serialization_fd, "Failed to create serialization file: %m");
+
+        f = take_fdopen(&serialization_fd, "w+");
+        if (!f)
+                return log_unit_error_errno(unit, errno, "Failed to open serialization file: %m");
+        fileno_f = fileno(f);
+
+        r = exec_invocation_serialize(f, fdset, unit, command, context, params, runtime, dcreds,
+                                      files_env, unit->manager->user_lookup_fds[1]);
+        if (r < 0)
+                return log_unit_error_errno(unit, r, "Failed to serialize execution parameters: %m");
+
+        if (fseeko(f, 0, SEEK_SET) < 0)
+                return log_unit_error_errno(unit, errno, "Failed to rewind serialization file: %m");
+
+        fds = new(int, fdset_size(fdset) + 1);
+        if (!fds)
+                return log_oom();
+
+        FDSET_FOREACH(fd, fdset)
+                fds[n_fds++] = fd;
+        fds[n_fds++] = fileno_f;
+
+        stack = malloc(EXECUTOR_STACK_SIZE);
+        if (!stack)
+                return log_oom();
+
+        xsprintf(fd_string, "%i", fileno_f);
+
+        c = (ExecutorChild) {
+                .executor_fd = unit->manager->executor_fd,
+                .fds = fds,
+                .n_fds = n_fds,
+                .argv = STRV_MAKE("systemd-executor", "--deserialize", fd_string),
+        };
+
+        /* Block all signals, so that no signal handler runs on the child's stack before it execs */
+        assert_se(sigfillset(&all) >= 0);
+        assert_se(sigprocmask(SIG_SETMASK, &all, &saved) >= 0);
+
+        pid = clone(executor_child, (uint8_t*) stack + EXECUTOR_STACK_SIZE, CLONE_VM|CLONE_VFORK|SIGCHLD, &c);
+        r = pid < 0 ? -errno : 0;
+
+        assert_se(sigprocmask(SIG_SETMASK, &saved, NULL) >= 0);
+
+        if (r < 0) {
+                log_unit_debug_errno(unit, r, "Failed to spawn systemd-executor, falling back to fork(): %m");
+                return 0;
+        }
+
+        if (c.error != 0) {
+                /* The executor never ran, hence nothing happened yet. Reap it, and do it the old way. */
+                (void) wait_for_terminate(pid, NULL);
+                log_unit_debug_errno(unit, c.error, "Failed to execute systemd-executor, falling back to fork(): %m");
+                return 0;
+        }
+
+        *ret = pid;
+        return 1;
+}
+
 int exec_spawn(Unit *unit,
                ExecCommand *command,
                const ExecContext *context,
@@ -4616,10 +4842,10 @@ int exec_spawn(Unit *unit,
                DynamicCreds *dcreds,
                pid_t *ret) {
 
-        int socket_fd, r, named_iofds[3] = { -1, -1, -1 }, *fds = NULL;
+        int socket_fd, r, named_iofds[3] = { -1, -1, -1 }, *fds;
         _cleanup_free_ char *subcgroup_path = NULL;
         _cleanup_strv_free_ char **files_env = NULL;
-        size_t n_storage_fds = 0, n_socket_fds = 0;
+        size_t n_storage_fds, n_socket_fds;
         _cleanup_free_ char *line = NULL;
         pid_t pid;
 
@@ -4630,23 +4856,9 @@ int exec_spawn(Unit *unit,
         assert(params);
         assert(params->fds || (params->n_socket_fds + params->n_storage_fds <= 0));
 
-        if (context->std_input == EXEC_INPUT_SOCKET ||
-            context->std_output == EXEC_OUTPUT_SOCKET ||
-            context->std_error == EXEC_OUTPUT_SOCKET) {
-
-                if (params->n_socket_fds > 1)
-                        return log_unit_error_errno(unit, SYNTHETIC_ERRNO(EINVAL), "Got more than one socket.");
-
-                if (params->n_socket_fds == 0)
-                        return log_unit_error_errno(unit, SYNTHETIC_ERRNO(EINVAL), "Got no socket.");
-
-                socket_fd = params->fds[0];
-        } else {
-                socket_fd = -1;
-                fds = params->fds;
-                n_socket_fds = params->n_socket_fds;
-                n_storage_fds = params->n_storage_fds;
-        }
+        r = exec_parameters_get_fds(unit, context, params, &socket_fd, &fds, &n_socket_fds, &n_storage_fds);
+        if (r < 0)
+                return r;
 
         r = exec_context_named_iofds(context, params, named_iofds);
         if (r < 0)
@@ -4684,47 +4896,29 @@ int exec_spawn(Unit *unit,
                 }
         }
 
-        pid = fork();
-        if (pid < 0)
-                return log_unit_error_errno(unit, errno, "Failed to fork: %m");
-
-        if (pid == 0) {
-                int exit_status = EXIT_SUCCESS;
-
-                r = exec_child(unit,
-                               command,
-                               context,
-                               params,
-                               runtime,
-                               dcreds,
-                               socket_fd,
-                               named_iofds,
-                               fds,
-                               n_socket_fds,
-                               n_storage_fds,
-                               files_env,
-                               unit->manager->user_lookup_fds[1],
-                               &exit_status);
-
-                if (r < 0) {
-                        const char *status =
-                                exit_status_to_string(exit_status,
-                                                      EXIT_STATUS_LIBC | EXIT_STATUS_SYSTEMD);
-
-                        log_struct_errno(LOG_ERR, r,
-                                         "MESSAGE_ID=" SD_MESSAGE_SPAWN_FAILED_STR,
-                                         LOG_UNIT_ID(unit),
-                                         LOG_UNIT_INVOCATION_ID(unit),
-                                         LOG_UNIT_MESSAGE(unit, "Failed at step %s spawning %s: %m",
-                                                          status, command->path),
-                                         "EXECUTABLE=%s", command->path);
-                }
-
-                _exit(exit_status);
+        r = exec_spawn_executor(unit, command, context, params, runtime, dcreds, files_env, &pid);
+        if (r < 0)
+                return r;
+        if (r > 0)
+                log_unit_debug(unit, "Spawned %s via systemd-executor as "PID_FMT, command->path, pid);
+        else {
+                pid = fork();
+                if (pid < 0)
+                        return log_unit_error_errno(unit, errno, "Failed to fork: %m");
+
+                if (pid == 0)
+                        _exit(exec_invoke(unit,
+                                          command,
+                                          context,
+                                          params,
+                                          runtime,
+                                          dcreds,
+                                          files_env,
+                                          unit->manager->user_lookup_fds[1]));
+
+                log_unit_debug(unit, "Forked %s as "PID_FMT, command->path, pid);
         }
 
-        log_unit_debug(unit, "Forked %s as "PID_FMT, command->path, pid);
-
         /* We add the new process to the cgroup both in the child (so that we can be sure that no user code is ever
          * executed outside of the cgroup) and in the parent (so that we can be sure that when we kill the cgroup the
          * process will be killed too). */
@@ -0,0 +1,112 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+
+#include <getopt.h>
+#include <unistd.h>
+
+#include "alloc-util.h"
+#include "execute-serialize.h"
+#include "execute.h"
+#include "fd-util.h"
+#include "fdset.h"
+#include "fileio.h"
+#include "log.h"
+#include "main-func.h"
+#include "parse-util.h"
+
+/* Spawned by the manager via exec_spawn() in place of a fork() of itself. Picks up the serialized execution
+ * parameters, and then does what the forked off child would have done. */
+
+static int arg_deserialize_fd = -1;
+
+static int parse_argv(int argc, char *argv[]) {
+        enum {
+                ARG_DESERIALIZE = 0x100,
+        };
+
+        static const struct option options[] = {
+                { "deserialize", required_argument, NULL, ARG_DESERIALIZE },
+                {}
+        };
+
+        int c, r;
+
+        assert(argc >= 0);
+        assert(argv);
+
+        while ((c = getopt_long(argc, argv, "", options, NULL)) >= 0)
+                switch (c) {
+
+                case ARG_DESERIALIZE:
+                        r = safe_atoi(optarg, &arg_deserialize_fd);
+                        if (r < 0)
+                                return log_error_errno(r, "Failed to parse deserialize option \"%s\": %m", optarg);
+                        if (arg_deserialize_fd < 0)
+                                return log_error_errno(SYNTHETIC_ERRNO(EINVAL), "Invalid deserialize fd: %d", arg_deserialize_fd);
+                        break;
+
+                case '?':
+                        return -EINVAL;
+
+                default:
+                        assert_not_reached("Unhandled option");
+                }
+
+        if (optind < argc)
+                return log_error_errno(SYNTHETIC_ERRNO(EINVAL), "This program takes no arguments.");
+
+        if (arg_deserialize_fd < 0)
+                return log_error_errno(SYNTHETIC_ERRNO(EINVAL), "No serialization passed.");
+
+        return 0;
+}
+
+static int run(int argc, char *argv[]) {
+        _cleanup_(exec_invocation_done) ExecInvocation i = EXEC_INVOCATION_NULL;
+        _cleanup_fdset_free_ FDSet *fds = NULL;
+        _cleanup_fclose_ FILE *f = NULL;
+        int r;
+
+        log_parse_environment();
+        log_open();
+
+        r = parse_argv(argc, argv);
+        if (r < 0)
+                return r;
+
+        r = fdset_new_fill(&fds);
+        if (r < 0)
+                return log_error_errno(r, "Failed to allocate fd set: %m");
+
+        if (fdset_remove(fds, arg_deserialize_fd) < 0)
+                return log_error_errno(SYNTHETIC_ERRNO(EBADF), "Serialization fd %i is not open.", arg_deserialize_fd);
+
+        f = fdopen(arg_deserialize_fd, "r");
+        if (!f)
+                return log_error_errno(errno, "Failed to open serialization fd: %m");
+
+        r = exec_invocation_deserialize(f, fds, &i);
+        if (r < 0)
+                return r;
+
+        /* Anything not referenced by the serialization is not ours to keep */
+        f = safe_fclose(f);
+        fds = fdset_free(fds);
+
+        if (i.log_level >= 0)
+                log_set_max_level(i.log_level);
+        if (i.log_target >= 0) {
+                log_set_target(i.log_target);
+                log_open();
+        }
+
+        return exec_invoke(&i.unit,
+                           &i.command,
+                           &i.context,
+                           &i.params,
+                           i.have_runtime ? &i.runtime : NULL,
+                           i.dcreds.user || i.dcreds.group ? &i.dcreds : NULL,
+                           i.files_env,
+                           i.user_lookup_fd);
+}
+
+DEFINE_MAIN_FUNCTION_WITH_POSITIVE_FAILURE(run);
@@ -1,11 +1,28 @@
 /* SPDX-License-Identifier: LGPL-2.1-or-later */
 
+#include <stdlib.h>
 #include <unistd.h>
 
+#include "sd-id128.h"
+
+#include "alloc-util.h"
+#include "copy.h"
+#include "dirent-util.h"
+#include "fd-util.h"
+#include "fileio.h"
+#include "fs-util.h"
+#include "generator.h"
 #include "generator-setup.h"
+#include "label.h"
 #include "macro.h"
 #include "mkdir.h"
+#include "parse-util.h"
+#include "path-util.h"
 #include "rm-rf.h"
+#include "siphash24.h"
+#include "string-util.h"
+#include "strv.h"
+#include "time-util.h"
 
 int lookup_paths_mkdir_generator(LookupPaths *p) {
         int r, q;
@@ -56,3 +73,379 @@ void lookup_paths_flush_generator(LookupPaths *p) {
         if (p->temporary_dir)
                 (void) rm_rf(p->temporary_dir, REMOVE_ROOT|REMOVE_PHYSICAL);
 }
+
+/* Generators may declare the inputs their output is derived from (see generator_add_input()), which are
+ * recorded in <generator>.cache/<name>/inputs. Only generators which did so on their previous run take part
+ * in caching: they write into private directories below <generator>.cache/<name>/, which are merged into the
+ * real generator directories once all generators are done, in the order they are run. Before each such run
+ * a hash of their binary, the environment and the previously declared inputs is taken, which is kept as stamp
+ * if the generator succeeds. As long as the stamp stays the same the generator is not run again, and its
+ * previous output is merged instead. All other generators write into the real directories directly. */
+
+#define GENERATOR_CACHE_HASH_KEY SD_ID128_MAKE(9b,0e,62,5c,1a,4f,4d,27,a5,33,0c,87,e4,d1,6f,52)
+
+static const char* const generator_cache_subdirs[] = {
+        "normal",
+        "early",
+        "late",
+};
+
+static char* generator_cache_path(const LookupPaths *p, const char *path) {
+        assert(p);
+        assert(p->generator);
+        assert(path);
+
+        return strjoin(p->generator, ".cache/", basename(path));
+}
+
+static const char* generator_target_dir(const LookupPaths *p, size_t i) {
+        assert(p);
+
+        switch (i) {
+        case 0:
+                return p->generator;
+        case 1:
+                return p->generator_early;
+        case 2:
+                return p->generator_late;
+        default:
+                assert_not_reached("Unknown generator directory");
+        }
+}
+
+static void generator_hash_input(const char *path, struct siphash *state) {
+        _cleanup_free_ char *contents = NULL;
+        size_t size;
+        struct stat st;
+
+        assert(path);
+        assert(state);
+
+        siphash24_compress_string(path, state);
+
+        if (stat(path, &st) < 0) {
+                siphash24_compress(&errno, sizeof(errno), state);
+                return;
+        }
+
+        siphash24_compress(&st.st_mode, sizeof(st.st_mode), state);
+
+        /* Regular files are hashed by contents, which also covers files in /proc and such whose timestamps
+         * are meaningless. For anything else, e.g. directories binaries are searched in, the timestamp has to
+         * do. */
+        if (S_ISREG(st.st_mode) && read_full_file(path, &contents, &size) >= 0)
+                siphash24_compress(contents, size, state);
+        else {
+                siphash24_compress(&st.st_ino, sizeof(st.st_ino), state);
+                siphash24_compress_usec_t(timespec_load(&st.st_mtim), state);
+        }
+}
+
+static int generator_fingerprint(const char *path, const char *cache, uint64_t *ret) {
+        _cleanup_fclose_ FILE *f = NULL;
+        struct siphash state;
+        const char *inputs;
+        struct stat st;
+        char **e;
+        int r;
+
+        assert(path);
+        assert(cache);
+        assert(ret);
+
+        inputs = strjoina(cache, "/inputs");
+
+        f = fopen(inputs, "re");
+        if (!f)
+                return -errno;
+
+        if (stat(path, &st) < 0)
+                return -errno;
+
+        siphash24_init(&state, GENERATOR_CACHE_HASH_KEY.bytes);
+
+        siphash24_compress(&st.st_dev, sizeof(st.st_dev), &state);
+        siphash24_compress(&st.st_ino, sizeof(st.st_ino), &state);
+        siphash24_compress(&st.st_size, sizeof(st.st_size), &state);
+        siphash24_compress_usec_t(timespec_load(&st.st_mtim), &state);
+
+        STRV_FOREACH(e, environ)
+                if (!startswith(*e, GENERATOR_INPUTS_ENV "="))
+                        siphash24_compress_string(*e, &state);
+
+        for (;;) {
+                _cleanup_free_ char *line = NULL;
+
+                r = read_line(f, PATH_MAX, &line);
+                if (r < 0)
+                        return r;
+                if (r == 0)
+                        break;
+
+                if (!path_is_absolute(line))
+                        continue;
+
+                generator_hash_input(line, &state);
+        }
+
+        *ret = siphash24_finalize(&state);
+        return 0;
+}
+
+static int generator_cache_valid(const char *path, const char *cache, uint64_t *ret_fingerprint) {
+        _cleanup_free_ char *stamp = NULL;
+        uint64_t fingerprint, old;
+        const char *p;
+        int r;
+
+        assert(path);
+        assert(cache);
+        assert(ret_fingerprint);
+
+        /* Returns -ENOENT if the generator did not declare any inputs last time, otherwise whether its
+         * previous output may be reused, together with the current fingerprint */
+
+        r = generator_fingerprint(path, cache, &fingerprint);
+        if (r < 0)
+                return r;
+
+        *ret_fingerprint = fingerprint;
+
+        p = strjoina(cache, "/stamp");
+
+        r = read_one_line_file(p, &stamp);
+        if (r == -ENOENT)
+                return 0;
+        if (r < 0)
+                return r;
+
+        r = safe_atoux64(stamp, &old);
+        if (r < 0)
+                return r;
+
+        return fingerprint == old;
+}
+
+static int generator_cache_symlink_target(const LookupPaths *p, const char *cache, char **target) {
+        assert(p);
+        assert(cache);
+        assert(target);
+
+        /* Absolute symlinks into any of the private directories have to point into the corresponding real
+         * one once merged, not just those into the directory the symlink itself is in */
+
+        for (size_t i = 0; i < ELEMENTSOF(generator_cache_subdirs); i++) {
+                _cleanup_free_ char *from = NULL;
+                const char *rest;
+                char *j;
+
+                from = path_join(cache, generator_cache_subdirs[i]);
+                if (!from)
+                        return -ENOMEM;
+
+                rest = path_startswith(*target, from);
+                if (!rest)
+                        continue;
+
+                j = path_join(generator_target_dir(p, i), rest);
+                if (!j)
+                        return -ENOMEM;
+
+                return free_and_replace(*target, j);
+        }
+
+        return 0;
+}
+
+static int merge_tree(const LookupPaths *p, const char *path, const char *cache, const char *from, const char *to) {
+        _cleanup_closedir_ DIR *d = NULL;
+        struct dirent *de;
+        int r = 0;
+
+        d = opendir(from);
+        if (!d)
+                return errno == ENOENT ? 0 : -errno;
+
+        FOREACH_DIRENT_ALL(de, d, return -errno) {
+                _cleanup_free_ char *f = NULL, *t = NULL, *target = NULL;
+                struct stat st;
+                int q;
+
+                if (dot_or_dot_dot(de->d_name))
+                        continue;
+
+                f = path_join(from, de->d_name);
+                t = path_join(to, de->d_name);
+                if (!f || !t)
+                        return -ENOMEM;
+
+                if (lstat(f, &st) < 0)
+                        q = -errno;
+                else if (S_ISDIR(st.st_mode)) {
+                        q = mkdir_label(t, st.st_mode & 07777);
+                        if (q >= 0 || q == -EEXIST)
+                                q = merge_tree(p, path, cache, f, t);
+                } else if (S_ISLNK(st.st_mode)) {
+                        q = readlink_malloc(f, &target);
+                        if (q >= 0)
+                                q = generator_cache_symlink_target(p, cache, &target);
+                        if (q == -ENOMEM)
+                                return q;
+                        if (q >= 0)
+                                q = symlink(target, t) < 0 ? -errno : 0;
+                } else if (S_ISREG(st.st_mode))
+                        q = copy_file(f, t, O_EXCL, st.st_mode & 07777, 0, 0, COPY_REFLINK|COPY_MAC_CREATE);
+                else
+                        q = 0;
+
+                if (q == -EEXIST) {
+                        _cleanup_free_ char *existing = NULL;
+
+                        /* The same symlink may well be created by several generators, e.g. in .wants/ */
+                        if (target && readlink_malloc(t, &existing) >= 0 && streq(existing, target))
+                                continue;
+
+                        log_warning("%s was already written by another generator, ignoring output of %s.", t, path);
+                } else if (q < 0 && r >= 0)
+                        r = q;
+        }
+
+        return r;
+}
+
+static void generator_cache_merge(const LookupPaths *p, const char *path, const char *cache) {
+        assert(p);
+        assert(path);
+        assert(cache);
+
+        for (size_t i = 0; i < ELEMENTSOF(generator_cache_subdirs); i++) {
+                _cleanup_free_ char *from = NULL;
+                const char *to;
+                int r;
+
+                to = generator_target_dir(p, i);
+
+                from = path_join(cache, generator_cache_subdirs[i]);
+                if (!from) {
+                        log_oom();
+                        return;
+                }
+
+                r = merge_tree(p, path, cache, from, to);
+                if (r < 0)
+                        log_warning_errno(r, "Failed to merge output of %s into %s, ignoring: %m", path, to);
+        }
+}
+
+static int generator_cache_prepare(const char *path, char ***ret_argv, void *userdata) {
+        const LookupPaths *p = userdata;
+        _cleanup_strv_free_ char **argv = NULL;
+        _cleanup_free_ char *cache = NULL;
+        uint64_t fingerprint;
+        const char *inputs;
+        bool private;
+        int r;
+
+        assert(path);
+        assert(ret_argv);
+        assert(p);
+
+        cache = generator_cache_path(p, path);
+        if (!cache)
+                return -ENOMEM;
+
+        /* The fingerprint is taken before the generator runs, so that inputs changing while it is running
+         * cause it to be run again next time */
+        r = generator_cache_valid(path, cache, &fingerprint);
+        if (r < 0 && r != -ENOENT)
+                log_debug_errno(r, "Failed to check cached output of %s, ignoring: %m", path);
+        if (r > 0) {
+                log_debug("Inputs of %s are unchanged, reusing its previous output.", path);
+                return 1;
+        }
+        private = r >= 0;
+
+        r = rm_rf(cache, REMOVE_ROOT|REMOVE_PHYSICAL|REMOVE_MISSING_OK);
+        if (r < 0)
+                return r;
+
+        r = mkdir_p_label(cache, 0755);
+        if (r < 0)
+                return r;
+
+        /* Children inherit this, the executor runs only one of them at a time. Generators which don't declare
+         * any inputs write into the real directories, with the common argv. */
+        inputs = strjoina(cache, "/inputs");
+        if (setenv(GENERATOR_INPUTS_ENV, inputs, 1) < 0)
+                return -errno;
+
+        if (!private)
+                return 0;
+
+        argv = strv_new(path);
+        if (!argv)
+                return -ENOMEM;
+
+        for (size_t i = 0; i < ELEMENTSOF(generator_cache_subdirs); i++) {
+                _cleanup_free_ char *d = NULL;
+
+                d = path_join(cache, generator_cache_subdirs[i]);
+                if (!d)
+                        return -ENOMEM;
+
+                r = mkdir_p_label(d, 0755);
+                if (r < 0)
+                        return r;
+
+                r = strv_consume(&argv, TAKE_PTR(d));
+                if (r < 0)
+                        return r;
+        }
+
+        /* Becomes the stamp once the generator succeeded. If it declares different inputs this time, the
+         * fingerprint taken next time won't match it anyway. */
+        r = write_string_filef(strjoina(cache, "/stamp.pending"), WRITE_STRING_FILE_CREATE, "%" PRIx64, fingerprint);
+        if (r < 0)
+                return r;
+
+        *ret_argv = TAKE_PTR(argv);
+        return 0;
+}
+
+static void generator_cache_finish(const char *path, int status, void *userdata) {
+        const LookupPaths *p = userdata;
+        _cleanup_free_ char *cache = NULL;
+        const char *pending, *stamp;
+
+        assert(path);
+        assert(p);
+
+        cache = generator_cache_path(p, path);
+        if (!cache) {
+                log_oom();
+                return;
+        }
+
+        /* Only output of generators that succeeded may be reused */
+        pending = strjoina(cache, "/stamp.pending");
+        stamp = strjoina(cache, "/stamp");
+
+        if (status == 0) {
+                if (rename(pending, stamp) < 0 && errno != ENOENT)
+                        log_debug_errno(errno, "Failed to write %s, ignoring: %m", stamp);
+        } else
+                (void) unlink(pending);
+
+        generator_cache_merge(p, path, cache);
+}
+
+void lookup_paths_generator_hooks(LookupPaths *p, ExecDirHooks *ret) {
+        assert(p);
+        assert(ret);
+
+        *ret = (ExecDirHooks) {
+                .prepare = generator_cache_prepare,
+                .finish = generator_cache_finish,
+                .userdata = p,
+        };
+}
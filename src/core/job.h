@@ -123,8 +123,8 @@ struct Job {
         LIST_HEAD(JobDependency, object_list);
 
         /* Used for graph algs as a "I have been here" marker */
-        Job* marker;
         unsigned generation;
+        unsigned graph_index;
 
         uint32_t id;
 
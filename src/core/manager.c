@@ -55,6 +55,7 @@
 #include "macro.h"
 #include "manager.h"
 #include "memory-util.h"
+#include "missing_syscall.h"
 #include "mkdir.h"
 #include "parse-util.h"
 #include "path-lookup.h"
@@ -66,6 +67,7 @@
 #include "selinux-util.h"
 #include "serialize.h"
 #include "signal-util.h"
+#include "siphash24.h"
 #include "socket-util.h"
 #include "special.h"
 #include "stat-util.h"
@@ -79,6 +81,7 @@
 #include "time-util.h"
 #include "transaction.h"
 #include "umask-util.h"
+#include "unit-file.h"
 #include "unit-name.h"
 #include "user-util.h"
 #include "virt.h"
@@ -100,6 +103,10 @@
 /* How many units and jobs to process of the bus queue before returning to the event loop. */
 #define MANAGER_BUS_MESSAGE_BUDGET 100U
 
+/* If clients haven't read everything we sent them yet, flush the bus queue at most this often, so that further
+ * changes to the same units are merged into one signal each, rather than piling up in the write queues. */
+#define MANAGER_BUS_COALESCE_USEC (50*USEC_PER_MSEC)
+
 static int manager_dispatch_notify_fd(sd_event_source *source, int fd, uint32_t revents, void *userdata);
 static int manager_dispatch_cgroups_agent_fd(sd_event_source *source, int fd, uint32_t revents, void *userdata);
 static int manager_dispatch_signal_fd(sd_event_source *source, int fd, uint32_t revents, void *userdata);
@@ -707,6 +714,66 @@ static void manager_free_unit_name_maps(Manager *m) {
         m->unit_cache_timestamp_hash = 0;
 }
 
+#define UNIT_DEFAULTS_HASH_KEY SD_ID128_MAKE(d2,5f,0b,71,8e,3c,4a,96,b1,07,6e,c9,24,f8,5a,13)
+
+static uint64_t manager_unit_defaults_hash(Manager *m) {
+        struct siphash state;
+        char **e;
+
+        assert(m);
+
+        /* Hashes everything units pick up from the manager when they are loaded, i.e. the settings from
+         * system.conf/user.conf that set_manager_defaults() propagates, and the environment. If any of that
+         * changed, reloading only the units whose unit files changed is not enough. */
+
+        siphash24_init(&state, UNIT_DEFAULTS_HASH_KEY.bytes);
+
+        siphash24_compress(&m->default_std_output, sizeof(m->default_std_output), &state);
+        siphash24_compress(&m->default_std_error, sizeof(m->default_std_error), &state);
+        siphash24_compress_usec_t(m->default_restart_usec, &state);
+        siphash24_compress_usec_t(m->default_timeout_start_usec, &state);
+        siphash24_compress_usec_t(m->default_timeout_stop_usec, &state);
+        siphash24_compress_usec_t(manager_default_timeout_abort_usec(m), &state);
+        siphash24_compress_boolean(m->default_timeout_abort_set, &state);
+        siphash24_compress_usec_t(m->default_start_limit_interval, &state);
+        siphash24_compress(&m->default_start_limit_burst, sizeof(m->default_start_limit_burst), &state);
+        siphash24_compress_boolean(m->default_cpu_accounting, &state);
+        siphash24_compress_boolean(m->default_memory_accounting, &state);
+        siphash24_compress_boolean(m->default_io_accounting, &state);
+        siphash24_compress_boolean(m->default_blockio_accounting, &state);
+        siphash24_compress_boolean(m->default_tasks_accounting, &state);
+        siphash24_compress_boolean(m->default_ip_accounting, &state);
+        siphash24_compress(&m->default_tasks_max.value, sizeof(m->default_tasks_max.value), &state);
+        siphash24_compress(&m->default_tasks_max.scale, sizeof(m->default_tasks_max.scale), &state);
+        siphash24_compress_usec_t(m->default_timer_accuracy_usec, &state);
+        siphash24_compress(&m->default_oom_policy, sizeof(m->default_oom_policy), &state);
+
+        for (int i = 0; i < _RLIMIT_MAX; i++) {
+                siphash24_compress_boolean(m->rlimit[i], &state);
+                if (m->rlimit[i])
+                        siphash24_compress(m->rlimit[i], sizeof(struct rlimit), &state);
+        }
+
+        /* Includes the terminating NUL, so that no two lists hash the same when concatenated */
+        STRV_FOREACH(e, m->transient_environment)
+                siphash24_compress(*e, strlen(*e) + 1, &state);
+
+        return siphash24_finalize(&state);
+}
+
+static void manager_take_unit_file_snapshot(Manager *m) {
+        int r;
+
+        assert(m);
+
+        m->unit_file_snapshot = hashmap_free(m->unit_file_snapshot);
+        m->unit_defaults_hash = manager_unit_defaults_hash(m);
+
+        r = unit_file_snapshot_take(&m->lookup_paths, &m->unit_file_snapshot);
+        if (r < 0)
+                log_debug_errno(r, "Failed to take snapshot of unit files, next reload will reload all units: %m");
+}
+
 static int manager_setup_run_queue(Manager *m) {
         int r;
 
@@ -753,6 +820,32 @@ static int manager_setup_sigchld_event_source(Manager *m) {
         return 0;
 }
 
+static void manager_open_executor(Manager *m) {
+        const char *e;
+
+        assert(m);
+
+        /* Opens the systemd-executor binary, which exec_spawn() uses to spawn processes without fork()ing
+         * the manager. If that fails for some reason, we just fall back to fork()ing, hence never fail. */
+
+        if (getenv_bool("SYSTEMD_EXECUTOR") == 0)
+                return;
+
+        e = getenv("SYSTEMD_EXECUTOR_PATH");
+        if (!e) {
+                /* In test runs, use the executor only if explicitly asked for, as the installed one might
+                 * not match the version of the tree under test */
+                if (MANAGER_IS_TEST_RUN(m))
+                        return;
+
+                e = SYSTEMD_EXECUTOR_PATH;
+        }
+
+        m->executor_fd = open(e, O_PATH|O_CLOEXEC);
+        if (m->executor_fd < 0)
+                log_debug_errno(errno, "Failed to open %s, spawning processes via fork(): %m", e);
+}
+
 int manager_new(UnitFileScope scope, ManagerTestRunFlags test_run_flags, Manager **_m) {
         _cleanup_(manager_freep) Manager *m = NULL;
         const char *e;
@@ -793,6 +886,7 @@ int manager_new(UnitFileScope scope, ManagerTestRunFlags test_run_flags, Manager
                 .signal_fd = -1,
                 .time_change_fd = -1,
                 .user_lookup_fds = { -1, -1 },
+                .executor_fd = -1,
                 .private_listen_fd = -1,
                 .dev_autofs_fd = -1,
                 .cgroup_inotify_fd = -1,
@@ -859,6 +953,8 @@ int manager_new(UnitFileScope scope, ManagerTestRunFlags test_run_flags, Manager
         if (r < 0)
                 return r;
 
+        manager_open_executor(m);
+
         e = secure_getenv("CREDENTIALS_DIRECTORY");
         if (e) {
                 m->received_credentials = strdup(e);
@@ -1146,12 +1242,11 @@ enum {
 
 static void unit_gc_mark_good(Unit *u, unsigned gc_marker) {
         Unit *other;
-        void *v;
 
         u->gc_marker = gc_marker + GC_OFFSET_GOOD;
 
         /* Recursively mark referenced units as GOOD as well */
-        HASHMAP_FOREACH_KEY(v, other, u->dependencies[UNIT_REFERENCES])
+        UNIT_FOREACH_DEPENDENCY(other, u, UNIT_REFERENCES)
                 if (other->gc_marker == gc_marker + GC_OFFSET_UNSURE)
                         unit_gc_mark_good(other, gc_marker);
 }
@@ -1159,7 +1254,6 @@ static void unit_gc_mark_good(Unit *u, unsigned gc_marker) {
 static void unit_gc_sweep(Unit *u, unsigned gc_marker) {
         Unit *other;
         bool is_bad;
-        void *v;
 
         assert(u);
 
@@ -1177,7 +1271,7 @@ static void unit_gc_sweep(Unit *u, unsigned gc_marker) {
 
         is_bad = true;
 
-        HASHMAP_FOREACH_KEY(v, other, u->dependencies[UNIT_REFERENCED_BY]) {
+        UNIT_FOREACH_DEPENDENCY(other, u, UNIT_REFERENCED_BY) {
                 unit_gc_sweep(other, gc_marker);
 
                 if (other->gc_marker == gc_marker + GC_OFFSET_GOOD)
@@ -1376,6 +1470,7 @@ Manager* manager_free(Manager *m) {
         hashmap_free(m->units_by_invocation_id);
         hashmap_free(m->jobs);
         hashmap_free(m->watch_pids);
+        hashmap_free(m->watch_pidfds);
         hashmap_free(m->watch_bus);
 
         prioq_free(m->run_queue);
@@ -1391,13 +1486,16 @@ Manager* manager_free(Manager *m) {
         sd_event_source_unref(m->timezone_change_event_source);
         sd_event_source_unref(m->jobs_in_progress_event_source);
         sd_event_source_unref(m->run_queue_event_source);
+        sd_event_source_unref(m->dbus_queue_event_source);
         sd_event_source_unref(m->user_lookup_event_source);
 
         safe_close(m->signal_fd);
         safe_close(m->notify_fd);
+        free(m->notify_batch);
         safe_close(m->cgroups_agent_fd);
         safe_close(m->time_change_fd);
         safe_close_pair(m->user_lookup_fds);
+        safe_close(m->executor_fd);
 
         manager_close_ask_password(m);
 
@@ -1413,6 +1511,7 @@ Manager* manager_free(Manager *m) {
 
         hashmap_free(m->cgroup_unit);
         manager_free_unit_name_maps(m);
+        hashmap_free(m->unit_file_snapshot);
 
         free(m->switch_root);
         free(m->switch_root_init);
@@ -1650,6 +1749,8 @@ int manager_startup(Manager *m, FILE *serialization, FDSet *fds) {
 
         lookup_paths_log(&m->lookup_paths);
 
+        manager_take_unit_file_snapshot(m);
+
         {
                 /* This block is (optionally) done with the reloading counter bumped */
                 _cleanup_(manager_reloading_stopp) Manager *reloading = NULL;
@@ -1896,9 +1997,8 @@ static int manager_dispatch_target_deps_queue(Manager *m) {
 
                 for (size_t k = 0; k < ELEMENTSOF(deps); k++) {
                         Unit *target;
-                        void *v;
 
-                        HASHMAP_FOREACH_KEY(v, target, u->dependencies[deps[k]]) {
+                        UNIT_FOREACH_DEPENDENCY(target, u, deps[k]) {
                                 r = unit_add_default_target_dependency(u, target);
                                 if (r < 0)
                                         return r;
@@ -2127,6 +2227,9 @@ void manager_dump(Manager *m, FILE *f, const char *prefix) {
                                                                 format_timespan(buf, sizeof buf, t->monotonic, 1));
         }
 
+        fprintf(f, "%sCGroup attribute writes: %" PRIu64 " (%" PRIu64 " skipped as unchanged)\n",
+                strempty(prefix), m->n_cgroup_attribute_writes, m->n_cgroup_attribute_writes_skipped);
+
         manager_dump_units(m, f, prefix);
         manager_dump_jobs(m, f, prefix);
 }
@@ -2175,6 +2278,129 @@ void manager_unwatch_pid(Manager *m, pid_t pid) {
 
         /* Then, let's also drop the array keyed by -pid. */
         free(hashmap_remove(m->watch_pids, PID_TO_PTR(-pid)));
+
+        /* And any pidfd we hold for it */
+        manager_unwatch_pidfd(m, NULL, pid);
+}
+
+typedef struct PidfdWatch {
+        Manager *manager;
+        Unit *unit;
+        pid_t pid;
+        int fd;
+        sd_event_source *event_source;
+} PidfdWatch;
+
+static PidfdWatch* pidfd_watch_free(PidfdWatch *w) {
+        if (!w)
+                return NULL;
+
+        sd_event_source_disable_unref(w->event_source);
+        safe_close(w->fd);
+        return mfree(w);
+}
+
+DEFINE_TRIVIAL_CLEANUP_FUNC(PidfdWatch*, pidfd_watch_free);
+
+DEFINE_PRIVATE_HASH_OPS_WITH_VALUE_DESTRUCTOR(pidfd_watch_hash_ops, void, trivial_hash_func, trivial_compare_func,
+                                              PidfdWatch, pidfd_watch_free);
+
+static int manager_dispatch_pidfd(sd_event_source *source, int fd, uint32_t revents, void *userdata);
+
+int manager_watch_pidfd(Manager *m, Unit *u, pid_t pid) {
+        _cleanup_(pidfd_watch_freep) PidfdWatch *w = NULL;
+        int r;
+
+        assert(m);
+        assert(u);
+        assert(pid_is_valid(pid));
+
+        /* Opens a pidfd for a child process we forked off ourselves, and watches it in the event loop. This
+         * way its exit is dispatched straight to the unit that owns it, and signals sent via the pidfd
+         * can't hit a different process that reused the PID. We haven't reaped the child yet, hence the
+         * PID still refers to it when we open the pidfd. Returns 0 if pidfds are not available, in which
+         * case we rely on the generic SIGCHLD logic. */
+
+        manager_unwatch_pidfd(m, NULL, pid);
+
+        w = new(PidfdWatch, 1);
+        if (!w)
+                return -ENOMEM;
+
+        *w = (PidfdWatch) {
+                .manager = m,
+                .unit = u,
+                .pid = pid,
+                .fd = pidfd_open(pid, 0),
+        };
+        if (w->fd < 0) {
+                if (ERRNO_IS_NOT_SUPPORTED(errno) || ERRNO_IS_PRIVILEGE(errno))
+                        return 0;
+
+                return -errno;
+        }
+
+        r = sd_event_add_io(m->event, &w->event_source, w->fd, EPOLLIN, manager_dispatch_pidfd, w);
+        if (r < 0)
+                return r;
+
+        /* Same priority as the SIGCHLD logic, i.e. after notification messages */
+        r = sd_event_source_set_priority(w->event_source, SD_EVENT_PRIORITY_NORMAL-7);
+        if (r < 0)
+                return r;
+
+        (void) sd_event_source_set_description(w->event_source, "manager-pidfd");
+
+        r = hashmap_ensure_allocated(&m->watch_pidfds, &pidfd_watch_hash_ops);
+        if (r < 0)
+                return r;
+
+        r = hashmap_put(m->watch_pidfds, PID_TO_PTR(pid), w);
+        if (r < 0)
+                return r;
+
+        TAKE_PTR(w);
+        return 1;
+}
+
+void manager_unwatch_pidfd(Manager *m, Unit *u, pid_t pid) {
+        PidfdWatch *w;
+
+        assert(m);
+
+        /* Drops the pidfd for the specified PID, but only if it is owned by the specified unit, if any */
+
+        w = hashmap_get(m->watch_pidfds, PID_TO_PTR(pid));
+        if (!w || (u && w->unit != u))
+                return;
+
+        assert_se(hashmap_remove(m->watch_pidfds, PID_TO_PTR(pid)) == w);
+        pidfd_watch_free(w);
+}
+
+int manager_kill_pid_and_sigcont(Manager *m, Unit *u, pid_t pid, int sig) {
+        PidfdWatch *w;
+
+        assert(m);
+        assert(pid_is_valid(pid));
+
+        /* Like kill_and_sigcont(), but goes via the pidfd if we have one for the process */
+
+        w = hashmap_get(m->watch_pidfds, PID_TO_PTR(pid));
+        if (!w || (u && w->unit != u))
+                return kill_and_sigcont(pid, sig);
+
+        if (pidfd_send_signal(w->fd, sig, NULL, 0) < 0) {
+                if (ERRNO_IS_NOT_SUPPORTED(errno))
+                        return kill_and_sigcont(pid, sig);
+
+                return -errno;
+        }
+
+        if (!IN_SET(sig, SIGCONT, SIGKILL))
+                (void) pidfd_send_signal(w->fd, SIGCONT, NULL, 0);
+
+        return 0;
 }
 
 static int manager_dispatch_run_queue(sd_event_source *source, void *userdata) {
@@ -2200,8 +2426,49 @@ static int manager_dispatch_run_queue(sd_event_source *source, void *userdata) {
         return 1;
 }
 
+static int manager_dispatch_dbus_queue_timer(sd_event_source *source, usec_t usec, void *userdata) {
+        /* Nothing to do here, this only wakes up the event loop, which then flushes the bus queue */
+        return 0;
+}
+
+static void manager_schedule_dbus_queue(Manager *m, usec_t usec) {
+        int r;
+
+        assert(m);
+
+        if (m->dbus_queue_event_source) {
+                r = sd_event_source_set_time(m->dbus_queue_event_source, usec);
+                if (r < 0)
+                        goto fail;
+
+                r = sd_event_source_set_enabled(m->dbus_queue_event_source, SD_EVENT_ONESHOT);
+                if (r < 0)
+                        goto fail;
+
+                return;
+        }
+
+        r = sd_event_add_time(
+                        m->event,
+                        &m->dbus_queue_event_source,
+                        CLOCK_MONOTONIC,
+                        usec, 0,
+                        manager_dispatch_dbus_queue_timer, m);
+        if (r < 0)
+                goto fail;
+
+        (void) sd_event_source_set_description(m->dbus_queue_event_source, "manager-dbus-queue");
+        return;
+
+fail:
+        /* Without the timer we might not get woken up in time, hence flush right-away next time */
+        log_debug_errno(r, "Failed to schedule bus queue flush, ignoring: %m");
+        m->dbus_queue_dispatch_timestamp = 0;
+}
+
 static unsigned manager_dispatch_dbus_queue(Manager *m) {
         unsigned n = 0, budget;
+        uint64_t q;
         Unit *u;
         Job *j;
 
@@ -2218,9 +2485,27 @@ static unsigned manager_dispatch_dbus_queue(Manager *m) {
 
                 /* Do we have overly many messages queued at the moment? If so, let's not enqueue more on top, let's
                  * sit this cycle out, and process things in a later cycle when the queues got a bit emptier. */
-                if (manager_bus_n_queued_write(m) > MANAGER_BUS_BUSY_THRESHOLD)
+                q = manager_bus_n_queued_write(m);
+                if (q > MANAGER_BUS_BUSY_THRESHOLD)
                         return 0;
 
+                /* If some clients are still busy reading what we sent them last time, don't flush the queue on
+                 * every iteration, but give further changes some time to accumulate. A unit that changes state
+                 * multiple times within the window is announced only once, with its latest properties. */
+                if (q > 0) {
+                        usec_t t, next;
+
+                        t = now(CLOCK_MONOTONIC);
+                        next = usec_add(m->dbus_queue_dispatch_timestamp, MANAGER_BUS_COALESCE_USEC);
+                        if (t < next) {
+                                manager_schedule_dbus_queue(m, next);
+                                return 0;
+                        }
+
+                        m->dbus_queue_dispatch_timestamp = t;
+                } else
+                        m->dbus_queue_dispatch_timestamp = 0;
+
                 /* Only process a certain number of units/jobs per event loop iteration. Even if the bus queue wasn't
                  * overly full before this call we shouldn't increase it in size too wildly in one step, and we
                  * shouldn't monopolize CPU time with generating these messages. Note the difference in counting of
@@ -2231,8 +2516,9 @@ static unsigned manager_dispatch_dbus_queue(Manager *m) {
                  * vs. "instances") is primarily a result of the fact that it's easier to implement it this way,
                  * however it also reflects the thinking that the "threshold" should put a limit on used queue memory,
                  * i.e. space, while the "budget" should put a limit on time. Also note that the "threshold" is
-                 * currently chosen much higher than the "budget". */
-                budget = MANAGER_BUS_MESSAGE_BUDGET;
+                 * currently chosen much higher than the "budget". The fuller the queues already are, the fewer
+                 * messages we add in one step, so that slow clients get a chance to catch up. */
+                budget = MAX(MANAGER_BUS_MESSAGE_BUDGET * (MANAGER_BUS_BUSY_THRESHOLD - q) / MANAGER_BUS_BUSY_THRESHOLD, 1U);
         }
 
         while (budget != 0 && (u = m->dbus_unit_queue)) {
@@ -2348,53 +2634,145 @@ static void manager_invoke_notify_message(
         }
 }
 
-static int manager_dispatch_notify_fd(sd_event_source *source, int fd, uint32_t revents, void *userdata) {
+/* How many notification messages to pick up with a single recvmmsg() call */
+#define NOTIFY_BATCH_MAX 16U
 
-        _cleanup_fdset_free_ FDSet *fds = NULL;
-        Manager *m = userdata;
-        char buf[NOTIFY_BUFFER_MAX+1];
-        struct iovec iovec = {
-                .iov_base = buf,
-                .iov_len = sizeof(buf)-1,
-        };
+struct NotifyBatch {
+        struct mmsghdr msgs[NOTIFY_BATCH_MAX];
+        struct iovec iovecs[NOTIFY_BATCH_MAX];
+        char bufs[NOTIFY_BATCH_MAX][NOTIFY_BUFFER_MAX+1];
         CMSG_BUFFER_TYPE(CMSG_SPACE(sizeof(struct ucred)) +
-                         CMSG_SPACE(sizeof(int) * NOTIFY_FD_MAX)) control;
-        struct msghdr msghdr = {
-                .msg_iov = &iovec,
-                .msg_iovlen = 1,
-                .msg_control = &control,
-                .msg_controllen = sizeof(control),
-        };
+                         CMSG_SPACE(sizeof(int) * NOTIFY_FD_MAX)) controls[NOTIFY_BATCH_MAX];
+};
 
+static bool notify_message_has_fds(struct msghdr *msghdr) {
+        struct cmsghdr *cmsg;
+
+        CMSG_FOREACH(cmsg, msghdr)
+                if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS)
+                        return true;
+
+        return false;
+}
+
+static const char* notify_message_single_assignment(const char *buf, size_t n) {
+
+        /* If the message consists of nothing but WATCHDOG=1 or a STATUS= assignment, returns the field,
+         * otherwise NULL. Only the most recent of those messages counts for a unit, hence we may skip
+         * earlier ones, and for WATCHDOG=1 we may skip parsing. A trailing newline or NUL is accepted. */
+
+        if (n > 0 && IN_SET(buf[n-1], '\n', 0))
+                n--;
+
+        if (memchr(buf, '\n', n) || memchr(buf, 0, n))
+                return NULL;
+
+        if (n == STRLEN("WATCHDOG=1") && memcmp(buf, "WATCHDOG=1", n) == 0)
+                return "WATCHDOG=1";
+        if (n >= STRLEN("STATUS=") && memcmp(buf, "STATUS=", STRLEN("STATUS=")) == 0)
+                return "STATUS=";
+
+        return NULL;
+}
+
+static const char* notify_batch_single_assignment(NotifyBatch *b, size_t i) {
+        struct msghdr *msghdr = &b->msgs[i].msg_hdr;
+
+        if (msghdr->msg_flags & (MSG_TRUNC|MSG_CTRUNC))
+                return NULL;
+
+        if (notify_message_has_fds(msghdr))
+                return NULL;
+
+        return notify_message_single_assignment(b->bufs[i], b->msgs[i].msg_len);
+}
+
+NotifyBatch* notify_batch_new(void) {
+        return new(NotifyBatch, 1);
+}
+
+int notify_batch_receive(NotifyBatch *b, int fd) {
+        int n;
+
+        assert(b);
+        assert(fd >= 0);
+
+        for (size_t i = 0; i < NOTIFY_BATCH_MAX; i++) {
+                b->iovecs[i] = IOVEC_MAKE(b->bufs[i], sizeof(b->bufs[i]) - 1);
+                b->msgs[i] = (struct mmsghdr) {
+                        .msg_hdr = {
+                                .msg_iov = &b->iovecs[i],
+                                .msg_iovlen = 1,
+                                .msg_control = &b->controls[i],
+                                .msg_controllen = sizeof(b->controls[i]),
+                        },
+                };
+        }
+
+        n = recvmmsg(fd, b->msgs, NOTIFY_BATCH_MAX, MSG_DONTWAIT|MSG_CMSG_CLOEXEC|MSG_TRUNC, NULL);
+        if (n < 0)
+                return -errno;
+
+        return n;
+}
+
+bool notify_batch_superseded(NotifyBatch *b, size_t n, size_t i) {
+        const char *field;
+        struct ucred *ucred;
+
+        assert(b);
+        assert(i < n);
+
+        /* Checks whether a later message of the same batch from the same process supersedes message i,
+         * because both only carry WATCHDOG=1 or STATUS=. Anything else from the same process in between
+         * is processed in order, hence stops the search. */
+
+        field = notify_batch_single_assignment(b, i);
+        if (!field)
+                return false;
+
+        ucred = CMSG_FIND_DATA(&b->msgs[i].msg_hdr, SOL_SOCKET, SCM_CREDENTIALS, struct ucred);
+        if (!ucred)
+                return false;
+
+        for (size_t j = i + 1; j < n; j++) {
+                struct ucred *c;
+
+                c = CMSG_FIND_DATA(&b->msgs[j].msg_hdr, SOL_SOCKET, SCM_CREDENTIALS, struct ucred);
+                if (!c || c->pid != ucred->pid)
+                        continue;
+
+                return streq_ptr(notify_batch_single_assignment(b, j), field);
+        }
+
+        return false;
+}
+
+static void manager_process_notify_message(Manager *m, struct msghdr *msghdr, size_t n) {
+
+        _cleanup_fdset_free_ FDSet *fds = NULL;
+        char *buf = msghdr->msg_iov[0].iov_base;
+        size_t size = msghdr->msg_iov[0].iov_len + 1;
         struct cmsghdr *cmsg;
         struct ucred *ucred = NULL;
         _cleanup_free_ Unit **array_copy = NULL;
-        _cleanup_strv_free_ char **tags = NULL;
+        _cleanup_strv_free_ char **allocated = NULL;
+        char **watchdog = STRV_MAKE("WATCHDOG=1"), **tags;
         Unit *u1, *u2, **array;
         int r, *fd_array = NULL;
         size_t n_fds = 0;
         bool found = false;
-        ssize_t n;
 
         assert(m);
-        assert(m->notify_fd == fd);
+        assert(msghdr);
 
-        if (revents != EPOLLIN) {
-                log_warning("Got unexpected poll event for notify fd.");
-                return 0;
+        if (msghdr->msg_flags & MSG_CTRUNC) {
+                cmsg_close_all(msghdr);
+                log_warning("Received notify message with truncated control data. Ignoring.");
+                return;
         }
 
-        n = recvmsg_safe(m->notify_fd, &msghdr, MSG_DONTWAIT|MSG_CMSG_CLOEXEC|MSG_TRUNC);
-        if (IN_SET(n, -EAGAIN, -EINTR))
-                return 0; /* Spurious wakeup, try again */
-        if (n < 0)
-                /* If this is any other, real error, then let's stop processing this socket. This of course
-                 * means we won't take notification messages anymore, but that's still better than busy
-                 * looping around this: being woken up over and over again but being unable to actually read
-                 * the message off the socket. */
-                return log_error_errno(n, "Failed to receive notification message: %m");
-
-        CMSG_FOREACH(cmsg, &msghdr) {
+        CMSG_FOREACH(cmsg, msghdr) {
                 if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
 
                         assert(!fd_array);
@@ -2417,38 +2795,43 @@ static int manager_dispatch_notify_fd(sd_event_source *source, int fd, uint32_t
                 if (r < 0) {
                         close_many(fd_array, n_fds);
                         log_oom();
-                        return 0;
+                        return;
                 }
         }
 
         if (!ucred || !pid_is_valid(ucred->pid)) {
                 log_warning("Received notify message without valid credentials. Ignoring.");
-                return 0;
+                return;
         }
 
-        if ((size_t) n >= sizeof(buf) || (msghdr.msg_flags & MSG_TRUNC)) {
+        if (n >= size || (msghdr->msg_flags & MSG_TRUNC)) {
                 log_warning("Received notify message exceeded maximum size. Ignoring.");
-                return 0;
+                return;
         }
 
         /* As extra safety check, let's make sure the string we get doesn't contain embedded NUL bytes. We permit one
          * trailing NUL byte in the message, but don't expect it. */
         if (n > 1 && memchr(buf, 0, n-1)) {
                 log_warning("Received notify message with embedded NUL bytes. Ignoring.");
-                return 0;
+                return;
         }
 
-        /* Make sure it's NUL-terminated, then parse it to obtain the tags list */
-        buf[n] = 0;
-        tags = strv_split_newlines(buf);
-        if (!tags) {
-                log_oom();
-                return 0;
-        }
+        /* Watchdog keep-alive pings are by far the most frequent messages, skip the parsing for them */
+        if (n_fds == 0 && streq_ptr(notify_message_single_assignment(buf, n), "WATCHDOG=1"))
+                tags = watchdog;
+        else {
+                /* Make sure it's NUL-terminated, then parse it to obtain the tags list */
+                buf[n] = 0;
+                tags = allocated = strv_split_newlines(buf);
+                if (!tags) {
+                        log_oom();
+                        return;
+                }
 
-        /* possibly a barrier fd, let's see */
-        if (manager_process_barrier_fd(tags, fds))
-                return 0;
+                /* possibly a barrier fd, let's see */
+                if (manager_process_barrier_fd(tags, fds))
+                        return;
+        }
 
         /* Increase the generation counter used for filtering out duplicate unit invocations. */
         m->notifygen++;
@@ -2488,6 +2871,51 @@ static int manager_dispatch_notify_fd(sd_event_source *source, int fd, uint32_t
 
         if (fdset_size(fds) > 0)
                 log_warning("Got extra auxiliary fds with notification message, closing them.");
+}
+
+static int manager_dispatch_notify_fd(sd_event_source *source, int fd, uint32_t revents, void *userdata) {
+        Manager *m = userdata;
+        NotifyBatch *b;
+        int n;
+
+        assert(m);
+        assert(m->notify_fd == fd);
+
+        if (revents != EPOLLIN) {
+                log_warning("Got unexpected poll event for notify fd.");
+                return 0;
+        }
+
+        if (!m->notify_batch) {
+                m->notify_batch = notify_batch_new();
+                if (!m->notify_batch) {
+                        log_oom();
+                        return 0;
+                }
+        }
+
+        b = m->notify_batch;
+
+        /* With many services sending watchdog pings and status updates, pick up a number of messages at
+         * once rather than going through the event loop for each. Whatever is left wakes us up again. */
+        n = notify_batch_receive(b, m->notify_fd);
+        if (n < 0) {
+                if (IN_SET(n, -EAGAIN, -EINTR))
+                        return 0; /* Spurious wakeup, try again */
+
+                /* If this is any other, real error, then let's stop processing this socket. This of course
+                 * means we won't take notification messages anymore, but that's still better than busy
+                 * looping around this: being woken up over and over again but being unable to actually read
+                 * the message off the socket. */
+                return log_error_errno(n, "Failed to receive notification message: %m");
+        }
+
+        for (size_t i = 0; i < (size_t) n; i++) {
+                if (notify_batch_superseded(b, n, i))
+                        continue;
+
+                manager_process_notify_message(m, &b->msgs[i].msg_hdr, b->msgs[i].msg_len);
+        }
 
         return 0;
 }
@@ -2513,6 +2941,70 @@ static void manager_invoke_sigchld_event(
                 UNIT_VTABLE(u)->sigchld_event(u, si->si_pid, si->si_code, si->si_status);
 }
 
+static void manager_dispatch_child_exit(Manager *m, const siginfo_t *si, Unit *owner) {
+        _cleanup_free_ Unit **array_copy = NULL;
+        _cleanup_free_ char *name = NULL;
+        Unit *u1, *u2, **array;
+
+        assert(m);
+        assert(si);
+
+        if (!IN_SET(si->si_code, CLD_EXITED, CLD_KILLED, CLD_DUMPED))
+                return;
+
+        (void) get_process_comm(si->si_pid, &name);
+
+        log_debug("Child "PID_FMT" (%s) died (code=%s, status=%i/%s)",
+                  si->si_pid, strna(name),
+                  sigchld_code_to_string(si->si_code),
+                  si->si_status,
+                  strna(si->si_code == CLD_EXITED
+                        ? exit_status_to_string(si->si_status, EXIT_STATUS_FULL)
+                        : signal_to_string(si->si_status)));
+
+        /* Increase the generation counter used for filtering out duplicate unit invocations */
+        m->sigchldgen++;
+
+        /* And now figure out the unit this belongs to, it might be multiple... If we know the owner
+         * already there's no need to look at the cgroup of the process. */
+        u1 = owner ?: manager_get_unit_by_pid_cgroup(m, si->si_pid);
+        u2 = hashmap_get(m->watch_pids, PID_TO_PTR(si->si_pid));
+        array = hashmap_get(m->watch_pids, PID_TO_PTR(-si->si_pid));
+        if (array) {
+                size_t n = 0;
+
+                /* Count how many entries the array has */
+                while (array[n])
+                        n++;
+
+                /* Make a copy of the array so that we don't trip up on the array changing beneath us */
+                array_copy = newdup(Unit*, array, n+1);
+                if (!array_copy)
+                        log_oom();
+        }
+
+        /* Finally, execute them all. Note that u1, u2 and the array might contain duplicates, but
+         * that's fine, manager_invoke_sigchld_event() will ensure we only invoke the handlers once for
+         * each iteration. */
+        if (u1) {
+                /* We check for oom condition, in case we got SIGCHLD before the oom notification.
+                 * We only do this for the cgroup the PID belonged to. */
+                (void) unit_check_oom(u1);
+
+                /* This only logs for now. In the future when the interface for kills/notifications
+                 * is more stable we can extend service results table similar to how kernel oom kills
+                 * are managed. */
+                (void) unit_check_oomd_kill(u1);
+
+                manager_invoke_sigchld_event(m, u1, si);
+        }
+        if (u2)
+                manager_invoke_sigchld_event(m, u2, si);
+        if (array_copy)
+                for (size_t i = 0; array_copy[i]; i++)
+                        manager_invoke_sigchld_event(m, array_copy[i], si);
+}
+
 static int manager_dispatch_sigchld(sd_event_source *source, void *userdata) {
         Manager *m = userdata;
         siginfo_t si = {};
@@ -2535,62 +3027,7 @@ static int manager_dispatch_sigchld(sd_event_source *source, void *userdata) {
         if (si.si_pid <= 0)
                 goto turn_off;
 
-        if (IN_SET(si.si_code, CLD_EXITED, CLD_KILLED, CLD_DUMPED)) {
-                _cleanup_free_ Unit **array_copy = NULL;
-                _cleanup_free_ char *name = NULL;
-                Unit *u1, *u2, **array;
-
-                (void) get_process_comm(si.si_pid, &name);
-
-                log_debug("Child "PID_FMT" (%s) died (code=%s, status=%i/%s)",
-                          si.si_pid, strna(name),
-                          sigchld_code_to_string(si.si_code),
-                          si.si_status,
-                          strna(si.si_code == CLD_EXITED
-                                ? exit_status_to_string(si.si_status, EXIT_STATUS_FULL)
-                                : signal_to_string(si.si_status)));
-
-                /* Increase the generation counter used for filtering out duplicate unit invocations */
-                m->sigchldgen++;
-
-                /* And now figure out the unit this belongs to, it might be multiple... */
-                u1 = manager_get_unit_by_pid_cgroup(m, si.si_pid);
-                u2 = hashmap_get(m->watch_pids, PID_TO_PTR(si.si_pid));
-                array = hashmap_get(m->watch_pids, PID_TO_PTR(-si.si_pid));
-                if (array) {
-                        size_t n = 0;
-
-                        /* Count how many entries the array has */
-                        while (array[n])
-                                n++;
-
-                        /* Make a copy of the array so that we don't trip up on the array changing beneath us */
-                        array_copy = newdup(Unit*, array, n+1);
-                        if (!array_copy)
-                                log_oom();
-                }
-
-                /* Finally, execute them all. Note that u1, u2 and the array might contain duplicates, but
-                 * that's fine, manager_invoke_sigchld_event() will ensure we only invoke the handlers once for
-                 * each iteration. */
-                if (u1) {
-                        /* We check for oom condition, in case we got SIGCHLD before the oom notification.
-                         * We only do this for the cgroup the PID belonged to. */
-                        (void) unit_check_oom(u1);
-
-                        /* This only logs for now. In the future when the interface for kills/notifications
-                         * is more stable we can extend service results table similar to how kernel oom kills
-                         * are managed. */
-                        (void) unit_check_oomd_kill(u1);
-
-                        manager_invoke_sigchld_event(m, u1, &si);
-                }
-                if (u2)
-                        manager_invoke_sigchld_event(m, u2, &si);
-                if (array_copy)
-                        for (size_t i = 0; array_copy[i]; i++)
-                                manager_invoke_sigchld_event(m, array_copy[i], &si);
-        }
+        manager_dispatch_child_exit(m, &si, NULL);
 
         /* And now, we actually reap the zombie. */
         if (waitid(P_PID, si.si_pid, &si, WEXITED) < 0) {
@@ -2598,6 +3035,9 @@ static int manager_dispatch_sigchld(sd_event_source *source, void *userdata) {
                 return 0;
         }
 
+        /* The PID is free for reuse now, hence a pidfd we might still hold for it is stale */
+        manager_unwatch_pidfd(m, NULL, si.si_pid);
+
         return 0;
 
 turn_off:
@@ -2610,6 +3050,47 @@ turn_off:
         return 0;
 }
 
+static int manager_dispatch_pidfd(sd_event_source *source, int fd, uint32_t revents, void *userdata) {
+        PidfdWatch *w = userdata;
+        _cleanup_close_ int pidfd = -1;
+        siginfo_t si = {};
+        Manager *m;
+        Unit *owner;
+        pid_t pid;
+
+        assert(w);
+        assert(w->fd == fd);
+
+        m = w->manager;
+        owner = w->unit;
+        pid = w->pid;
+
+        /* The unit will drop the watch when it is told about the exit, hence detach the watch from it first,
+         * so that it doesn't go away beneath us. */
+        pidfd = TAKE_FD(w->fd);
+        manager_unwatch_pidfd(m, NULL, pid);
+
+        /* We only watch children we forked off ourselves, and only their parent (i.e. us) can reap them,
+         * hence the PID is not freed for reuse until we reap it. The pidfd doesn't change that, it merely
+         * tells us about the exit. Both this and the SIGCHLD logic reap from this thread, and the latter
+         * drops our watch when it reaps a PID, hence if we get here the PID still refers to our child. If
+         * the SIGCHLD logic already took care of the process anyway, there's nothing to do. */
+        if (waitid(P_PID, pid, &si, WEXITED|WNOHANG|WNOWAIT) < 0) {
+                if (errno != ECHILD)
+                        log_debug_errno(errno, "Failed to peek for child "PID_FMT" with waitid(), ignoring: %m", pid);
+                return 0;
+        }
+        if (si.si_pid <= 0)
+                return 0;
+
+        manager_dispatch_child_exit(m, &si, owner);
+
+        if (waitid(P_PID, pid, &si, WEXITED) < 0)
+                log_error_errno(errno, "Failed to dequeue child "PID_FMT", ignoring: %m", pid);
+
+        return 0;
+}
+
 static void manager_start_target(Manager *m, const char *name, JobMode mode) {
         _cleanup_(sd_bus_error_free) sd_bus_error error = SD_BUS_ERROR_NULL;
         int r;
@@ -3760,14 +4241,277 @@ int manager_deserialize(Manager *m, FILE *f, FDSet *fds) {
         return manager_deserialize_units(m, f, fds);
 }
 
+static void manager_reload_lookup_paths(Manager *m) {
+        int r;
+
+        assert(m);
+
+        lookup_paths_flush_generator(&m->lookup_paths);
+        lookup_paths_free(&m->lookup_paths);
+
+        r = lookup_paths_init(&m->lookup_paths, m->unit_file_scope, 0, NULL);
+        if (r < 0)
+                log_warning_errno(r, "Failed to initialize path lookup table, ignoring: %m");
+
+        (void) manager_run_environment_generators(m);
+        (void) manager_run_generators(m);
+
+        lookup_paths_log(&m->lookup_paths);
+
+        /* We flushed out generated files, for which we don't watch mtime, so we should flush the old map. */
+        manager_free_unit_name_maps(m);
+}
+
+static bool unit_can_reload_alone(Unit *u) {
+        assert(u);
+
+        /* Only units that have no job, and whose runtime state is fully covered by their own serialization may
+         * be freed and loaded again while everything else stays in place. Running units are fine: the runtime
+         * state shared with the manager, i.e. their ExecRuntime and the references other units hold on them,
+         * is carried over by manager_reload_unit(). */
+
+        if (!IN_SET(u->type, UNIT_SERVICE, UNIT_SOCKET, UNIT_TARGET, UNIT_TIMER, UNIT_PATH))
+                return false;
+
+        if (u->perpetual || u->transient)
+                return false;
+
+        if (u->job || u->nop_job)
+                return false;
+
+        return true;
+}
+
+static int manager_find_changed_units(
+                Manager *m,
+                char **old_search_path,
+                Hashmap *old_snapshot,
+                uint64_t old_defaults_hash,
+                Set **ret) {
+
+        _cleanup_set_free_ Set *changed = NULL, *units = NULL;
+        bool dropins_changed;
+        Unit *u;
+        char *k;
+        int r;
+
+        assert(m);
+        assert(ret);
+
+        /* Returns > 0 and the units whose unit files changed since the previous snapshot, if reloading just
+         * those is sufficient. Returns 0 if all units need to be reloaded. */
+
+        if (!m->unit_file_snapshot)
+                return 0;
+
+        if (!strv_equal(old_search_path, m->lookup_paths.search_path)) {
+                log_debug("Unit search path changed, reloading all units.");
+                return 0;
+        }
+
+        if (old_defaults_hash != m->unit_defaults_hash) {
+                log_debug("Unit defaults or environment changed, reloading all units.");
+                return 0;
+        }
+
+        r = unit_file_snapshot_diff(old_snapshot, m->unit_file_snapshot, &changed, &dropins_changed);
+        if (r < 0)
+                return log_debug_errno(r, "Failed to compare unit file snapshots, reloading all units: %m");
+        if (r > 0) {
+                log_debug("Unit files, aliases or dependency symlinks were added or removed, reloading all units.");
+                return 0;
+        }
+
+        HASHMAP_FOREACH_KEY(u, k, m->units) {
+
+                /* ignore aliases */
+                if (u->id != k)
+                        continue;
+
+                if (!unit_files_changed(u, m->unit_file_snapshot, changed, dropins_changed))
+                        continue;
+
+                if (!unit_can_reload_alone(u)) {
+                        log_unit_debug(u, "Unit file changed, but unit cannot be reloaded on its own, reloading all units.");
+                        return 0;
+                }
+
+                r = set_ensure_put(&units, NULL, u);
+                if (r < 0)
+                        return log_oom();
+        }
+
+        *ret = TAKE_PTR(units);
+        return 1;
+}
+
+static int manager_reload_unit(Manager *m, Unit *u) {
+        _cleanup_free_ UnitDependencyEntry *reverse = NULL;
+        size_t n_reverse = 0, n_reverse_allocated = 0, n_refs = 0, n_refs_allocated = 0;
+        _cleanup_set_free_ Set *others = NULL;
+        _cleanup_fdset_free_ FDSet *fds = NULL;
+        _cleanup_fclose_ FILE *f = NULL;
+        _cleanup_free_ char *id = NULL;
+        _cleanup_free_ struct {
+                UnitRef *ref;
+                Unit *source;
+        } *refs = NULL;
+        ExecRuntime *rt = NULL;
+        UnitRef *ref;
+        Unit *other;
+        int r;
+
+        assert(m);
+        assert(u);
+        assert(MANAGER_IS_RELOADING(m));
+
+        id = strdup(u->id);
+        if (!id)
+                return log_oom();
+
+        r = manager_open_serialization(m, &f);
+        if (r < 0)
+                return log_error_errno(r, "Failed to create serialization file: %m");
+
+        fds = fdset_new();
+        if (!fds)
+                return log_oom();
+
+        r = unit_serialize(u, f, fds, false);
+        if (r < 0)
+                return log_unit_error_errno(u, r, "Failed to serialize unit: %m");
+
+        r = fflush_and_check(f);
+        if (r < 0)
+                return log_error_errno(r, "Failed to flush serialization: %m");
+
+        if (fseeko(f, 0, SEEK_SET) < 0)
+                return log_error_errno(errno, "Failed to seek to beginning of serialization: %m");
+
+        /* Remember the dependencies other units configured on this unit, so that we can restore them once it
+         * is loaded again. The ones this unit configured on others are recreated when loading it. */
+        for (UnitDependency d = 0; d < _UNIT_DEPENDENCY_MAX; d++)
+                for (UnitDependencyEntry *e = unit_dependencies_begin(u, d); e < unit_dependencies_end(u, d); e++) {
+                        r = set_ensure_put(&others, NULL, e->other);
+                        if (r < 0)
+                                return log_oom();
+                }
+
+        SET_FOREACH(other, others)
+                for (UnitDependency d = 0; d < _UNIT_DEPENDENCY_MAX; d++) {
+                        UnitDependencyEntry *e;
+
+                        e = unit_dependency_find(other, d, u);
+                        if (!e || e->origin_mask == 0)
+                                continue;
+
+                        if (!GREEDY_REALLOC(reverse, n_reverse_allocated, n_reverse + 1))
+                                return log_oom();
+
+                        reverse[n_reverse++] = (UnitDependencyEntry) {
+                                .other = other,
+                                .type = d,
+                                .origin_mask = e->origin_mask,
+                        };
+                }
+
+        /* Remember which units reference this one, e.g. sockets their service, so that we can point them to
+         * the new unit. Unlike dependencies, those aren't recreated when loading it. */
+        LIST_FOREACH(refs_by_target, ref, u->refs_by_target) {
+                if (!GREEDY_REALLOC(refs, n_refs_allocated, n_refs + 1))
+                        return log_oom();
+
+                refs[n_refs].ref = ref;
+                refs[n_refs++].source = ref->source;
+        }
+
+        /* A running unit's ExecRuntime goes away with its last reference, and with it the names of its private
+         * temporary directories. Keep it around, the new unit picks it up again when coldplugged. */
+        if (unit_get_exec_runtime(u)) {
+                r = exec_runtime_acquire(m, NULL, unit_get_exec_runtime(u)->id, false, &rt);
+                if (r < 0)
+                        return log_unit_error_errno(u, r, "Failed to reference runtime: %m");
+        }
+
+        /* 💀 From here on the unit is gone, and we have to live with whatever we get back. 💀 */
+        log_unit_debug(u, "Unit file changed, reloading unit.");
+        unit_free(u);
+
+        r = manager_load_unit(m, id, NULL, NULL, &u);
+        if (r < 0) {
+                exec_runtime_unref(rt, false);
+                return log_error_errno(r, "Failed to load unit %s: %m", id);
+        }
+
+        r = unit_deserialize(u, f, fds);
+        if (r < 0)
+                log_unit_warning_errno(u, r, "Failed to deserialize unit, proceeding anyway: %m");
+
+        for (size_t i = 0; i < n_reverse; i++) {
+                r = unit_add_dependency(reverse[i].other, reverse[i].type, u, false, reverse[i].origin_mask);
+                if (r < 0)
+                        log_unit_warning_errno(reverse[i].other, r, "Failed to restore dependency on %s, ignoring: %m", u->id);
+        }
+
+        /* unit_free() unset these references, but left the referencing units otherwise alone */
+        for (size_t i = 0; i < n_refs; i++)
+                unit_ref_set(refs[i].ref, refs[i].source, u);
+
+        r = unit_coldplug(u);
+        if (r < 0)
+                log_unit_warning_errno(u, r, "We couldn't coldplug unit, proceeding anyway: %m");
+
+        exec_runtime_unref(rt, false);
+
+        unit_catchup(u);
+        return 0;
+}
+
+static void manager_reload_units(Manager *m, Set *units) {
+        Unit *u;
+
+        assert(m);
+        assert(MANAGER_IS_RELOADING(m));
+
+        /* Reloads just the specified units from disk, and leaves everything else in place. Each unit is
+         * serialized, freed, loaded again and deserialized, the same way a full reload does it for all units. */
+
+        log_debug("Reloading %u changed units.", set_size(units));
+
+        SET_FOREACH(u, units)
+                (void) manager_reload_unit(m, u);
+}
+
+static bool manager_incremental_reload_enabled(void) {
+        int r;
+
+        r = getenv_bool("SYSTEMD_INCREMENTAL_RELOAD");
+        if (r < 0 && r != -ENXIO)
+                log_debug_errno(r, "Failed to parse $SYSTEMD_INCREMENTAL_RELOAD, ignoring: %m");
+
+        return r != 0;
+}
+
 int manager_reload(Manager *m) {
         _cleanup_(manager_reloading_stopp) Manager *reloading = NULL;
+        _cleanup_strv_free_ char **old_search_path = NULL;
+        _cleanup_hashmap_free_ Hashmap *old_snapshot = NULL;
+        _cleanup_set_free_ Set *units = NULL;
         _cleanup_fdset_free_ FDSet *fds = NULL;
         _cleanup_fclose_ FILE *f = NULL;
+        uint64_t old_defaults_hash;
+        bool incremental;
         int r;
 
         assert(m);
 
+        incremental = m->unit_file_snapshot && manager_incremental_reload_enabled();
+        if (incremental) {
+                old_search_path = strv_copy(m->lookup_paths.search_path);
+                if (!old_search_path)
+                        return log_oom();
+        }
+
         r = manager_open_serialization(m, &f);
         if (r < 0)
                 return log_error_errno(r, "Failed to create serialization file: %m");
@@ -3791,30 +4535,34 @@ int manager_reload(Manager *m) {
 
         bus_manager_send_reloading(m, true);
 
+        /* Rerun the generators. They replace their output in place, hence this may only happen once nothing can
+         * fail anymore, even if it turns out below that we don't need the serialization. */
+        old_snapshot = TAKE_PTR(m->unit_file_snapshot);
+        old_defaults_hash = m->unit_defaults_hash;
+
+        manager_reload_lookup_paths(m);
+        manager_take_unit_file_snapshot(m);
+
+        /* If we know what the unit files looked like when we loaded them, check whether only the contents of
+         * some unit files or drop-ins changed, and all affected units can be reloaded on their own. In that
+         * case it's enough to reload those units, everything else including dependencies between units stays
+         * the same. */
+        if (incremental &&
+            manager_find_changed_units(m, old_search_path, old_snapshot, old_defaults_hash, &units) > 0) {
+                manager_reload_units(m, units);
+                goto finish;
+        }
+
         /* Start by flushing out all jobs and units, all generated units, all runtime environments, all dynamic users
          * and everything else that is worth flushing out. We'll get it all back from the serialization — if we need
          * it.*/
 
         manager_clear_jobs_and_units(m);
-        lookup_paths_flush_generator(&m->lookup_paths);
-        lookup_paths_free(&m->lookup_paths);
         exec_runtime_vacuum(m);
         dynamic_user_vacuum(m, false);
         m->uid_refs = hashmap_free(m->uid_refs);
         m->gid_refs = hashmap_free(m->gid_refs);
 
-        r = lookup_paths_init(&m->lookup_paths, m->unit_file_scope, 0, NULL);
-        if (r < 0)
-                log_warning_errno(r, "Failed to initialize path lookup table, ignoring: %m");
-
-        (void) manager_run_environment_generators(m);
-        (void) manager_run_generators(m);
-
-        lookup_paths_log(&m->lookup_paths);
-
-        /* We flushed out generated files, for which we don't watch mtime, so we should flush the old map. */
-        manager_free_unit_name_maps(m);
-
         /* First, enumerate what we can from kernel and suchlike */
         manager_enumerate_perpetual(m);
         manager_enumerate(m);
@@ -3835,6 +4583,7 @@ int manager_reload(Manager *m) {
         /* Third, fire things up! */
         manager_coldplug(m);
 
+finish:
         /* Clean up runtime objects no longer referenced */
         manager_vacuum(m);
 
@@ -4107,6 +4856,7 @@ static int manager_run_environment_generators(Manager *m) {
 
 static int manager_run_generators(Manager *m) {
         _cleanup_strv_free_ char **paths = NULL;
+        ExecDirHooks hooks = {};
         const char *argv[5];
         int r;
 
@@ -4134,9 +4884,15 @@ static int manager_run_generators(Manager *m) {
         argv[3] = m->lookup_paths.generator_late;
         argv[4] = NULL;
 
+        /* Unless turned off, reuse the output of generators whose declared inputs did not change */
+        if (getenv_bool("SYSTEMD_GENERATOR_CACHE") != 0)
+                lookup_paths_generator_hooks(&m->lookup_paths, &hooks);
+
         RUN_WITH_UMASK(0022)
-                (void) execute_directories((const char* const*) paths, DEFAULT_TIMEOUT_USEC, NULL, NULL,
-                                           (char**) argv, m->transient_environment, EXEC_DIR_PARALLEL | EXEC_DIR_IGNORE_ERRORS);
+                (void) execute_directories_full((const char* const*) paths, DEFAULT_TIMEOUT_USEC, NULL, NULL,
+                                                (char**) argv, m->transient_environment,
+                                                hooks.prepare ? &hooks : NULL,
+                                                EXEC_DIR_PARALLEL | EXEC_DIR_IGNORE_ERRORS);
 
         r = 0;
 
@@ -25,6 +25,7 @@ typedef struct Unit Unit;
 #define MANAGER_MAX_NAMES 131072 /* 128K */
 
 typedef struct Manager Manager;
+typedef struct NotifyBatch NotifyBatch;
 
 /* An externally visible state. We don't actually maintain this as state variable, but derive it from various fields
  * when requested */
@@ -165,6 +166,11 @@ struct Manager {
         LIST_HEAD(Unit, dbus_unit_queue);
         LIST_HEAD(Job, dbus_job_queue);
 
+        /* When the queues above were last flushed while clients were still lagging behind, and the timer
+         * that wakes us up again for the next flush. */
+        usec_t dbus_queue_dispatch_timestamp;
+        sd_event_source *dbus_queue_event_source;
+
         /* Units to remove */
         LIST_HEAD(Unit, cleanup_queue);
 
@@ -197,6 +203,7 @@ struct Manager {
          * negative PIDs are not used for regular processes but process groups, which we don't care about in this
          * context, but this allows us to use the negative range for our own purposes. */
         Hashmap *watch_pids;  /* pid => unit as well as -pid => array of units */
+        Hashmap *watch_pidfds; /* pid => pidfd of a child we forked off */
 
         /* A set contains all units which cgroup should be refreshed after startup */
         Set *startup_units;
@@ -209,6 +216,7 @@ struct Manager {
         char *notify_socket;
         int notify_fd;
         sd_event_source *notify_event_source;
+        NotifyBatch *notify_batch; /* receive buffers, allocated on first use */
 
         int cgroups_agent_fd;
         sd_event_source *cgroups_agent_event_source;
@@ -228,12 +236,18 @@ struct Manager {
         int user_lookup_fds[2];
         sd_event_source *user_lookup_event_source;
 
+        /* The systemd-executor binary, pinned at startup, so that we keep spawning the version matching
+         * ours even if the file is replaced on disk by an upgrade */
+        int executor_fd;
+
         UnitFileScope unit_file_scope;
         LookupPaths lookup_paths;
         Hashmap *unit_id_map;
         Hashmap *unit_name_map;
         Set *unit_path_cache;
         uint64_t unit_cache_timestamp_hash;
+        Hashmap *unit_file_snapshot;   /* The state of all unit files when they were last loaded, see unit_file_snapshot_take() */
+        uint64_t unit_defaults_hash;   /* The unit defaults and environment at that time, see manager_unit_defaults_hash() */
 
         char **transient_environment;  /* The environment, as determined from config files, kernel cmdline and environment generators */
         char **client_environment;     /* Environment variables created by clients through the bus API */
@@ -253,6 +267,10 @@ struct Manager {
         struct libmnt_monitor *mount_monitor;
         sd_event_source *mount_event_source;
 
+        /* The entries of /proc/self/mountinfo we processed, see MountInfoEntry */
+        Hashmap *mountinfo_entries;
+        unsigned mountinfo_generation;
+
         /* Data specific to the swap filesystem */
         FILE *proc_swaps;
         sd_event_source *swap_event_source;
@@ -299,6 +317,19 @@ struct Manager {
         Hashmap *cgroup_control_inotify_wd_unit;
         Hashmap *cgroup_memory_inotify_wd_unit;
 
+        /* While a batch of cgroup realizations is in progress, the directories of the cgroups we write
+         * attributes of are kept open, mapping their paths to fds */
+        Hashmap *cgroup_write_dir_fds;
+        unsigned cgroup_write_batch_depth;
+
+        /* Counts batches of cgroup realizations, so that ancestors shared by the units realized in a batch
+         * are only looked at once */
+        uint64_t cgroup_realize_pass;
+
+        /* Statistics: cgroup attributes written, and writes skipped since the value was unchanged */
+        uint64_t n_cgroup_attribute_writes;
+        uint64_t n_cgroup_attribute_writes_skipped;
+
         /* A defer event for handling cgroup empty events and processing them after SIGCHLD in all cases. */
         sd_event_source *cgroup_empty_event_source;
         sd_event_source *cgroup_oom_event_source;
@@ -487,9 +518,17 @@ int manager_get_dump_string(Manager *m, char **ret);
 void manager_clear_jobs(Manager *m);
 
 void manager_unwatch_pid(Manager *m, pid_t pid);
+int manager_watch_pidfd(Manager *m, Unit *u, pid_t pid);
+void manager_unwatch_pidfd(Manager *m, Unit *u, pid_t pid);
+int manager_kill_pid_and_sigcont(Manager *m, Unit *u, pid_t pid, int sig);
 
 unsigned manager_dispatch_load_queue(Manager *m);
 
+/* Receiving notification messages in batches, exported for the tests */
+NotifyBatch* notify_batch_new(void);
+int notify_batch_receive(NotifyBatch *b, int fd);
+bool notify_batch_superseded(NotifyBatch *b, size_t n, size_t i);
+
 int manager_default_environment(Manager *m);
 int manager_transient_environment_add(Manager *m, char **plus);
 int manager_client_environment_modify(Manager *m, char **minus, char **plus);
@@ -161,6 +161,7 @@ static void mount_init(Unit *u) {
         m->exec_context.same_pgrp = true;
 
         m->control_command_id = _MOUNT_EXEC_COMMAND_INVALID;
+        m->proc_mount_id = -1;
 
         u->ignore_on_isolate = true;
 }
@@ -728,7 +729,7 @@ static int mount_coldplug(Unit *u) {
             pid_is_unwaited(m->control_pid) &&
             MOUNT_STATE_WITH_PROCESS(new_state)) {
 
-                r = unit_watch_pid(UNIT(m), m->control_pid, false);
+                r = unit_watch_pid_coldplug(UNIT(m), m->control_pid);
                 if (r < 0)
                         return r;
 
@@ -1643,7 +1644,8 @@ static int mount_setup_unit(
                 const char *where,
                 const char *options,
                 const char *fstype,
-                bool set_flags) {
+                bool set_flags,
+                Unit **ret) {
 
         _cleanup_free_ char *e = NULL;
         MountProcFlags flags;
@@ -1655,6 +1657,9 @@ static int mount_setup_unit(
         assert(where);
         assert(options);
         assert(fstype);
+        assert(ret);
+
+        *ret = NULL;
 
         /* Ignore API mount points. They should never be referenced in
          * dependencies ever. */
@@ -1710,12 +1715,164 @@ static int mount_setup_unit(
         if (set_flags)
                 MOUNT(u)->proc_flags = flags;
 
+        *ret = u;
         return 0;
 }
 
+static void mount_info_entry_free_fields(MountInfoEntry *e) {
+        assert(e);
+
+        e->what = mfree(e->what);
+        e->where = mfree(e->where);
+        e->options = mfree(e->options);
+        e->fstype = mfree(e->fstype);
+        e->unit = mfree(e->unit);
+}
+
+MountInfoEntry* mount_info_entry_free(MountInfoEntry *e) {
+        if (!e)
+                return NULL;
+
+        mount_info_entry_free_fields(e);
+        return mfree(e);
+}
+
+DEFINE_PRIVATE_HASH_OPS_WITH_VALUE_DESTRUCTOR(mount_info_entry_hash_ops, void, trivial_hash_func, trivial_compare_func,
+                                              MountInfoEntry, mount_info_entry_free);
+
+int mount_info_entry_update(
+                Hashmap **entries,
+                int id,
+                const char *what,
+                const char *where,
+                const char *options,
+                const char *fstype,
+                unsigned generation,
+                MountInfoEntry **ret) {
+
+        _cleanup_(mount_info_entry_freep) MountInfoEntry *n = NULL;
+        MountInfoEntry *e;
+        int r;
+
+        assert(entries);
+        assert(ret);
+
+        /* Records an entry of /proc/self/mountinfo as seen in the pass 'generation'. Returns 0 if we saw it
+         * unchanged in the previous pass already, > 0 if it is new or changed. In the latter case the 'unit'
+         * field is reset, and needs to be filled in again by the caller. */
+
+        e = hashmap_get(*entries, INT_TO_PTR(id));
+        if (e) {
+                e->generation = generation;
+
+                if (streq_ptr(e->what, what) &&
+                    streq_ptr(e->where, where) &&
+                    streq_ptr(e->options, options) &&
+                    streq_ptr(e->fstype, fstype)) {
+                        *ret = e;
+                        return 0;
+                }
+
+                mount_info_entry_free_fields(e);
+        } else {
+                r = hashmap_ensure_allocated(entries, &mount_info_entry_hash_ops);
+                if (r < 0)
+                        return r;
+
+                n = new(MountInfoEntry, 1);
+                if (!n)
+                        return -ENOMEM;
+
+                *n = (MountInfoEntry) {
+                        .id = id,
+                        .generation = generation,
+                };
+
+                e = n;
+        }
+
+        if (free_and_strdup(&e->what, what) < 0 ||
+            free_and_strdup(&e->where, where) < 0 ||
+            free_and_strdup(&e->options, options) < 0 ||
+            free_and_strdup(&e->fstype, fstype) < 0) {
+                if (!n) {
+                        /* Don't leave a half-initialized entry behind that might compare equal next time */
+                        assert_se(hashmap_remove(*entries, INT_TO_PTR(id)) == e);
+                        mount_info_entry_free(e);
+                }
+                return -ENOMEM;
+        }
+
+        if (n) {
+                r = hashmap_put(*entries, INT_TO_PTR(id), n);
+                if (r < 0)
+                        return r;
+
+                TAKE_PTR(n);
+        }
+
+        *ret = e;
+        return 1;
+}
+
+unsigned mount_info_entries_prune(Hashmap *entries, unsigned generation) {
+        MountInfoEntry *e;
+        unsigned n = 0;
+
+        /* Drops all entries that weren't seen in the pass 'generation', i.e. that are gone now */
+
+        HASHMAP_FOREACH(e, entries)
+                if (e->generation != generation) {
+                        mount_info_entry_free(hashmap_remove(entries, INT_TO_PTR(e->id)));
+                        n++;
+                }
+
+        return n;
+}
+
+static bool mount_setup_unchanged_unit(Manager *m, const MountInfoEntry *e) {
+        Mount *mount;
+        Unit *u;
+
+        assert(m);
+        assert(e);
+
+        /* Takes care of an entry of /proc/self/mountinfo that didn't change since the last pass. Returns false
+         * if it needs the full treatment of mount_setup_unit() nonetheless. */
+
+        if (!e->unit)
+                return true; /* Not something we track as a unit */
+
+        u = manager_get_unit(m, e->unit);
+        if (!u)
+                return false;
+
+        mount = MOUNT(u);
+
+        /* The unit isn't in sync with /proc/self/mountinfo yet, or waits for this very mount to show up */
+        if (!mount->from_proc_self_mountinfo ||
+            mount->state == MOUNT_MOUNTING ||
+            IN_SET(u->load_state, UNIT_NOT_FOUND, UNIT_BAD_SETTING, UNIT_ERROR))
+                return false;
+
+        /* Multiple mounts on the same mount point, let's process the entries in full, so that the last one
+         * wins, as before. */
+        if (FLAGS_SET(mount->proc_flags, MOUNT_PROC_IS_MOUNTED))
+                return false;
+
+        /* The unit's parameters were taken from a different entry, e.g. from a mount stacked on top of this
+         * one, that is gone now. Update them from this one, so that the change is noticed. */
+        if (mount->proc_mount_id != e->id)
+                return false;
+
+        mount->proc_flags |= MOUNT_PROC_IS_MOUNTED;
+        return true;
+}
+
 static int mount_load_proc_self_mountinfo(Manager *m, bool set_flags) {
         _cleanup_(mnt_free_tablep) struct libmnt_table *table = NULL;
         _cleanup_(mnt_free_iterp) struct libmnt_iter *iter = NULL;
+        unsigned n_entries = 0, n_changed = 0, n_gone;
         int r;
 
         assert(m);
@@ -1724,9 +1881,14 @@ static int mount_load_proc_self_mountinfo(Manager *m, bool set_flags) {
         if (r < 0)
                 return log_error_errno(r, "Failed to parse /proc/self/mountinfo: %m");
 
+        m->mountinfo_generation++;
+
         for (;;) {
                 struct libmnt_fs *fs;
                 const char *device, *path, *options, *fstype;
+                MountInfoEntry *e;
+                Unit *u;
+                int id;
 
                 r = mnt_table_next_fs(table, iter, &fs);
                 if (r == 1)
@@ -1742,11 +1904,35 @@ static int mount_load_proc_self_mountinfo(Manager *m, bool set_flags) {
                 if (!device || !path)
                         continue;
 
+                n_entries++;
+
+                /* Only entries that are new or changed since the last pass need to be looked at in full. When
+                 * enumerating (i.e. !set_flags) we look at everything though, as the units are new. */
+                id = mnt_fs_get_id(fs);
+                r = mount_info_entry_update(&m->mountinfo_entries, id, device, path, options, fstype, m->mountinfo_generation, &e);
+                if (r < 0) {
+                        log_oom();
+                        e = NULL;
+                } else if (r == 0 && set_flags && mount_setup_unchanged_unit(m, e))
+                        continue;
+
+                n_changed++;
+
                 device_found_node(m, device, DEVICE_FOUND_MOUNT, DEVICE_FOUND_MOUNT);
 
-                (void) mount_setup_unit(m, device, path, options, fstype, set_flags);
+                r = mount_setup_unit(m, device, path, options, fstype, set_flags, &u);
+                if (u)
+                        MOUNT(u)->proc_mount_id = id;
+                if (!e)
+                        continue;
+                if (r < 0 || (u && free_and_strdup(&e->unit, u->id) < 0))
+                        /* Make sure we'll look at this one again next time */
+                        mount_info_entry_free(hashmap_remove(m->mountinfo_entries, INT_TO_PTR(e->id)));
         }
 
+        n_gone = mount_info_entries_prune(m->mountinfo_entries, m->mountinfo_generation);
+
+        log_debug("Processed /proc/self/mountinfo: %u entries, %u new or changed, %u gone.", n_entries, n_changed, n_gone);
         return 0;
 }
 
@@ -1757,6 +1943,8 @@ static void mount_shutdown(Manager *m) {
 
         mnt_unref_monitor(m->mount_monitor);
         m->mount_monitor = NULL;
+
+        m->mountinfo_entries = hashmap_free(m->mountinfo_entries);
 }
 
 static int mount_get_timeout(Unit *u, usec_t *timeout) {
@@ -1915,6 +2103,9 @@ static int mount_process_proc_self_mountinfo(Manager *m) {
                 LIST_FOREACH(units_by_type, u, m->units_by_type[UNIT_MOUNT])
                         MOUNT(u)->proc_flags = 0;
 
+                /* We don't know which entries we got to, hence look at everything again next time */
+                hashmap_clear(m->mountinfo_entries);
+
                 return 0;
         }
 
@@ -1992,18 +2183,24 @@ static int mount_process_proc_self_mountinfo(Manager *m) {
                         }
                 }
 
-                if (mount_is_mounted(mount) &&
-                    mount->from_proc_self_mountinfo &&
-                    mount->parameters_proc_self_mountinfo.what) {
-                        /* Track devices currently used */
+                /* Reset the flags for later calls */
+                mount->proc_flags = 0;
+        }
+
+        if (set_isempty(gone))
+                return 0;
 
+        /* Track devices currently used, so that we don't consider a device gone if it is still mounted
+         * elsewhere. Only bother with this if there's anything that might be gone. Note that at this point
+         * from_proc_self_mountinfo is set exactly for the units that are mounted. */
+        LIST_FOREACH(units_by_type, u, m->units_by_type[UNIT_MOUNT]) {
+                Mount *mount = MOUNT(u);
+
+                if (mount->from_proc_self_mountinfo &&
+                    mount->parameters_proc_self_mountinfo.what)
                         if (set_ensure_allocated(&around, &path_hash_ops) < 0 ||
                             set_put_strdup(&around, mount->parameters_proc_self_mountinfo.what) < 0)
                                 log_oom();
-                }
-
-                /* Reset the flags for later calls */
-                mount->proc_flags = 0;
         }
 
         SET_FOREACH(what, gone) {
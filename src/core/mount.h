@@ -41,6 +41,21 @@ typedef enum MountProcFlags {
         MOUNT_PROC_JUST_CHANGED = 1 << 2,
 } MountProcFlags;
 
+/* An entry of /proc/self/mountinfo as seen the last time we processed the file, indexed by mount ID. Used to
+ * skip over the entries that didn't change since, so that mount churn on systems with many mounts only costs
+ * us work for the entries actually affected. */
+typedef struct MountInfoEntry {
+        int id;
+        unsigned generation;  /* The pass in which we saw this entry the last time */
+
+        char *what;
+        char *where;
+        char *options;
+        char *fstype;
+
+        char *unit;           /* The mount unit this entry maps to, NULL if it doesn't map to any */
+} MountInfoEntry;
+
 struct Mount {
         Unit meta;
 
@@ -54,6 +69,9 @@ struct Mount {
 
         MountProcFlags proc_flags;
 
+        /* The mount ID of the /proc/self/mountinfo entry parameters_proc_self_mountinfo was last set from, or -1 */
+        int proc_mount_id;
+
         bool sloppy_options;
 
         bool lazy_unmount;
@@ -93,6 +111,20 @@ extern const UnitVTable mount_vtable;
 
 void mount_fd_event(Manager *m, int events);
 
+MountInfoEntry* mount_info_entry_free(MountInfoEntry *e);
+DEFINE_TRIVIAL_CLEANUP_FUNC(MountInfoEntry*, mount_info_entry_free);
+
+int mount_info_entry_update(
+                Hashmap **entries,
+                int id,
+                const char *what,
+                const char *where,
+                const char *options,
+                const char *fstype,
+                unsigned generation,
+                MountInfoEntry **ret);
+unsigned mount_info_entries_prune(Hashmap *entries, unsigned generation);
+
 const char* mount_exec_command_to_string(MountExecCommand i) _const_;
 MountExecCommand mount_exec_command_from_string(const char *s) _pure_;
 
@@ -20,15 +20,19 @@
 #include "format-util.h"
 #include "log.h"
 #include "path-util.h"
+#include "process-util.h"
 #include "selinux-util.h"
+#include "socket-util.h"
 #include "stdio-util.h"
 #include "strv.h"
+#include "user-util.h"
 #include "util.h"
 
 static bool initialized = false;
 
 struct audit_info {
         sd_bus_creds *creds;
+        uid_t uid; /* only used if there are no creds */
         const char *path;
         const char *cmdline;
 };
@@ -50,12 +54,15 @@ static int audit_callback(
         char uid_buf[DECIMAL_STR_MAX(uid_t) + 1] = "n/a";
         char gid_buf[DECIMAL_STR_MAX(gid_t) + 1] = "n/a";
 
-        if (sd_bus_creds_get_audit_login_uid(audit->creds, &login_uid) >= 0)
-                xsprintf(login_uid_buf, UID_FMT, login_uid);
-        if (sd_bus_creds_get_euid(audit->creds, &uid) >= 0)
-                xsprintf(uid_buf, UID_FMT, uid);
-        if (sd_bus_creds_get_egid(audit->creds, &gid) >= 0)
-                xsprintf(gid_buf, GID_FMT, gid);
+        if (audit->creds) {
+                if (sd_bus_creds_get_audit_login_uid(audit->creds, &login_uid) >= 0)
+                        xsprintf(login_uid_buf, UID_FMT, login_uid);
+                if (sd_bus_creds_get_euid(audit->creds, &uid) >= 0)
+                        xsprintf(uid_buf, UID_FMT, uid);
+                if (sd_bus_creds_get_egid(audit->creds, &gid) >= 0)
+                        xsprintf(gid_buf, GID_FMT, gid);
+        } else if (uid_is_valid(audit->uid))
+                xsprintf(uid_buf, UID_FMT, audit->uid);
 
         snprintf(msgbuf, msgbufsize,
                  "auid=%s uid=%s gid=%s%s%s%s%s%s%s",
@@ -278,6 +285,64 @@ int mac_selinux_generic_access_check(
         return enforce ? r : 0;
 }
 
+int mac_selinux_varlink_access_check(Varlink *link, const char *permission) {
+        _cleanup_free_ char *scon = NULL, *cl = NULL;
+        _cleanup_freecon_ char *fcon = NULL;
+        uid_t uid = UID_INVALID;
+        bool enforce;
+        pid_t pid;
+        int fd, r;
+
+        assert(link);
+        assert(permission);
+
+        /* Same as mac_selinux_access_check(), but for a Varlink peer. The context is taken from the socket
+         * directly, the rest is only used for the audit record. */
+
+        r = access_init(NULL);
+        if (r <= 0)
+                return r;
+
+        enforce = mac_selinux_enforcing();
+
+        fd = varlink_get_fd(link);
+        if (fd < 0)
+                return fd;
+
+        r = getpeersec(fd, &scon);
+        if (r < 0)
+                return r;
+
+        if (getcon_raw(&fcon) < 0) {
+                r = -errno;
+
+                log_warning_errno(r, "SELinux getcon_raw() failed%s (perm=%s): %m",
+                                  enforce ? "" : ", ignoring",
+                                  permission);
+                if (!enforce)
+                        return 0;
+
+                return -EACCES;
+        }
+
+        (void) varlink_get_peer_uid(link, &uid);
+        if (varlink_get_peer_pid(link, &pid) >= 0)
+                (void) get_process_cmdline(pid, SIZE_MAX, 0, &cl);
+
+        struct audit_info audit_info = {
+                .uid = uid,
+                .cmdline = cl,
+        };
+
+        r = selinux_check_access(scon, fcon, "system", permission, &audit_info);
+        if (r < 0)
+                r = errno_or_else(EPERM);
+
+        log_debug_errno(r, "SELinux access check scon=%s tcon=%s tclass=system perm=%s state=%s cmdline=%s: %m",
+                        scon, fcon, permission, enforce ? "enforcing" : "permissive", cl);
+        return enforce ? r : 0;
+}
+
 #else /* HAVE_SELINUX */
 
 int mac_selinux_generic_access_check(
@@ -289,4 +354,8 @@ int mac_selinux_generic_access_check(
         return 0;
 }
 
+int mac_selinux_varlink_access_check(Varlink *link, const char *permission) {
+        return 0;
+}
+
 #endif /* HAVE_SELINUX */
@@ -4,8 +4,10 @@
 #include "sd-bus.h"
 
 #include "manager.h"
+#include "varlink.h"
 
 int mac_selinux_generic_access_check(sd_bus_message *message, const char *path, const char *permission, sd_bus_error *error);
+int mac_selinux_varlink_access_check(Varlink *link, const char *permission);
 
 #define mac_selinux_access_check(message, permission, error) \
         mac_selinux_generic_access_check((message), NULL, (permission), (error))
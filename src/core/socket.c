@@ -1874,7 +1874,7 @@ static int socket_coldplug(Unit *u) {
                    SOCKET_FINAL_SIGKILL,
                    SOCKET_CLEANING)) {
 
-                r = unit_watch_pid(UNIT(s), s->control_pid, false);
+                r = unit_watch_pid_coldplug(UNIT(s), s->control_pid);
                 if (r < 0)
                         return r;
 
@@ -2330,11 +2330,10 @@ static void socket_enter_running(Socket *s, int cfd_in) {
         if (cfd < 0) {
                 bool pending = false;
                 Unit *other;
-                void *v;
 
                 /* If there's already a start pending don't bother to
                  * do anything */
-                HASHMAP_FOREACH_KEY(v, other, UNIT(s)->dependencies[UNIT_TRIGGERS])
+                UNIT_FOREACH_DEPENDENCY(other, UNIT(s), UNIT_TRIGGERS)
                         if (unit_active_or_pending(other)) {
                                 pending = true;
                                 break;
@@ -117,7 +117,7 @@ static int timer_add_trigger_dependencies(Timer *t) {
 
         assert(t);
 
-        if (!hashmap_isempty(UNIT(t)->dependencies[UNIT_TRIGGERS]))
+        if (unit_has_dependencies(UNIT(t), UNIT_TRIGGERS))
                 return 0;
 
         r = unit_load_related_unit(UNIT(t), ".service", &x);
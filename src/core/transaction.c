@@ -346,115 +346,77 @@ static char* merge_unit_ids(const char* unit_log_field, char **pairs) {
         return ans;
 }
 
-static int transaction_verify_order_one(Transaction *tr, Job *j, Job *from, unsigned generation, sd_bus_error *e) {
-        Unit *u;
-        void *v;
-        int r;
-        static const UnitDependency directions[] = {
-                UNIT_BEFORE,
-                UNIT_AFTER,
-        };
-        size_t d;
+/* The ordering graph of a transaction, with the jobs numbered densely, and the "before" edges of each job
+ * stored as a slice of one array of job indexes. Job::graph_index maps jobs to their number, and is valid
+ * for jobs whose Job::generation matches the one the graph was built with. */
+typedef struct OrderGraph {
+        Job **jobs;
+        size_t n_jobs, n_jobs_allocated;
+
+        size_t *edge_offsets;  /* The edges of job i are edges[edge_offsets[i]] to edges[edge_offsets[i+1]-1] */
+        size_t n_edge_offsets_allocated;
+
+        unsigned *edges;
+        size_t n_edges, n_edges_allocated;
+} OrderGraph;
+
+static void order_graph_done(OrderGraph *g) {
+        assert(g);
+
+        g->jobs = mfree(g->jobs);
+        g->edge_offsets = mfree(g->edge_offsets);
+        g->edges = mfree(g->edges);
+}
 
-        assert(tr);
+static int order_graph_add_job(OrderGraph *g, Job *j, unsigned generation) {
+        assert(g);
         assert(j);
-        assert(!j->transaction_prev);
-
-        /* Does a recursive sweep through the ordering graph, looking
-         * for a cycle. If we find a cycle we try to break it. */
 
-        /* Have we seen this before? */
-        if (j->generation == generation) {
-                Job *k, *delete = NULL;
-                _cleanup_free_ char **array = NULL, *unit_ids = NULL;
-                char **unit_id, **job_type;
-
-                /* If the marker is NULL we have been here already and
-                 * decided the job was loop-free from here. Hence
-                 * shortcut things and return right-away. */
-                if (!j->marker)
-                        return 0;
+        if (j->generation == generation)
+                return j->graph_index;
 
-                /* So, the marker is not NULL and we already have been here. We have
-                 * a cycle. Let's try to break it. We go backwards in our path and
-                 * try to find a suitable job to remove. We use the marker to find
-                 * our way back, since smart how we are we stored our way back in
-                 * there. */
+        if (g->n_jobs >= INT_MAX)
+                return -E2BIG;
 
-                for (k = from; k; k = ((k->generation == generation && k->marker != k) ? k->marker : NULL)) {
-
-                        /* For logging below */
-                        if (strv_push_pair(&array, k->unit->id, (char*) job_type_to_string(k->type)) < 0)
-                                log_oom();
+        if (!GREEDY_REALLOC(g->jobs, g->n_jobs_allocated, g->n_jobs + 1))
+                return -ENOMEM;
 
-                        if (!delete && hashmap_get(tr->jobs, k->unit) && !unit_matters_to_anchor(k->unit, k))
-                                /* Ok, we can drop this one, so let's do so. */
-                                delete = k;
+        j->generation = generation;
+        j->graph_index = g->n_jobs;
+        g->jobs[g->n_jobs] = j;
 
-                        /* Check if this in fact was the beginning of the cycle */
-                        if (k == j)
-                                break;
-                }
+        return g->n_jobs++;
+}
 
-                unit_ids = merge_unit_ids(j->manager->unit_log_field, array); /* ignore error */
-
-                STRV_FOREACH_PAIR(unit_id, job_type, array)
-                        /* logging for j not k here to provide a consistent narrative */
-                        log_struct(LOG_WARNING,
-                                   "MESSAGE=%s: Found %s on %s/%s",
-                                   j->unit->id,
-                                   unit_id == array ? "ordering cycle" : "dependency",
-                                   *unit_id, *job_type,
-                                   unit_ids);
-
-                if (delete) {
-                        const char *status;
-                        /* logging for j not k here to provide a consistent narrative */
-                        log_struct(LOG_ERR,
-                                   "MESSAGE=%s: Job %s/%s deleted to break ordering cycle starting with %s/%s",
-                                   j->unit->id, delete->unit->id, job_type_to_string(delete->type),
-                                   j->unit->id, job_type_to_string(j->type),
-                                   unit_ids);
-
-                        if (log_get_show_color())
-                                status = ANSI_HIGHLIGHT_RED " SKIP " ANSI_NORMAL;
-                        else
-                                status = " SKIP ";
-
-                        unit_status_printf(delete->unit,
-                                           STATUS_TYPE_NOTICE,
-                                           status,
-                                           "Ordering cycle found, skipping %s");
-                        transaction_delete_unit(tr, delete->unit);
-                        return -EAGAIN;
-                }
+static int order_graph_add_edges(OrderGraph *g, size_t i, unsigned generation) {
+        static const UnitDependency directions[] = {
+                UNIT_BEFORE,
+                UNIT_AFTER,
+        };
+        Job *j;
+        int r;
 
-                log_struct(LOG_ERR,
-                           "MESSAGE=%s: Unable to break cycle starting with %s/%s",
-                           j->unit->id, j->unit->id, job_type_to_string(j->type),
-                           unit_ids);
+        assert(g);
+        assert(i < g->n_jobs);
 
-                return sd_bus_error_setf(e, BUS_ERROR_TRANSACTION_ORDER_IS_CYCLIC,
-                                         "Transaction order is cyclic. See system logs for details.");
-        }
+        j = g->jobs[i];
 
-        /* Make the marker point to where we come from, so that we can
-         * find our way backwards if we want to break a cycle. We use
-         * a special marker for the beginning: we point to
-         * ourselves. */
-        j->marker = from ? from : j;
-        j->generation = generation;
+        if (!GREEDY_REALLOC(g->edge_offsets, g->n_edge_offsets_allocated, i + 2))
+                return -ENOMEM;
+        g->edge_offsets[i] = g->n_edges;
 
         /* Actual ordering of jobs depends on the unit ordering dependency and job types. We need to traverse
          * the graph over 'before' edges in the actual job execution order. We traverse over both unit
          * ordering dependencies and we test with job_compare() whether it is the 'before' edge in the job
          * execution ordering. */
-        for (d = 0; d < ELEMENTSOF(directions); d++) {
-                HASHMAP_FOREACH_KEY(v, u, j->unit->dependencies[directions[d]]) {
+        for (size_t d = 0; d < ELEMENTSOF(directions); d++) {
+                Unit *u;
+
+                UNIT_FOREACH_DEPENDENCY(u, j->unit, directions[d]) {
                         Job *o;
 
                         /* Is there a job for this unit? */
-                        o = hashmap_get(tr->jobs, u);
+                        o = u->transaction_job;
                         if (!o) {
                                 /* Ok, there is no job for this in the
                                  * transaction, but maybe there is already one
@@ -464,27 +426,283 @@ static int transaction_verify_order_one(Transaction *tr, Job *j, Job *from, unsi
                                         continue;
                         }
 
-                        /* Cut traversing if the job j is not really *before* o. */
+                        /* Skip if the job j is not really *before* o. */
                         if (job_compare(j, o, directions[d]) >= 0)
                                 continue;
 
-                        r = transaction_verify_order_one(tr, o, j, generation, e);
+                        r = order_graph_add_job(g, o, generation);
                         if (r < 0)
                                 return r;
+
+                        if (!GREEDY_REALLOC(g->edges, g->n_edges_allocated, g->n_edges + 1))
+                                return -ENOMEM;
+                        g->edges[g->n_edges++] = r;
                 }
         }
 
-        /* Ok, let's backtrack, and remember that this entry is not on
-         * our path anymore. */
-        j->marker = NULL;
-
+        g->edge_offsets[i + 1] = g->n_edges;
         return 0;
 }
 
-static int transaction_verify_order(Transaction *tr, unsigned *generation, sd_bus_error *e) {
+static int order_graph_build(OrderGraph *g, Transaction *tr, unsigned generation) {
+        size_t i = 0;
         Job *j;
+        int r = 0;
+
+        assert(g);
+        assert(tr);
+
+        /* Looking up the job of every unit we are ordered against in tr->jobs is what dominates building
+         * the graph for large transactions, hence let each unit point to its job while we are at it. */
+        HASHMAP_FOREACH(j, tr->jobs)
+                j->unit->transaction_job = j;
+
+        /* Number the jobs breadth first, starting from the jobs of the transaction, in the order of tr->jobs.
+         * Jobs already installed are included as they are encountered, since the ordering might go through
+         * them too. Numbering jobs close to each other in the graph next to each other keeps the following
+         * walks over the graph local. */
+        HASHMAP_FOREACH(j, tr->jobs) {
+                r = order_graph_add_job(g, j, generation);
+                if (r < 0)
+                        goto finish;
+
+                for (; i < g->n_jobs; i++) {
+                        r = order_graph_add_edges(g, i, generation);
+                        if (r < 0)
+                                goto finish;
+                }
+        }
+
+finish:
+        HASHMAP_FOREACH(j, tr->jobs)
+                j->unit->transaction_job = NULL;
+
+        return r;
+}
+
+static int order_graph_find_cycle(OrderGraph *g, unsigned **ret_path, size_t *ret_n_path) {
+        _cleanup_free_ unsigned *index = NULL, *lowlink = NULL, *parent = NULL, *stack = NULL, *component = NULL;
+        _cleanup_free_ size_t *next_edge = NULL;
+        _cleanup_free_ bool *on_stack = NULL;
+        unsigned n_index = 0, start = UINT_MAX, *queue, *prev, *path;
+        size_t n_stack = 0, n_queue = 0, n_path;
+
+        assert(g);
+        assert(ret_path);
+        assert(ret_n_path);
+
+        /* Looks for the strongly connected components of the ordering graph, with Tarjan's algorithm. Any
+         * component with more than one job, or with a job ordered before itself, contains a cycle. This
+         * runs in linear time, and iteratively, so that long ordering chains can't exhaust our stack.
+         *
+         * If there's a cycle, returns 1 and the shortest cycle through the first job of the first cyclic
+         * component we find. The path is in reverse ordering direction, i.e. it begins with the job that
+         * is ordered before that first job, and ends with the first job itself. */
+
+        index = new(unsigned, g->n_jobs);
+        lowlink = new(unsigned, g->n_jobs);
+        parent = new(unsigned, g->n_jobs);
+        stack = new(unsigned, g->n_jobs);
+        component = new(unsigned, g->n_jobs);
+        next_edge = new(size_t, g->n_jobs);
+        on_stack = new0(bool, g->n_jobs);
+        if (!index || !lowlink || !parent || !stack || !component || !next_edge || !on_stack)
+                return -ENOMEM;
+
+        for (size_t i = 0; i < g->n_jobs; i++)
+                index[i] = component[i] = UINT_MAX;
+
+        for (unsigned root = 0; root < g->n_jobs && start == UINT_MAX; root++) {
+                unsigned v;
+
+                if (index[root] != UINT_MAX)
+                        continue;
+
+                /* Instead of recursing we remember where we came from in 'parent', and which edge to
+                 * look at next in 'next_edge'. */
+                parent[root] = UINT_MAX;
+                v = root;
+
+                for (;;) {
+                        unsigned w;
+
+                        if (index[v] == UINT_MAX) {
+                                index[v] = lowlink[v] = n_index++;
+                                next_edge[v] = g->edge_offsets[v];
+                                stack[n_stack++] = v;
+                                on_stack[v] = true;
+                        }
+
+                        if (next_edge[v] < g->edge_offsets[v + 1]) {
+                                w = g->edges[next_edge[v]++];
+
+                                if (index[w] == UINT_MAX) {
+                                        parent[w] = v;
+                                        v = w;
+                                } else if (on_stack[w])
+                                        lowlink[v] = MIN(lowlink[v], index[w]);
+
+                                continue;
+                        }
+
+                        /* All edges of v done. If it is the root of a component, pop the component. */
+                        if (lowlink[v] == index[v]) {
+                                unsigned first = v;
+                                bool cyclic = false;
+
+                                do {
+                                        w = stack[--n_stack];
+                                        on_stack[w] = false;
+                                        component[w] = v;
+                                        first = MIN(first, w);
+                                        if (w != v)
+                                                cyclic = true;
+                                } while (w != v);
+
+                                for (size_t e = g->edge_offsets[v]; !cyclic && e < g->edge_offsets[v + 1]; e++)
+                                        if (g->edges[e] == v)
+                                                cyclic = true;
+
+                                if (cyclic) {
+                                        start = first;
+                                        break;
+                                }
+                        }
+
+                        w = v;
+                        v = parent[w];
+                        if (v == UINT_MAX)
+                                break;
+
+                        lowlink[v] = MIN(lowlink[v], lowlink[w]);
+                }
+        }
+
+        if (start == UINT_MAX) {
+                *ret_path = NULL;
+                *ret_n_path = 0;
+                return 0;
+        }
+
+        /* Now find the shortest way from the first job of the component back to itself, breadth first. We
+         * don't need the DFS state anymore, hence reuse the arrays. */
+        queue = stack;
+        prev = parent;
+        for (size_t i = 0; i < g->n_jobs; i++)
+                prev[i] = UINT_MAX;
+
+        queue[n_queue++] = start;
+        for (size_t q = 0; q < n_queue; q++) {
+                unsigned v = queue[q];
+
+                for (size_t e = g->edge_offsets[v]; e < g->edge_offsets[v + 1]; e++) {
+                        unsigned w = g->edges[e];
+
+                        if (w == start) {
+                                /* Found our way back. Walk it backwards. */
+                                n_path = 1;
+                                for (unsigned k = v; k != start; k = prev[k])
+                                        n_path++;
+
+                                path = new(unsigned, n_path);
+                                if (!path)
+                                        return -ENOMEM;
+
+                                n_path = 0;
+                                for (unsigned k = v; k != start; k = prev[k])
+                                        path[n_path++] = k;
+                                path[n_path++] = start;
+
+                                *ret_path = path;
+                                *ret_n_path = n_path;
+                                return 1;
+                        }
+
+                        if (component[w] != component[start] || prev[w] != UINT_MAX)
+                                continue;
+
+                        prev[w] = v;
+                        queue[n_queue++] = w;
+                }
+        }
+
+        assert_not_reached("Cyclic component without cycle");
+}
+
+static int transaction_break_cycle(Transaction *tr, Job **path, size_t n_path, sd_bus_error *e) {
+        _cleanup_free_ char **array = NULL, *unit_ids = NULL;
+        char **unit_id, **job_type;
+        Job *j, *delete = NULL;
+
+        assert(tr);
+        assert(path);
+        assert(n_path > 0);
+
+        /* We have a cycle, let's try to break it. The path is in reverse order, and ends with the job
+         * where we noticed the cycle. Let's find a job on it we can remove. */
+
+        j = path[n_path - 1];
+
+        for (size_t i = 0; i < n_path; i++) {
+                Job *k = path[i];
+
+                /* For logging below */
+                if (strv_push_pair(&array, k->unit->id, (char*) job_type_to_string(k->type)) < 0)
+                        log_oom();
+
+                if (!delete && hashmap_get(tr->jobs, k->unit) && !unit_matters_to_anchor(k->unit, k))
+                        /* Ok, we can drop this one, so let's do so. */
+                        delete = k;
+        }
+
+        unit_ids = merge_unit_ids(j->manager->unit_log_field, array); /* ignore error */
+
+        STRV_FOREACH_PAIR(unit_id, job_type, array)
+                /* logging for j not k here to provide a consistent narrative */
+                log_struct(LOG_WARNING,
+                           "MESSAGE=%s: Found %s on %s/%s",
+                           j->unit->id,
+                           unit_id == array ? "ordering cycle" : "dependency",
+                           *unit_id, *job_type,
+                           unit_ids);
+
+        if (delete) {
+                const char *status;
+                /* logging for j not k here to provide a consistent narrative */
+                log_struct(LOG_ERR,
+                           "MESSAGE=%s: Job %s/%s deleted to break ordering cycle starting with %s/%s",
+                           j->unit->id, delete->unit->id, job_type_to_string(delete->type),
+                           j->unit->id, job_type_to_string(j->type),
+                           unit_ids);
+
+                if (log_get_show_color())
+                        status = ANSI_HIGHLIGHT_RED " SKIP " ANSI_NORMAL;
+                else
+                        status = " SKIP ";
+
+                unit_status_printf(delete->unit,
+                                   STATUS_TYPE_NOTICE,
+                                   status,
+                                   "Ordering cycle found, skipping %s");
+                transaction_delete_unit(tr, delete->unit);
+                return -EAGAIN;
+        }
+
+        log_struct(LOG_ERR,
+                   "MESSAGE=%s: Unable to break cycle starting with %s/%s",
+                   j->unit->id, j->unit->id, job_type_to_string(j->type),
+                   unit_ids);
+
+        return sd_bus_error_setf(e, BUS_ERROR_TRANSACTION_ORDER_IS_CYCLIC,
+                                 "Transaction order is cyclic. See system logs for details.");
+}
+
+static int transaction_verify_order(Transaction *tr, unsigned *generation, sd_bus_error *e) {
+        _cleanup_(order_graph_done) OrderGraph g = {};
+        _cleanup_free_ unsigned *cycle = NULL;
+        _cleanup_free_ Job **path = NULL;
+        size_t n_cycle;
         int r;
-        unsigned g;
 
         assert(tr);
         assert(generation);
@@ -492,15 +710,24 @@ static int transaction_verify_order(Transaction *tr, unsigned *generation, sd_bu
         /* Check if the ordering graph is cyclic. If it is, try to fix
          * that up by dropping one of the jobs. */
 
-        g = (*generation)++;
+        r = order_graph_build(&g, tr, (*generation)++);
+        if (r < 0)
+                return sd_bus_error_set_errnof(e, r, "Failed to build ordering graph of transaction: %m");
 
-        HASHMAP_FOREACH(j, tr->jobs) {
-                r = transaction_verify_order_one(tr, j, NULL, g, e);
-                if (r < 0)
-                        return r;
-        }
+        r = order_graph_find_cycle(&g, &cycle, &n_cycle);
+        if (r < 0)
+                return sd_bus_error_set_errnof(e, r, "Failed to look for ordering cycles in transaction: %m");
+        if (r == 0)
+                return 0;
 
-        return 0;
+        path = new(Job*, n_cycle);
+        if (!path)
+                return sd_bus_error_set_errno(e, -ENOMEM);
+
+        for (size_t i = 0; i < n_cycle; i++)
+                path[i] = g.jobs[cycle[i]];
+
+        return transaction_break_cycle(tr, path, n_cycle, e);
 }
 
 static void transaction_collect_garbage(Transaction *tr) {
@@ -740,6 +967,10 @@ int transaction_activate(
                 if (r >= 0)
                         break;
 
+                /* Building the ordering graph might fail with OOM, which is not about the ordering itself */
+                if (r == -ENOMEM)
+                        return log_oom();
+
                 if (r != -EAGAIN)
                         return log_warning_errno(r, "Requested transaction contains an unfixable cyclic ordering dependency: %s", bus_error_message(e, r));
 
@@ -826,7 +1057,6 @@ static Job* transaction_add_one_job(Transaction *tr, JobType type, Unit *unit, b
                 return NULL;
 
         j->generation = 0;
-        j->marker = NULL;
         j->matters_to_anchor = false;
         j->irreversible = tr->irreversible;
 
@@ -883,13 +1113,12 @@ static void transaction_unlink_job(Transaction *tr, Job *j, bool delete_dependen
 void transaction_add_propagate_reload_jobs(Transaction *tr, Unit *unit, Job *by, bool ignore_order, sd_bus_error *e) {
         JobType nt;
         Unit *dep;
-        void *v;
         int r;
 
         assert(tr);
         assert(unit);
 
-        HASHMAP_FOREACH_KEY(v, dep, unit->dependencies[UNIT_PROPAGATES_RELOAD_TO]) {
+        UNIT_FOREACH_DEPENDENCY(dep, unit, UNIT_PROPAGATES_RELOAD_TO) {
                 nt = job_type_collapse(JOB_TRY_RELOAD, dep);
                 if (nt == JOB_NOP)
                         continue;
@@ -918,7 +1147,6 @@ int transaction_add_job_and_dependencies(
         bool is_new;
         Unit *dep;
         Job *ret;
-        void *v;
         int r;
 
         assert(tr);
@@ -1010,7 +1238,7 @@ int transaction_add_job_and_dependencies(
 
                 /* Finally, recursively add in all dependencies. */
                 if (IN_SET(type, JOB_START, JOB_RESTART)) {
-                        HASHMAP_FOREACH_KEY(v, dep, ret->unit->dependencies[UNIT_REQUIRES]) {
+                        UNIT_FOREACH_DEPENDENCY(dep, ret->unit, UNIT_REQUIRES) {
                                 r = transaction_add_job_and_dependencies(tr, JOB_START, dep, ret, true, false, false, ignore_order, e);
                                 if (r < 0) {
                                         if (r != -EBADR) /* job type not applicable */
@@ -1020,7 +1248,7 @@ int transaction_add_job_and_dependencies(
                                 }
                         }
 
-                        HASHMAP_FOREACH_KEY(v, dep, ret->unit->dependencies[UNIT_BINDS_TO]) {
+                        UNIT_FOREACH_DEPENDENCY(dep, ret->unit, UNIT_BINDS_TO) {
                                 r = transaction_add_job_and_dependencies(tr, JOB_START, dep, ret, true, false, false, ignore_order, e);
                                 if (r < 0) {
                                         if (r != -EBADR) /* job type not applicable */
@@ -1030,7 +1258,7 @@ int transaction_add_job_and_dependencies(
                                 }
                         }
 
-                        HASHMAP_FOREACH_KEY(v, dep, ret->unit->dependencies[UNIT_WANTS]) {
+                        UNIT_FOREACH_DEPENDENCY(dep, ret->unit, UNIT_WANTS) {
                                 r = transaction_add_job_and_dependencies(tr, JOB_START, dep, ret, false, false, false, ignore_order, e);
                                 if (r < 0) {
                                         /* unit masked, job type not applicable and unit not found are not considered as errors. */
@@ -1042,7 +1270,7 @@ int transaction_add_job_and_dependencies(
                                 }
                         }
 
-                        HASHMAP_FOREACH_KEY(v, dep, ret->unit->dependencies[UNIT_REQUISITE]) {
+                        UNIT_FOREACH_DEPENDENCY(dep, ret->unit, UNIT_REQUISITE) {
                                 r = transaction_add_job_and_dependencies(tr, JOB_VERIFY_ACTIVE, dep, ret, true, false, false, ignore_order, e);
                                 if (r < 0) {
                                         if (r != -EBADR) /* job type not applicable */
@@ -1052,7 +1280,7 @@ int transaction_add_job_and_dependencies(
                                 }
                         }
 
-                        HASHMAP_FOREACH_KEY(v, dep, ret->unit->dependencies[UNIT_CONFLICTS]) {
+                        UNIT_FOREACH_DEPENDENCY(dep, ret->unit, UNIT_CONFLICTS) {
                                 r = transaction_add_job_and_dependencies(tr, JOB_STOP, dep, ret, true, true, false, ignore_order, e);
                                 if (r < 0) {
                                         if (r != -EBADR) /* job type not applicable */
@@ -1062,7 +1290,7 @@ int transaction_add_job_and_dependencies(
                                 }
                         }
 
-                        HASHMAP_FOREACH_KEY(v, dep, ret->unit->dependencies[UNIT_CONFLICTED_BY]) {
+                        UNIT_FOREACH_DEPENDENCY(dep, ret->unit, UNIT_CONFLICTED_BY) {
                                 r = transaction_add_job_and_dependencies(tr, JOB_STOP, dep, ret, false, false, false, ignore_order, e);
                                 if (r < 0) {
                                         log_unit_warning(dep,
@@ -1091,7 +1319,7 @@ int transaction_add_job_and_dependencies(
                         ptype = type == JOB_RESTART ? JOB_TRY_RESTART : type;
 
                         for (j = 0; j < ELEMENTSOF(propagate_deps); j++)
-                                HASHMAP_FOREACH_KEY(v, dep, ret->unit->dependencies[propagate_deps[j]]) {
+                                UNIT_FOREACH_DEPENDENCY(dep, ret->unit, propagate_deps[j]) {
                                         JobType nt;
 
                                         nt = job_type_collapse(ptype, dep);
@@ -1154,14 +1382,13 @@ int transaction_add_isolate_jobs(Transaction *tr, Manager *m) {
 }
 
 int transaction_add_triggering_jobs(Transaction *tr, Unit *u) {
-        void *v;
         Unit *trigger;
         int r;
 
         assert(tr);
         assert(u);
 
-        HASHMAP_FOREACH_KEY(v, trigger, u->dependencies[UNIT_TRIGGERED_BY]) {
+        UNIT_FOREACH_DEPENDENCY(trigger, u, UNIT_TRIGGERED_BY) {
                 /* No need to stop inactive jobs */
                 if (UNIT_IS_INACTIVE_OR_FAILED(unit_active_state(trigger)) && !trigger->job)
                         continue;
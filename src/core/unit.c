@@ -3,6 +3,7 @@
 #include <errno.h>
 #include <stdlib.h>
 #include <sys/prctl.h>
+#include <sys/wait.h>
 #include <unistd.h>
 
 #include "sd-id128.h"
@@ -68,6 +69,9 @@
 #define NOTICEWORTHY_IO_BYTES (10 * 1024 * 1024ULL)  /* 10 MB */
 #define NOTICEWORTHY_IP_BYTES (128 * 1024 * 1024ULL) /* 128 MB */
 
+/* Units with fewer dependencies than this look them up by walking the array, see unit_dependency_find() */
+#define UNIT_DEPENDENCIES_INDEX_MIN 32U
+
 const UnitVTable * const unit_vtable[_UNIT_TYPE_MAX] = {
         [UNIT_SERVICE] = &service_vtable,
         [UNIT_SOCKET] = &socket_vtable,
@@ -505,22 +509,252 @@ void unit_submit_to_stop_when_unneeded_queue(Unit *u) {
         u->in_stop_when_unneeded_queue = true;
 }
 
-static void bidi_set_free(Unit *u, Hashmap *h) {
-        Unit *other;
-        void *v;
+static void unit_dependency_entry_hash_func(const UnitDependencyEntry *e, struct siphash *state) {
+        UnitDependency d = e->type;
+
+        siphash24_compress(&e->other, sizeof(e->other), state);
+        siphash24_compress(&d, sizeof(d), state);
+}
+
+static uint64_t unit_dependency_entry_trusted_hash_func(const UnitDependencyEntry *e, const uint8_t key[static 16]) {
+        /* Entries for the same unit end up in neighbouring buckets, which is fine for linear probing */
+        return trusted_pointer_hash_func(e->other, key) + (uint64_t) e->type;
+}
+
+static int unit_dependency_entry_compare_func(const UnitDependencyEntry *a, const UnitDependencyEntry *b) {
+        UnitDependency x = a->type, y = b->type;
+
+        return CMP(a->other, b->other) ?: CMP(x, y);
+}
+
+static const struct hash_ops unit_dependency_entry_hash_ops = {
+        .hash = (hash_func_t) unit_dependency_entry_hash_func,
+        .compare = (compare_func_t) unit_dependency_entry_compare_func,
+        .trusted_hash = (trusted_hash_func_t) unit_dependency_entry_trusted_hash_func,
+};
+
+static void unit_dependencies_reindex(Unit *u) {
+        int r;
 
         assert(u);
 
-        /* Frees the hashmap and makes sure we are dropped from the inverse pointers */
+        /* (Re-)builds the index of the dependencies array, which refers to the entries by pointer. The index is
+         * just an optimization: if we fail to build it, we look up entries by walking the array instead. */
 
-        HASHMAP_FOREACH_KEY(v, other, h) {
-                for (UnitDependency d = 0; d < _UNIT_DEPENDENCY_MAX; d++)
-                        hashmap_remove(other->dependencies[d], u);
+        if (u->n_dependencies < UNIT_DEPENDENCIES_INDEX_MIN) {
+                u->dependencies_index = set_free(u->dependencies_index);
+                return;
+        }
 
-                unit_add_to_gc_queue(other);
+        set_clear(u->dependencies_index);
+
+        r = set_ensure_allocated(&u->dependencies_index, &unit_dependency_entry_hash_ops);
+        if (r < 0)
+                return;
+
+        r = set_reserve(u->dependencies_index, u->n_dependencies);
+        if (r < 0)
+                goto fail;
+
+        for (UnitDependency d = 0; d < _UNIT_DEPENDENCY_MAX; d++)
+                for (UnitDependencyEntry *e = unit_dependencies_begin(u, d); e < unit_dependencies_end(u, d); e++) {
+                        r = set_put(u->dependencies_index, e);
+                        if (r < 0)
+                                goto fail;
+                }
+
+        return;
+
+fail:
+        u->dependencies_index = set_free(u->dependencies_index);
+}
+
+UnitDependencyEntry* unit_dependency_find(Unit *u, UnitDependency d, Unit *other) {
+        assert(u);
+        assert(d >= 0 && d < _UNIT_DEPENDENCY_MAX);
+        assert(other);
+
+        if (u->dependencies_index)
+                return set_get(u->dependencies_index, &(UnitDependencyEntry) { .other = other, .type = d });
+
+        for (UnitDependencyEntry *e = unit_dependencies_begin(u, d); e < unit_dependencies_end(u, d); e++)
+                if (e->other == other)
+                        return e;
+
+        return NULL;
+}
+
+unsigned unit_count_dependencies(Unit *u, UnitDependency d) {
+        assert(u);
+        assert(d >= 0 && d < _UNIT_DEPENDENCY_MAX);
+
+        return u->dependency_ranges[d].n;
+}
+
+static size_t unit_dependencies_room(Unit *u, UnitDependency d) {
+        assert(u);
+
+        /* Returns how many entries of type d fit before we run into the next type's range */
+
+        return (d + 1 < _UNIT_DEPENDENCY_MAX ? u->dependency_ranges[d + 1].offset : u->n_dependencies_allocated) -
+                u->dependency_ranges[d].offset;
+}
+
+static int unit_dependencies_reserve(Unit *u, UnitDependency d, size_t n_add) {
+        size_t room, need, delta;
+        UnitDependencyEntry *p;
+
+        assert(u);
+        assert(d >= 0 && d < _UNIT_DEPENDENCY_MAX);
+
+        /* Makes sure n_add more entries of type d can be added without moving the array. Otherwise grows the
+         * range of this type, at least to twice its size, by moving up the ranges of all later types. The order
+         * of the entries within each type is kept, so that iterating through them continues to work. */
+
+        room = unit_dependencies_room(u, d);
+        need = u->dependency_ranges[d].n + n_add;
+        if (need <= room)
+                return 0;
+
+        delta = MAX(need, room * 2) - room;
+        if (u->n_dependencies_allocated + delta > UINT_MAX)
+                return -ENOMEM;
+
+        p = reallocarray(u->dependencies, u->n_dependencies_allocated + delta, sizeof(UnitDependencyEntry));
+        if (!p)
+                return -ENOMEM;
+
+        u->dependencies = p;
+        u->n_dependencies_allocated += delta;
+
+        for (UnitDependency k = _UNIT_DEPENDENCY_MAX - 1; k > d; k--) {
+                memmove(unit_dependencies_begin(u, k) + delta,
+                        unit_dependencies_begin(u, k),
+                        u->dependency_ranges[k].n * sizeof(UnitDependencyEntry));
+                u->dependency_ranges[k].offset += delta;
+        }
+
+        /* All entries moved, hence the index needs to be rebuilt */
+        if (u->dependencies_index)
+                unit_dependencies_reindex(u);
+
+        return 0;
+}
+
+static int unit_dependency_add(
+                Unit *u,
+                UnitDependency d,
+                Unit *other,
+                UnitDependencyMask origin_mask,
+                UnitDependencyMask destination_mask) {
+
+        UnitDependencyEntry *e;
+        int r;
+
+        assert(u);
+        assert(!unit_dependency_find(u, d, other));
+
+        r = unit_dependencies_reserve(u, d, 1);
+        if (r < 0)
+                return r;
+
+        e = unit_dependencies_end(u, d);
+        *e = (UnitDependencyEntry) {
+                .other = other,
+                .type = d,
+                .origin_mask = origin_mask,
+                .destination_mask = destination_mask,
+        };
+        u->dependency_ranges[d].n++;
+        u->n_dependencies++;
+
+        if (!u->dependencies_index) {
+                if (u->n_dependencies >= UNIT_DEPENDENCIES_INDEX_MIN)
+                        unit_dependencies_reindex(u);
+        } else if (set_put(u->dependencies_index, e) < 0)
+                u->dependencies_index = set_free(u->dependencies_index);
+
+        return 0;
+}
+
+static void unit_dependency_remove(Unit *u, UnitDependencyEntry *e) {
+        UnitDependencyEntry *last;
+        UnitDependency d;
+
+        assert(u);
+        assert(e);
+
+        d = e->type;
+        assert(e >= unit_dependencies_begin(u, d) && e < unit_dependencies_end(u, d));
+
+        last = unit_dependencies_end(u, d) - 1;
+
+        if (u->dependencies_index) {
+                assert_se(set_remove(u->dependencies_index, e) == e);
+                if (e != last)
+                        assert_se(set_remove(u->dependencies_index, last) == last);
+        }
+
+        /* Fill the hole with the last entry of the same type, see unit_dependency_iterate() */
+        if (e != last)
+                *e = *last;
+        u->dependency_ranges[d].n--;
+        u->n_dependencies--;
+
+        if (u->dependencies_index && e != last && set_put(u->dependencies_index, e) < 0)
+                u->dependencies_index = set_free(u->dependencies_index);
+}
+
+static void unit_dependency_set_other(Unit *u, UnitDependencyEntry *e, Unit *other) {
+        assert(u);
+        assert(e);
+        assert(other);
+
+        if (u->dependencies_index)
+                assert_se(set_remove(u->dependencies_index, e) == e);
+
+        e->other = other;
+
+        if (u->dependencies_index && set_put(u->dependencies_index, e) < 0)
+                u->dependencies_index = set_free(u->dependencies_index);
+}
+
+static void unit_remove_dependencies_on(Unit *u, Unit *other) {
+        assert(u);
+        assert(other);
+
+        /* Removes all dependencies of any type u has on other */
+
+        for (UnitDependency d = 0; d < _UNIT_DEPENDENCY_MAX; d++) {
+                UnitDependencyEntry *e;
+
+                e = unit_dependency_find(u, d, other);
+                if (e)
+                        unit_dependency_remove(u, e);
         }
+}
+
+static void unit_dependencies_done(Unit *u) {
+        assert(u);
 
-        hashmap_free(h);
+        u->dependencies = mfree(u->dependencies);
+        u->n_dependencies = u->n_dependencies_allocated = 0;
+        zero(u->dependency_ranges);
+        u->dependencies_index = set_free(u->dependencies_index);
+}
+
+static void unit_free_dependencies(Unit *u) {
+        assert(u);
+
+        /* Frees all dependencies and makes sure we are dropped from the inverse pointers */
+
+        for (UnitDependency d = 0; d < _UNIT_DEPENDENCY_MAX; d++)
+                for (UnitDependencyEntry *e = unit_dependencies_begin(u, d); e < unit_dependencies_end(u, d); e++) {
+                        unit_remove_dependencies_on(e->other, u);
+                        unit_add_to_gc_queue(e->other);
+                }
+
+        unit_dependencies_done(u);
 }
 
 static void unit_remove_transient(Unit *u) {
@@ -653,8 +887,7 @@ void unit_free(Unit *u) {
                 job_free(j);
         }
 
-        for (UnitDependency d = 0; d < _UNIT_DEPENDENCY_MAX; d++)
-                bidi_set_free(u, u->dependencies[d]);
+        unit_free_dependencies(u);
 
         /* A unit is being dropped from the tree, make sure our family is realized properly. Do this after we
          * detach the unit from slice tree in order to eliminate its effect on controller masks. */
@@ -797,21 +1030,6 @@ const char* unit_sub_state_to_string(Unit *u) {
         return UNIT_VTABLE(u)->sub_state_to_string(u);
 }
 
-static int hashmap_complete_move(Hashmap **s, Hashmap **other) {
-        assert(s);
-        assert(other);
-
-        if (!*other)
-                return 0;
-
-        if (*s)
-                return hashmap_move(*s, *other);
-        else
-                *s = TAKE_PTR(*other);
-
-        return 0;
-}
-
 static int merge_names(Unit *u, Unit *other) {
         char *name;
         int r;
@@ -838,83 +1056,67 @@ static int merge_names(Unit *u, Unit *other) {
         return 0;
 }
 
-static int reserve_dependencies(Unit *u, Unit *other, UnitDependency d) {
-        unsigned n_reserve;
-
-        assert(u);
-        assert(other);
-        assert(d < _UNIT_DEPENDENCY_MAX);
-
-        /*
-         * If u does not have this dependency set allocated, there is no need
-         * to reserve anything. In that case other's set will be transferred
-         * as a whole to u by complete_move().
-         */
-        if (!u->dependencies[d])
-                return 0;
-
-        /* merge_dependencies() will skip a u-on-u dependency */
-        n_reserve = hashmap_size(other->dependencies[d]) - !!hashmap_get(other->dependencies[d], u);
+static void merge_dependencies(Unit *u, Unit *other, const char *other_id) {
+        UnitDependencyEntry *e;
 
-        return hashmap_reserve(u->dependencies[d], n_reserve);
-}
-
-static void merge_dependencies(Unit *u, Unit *other, const char *other_id, UnitDependency d) {
-        Unit *back;
-        void *v;
-        int r;
-
-        /* Merges all dependencies of type 'd' of the unit 'other' into the deps of the unit 'u' */
+        /* Merges all dependencies of the unit 'other' into the deps of the unit 'u' */
 
         assert(u);
         assert(other);
-        assert(d < _UNIT_DEPENDENCY_MAX);
 
         /* Fix backwards pointers. Let's iterate through all dependent units of the other unit. */
-        HASHMAP_FOREACH_KEY(v, back, other->dependencies[d])
-
-                /* Let's now iterate through the dependencies of that dependencies of the other units,
-                 * looking for pointers back, and let's fix them up, to instead point to 'u'. */
-                for (UnitDependency k = 0; k < _UNIT_DEPENDENCY_MAX; k++)
-                        if (back == u) {
-                                /* Do not add dependencies between u and itself. */
-                                if (hashmap_remove(back->dependencies[k], other))
-                                        maybe_warn_about_dependency(u, other_id, k);
-                        } else {
-                                UnitDependencyInfo di_u, di_other;
+        for (UnitDependency d = 0; d < _UNIT_DEPENDENCY_MAX; d++)
+                for (e = unit_dependencies_begin(other, d); e < unit_dependencies_end(other, d); e++) {
+                        Unit *back = e->other;
 
-                                /* Let's drop this dependency between "back" and "other", and let's create it between
-                                 * "back" and "u" instead. Let's merge the bit masks of the dependency we are moving,
-                                 * and any such dependency which might already exist */
+                        /* Let's now iterate through the dependencies of that dependencies of the other units,
+                         * looking for pointers back, and let's fix them up, to instead point to 'u'. */
+                        for (UnitDependency k = 0; k < _UNIT_DEPENDENCY_MAX; k++) {
+                                UnitDependencyEntry *f, *g;
 
-                                di_other.data = hashmap_get(back->dependencies[k], other);
-                                if (!di_other.data)
+                                f = unit_dependency_find(back, k, other);
+                                if (!f)
                                         continue; /* dependency isn't set, let's try the next one */
 
-                                di_u.data = hashmap_get(back->dependencies[k], u);
-
-                                UnitDependencyInfo di_merged = {
-                                        .origin_mask = di_u.origin_mask | di_other.origin_mask,
-                                        .destination_mask = di_u.destination_mask | di_other.destination_mask,
-                                };
-
-                                r = hashmap_remove_and_replace(back->dependencies[k], other, u, di_merged.data);
-                                if (r < 0)
-                                        log_warning_errno(r, "Failed to remove/replace: back=%s other=%s u=%s: %m", back->id, other_id, u->id);
-                                assert(r >= 0);
+                                if (back == u) {
+                                        /* Do not add dependencies between u and itself. */
+                                        unit_dependency_remove(back, f);
+                                        maybe_warn_about_dependency(u, other_id, k);
+                                        continue;
+                                }
 
-                                /* assert_se(hashmap_remove_and_replace(back->dependencies[k], other, u, di_merged.data) >= 0); */
+                                /* Let's drop this dependency between "back" and "other", and let's create it
+                                 * between "back" and "u" instead. Let's merge the bit masks of the dependency we
+                                 * are moving, and any such dependency which might already exist */
+
+                                g = unit_dependency_find(back, k, u);
+                                if (g) {
+                                        g->origin_mask |= f->origin_mask;
+                                        g->destination_mask |= f->destination_mask;
+                                        unit_dependency_remove(back, f);
+                                } else
+                                        unit_dependency_set_other(back, f, u);
                         }
+                }
 
         /* Also do not move dependencies on u to itself */
-        back = hashmap_remove(other->dependencies[d], u);
-        if (back)
+        for (UnitDependency d = 0; d < _UNIT_DEPENDENCY_MAX; d++) {
+                e = unit_dependency_find(other, d, u);
+                if (!e)
+                        continue;
+
                 maybe_warn_about_dependency(u, other_id, d);
+                unit_dependency_remove(other, e);
+        }
 
-        /* The move cannot fail. The caller must have performed a reservation. */
-        assert_se(hashmap_complete_move(&u->dependencies[d], &other->dependencies[d]) == 0);
+        /* Dependencies u already has take precedence. This cannot fail, the caller must have performed a
+         * reservation. */
+        for (UnitDependency d = 0; d < _UNIT_DEPENDENCY_MAX; d++)
+                for (e = unit_dependencies_begin(other, d); e < unit_dependencies_end(other, d); e++)
+                        if (!unit_dependency_find(u, d, e->other))
+                                assert_se(unit_dependency_add(u, d, e->other, e->origin_mask, e->destination_mask) >= 0);
 
-        other->dependencies[d] = hashmap_free(other->dependencies[d]);
+        unit_dependencies_done(other);
 }
 
 int unit_merge(Unit *u, Unit *other) {
@@ -955,13 +1157,10 @@ int unit_merge(Unit *u, Unit *other) {
         if (other->id)
                 other_id = strdupa(other->id);
 
-        /* Make reservations to ensure merge_dependencies() won't fail */
+        /* Make a reservation to ensure merge_dependencies() won't fail. We don't rollback the reservation if we
+         * fail. A reservation is not a leak. */
         for (UnitDependency d = 0; d < _UNIT_DEPENDENCY_MAX; d++) {
-                r = reserve_dependencies(u, other, d);
-                /*
-                 * We don't rollback reservations if we fail. We don't have
-                 * a way to undo reservations. A reservation is not a leak.
-                 */
+                r = unit_dependencies_reserve(u, d, other->dependency_ranges[d].n);
                 if (r < 0)
                         return r;
         }
@@ -976,8 +1175,7 @@ int unit_merge(Unit *u, Unit *other) {
                 unit_ref_set(other->refs_by_target, other->refs_by_target->source, u);
 
         /* Merge dependencies */
-        for (UnitDependency d = 0; d < _UNIT_DEPENDENCY_MAX; d++)
-                merge_dependencies(u, other, other_id, d);
+        merge_dependencies(u, other, other_id);
 
         other->load_state = UNIT_MERGED;
         other->merged_into = u;
@@ -1365,7 +1563,7 @@ void unit_dump(Unit *u, FILE *f, const char *prefix) {
                 UnitDependencyInfo di;
                 Unit *other;
 
-                HASHMAP_FOREACH_KEY(di.data, other, u->dependencies[d]) {
+                UNIT_FOREACH_DEPENDENCY_INFO(other, di, u, d) {
                         bool space = false;
 
                         fprintf(f, "%s\t%s: %s (", prefix, unit_dependency_to_string(d), other->id);
@@ -1499,7 +1697,7 @@ int unit_add_default_target_dependency(Unit *u, Unit *target) {
                 return 0;
 
         /* Don't create loops */
-        if (hashmap_get(target->dependencies[UNIT_BEFORE], u))
+        if (unit_has_dependency(target, UNIT_BEFORE, u))
                 return 0;
 
         return unit_add_dependency(target, UNIT_AFTER, u, true, UNIT_DEPENDENCY_DEFAULT);
@@ -1667,7 +1865,7 @@ int unit_load(Unit *u) {
                 if (r < 0)
                         goto fail;
 
-                if (u->on_failure_job_mode == JOB_ISOLATE && hashmap_size(u->dependencies[UNIT_ON_FAILURE]) > 1) {
+                if (u->on_failure_job_mode == JOB_ISOLATE && unit_count_dependencies(u, UNIT_ON_FAILURE) > 1) {
                         r = log_unit_error_errno(u, SYNTHETIC_ERRNO(ENOEXEC),
                                                  "More than one OnFailure= dependencies specified but OnFailureJobMode=isolate set. Refusing.");
                         goto fail;
@@ -1825,7 +2023,6 @@ bool unit_shall_confirm_spawn(Unit *u) {
 
 static bool unit_verify_deps(Unit *u) {
         Unit *other;
-        void *v;
 
         assert(u);
 
@@ -1834,9 +2031,9 @@ static bool unit_verify_deps(Unit *u) {
          * processing, but do not have any effect afterwards. We don't check BindsTo= dependencies that are not used in
          * conjunction with After= as for them any such check would make things entirely racy. */
 
-        HASHMAP_FOREACH_KEY(v, other, u->dependencies[UNIT_BINDS_TO]) {
+        UNIT_FOREACH_DEPENDENCY(other, u, UNIT_BINDS_TO) {
 
-                if (!hashmap_contains(u->dependencies[UNIT_AFTER], other))
+                if (!unit_has_dependency(u, UNIT_AFTER, other))
                         continue;
 
                 if (!UNIT_IS_ACTIVE_OR_RELOADING(unit_active_state(other))) {
@@ -2050,7 +2247,7 @@ bool unit_can_reload(Unit *u) {
         if (UNIT_VTABLE(u)->can_reload)
                 return UNIT_VTABLE(u)->can_reload(u);
 
-        if (!hashmap_isempty(u->dependencies[UNIT_PROPAGATES_RELOAD_TO]))
+        if (unit_has_dependencies(u, UNIT_PROPAGATES_RELOAD_TO))
                 return true;
 
         return UNIT_VTABLE(u)->reload;
@@ -2077,12 +2274,11 @@ bool unit_is_unneeded(Unit *u) {
 
         for (size_t j = 0; j < ELEMENTSOF(deps); j++) {
                 Unit *other;
-                void *v;
 
                 /* If a dependent unit has a job queued, is active or transitioning, or is marked for
                  * restart, then don't clean this one up. */
 
-                HASHMAP_FOREACH_KEY(v, other, u->dependencies[deps[j]]) {
+                UNIT_FOREACH_DEPENDENCY(other, u, deps[j]) {
                         if (other->job)
                                 return false;
 
@@ -2112,9 +2308,8 @@ static void check_unneeded_dependencies(Unit *u) {
 
         for (size_t j = 0; j < ELEMENTSOF(deps); j++) {
                 Unit *other;
-                void *v;
 
-                HASHMAP_FOREACH_KEY(v, other, u->dependencies[deps[j]])
+                UNIT_FOREACH_DEPENDENCY(other, u, deps[j])
                         unit_submit_to_stop_when_unneeded_queue(other);
         }
 }
@@ -2123,7 +2318,6 @@ static void unit_check_binds_to(Unit *u) {
         _cleanup_(sd_bus_error_free) sd_bus_error error = SD_BUS_ERROR_NULL;
         bool stop = false;
         Unit *other;
-        void *v;
         int r;
 
         assert(u);
@@ -2134,7 +2328,7 @@ static void unit_check_binds_to(Unit *u) {
         if (unit_active_state(u) != UNIT_ACTIVE)
                 return;
 
-        HASHMAP_FOREACH_KEY(v, other, u->dependencies[UNIT_BINDS_TO]) {
+        UNIT_FOREACH_DEPENDENCY(other, u, UNIT_BINDS_TO) {
                 if (other->job)
                         continue;
 
@@ -2171,61 +2365,58 @@ static void unit_check_binds_to(Unit *u) {
 
 static void retroactively_start_dependencies(Unit *u) {
         Unit *other;
-        void *v;
 
         assert(u);
         assert(UNIT_IS_ACTIVE_OR_ACTIVATING(unit_active_state(u)));
 
-        HASHMAP_FOREACH_KEY(v, other, u->dependencies[UNIT_REQUIRES])
-                if (!hashmap_get(u->dependencies[UNIT_AFTER], other) &&
+        UNIT_FOREACH_DEPENDENCY(other, u, UNIT_REQUIRES)
+                if (!unit_has_dependency(u, UNIT_AFTER, other) &&
                     !UNIT_IS_ACTIVE_OR_ACTIVATING(unit_active_state(other)))
                         manager_add_job(u->manager, JOB_START, other, JOB_REPLACE, NULL, NULL, NULL);
 
-        HASHMAP_FOREACH_KEY(v, other, u->dependencies[UNIT_BINDS_TO])
-                if (!hashmap_get(u->dependencies[UNIT_AFTER], other) &&
+        UNIT_FOREACH_DEPENDENCY(other, u, UNIT_BINDS_TO)
+                if (!unit_has_dependency(u, UNIT_AFTER, other) &&
                     !UNIT_IS_ACTIVE_OR_ACTIVATING(unit_active_state(other)))
                         manager_add_job(u->manager, JOB_START, other, JOB_REPLACE, NULL, NULL, NULL);
 
-        HASHMAP_FOREACH_KEY(v, other, u->dependencies[UNIT_WANTS])
-                if (!hashmap_get(u->dependencies[UNIT_AFTER], other) &&
+        UNIT_FOREACH_DEPENDENCY(other, u, UNIT_WANTS)
+                if (!unit_has_dependency(u, UNIT_AFTER, other) &&
                     !UNIT_IS_ACTIVE_OR_ACTIVATING(unit_active_state(other)))
                         manager_add_job(u->manager, JOB_START, other, JOB_FAIL, NULL, NULL, NULL);
 
-        HASHMAP_FOREACH_KEY(v, other, u->dependencies[UNIT_CONFLICTS])
+        UNIT_FOREACH_DEPENDENCY(other, u, UNIT_CONFLICTS)
                 if (!UNIT_IS_INACTIVE_OR_DEACTIVATING(unit_active_state(other)))
                         manager_add_job(u->manager, JOB_STOP, other, JOB_REPLACE, NULL, NULL, NULL);
 
-        HASHMAP_FOREACH_KEY(v, other, u->dependencies[UNIT_CONFLICTED_BY])
+        UNIT_FOREACH_DEPENDENCY(other, u, UNIT_CONFLICTED_BY)
                 if (!UNIT_IS_INACTIVE_OR_DEACTIVATING(unit_active_state(other)))
                         manager_add_job(u->manager, JOB_STOP, other, JOB_REPLACE, NULL, NULL, NULL);
 }
 
 static void retroactively_stop_dependencies(Unit *u) {
         Unit *other;
-        void *v;
 
         assert(u);
         assert(UNIT_IS_INACTIVE_OR_DEACTIVATING(unit_active_state(u)));
 
         /* Pull down units which are bound to us recursively if enabled */
-        HASHMAP_FOREACH_KEY(v, other, u->dependencies[UNIT_BOUND_BY])
+        UNIT_FOREACH_DEPENDENCY(other, u, UNIT_BOUND_BY)
                 if (!UNIT_IS_INACTIVE_OR_DEACTIVATING(unit_active_state(other)))
                         manager_add_job(u->manager, JOB_STOP, other, JOB_REPLACE, NULL, NULL, NULL);
 }
 
 void unit_start_on_failure(Unit *u) {
         Unit *other;
-        void *v;
         int r;
 
         assert(u);
 
-        if (hashmap_size(u->dependencies[UNIT_ON_FAILURE]) <= 0)
+        if (unit_count_dependencies(u, UNIT_ON_FAILURE) <= 0)
                 return;
 
         log_unit_info(u, "Triggering OnFailure= dependencies.");
 
-        HASHMAP_FOREACH_KEY(v, other, u->dependencies[UNIT_ON_FAILURE]) {
+        UNIT_FOREACH_DEPENDENCY(other, u, UNIT_ON_FAILURE) {
                 _cleanup_(sd_bus_error_free) sd_bus_error error = SD_BUS_ERROR_NULL;
 
                 r = manager_add_job(u->manager, JOB_START, other, u->on_failure_job_mode, NULL, &error, NULL);
@@ -2236,11 +2427,10 @@ void unit_start_on_failure(Unit *u) {
 
 void unit_trigger_notify(Unit *u) {
         Unit *other;
-        void *v;
 
         assert(u);
 
-        HASHMAP_FOREACH_KEY(v, other, u->dependencies[UNIT_TRIGGERED_BY])
+        UNIT_FOREACH_DEPENDENCY(other, u, UNIT_TRIGGERED_BY)
                 if (UNIT_VTABLE(other)->trigger_notify)
                         UNIT_VTABLE(other)->trigger_notify(other, u);
 }
@@ -2803,6 +2993,39 @@ int unit_watch_pid(Unit *u, pid_t pid, bool exclusive) {
         if (r < 0)
                 return r;
 
+        /* A PID exclusively ours is a child we just forked off. Watch it via a pidfd, so that its exit is
+         * routed to us directly, and signals can't hit a different process reusing the PID. */
+        if (exclusive) {
+                r = manager_watch_pidfd(u->manager, u, pid);
+                if (r < 0)
+                        log_unit_debug_errno(u, r, "Failed to watch PID "PID_FMT" via pidfd, relying on SIGCHLD: %m", pid);
+        }
+
+        return 0;
+}
+
+int unit_watch_pid_coldplug(Unit *u, pid_t pid) {
+        siginfo_t si = {};
+        int r;
+
+        assert(u);
+        assert(pid_is_valid(pid));
+
+        /* Like unit_watch_pid(), but for a PID from the deserialized state, which other units might watch
+         * too. The pidfds are gone after a reload or reexec. If the PID is still our unreaped child it
+         * can't have been reused, hence watch it via a pidfd again. */
+
+        r = unit_watch_pid(u, pid, false);
+        if (r < 0)
+                return r;
+
+        if (waitid(P_PID, pid, &si, WEXITED|WNOHANG|WNOWAIT) < 0)
+                return 0; /* Not our child, e.g. a daemon that double-forked, or already reaped */
+
+        r = manager_watch_pidfd(u->manager, u, pid);
+        if (r < 0)
+                log_unit_debug_errno(u, r, "Failed to watch PID "PID_FMT" via pidfd, relying on SIGCHLD: %m", pid);
+
         return 0;
 }
 
@@ -2834,6 +3057,8 @@ void unit_unwatch_pid(Unit *u, pid_t pid) {
         }
 
         (void) set_remove(u->pids, PID_TO_PTR(pid));
+
+        manager_unwatch_pidfd(u->manager, u, pid);
 }
 
 void unit_unwatch_all_pids(Unit *u) {
@@ -2985,49 +3210,37 @@ static void maybe_warn_about_dependency(Unit *u, const char *other, UnitDependen
                 log_unit_warning(u, "Dependency %s=%s dropped, merged into %s", unit_dependency_to_string(dependency), strna(other), u->id);
 }
 
-static int unit_add_dependency_hashmap(
-                Hashmap **h,
+static int unit_add_dependency_entry(
+                Unit *u,
+                UnitDependency d,
                 Unit *other,
                 UnitDependencyMask origin_mask,
                 UnitDependencyMask destination_mask) {
 
-        UnitDependencyInfo info;
+        UnitDependencyEntry *e;
         int r;
 
-        assert(h);
+        assert(u);
         assert(other);
         assert(origin_mask < _UNIT_DEPENDENCY_MASK_FULL);
         assert(destination_mask < _UNIT_DEPENDENCY_MASK_FULL);
         assert(origin_mask > 0 || destination_mask > 0);
 
-        r = hashmap_ensure_allocated(h, NULL);
-        if (r < 0)
-                return r;
-
-        assert_cc(sizeof(void*) == sizeof(info));
-
-        info.data = hashmap_get(*h, other);
-        if (info.data) {
+        e = unit_dependency_find(u, d, other);
+        if (e) {
                 /* Entry already exists. Add in our mask. */
 
-                if (FLAGS_SET(origin_mask, info.origin_mask) &&
-                    FLAGS_SET(destination_mask, info.destination_mask))
+                if (FLAGS_SET(origin_mask, e->origin_mask) &&
+                    FLAGS_SET(destination_mask, e->destination_mask))
                         return 0; /* NOP */
 
-                info.origin_mask |= origin_mask;
-                info.destination_mask |= destination_mask;
-
-                r = hashmap_update(*h, other, info.data);
+                e->origin_mask |= origin_mask;
+                e->destination_mask |= destination_mask;
         } else {
-                info = (UnitDependencyInfo) {
-                        .origin_mask = origin_mask,
-                        .destination_mask = destination_mask,
-                };
-
-                r = hashmap_put(*h, other, info.data);
+                r = unit_dependency_add(u, d, other, origin_mask, destination_mask);
+                if (r < 0)
+                        return r;
         }
-        if (r < 0)
-                return r;
 
         return 1;
 }
@@ -3102,14 +3315,14 @@ int unit_add_dependency(
                 return log_unit_error_errno(u, SYNTHETIC_ERRNO(EINVAL),
                                             "Requested dependency TriggeredBy=%s refused (%s units cannot trigger other units).", other->id, unit_type_to_string(other->type));
 
-        r = unit_add_dependency_hashmap(u->dependencies + d, other, mask, 0);
+        r = unit_add_dependency_entry(u, d, other, mask, 0);
         if (r < 0)
                 return r;
         else if (r > 0)
                 noop = false;
 
         if (inverse_table[d] != _UNIT_DEPENDENCY_INVALID && inverse_table[d] != d) {
-                r = unit_add_dependency_hashmap(other->dependencies + inverse_table[d], u, 0, mask);
+                r = unit_add_dependency_entry(other, inverse_table[d], u, 0, mask);
                 if (r < 0)
                         return r;
                 else if (r > 0)
@@ -3117,13 +3330,13 @@ int unit_add_dependency(
         }
 
         if (add_reference) {
-                r = unit_add_dependency_hashmap(u->dependencies + UNIT_REFERENCES, other, mask, 0);
+                r = unit_add_dependency_entry(u, UNIT_REFERENCES, other, mask, 0);
                 if (r < 0)
                         return r;
                 else if (r > 0)
                         noop = false;
 
-                r = unit_add_dependency_hashmap(other->dependencies + UNIT_REFERENCED_BY, u, 0, mask);
+                r = unit_add_dependency_entry(other, UNIT_REFERENCED_BY, u, 0, mask);
                 if (r < 0)
                         return r;
                 else if (r > 0)
@@ -4218,6 +4431,43 @@ bool unit_need_daemon_reload(Unit *u) {
         return false;
 }
 
+bool unit_files_changed(Unit *u, Hashmap *snapshot, Set *changed, bool check_dropin_list) {
+        char **path;
+
+        assert(u);
+
+        /* Like unit_need_daemon_reload(), but based on the result of unit_file_snapshot_diff(), which also
+         * covers generated files, whose mtime changes on every reload. Paths outside of the snapshot, such as
+         * linked unit files, are checked by their mtime. The source path is not checked, if it changed the
+         * generator output will have changed too. */
+
+        if (u->fragment_path) {
+                if (hashmap_contains(snapshot, u->fragment_path)) {
+                        if (set_contains(changed, u->fragment_path))
+                                return true;
+                } else if (fragment_mtime_newer(u->fragment_path, u->fragment_mtime,
+                                                u->load_state == UNIT_MASKED))
+                        return true;
+        }
+
+        if (check_dropin_list) {
+                _cleanup_strv_free_ char **t = NULL;
+
+                if (u->load_state == UNIT_LOADED)
+                        (void) unit_find_dropin_paths(u, &t);
+                if (!strv_equal(u->dropin_paths, t))
+                        return true;
+        }
+
+        STRV_FOREACH(path, u->dropin_paths)
+                if (hashmap_contains(snapshot, *path) ?
+                    set_contains(changed, *path) :
+                    fragment_mtime_newer(*path, u->dropin_mtime, false))
+                        return true;
+
+        return false;
+}
+
 void unit_reset_failed(Unit *u) {
         assert(u);
 
@@ -5051,7 +5301,7 @@ int unit_kill_context(
                 if (log_func)
                         log_func(main_pid, sig, u);
 
-                r = kill_and_sigcont(main_pid, sig);
+                r = manager_kill_pid_and_sigcont(u->manager, u, main_pid, sig);
                 if (r < 0 && r != -ESRCH) {
                         _cleanup_free_ char *comm = NULL;
                         (void) get_process_comm(main_pid, &comm);
@@ -5070,7 +5320,7 @@ int unit_kill_context(
                 if (log_func)
                         log_func(control_pid, sig, u);
 
-                r = kill_and_sigcont(control_pid, sig);
+                r = manager_kill_pid_and_sigcont(u->manager, u, control_pid, sig);
                 if (r < 0 && r != -ESRCH) {
                         _cleanup_free_ char *comm = NULL;
                         (void) get_process_comm(control_pid, &comm);
@@ -5215,7 +5465,6 @@ int unit_setup_exec_runtime(Unit *u) {
         ExecRuntime **rt;
         size_t offset;
         Unit *other;
-        void *v;
         int r;
 
         offset = UNIT_VTABLE(u)->exec_runtime_offset;
@@ -5227,7 +5476,7 @@ int unit_setup_exec_runtime(Unit *u) {
                 return 0;
 
         /* Try to get it from somebody else */
-        HASHMAP_FOREACH_KEY(v, other, u->dependencies[UNIT_JOINS_NAMESPACE_OF]) {
+        UNIT_FOREACH_DEPENDENCY(other, u, UNIT_JOINS_NAMESPACE_OF) {
                 r = exec_runtime_acquire(u->manager, NULL, other->id, false, rt);
                 if (r == 1)
                         return 1;
@@ -5601,19 +5850,16 @@ int unit_fork_and_watch_rm_rf(Unit *u, char **paths, pid_t *ret_pid) {
         return 0;
 }
 
-static void unit_update_dependency_mask(Unit *u, UnitDependency d, Unit *other, UnitDependencyInfo di) {
+static void unit_update_dependency_mask(Unit *u, UnitDependencyEntry *e) {
         assert(u);
-        assert(d >= 0);
-        assert(d < _UNIT_DEPENDENCY_MAX);
-        assert(other);
+        assert(e);
 
-        if (di.origin_mask == 0 && di.destination_mask == 0) {
-                /* No bit set anymore, let's drop the whole entry */
-                assert_se(hashmap_remove(u->dependencies[d], other));
-                log_unit_debug(u, "lost dependency %s=%s", unit_dependency_to_string(d), other->id);
-        } else
-                /* Mask was reduced, let's update the entry */
-                assert_se(hashmap_update(u->dependencies[d], other, di.data) == 0);
+        /* No bit set anymore? Then let's drop the whole entry */
+        if (e->origin_mask != 0 || e->destination_mask != 0)
+                return;
+
+        log_unit_debug(u, "lost dependency %s=%s", unit_dependency_to_string(e->type), e->other->id);
+        unit_dependency_remove(u, e);
 }
 
 void unit_remove_dependencies(Unit *u, UnitDependencyMask mask) {
@@ -5624,45 +5870,35 @@ void unit_remove_dependencies(Unit *u, UnitDependencyMask mask) {
         if (mask == 0)
                 return;
 
-        for (UnitDependency d = 0; d < _UNIT_DEPENDENCY_MAX; d++) {
-                bool done;
-
-                do {
-                        UnitDependencyInfo di;
-                        Unit *other;
-
-                        done = true;
-
-                        HASHMAP_FOREACH_KEY(di.data, other, u->dependencies[d]) {
-                                if (FLAGS_SET(~mask, di.origin_mask))
-                                        continue;
-                                di.origin_mask &= ~mask;
-                                unit_update_dependency_mask(u, d, other, di);
-
-                                /* We updated the dependency from our unit to the other unit now. But most dependencies
-                                 * imply a reverse dependency. Hence, let's delete that one too. For that we go through
-                                 * all dependency types on the other unit and delete all those which point to us and
-                                 * have the right mask set. */
+        /* Walk backwards, so that the entries moved into the place of removed ones have been looked at already */
+        for (UnitDependency d = 0; d < _UNIT_DEPENDENCY_MAX; d++)
+                for (size_t i = u->dependency_ranges[d].n; i > 0; i--) {
+                        UnitDependencyEntry *e = unit_dependencies_begin(u, d) + i - 1;
+                        Unit *other = e->other;
 
-                                for (UnitDependency q = 0; q < _UNIT_DEPENDENCY_MAX; q++) {
-                                        UnitDependencyInfo dj;
+                        if (FLAGS_SET(~mask, e->origin_mask))
+                                continue;
+                        e->origin_mask &= ~mask;
+                        unit_update_dependency_mask(u, e);
 
-                                        dj.data = hashmap_get(other->dependencies[q], u);
-                                        if (FLAGS_SET(~mask, dj.destination_mask))
-                                                continue;
-                                        dj.destination_mask &= ~mask;
+                        /* We updated the dependency from our unit to the other unit now. But most dependencies
+                         * imply a reverse dependency. Hence, let's delete that one too. For that we go through all
+                         * dependency types on the other unit and delete all those which point to us and have the
+                         * right mask set. */
 
-                                        unit_update_dependency_mask(other, q, u, dj);
-                                }
+                        for (UnitDependency q = 0; q < _UNIT_DEPENDENCY_MAX; q++) {
+                                UnitDependencyEntry *f;
 
-                                unit_add_to_gc_queue(other);
+                                f = unit_dependency_find(other, q, u);
+                                if (!f || FLAGS_SET(~mask, f->destination_mask))
+                                        continue;
+                                f->destination_mask &= ~mask;
 
-                                done = false;
-                                break;
+                                unit_update_dependency_mask(other, f);
                         }
 
-                } while (!done);
-        }
+                        unit_add_to_gc_queue(other);
+                }
 }
 
 static int unit_get_invocation_path(Unit *u, char **ret) {
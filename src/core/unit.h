@@ -89,9 +89,9 @@ typedef enum UnitDependencyMask {
         _UNIT_DEPENDENCY_MASK_FULL         = (1 << 8) - 1,
 } UnitDependencyMask;
 
-/* The Unit's dependencies[] hashmaps use this structure as value. It has the same size as a void pointer, and thus can
- * be stored directly as hashmap value, without any indirection. Note that this stores two masks, as both the origin
- * and the destination of a dependency might have created it. */
+/* Describes why a dependency exists. It has the same size as a void pointer, and thus can be stored directly as hashmap
+ * value, without any indirection. Note that this stores two masks, as both the origin and the destination of a
+ * dependency might have created it. */
 typedef union UnitDependencyInfo {
         void *data;
         struct {
@@ -100,6 +100,31 @@ typedef union UnitDependencyInfo {
         } _packed_;
 } UnitDependencyInfo;
 
+/* One entry of a Unit's dependencies[] array, i.e. one dependency of a specific type on one other unit */
+typedef struct UnitDependencyEntry {
+        Unit *other;
+        UnitDependency type:8;
+        UnitDependencyMask origin_mask:8;
+        UnitDependencyMask destination_mask:8;
+} UnitDependencyEntry;
+
+assert_cc(_UNIT_DEPENDENCY_MAX <= 1 << 7);
+assert_cc(_UNIT_DEPENDENCY_MASK_FULL < 1 << 8);
+
+/* The entries of one dependency type in the dependencies[] array: they start at 'offset', the first 'n' of them are
+ * used, and room is left up to the offset of the next type */
+typedef struct UnitDependencyRange {
+        unsigned offset;
+        unsigned n;
+} UnitDependencyRange;
+
+typedef struct UnitDependencyIterator {
+        size_t idx;   /* index of the entry returned last, relative to the start of its type's range */
+        Unit *other;  /* the unit it pointed to, so that we notice when it was removed */
+} UnitDependencyIterator;
+
+#define UNIT_DEPENDENCY_ITERATOR_FIRST ((UnitDependencyIterator) { .idx = SIZE_MAX })
+
 #include "job.h"
 
 struct UnitRef {
@@ -126,9 +151,14 @@ typedef struct Unit {
 
         Set *aliases; /* All the other names. */
 
-        /* For each dependency type we maintain a Hashmap whose key is the Unit* object, and the value encodes why the
-         * dependency exists, using the UnitDependencyInfo type */
-        Hashmap *dependencies[_UNIT_DEPENDENCY_MAX];
+        /* All dependencies on other units, of all types, in a single array grouped by type, see
+         * dependency_ranges[] for where each type is found. Within a type the entries are in no particular order.
+         * There's at most one entry for each pair of dependency type and other unit. Units with many dependencies
+         * additionally get an index for looking up entries, see unit_dependency_find(). */
+        UnitDependencyEntry *dependencies;
+        size_t n_dependencies, n_dependencies_allocated;
+        UnitDependencyRange dependency_ranges[_UNIT_DEPENDENCY_MAX];
+        Set *dependencies_index;
 
         /* Similar, for RequiresMountsFor= path dependencies. The key is the path, the value the UnitDependencyInfo type */
         Hashmap *requires_mounts_for;
@@ -154,6 +184,10 @@ typedef struct Unit {
         /* JOB_NOP jobs are special and can be installed without disturbing the real job. */
         Job *nop_job;
 
+        /* The job for this unit in the transaction whose ordering is being verified. Only set while
+         * transaction_verify_order() builds its ordering graph, NULL otherwise. */
+        Job *transaction_job;
+
         /* The slot used for watching NameOwnerChanged signals */
         sd_bus_slot *match_bus_slot;
         sd_bus_slot *get_name_owner_slot;
@@ -270,6 +304,9 @@ typedef struct Unit {
         uint64_t io_accounting_base[_CGROUP_IO_ACCOUNTING_METRIC_MAX];
         uint64_t io_accounting_last[_CGROUP_IO_ACCOUNTING_METRIC_MAX]; /* the most recently read value */
 
+        /* The most recent readout of all accounting counters, see unit_get_accounting() */
+        UnitAccounting *accounting_cache;
+
         /* Counterparts in the cgroup filesystem */
         char *cgroup_path;
         CGroupMask cgroup_realized_mask;           /* In which hierarchies does this unit's cgroup exist? (only relevant on cgroup v1) */
@@ -277,6 +314,12 @@ typedef struct Unit {
         CGroupMask cgroup_invalidated_mask;        /* A mask specifying controllers which shall be considered invalidated, and require re-realization */
         CGroupMask cgroup_members_mask;            /* A cache for the controllers required by all children of this cgroup (only relevant for slice units) */
 
+        /* The values we last successfully wrote to the attributes of our cgroup, by attribute name */
+        Hashmap *cgroup_attribute_cache;
+
+        /* The batch of cgroup realizations in which controllers were last enabled for this unit and its ancestors */
+        uint64_t cgroup_enable_pass;
+
         /* Inotify watch descriptors for watching cgroup.events and memory.events on cgroupv2 */
         int cgroup_control_inotify_wd;
         int cgroup_memory_inotify_wd;
@@ -663,8 +706,83 @@ static inline const UnitVTable* UNIT_VTABLE(Unit *u) {
 #define UNIT_HAS_CGROUP_CONTEXT(u) (UNIT_VTABLE(u)->cgroup_context_offset > 0)
 #define UNIT_HAS_KILL_CONTEXT(u) (UNIT_VTABLE(u)->kill_context_offset > 0)
 
+static inline UnitDependencyEntry* unit_dependencies_begin(Unit *u, UnitDependency d) {
+        return u->dependencies + u->dependency_ranges[d].offset;
+}
+
+static inline UnitDependencyEntry* unit_dependencies_end(Unit *u, UnitDependency d) {
+        return unit_dependencies_begin(u, d) + u->dependency_ranges[d].n;
+}
+
+static inline bool unit_dependency_iterate(Unit *u, UnitDependency d, UnitDependencyIterator *i, Unit **ret_other, UnitDependencyInfo *ret_info) {
+        UnitDependencyEntry *e;
+        size_t idx;
+
+        assert(u);
+        assert(d >= 0 && d < _UNIT_DEPENDENCY_MAX);
+        assert(i);
+
+        if (i->idx == SIZE_MAX)
+                idx = 0;
+        else if (i->idx < u->dependency_ranges[d].n &&
+                 unit_dependencies_begin(u, d)[i->idx].other == i->other)
+                idx = i->idx + 1;
+        else
+                /* The current entry was removed while iterating, and the last entry of this type was moved into its
+                 * place. Let's look at it next. */
+                idx = i->idx;
+
+        if (idx >= u->dependency_ranges[d].n) {
+                i->idx = idx;
+                i->other = NULL;
+
+                if (ret_other)
+                        *ret_other = NULL;
+                return false;
+        }
+
+        /* Look the entry up only now: adding dependencies might have moved the array around since the last call */
+        e = unit_dependencies_begin(u, d) + idx;
+
+        i->idx = idx;
+        i->other = e->other;
+
+        if (ret_other)
+                *ret_other = e->other;
+        if (ret_info)
+                *ret_info = (UnitDependencyInfo) {
+                        .origin_mask = e->origin_mask,
+                        .destination_mask = e->destination_mask,
+                };
+        return true;
+}
+
+/* Iterates through all units 'u' has a dependency of type 'd' on. The current entry may be removed while iterating,
+ * but no other entries. New entries of any type may be added; those of type 'd' are visited later on in the same
+ * loop. */
+#define _UNIT_FOREACH_DEPENDENCY(other, u, d, i)                        \
+        for (UnitDependencyIterator i = UNIT_DEPENDENCY_ITERATOR_FIRST; unit_dependency_iterate((u), (d), &i, &(other), NULL); )
+#define UNIT_FOREACH_DEPENDENCY(other, u, d)                            \
+        _UNIT_FOREACH_DEPENDENCY(other, u, d, UNIQ_T(i, UNIQ))
+
+#define _UNIT_FOREACH_DEPENDENCY_INFO(other, info, u, d, i)             \
+        for (UnitDependencyIterator i = UNIT_DEPENDENCY_ITERATOR_FIRST; unit_dependency_iterate((u), (d), &i, &(other), &(info)); )
+#define UNIT_FOREACH_DEPENDENCY_INFO(other, info, u, d)                 \
+        _UNIT_FOREACH_DEPENDENCY_INFO(other, info, u, d, UNIQ_T(i, UNIQ))
+
+static inline Unit* unit_first_dependency(Unit *u, UnitDependency d) {
+        UnitDependencyIterator i = UNIT_DEPENDENCY_ITERATOR_FIRST;
+        Unit *other;
+
+        return unit_dependency_iterate(u, d, &i, &other, NULL) ? other : NULL;
+}
+
+static inline bool unit_has_dependencies(Unit *u, UnitDependency d) {
+        return !!unit_first_dependency(u, d);
+}
+
 static inline Unit* UNIT_TRIGGER(Unit *u) {
-        return hashmap_first_key(u->dependencies[UNIT_TRIGGERS]);
+        return unit_first_dependency(u, UNIT_TRIGGERS);
 }
 
 Unit *unit_new(Manager *m, size_t size);
@@ -674,6 +792,12 @@ DEFINE_TRIVIAL_CLEANUP_FUNC(Unit *, unit_free);
 int unit_new_for_name(Manager *m, size_t size, const char *name, Unit **ret);
 int unit_add_name(Unit *u, const char *name);
 
+UnitDependencyEntry* unit_dependency_find(Unit *u, UnitDependency d, Unit *other);
+static inline bool unit_has_dependency(Unit *u, UnitDependency d, Unit *other) {
+        return !!unit_dependency_find(u, d, other);
+}
+unsigned unit_count_dependencies(Unit *u, UnitDependency d);
+
 int unit_add_dependency(Unit *u, UnitDependency d, Unit *other, bool add_reference, UnitDependencyMask mask);
 int unit_add_two_dependencies(Unit *u, UnitDependency d, UnitDependency e, Unit *other, bool add_reference, UnitDependencyMask mask);
 
@@ -744,6 +868,7 @@ typedef enum UnitNotifyFlags {
 void unit_notify(Unit *u, UnitActiveState os, UnitActiveState ns, UnitNotifyFlags flags);
 
 int unit_watch_pid(Unit *u, pid_t pid, bool exclusive);
+int unit_watch_pid_coldplug(Unit *u, pid_t pid);
 void unit_unwatch_pid(Unit *u, pid_t pid);
 void unit_unwatch_all_pids(Unit *u);
 
@@ -778,6 +903,7 @@ void unit_catchup(Unit *u);
 void unit_status_printf(Unit *u, StatusType status_type, const char *status, const char *unit_status_msg_format) _printf_(4, 0);
 
 bool unit_need_daemon_reload(Unit *u);
+bool unit_files_changed(Unit *u, Hashmap *snapshot, Set *changed, bool check_dropin_list);
 
 void unit_reset_failed(Unit *u);
 
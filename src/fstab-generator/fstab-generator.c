@@ -574,6 +574,8 @@ static int parse_fstab(bool initrd) {
         fstab = initrd ? "/sysroot/etc/fstab" : fstab_path();
         log_debug("Parsing %s...", fstab);
 
+        (void) generator_add_input(fstab);
+
         f = setmntent(fstab, "re");
         if (!f) {
                 if (errno == ENOENT)
@@ -930,6 +932,8 @@ static int run(const char *dest, const char *dest_early, const char *dest_late)
         assert_se(arg_dest = dest);
         assert_se(arg_dest_late = dest_late);
 
+        (void) generator_add_input_proc_cmdline();
+
         r = proc_cmdline_parse(parse_proc_cmdline_item, NULL, 0);
         if (r < 0)
                 log_warning_errno(r, "Failed to parse kernel command line, ignoring: %m");
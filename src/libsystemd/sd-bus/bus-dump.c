@@ -575,14 +575,30 @@ int bus_message_pcap_frame(sd_bus_message *m, size_t snaplen, FILE *f) {
 
         /* write the dbus header */
         w = MIN(BUS_MESSAGE_BODY_BEGIN(m), snaplen);
-        fwrite(m->header, 1, w, f);
+        if (m->memfd_body && w >= sizeof(struct bus_header)) {
+                struct bus_header h = *m->header;
+
+                /* The header we send says the body is empty, as it is passed as memfd. But we capture it
+                 * inline. */
+                h.dbus1.body_size = BUS_MESSAGE_BSWAP32(m, (uint32_t) m->body_size);
+                fwrite(&h, 1, sizeof(h), f);
+                fwrite((const uint8_t*) m->header + sizeof(h), 1, w - sizeof(h), f);
+        } else
+                fwrite(m->header, 1, w, f);
         snaplen -= w;
 
         /* write the dbus body */
         MESSAGE_FOREACH_PART(part, i, m) {
+                int r;
+
                 if (snaplen <= 0)
                         break;
 
+                /* A body received as memfd is only mapped once it is read */
+                r = bus_body_part_map(part);
+                if (r < 0)
+                        return r;
+
                 w = MIN(part->size, snaplen);
                 fwrite(part->data, 1, w, f);
                 snaplen -= w;
@@ -211,6 +211,8 @@ struct sd_bus {
         bool watch_bind:1;
         bool is_monitor:1;
         bool accept_fd:1;
+        bool accept_memfd:1;
+        bool can_memfd:1;
         bool attach_timestamp:1;
         bool connected_signal:1;
         bool close_on_exit:1;
@@ -259,7 +261,7 @@ struct sd_bus {
 
         enum bus_auth auth;
         unsigned auth_index;
-        struct iovec auth_iovec[3];
+        struct iovec auth_iovec[4];
         size_t auth_rbegin;
         char *auth_buffer;
         usec_t auth_timeout;
@@ -53,9 +53,15 @@ static bool BUS_MATCH_IS_COMPARE(enum bus_match_node_type t) {
 }
 
 static bool BUS_MATCH_CAN_HASH(enum bus_match_node_type t) {
-        return (t >= BUS_MATCH_MESSAGE_TYPE && t <= BUS_MATCH_PATH) ||
-                (t >= BUS_MATCH_ARG && t <= BUS_MATCH_ARG_LAST) ||
-                (t >= BUS_MATCH_ARG_HAS && t <= BUS_MATCH_ARG_HAS_LAST);
+        /* Everything but the sender, whose well-known names we cannot resolve */
+        return t >= BUS_MATCH_MESSAGE_TYPE && t <= BUS_MATCH_ARG_HAS_LAST;
+}
+
+static bool BUS_MATCH_IS_PREFIX(enum bus_match_node_type t) {
+        /* Hashed by the match string, but matching all values the match string is a prefix of */
+        return t == BUS_MATCH_PATH_NAMESPACE ||
+                (t >= BUS_MATCH_ARG_PATH && t <= BUS_MATCH_ARG_PATH_LAST) ||
+                (t >= BUS_MATCH_ARG_NAMESPACE && t <= BUS_MATCH_ARG_NAMESPACE_LAST);
 }
 
 static void bus_match_node_free(struct bus_match_node *node) {
@@ -239,6 +245,100 @@ static bool value_node_same(
         }
 }
 
+static int bus_match_run_prefixes(
+                sd_bus *bus,
+                struct bus_match_node *node,
+                const char *test_str,
+                sd_bus_message *m) {
+
+        struct bus_match_node *found;
+        _cleanup_free_ char *p = NULL;
+        bool simple;
+        char separator;
+        size_t l;
+        int r;
+
+        assert(node);
+        assert(BUS_MATCH_IS_PREFIX(node->type));
+        assert(m);
+
+        /* Instead of testing each namespace or path match against the value, look up all prefixes of the
+         * value that could match it. That makes the cost depend on the number of labels in the value, and
+         * not on the number of matches installed. */
+
+        if (!test_str)
+                return 0;
+
+        simple = !(node->type >= BUS_MATCH_ARG_PATH && node->type <= BUS_MATCH_ARG_PATH_LAST);
+        separator = node->type >= BUS_MATCH_ARG_NAMESPACE && node->type <= BUS_MATCH_ARG_NAMESPACE_LAST ? '.' : '/';
+
+        l = strlen(test_str);
+
+        if (!simple && l > 0 && test_str[l-1] == separator) {
+                struct bus_match_node *c;
+
+                /* argNpath matches are symmetric: a value ending in a separator matches all paths it is a
+                 * prefix of. That can't be looked up, hence test all matches in this rare case. */
+
+                HASHMAP_FOREACH(c, node->compare.children) {
+                        if (!value_node_test(c, node->type, 0, test_str, NULL, m))
+                                continue;
+
+                        r = bus_match_run(bus, c, m);
+                        if (r != 0)
+                                return r;
+
+                        if (bus && bus->match_callbacks_modified)
+                                return 0;
+                }
+
+                return 0;
+        }
+
+        p = strdup(test_str);
+        if (!p)
+                return -ENOMEM;
+
+        for (size_t i = 0; i <= l; i++) {
+                size_t k[2];
+                unsigned n = 0;
+
+                if (i == l)
+                        k[n++] = l; /* The full value */
+                else if (p[i] == separator) {
+                        /* Simple patterns also match without the trailing separator, unless that was
+                         * already looked up with a separator in the previous iteration. */
+                        if (simple && (i == 0 || p[i-1] != separator))
+                                k[n++] = i;
+
+                        if (i + 1 < l)
+                                k[n++] = i + 1;
+                } else
+                        continue;
+
+                for (unsigned j = 0; j < n; j++) {
+                        char c;
+
+                        c = p[k[j]];
+                        p[k[j]] = 0;
+                        found = hashmap_get(node->compare.children, p);
+                        p[k[j]] = c;
+
+                        if (!found)
+                                continue;
+
+                        r = bus_match_run(bus, found, m);
+                        if (r != 0)
+                                return r;
+
+                        if (bus && bus->match_callbacks_modified)
+                                return 0;
+                }
+        }
+
+        return 0;
+}
+
 int bus_match_run(
                 sd_bus *bus,
                 struct bus_match_node *node,
@@ -379,7 +479,12 @@ int bus_match_run(
                 assert_not_reached("Unknown match type.");
         }
 
-        if (BUS_MATCH_CAN_HASH(node->type)) {
+        if (BUS_MATCH_IS_PREFIX(node->type)) {
+                r = bus_match_run_prefixes(bus, node, test_str, m);
+                if (r != 0)
+                        return r;
+
+        } else if (BUS_MATCH_CAN_HASH(node->type)) {
                 struct bus_match_node *found;
 
                 /* Lookup via hash table, nice! So let's jump directly. */
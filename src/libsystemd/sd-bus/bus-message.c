@@ -17,6 +17,7 @@
 #include "io-util.h"
 #include "memfd-util.h"
 #include "memory-util.h"
+#include "mempool.h"
 #include "string-util.h"
 #include "strv.h"
 #include "time-util.h"
@@ -122,6 +123,39 @@ static void message_reset_containers(sd_bus_message *m) {
         m->root_container.index = 0;
 }
 
+/* Messages we create ourselves carry their header inline, and so do received messages without a security
+ * label. Those fit into a tile of this size. */
+#define MESSAGE_TILE_SIZE (ALIGN(sizeof(sd_bus_message)) + ALIGN(sizeof(struct bus_header)))
+
+DEFINE_MEMPOOL(message_pool, uint8_t[MESSAGE_TILE_SIZE], 16);
+
+static sd_bus_message* message_alloc0(size_t size) {
+        sd_bus_message *m;
+
+        if (size > MESSAGE_TILE_SIZE || !mempool_enabled())
+                return malloc0(size);
+
+        m = mempool_alloc0_tile(&message_pool);
+        if (m)
+                m->from_pool = true;
+
+        return m;
+}
+
+static sd_bus_message* message_free_memory(sd_bus_message *m) {
+        if (!m)
+                return NULL;
+
+        if (m->from_pool) {
+                mempool_free_tile(&message_pool, m);
+                return NULL;
+        }
+
+        return mfree(m);
+}
+
+DEFINE_TRIVIAL_CLEANUP_FUNC(sd_bus_message*, message_free_memory);
+
 static sd_bus_message* message_free(sd_bus_message *m) {
         assert(m);
 
@@ -146,7 +180,7 @@ static sd_bus_message* message_free(sd_bus_message *m) {
         message_free_last_container(m);
 
         bus_creds_done(&m->creds);
-        return mfree(m);
+        return message_free_memory(m);
 }
 
 static void *message_extend_fields(sd_bus_message *m, size_t align, size_t sz, bool add_offset) {
@@ -429,7 +463,7 @@ int bus_message_from_header(
                 size_t extra,
                 sd_bus_message **ret) {
 
-        _cleanup_free_ sd_bus_message *m = NULL;
+        _cleanup_(message_free_memoryp) sd_bus_message *m = NULL;
         struct bus_header *h;
         size_t a, label_sz;
 
@@ -466,7 +500,7 @@ int bus_message_from_header(
                 a += label_sz + 1;
         }
 
-        m = malloc0(a);
+        m = message_alloc0(a);
         if (!m)
                 return -ENOMEM;
 
@@ -592,7 +626,7 @@ _public_ int sd_bus_message_new(
         /* Creation of messages with _SD_BUS_MESSAGE_TYPE_INVALID is allowed. */
         assert_return(type < _SD_BUS_MESSAGE_TYPE_MAX, -EINVAL);
 
-        sd_bus_message *t = malloc0(ALIGN(sizeof(sd_bus_message)) + sizeof(struct bus_header));
+        sd_bus_message *t = message_alloc0(ALIGN(sizeof(sd_bus_message)) + sizeof(struct bus_header));
         if (!t)
                 return -ENOMEM;
 
@@ -2899,6 +2933,59 @@ static int bus_message_close_header(sd_bus_message *m) {
         return 0;
 }
 
+static int message_pass_body_as_memfd(sd_bus_message *m) {
+        _cleanup_close_ int fd = -1;
+        struct bus_body_part *part;
+        unsigned i;
+        int *f, r;
+
+        assert(m);
+
+        /* Copies the body into a sealed memfd that is passed along with the message, so that it doesn't
+         * have to be pushed through the socket, and the receiver can just map it. Our own body parts are
+         * left as they are, so that the message remains readable locally.
+         *
+         * This doesn't need any header field of its own: the memfd is always the last fd of the message,
+         * and the body size in the header is written as 0. A regular message with a non-empty signature
+         * never has an empty body, hence the receiver can tell the two apart. */
+
+        fd = memfd_new("sd-bus-body");
+        if (fd < 0)
+                goto fallback;
+
+        MESSAGE_FOREACH_PART(part, i, m) {
+                r = bus_body_part_map(part);
+                if (r < 0)
+                        return r;
+
+                r = loop_write(fd, part->data, part->size, false);
+                if (r < 0)
+                        goto fallback;
+        }
+
+        r = memfd_set_sealed(fd);
+        if (r < 0)
+                goto fallback;
+
+        f = reallocarray(m->fds, m->n_fds + 1, sizeof(int));
+        if (!f) {
+                m->poisoned = true;
+                return -ENOMEM;
+        }
+
+        m->fds = f;
+        m->fds[m->n_fds++] = TAKE_FD(fd);
+        m->free_fds = true;
+
+        m->memfd_body = true;
+        return 1;
+
+fallback:
+        /* Nothing changed on the message so far, hence just send the body inline */
+        log_debug_errno(fd < 0 ? fd : r, "Failed to pass message body as memfd, sending it inline: %m");
+        return 0;
+}
+
 _public_ int sd_bus_message_seal(sd_bus_message *m, uint64_t cookie, uint64_t timeout_usec) {
         struct bus_body_part *part;
         size_t a;
@@ -2940,6 +3027,18 @@ _public_ int sd_bus_message_seal(sd_bus_message *m, uint64_t cookie, uint64_t ti
                         return r;
         }
 
+        /* If the peer agreed to it, pass large bodies as sealed memfd instead of copying them through the
+         * socket. This needs to happen before the fd count is written to the header. */
+        if (m->bus->can_memfd &&
+            !BUS_MESSAGE_IS_GVARIANT(m) &&
+            !m->sensitive && /* A sealed memfd cannot be erased after use */
+            m->body_size >= MEMFD_MIN_SIZE &&
+            m->n_fds < BUS_FDS_MAX) {
+                r = message_pass_body_as_memfd(m);
+                if (r < 0)
+                        return r;
+        }
+
         if (m->n_fds > 0) {
                 r = message_append_field_uint32(m, BUS_MESSAGE_HEADER_UNIX_FDS, m->n_fds);
                 if (r < 0)
@@ -2950,6 +3049,10 @@ _public_ int sd_bus_message_seal(sd_bus_message *m, uint64_t cookie, uint64_t ti
         if (r < 0)
                 return r;
 
+        /* On the wire the body is empty, the receiver picks up its size from the memfd */
+        if (m->memfd_body)
+                m->header->dbus1.body_size = 0;
+
         if (BUS_MESSAGE_IS_GVARIANT(m))
                 m->header->dbus2.cookie = cookie;
         else
@@ -5152,6 +5255,53 @@ static int message_skip_fields(
         }
 }
 
+static int message_attach_memfd_body(sd_bus_message *m) {
+        uint64_t sz;
+        int fd, r;
+        size_t idx;
+
+        assert(m);
+        assert(m->n_body_parts == 0);
+
+        /* The peer passed the body as sealed memfd, as the last fd of the message. Turn it into our only
+         * body part, which is mapped lazily when the body is read. */
+
+        if (m->n_fds == 0)
+                return -EBADMSG;
+        idx = m->n_fds - 1;
+
+        /* Refuse anything the sender could still modify under our feet */
+        r = memfd_get_sealed(m->fds[idx]);
+        if (r <= 0)
+                return -EBADMSG;
+
+        r = memfd_get_size(m->fds[idx], &sz);
+        if (r < 0)
+                return r;
+        if (sz == 0 || sz >= BUS_MESSAGE_SIZE_MAX)
+                return -EBADMSG;
+
+        fd = fcntl(m->fds[idx], F_DUPFD_CLOEXEC, 3);
+        if (fd < 0)
+                return -errno;
+
+        m->body = (struct bus_body_part) {
+                .memfd = fd,
+                .size = sz,
+                .sealed = true,
+        };
+        m->n_body_parts = 1;
+        m->body_size = m->user_body_size = sz;
+
+        /* Make the header describe the message as we have it now, in case it is sent on elsewhere, where
+         * the body will be sent inline. */
+        m->header->dbus1.body_size = BUS_MESSAGE_BSWAP32(m, (uint32_t) sz);
+        m->iovec = NULL;
+        m->n_iovec = 0;
+
+        return 0;
+}
+
 int bus_message_parse_fields(sd_bus_message *m) {
         size_t ri;
         int r;
@@ -5474,6 +5624,18 @@ int bus_message_parse_fields(sd_bus_message *m) {
         if (m->n_fds != unix_fds)
                 return -EBADMSG;
 
+        /* If we agreed to memfd bodies, a message with a signature but without inline body carries its body
+         * in its last fd. Messages that got their memfd body attached already and are passed on carry the
+         * body inline. */
+        if (m->bus->can_memfd &&
+            !BUS_MESSAGE_IS_GVARIANT(m) &&
+            m->body_size == 0 &&
+            !isempty(m->root_container.signature)) {
+                r = message_attach_memfd_body(m);
+                if (r < 0)
+                        return r;
+        }
+
         switch (m->header->type) {
 
         case SD_BUS_MESSAGE_SIGNAL:
@@ -5576,8 +5738,23 @@ int bus_message_get_blob(sd_bus_message *m, void **buffer, size_t *sz) {
                 return -ENOMEM;
 
         e = mempcpy(p, m->header, BUS_MESSAGE_BODY_BEGIN(m));
-        MESSAGE_FOREACH_PART(part, i, m)
+
+        /* If the body is passed as memfd, the header we send says it's empty, but the blob has it inline */
+        if (m->memfd_body)
+                ((struct bus_header*) p)->dbus1.body_size = BUS_MESSAGE_BSWAP32(m, (uint32_t) m->body_size);
+
+        MESSAGE_FOREACH_PART(part, i, m) {
+                int r;
+
+                /* A body received as memfd is only mapped once it is read */
+                r = bus_body_part_map(part);
+                if (r < 0) {
+                        free(p);
+                        return r;
+                }
+
                 e = mempcpy(e, part->data, part->size);
+        }
 
         assert(total == (size_t) ((uint8_t*) e - (uint8_t*) p));
 
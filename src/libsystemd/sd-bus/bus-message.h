@@ -85,6 +85,8 @@ struct sd_bus_message {
         bool free_fds:1;
         bool poisoned:1;
         bool sensitive:1;
+        bool memfd_body:1; /* The body is passed as sealed memfd, and not sent through the socket */
+        bool from_pool:1;  /* The message was allocated from the mempool */
 
         /* The first and last bytes of the message */
         struct bus_header *header;
@@ -168,6 +170,11 @@ static inline size_t BUS_MESSAGE_BODY_BEGIN(sd_bus_message *m) {
                 ALIGN8(m->fields_size);
 }
 
+static inline size_t BUS_MESSAGE_WIRE_SIZE(sd_bus_message *m) {
+        /* The number of bytes actually written to the socket */
+        return m->memfd_body ? BUS_MESSAGE_BODY_BEGIN(m) : BUS_MESSAGE_SIZE(m);
+}
+
 static inline void* BUS_MESSAGE_FIELDS(sd_bus_message *m) {
         return (uint8_t*) m->header + sizeof(struct bus_header);
 }
@@ -2066,7 +2066,8 @@ static int emit_properties_changed_on_interface(
                 const char *interface,
                 bool require_fallback,
                 bool *found_interface,
-                char **names) {
+                char **names,
+                sd_bus_message **ret) {
 
         _cleanup_(sd_bus_error_free) sd_bus_error error = SD_BUS_ERROR_NULL;
         _cleanup_(sd_bus_message_unrefp) sd_bus_message *m = NULL;
@@ -2083,6 +2084,7 @@ static int emit_properties_changed_on_interface(
         assert(path);
         assert(interface);
         assert(found_interface);
+        assert(ret);
 
         n = hashmap_get(bus->nodes, prefix);
         if (!n)
@@ -2261,32 +2263,32 @@ static int emit_properties_changed_on_interface(
         if (r < 0)
                 return r;
 
-        r = sd_bus_send(bus, m, NULL);
-        if (r < 0)
-                return r;
-
+        *ret = TAKE_PTR(m);
         return 1;
 }
 
-_public_ int sd_bus_emit_properties_changed_strv(
+int bus_message_new_properties_changed(
                 sd_bus *bus,
                 const char *path,
                 const char *interface,
-                char **names) {
+                char **names,
+                sd_bus_message **ret) {
 
         _cleanup_free_ char *prefix = NULL;
         bool found_interface = false;
         size_t pl;
         int r;
 
-        assert_return(bus, -EINVAL);
-        assert_return(bus = bus_resolve(bus), -ENOPKG);
-        assert_return(object_path_is_valid(path), -EINVAL);
-        assert_return(interface_name_is_valid(interface), -EINVAL);
-        assert_return(!bus_pid_changed(bus), -ECHILD);
+        assert(bus);
+        assert(path);
+        assert(interface);
+        assert(ret);
 
-        if (!BUS_IS_OPEN(bus->state))
-                return -ENOTCONN;
+        /* Builds the PropertiesChanged message sd_bus_emit_properties_changed_strv() would send, without
+         * sending it. This way the same message may be sent on multiple connections, without collecting
+         * the properties again for each. Returns 0 and sets *ret to NULL if there is nothing to send. */
+
+        *ret = NULL;
 
         /* A non-NULL but empty names list means nothing needs to be
            generated. A NULL list OTOH indicates that all properties
@@ -2306,14 +2308,14 @@ _public_ int sd_bus_emit_properties_changed_strv(
         do {
                 bus->nodes_modified = false;
 
-                r = emit_properties_changed_on_interface(bus, path, path, interface, false, &found_interface, names);
+                r = emit_properties_changed_on_interface(bus, path, path, interface, false, &found_interface, names, ret);
                 if (r != 0)
                         return r;
                 if (bus->nodes_modified)
                         continue;
 
                 OBJECT_PATH_FOREACH_PREFIX(prefix, path) {
-                        r = emit_properties_changed_on_interface(bus, prefix, path, interface, true, &found_interface, names);
+                        r = emit_properties_changed_on_interface(bus, prefix, path, interface, true, &found_interface, names, ret);
                         if (r != 0)
                                 return r;
                         if (bus->nodes_modified)
@@ -2325,6 +2327,35 @@ _public_ int sd_bus_emit_properties_changed_strv(
         return found_interface ? 0 : -ENOENT;
 }
 
+_public_ int sd_bus_emit_properties_changed_strv(
+                sd_bus *bus,
+                const char *path,
+                const char *interface,
+                char **names) {
+
+        _cleanup_(sd_bus_message_unrefp) sd_bus_message *m = NULL;
+        int r;
+
+        assert_return(bus, -EINVAL);
+        assert_return(bus = bus_resolve(bus), -ENOPKG);
+        assert_return(object_path_is_valid(path), -EINVAL);
+        assert_return(interface_name_is_valid(interface), -EINVAL);
+        assert_return(!bus_pid_changed(bus), -ECHILD);
+
+        if (!BUS_IS_OPEN(bus->state))
+                return -ENOTCONN;
+
+        r = bus_message_new_properties_changed(bus, path, interface, names, &m);
+        if (r <= 0)
+                return r;
+
+        r = sd_bus_send(bus, m, NULL);
+        if (r < 0)
+                return r;
+
+        return 1;
+}
+
 _public_ int sd_bus_emit_properties_changed(
                 sd_bus *bus,
                 const char *path,
@@ -9,6 +9,13 @@ bool bus_vtable_has_names(const sd_bus_vtable *vtable);
 int bus_process_object(sd_bus *bus, sd_bus_message *m);
 void bus_node_gc(sd_bus *b, struct node *n);
 
+int bus_message_new_properties_changed(
+                sd_bus *bus,
+                const char *path,
+                const char *interface,
+                char **names,
+                sd_bus_message **ret);
+
 int introspect_path(
                 sd_bus *bus,
                 const char *path,
@@ -12,6 +12,7 @@
 #include "bus-internal.h"
 #include "bus-message.h"
 #include "bus-socket.h"
+#include "bus-type.h"
 #include "fd-util.h"
 #include "format-util.h"
 #include "fs-util.h"
@@ -26,11 +27,15 @@
 #include "signal-util.h"
 #include "stdio-util.h"
 #include "string-util.h"
+#include "unaligned.h"
 #include "user-util.h"
 #include "utf8.h"
 
 #define SNDBUF_SIZE (8*1024*1024)
 
+/* How much we try to read from the socket at once, see bus_socket_read_message() */
+#define BUS_SOCKET_READ_BATCH (64U*1024U)
+
 static void iovec_advance(struct iovec iov[], unsigned *idx, size_t size) {
 
         while (size > 0) {
@@ -73,7 +78,8 @@ static int bus_message_setup_iovec(sd_bus_message *m) {
 
         assert(!m->iovec);
 
-        n = 1 + m->n_body_parts;
+        /* If the body is passed as memfd, only the header goes through the socket */
+        n = m->memfd_body ? 1 : 1 + m->n_body_parts;
         if (n < ELEMENTSOF(m->iovec_fixed))
                 m->iovec = m->iovec_fixed;
         else {
@@ -88,15 +94,16 @@ static int bus_message_setup_iovec(sd_bus_message *m) {
         if (r < 0)
                 goto fail;
 
-        MESSAGE_FOREACH_PART(part, i, m)  {
-                r = bus_body_part_map(part);
-                if (r < 0)
-                        goto fail;
+        if (!m->memfd_body)
+                MESSAGE_FOREACH_PART(part, i, m)  {
+                        r = bus_body_part_map(part);
+                        if (r < 0)
+                                goto fail;
 
-                r = append_iovec(m, part->data, part->size);
-                if (r < 0)
-                        goto fail;
-        }
+                        r = append_iovec(m, part->data, part->size);
+                        if (r < 0)
+                                goto fail;
+                }
 
         assert(n == m->n_iovec);
 
@@ -156,17 +163,18 @@ static int bus_socket_write_auth(sd_bus *b) {
 }
 
 static int bus_socket_auth_verify_client(sd_bus *b) {
-        char *d, *e, *f, *start;
+        char *d, *e, *f, *g, *start;
         sd_id128_t peer;
         int r;
 
         assert(b);
 
         /*
-         * We expect three response lines:
+         * We expect up to four response lines:
          *   "DATA\r\n"
          *   "OK <server-id>\r\n"
          *   "AGREE_UNIX_FD\r\n"        (optional)
+         *   "AGREE_MEMFD\r\n"          (optional)
          */
 
         d = memmem_safe(b->rbuffer, b->rbuffer_size, "\r\n", 2);
@@ -188,6 +196,15 @@ static int bus_socket_auth_verify_client(sd_bus *b) {
                 start = e + 2;
         }
 
+        if (b->accept_fd && b->accept_memfd) {
+                g = memmem(f + 2, b->rbuffer_size - (f - (char*) b->rbuffer) - 2, "\r\n", 2);
+                if (!g)
+                        return 0;
+
+                start = g + 2;
+        } else
+                g = NULL;
+
         /* Nice! We got all the lines we need. First check the DATA line. */
 
         if (d - (char*) b->rbuffer == 4) {
@@ -233,7 +250,7 @@ static int bus_socket_auth_verify_client(sd_bus *b) {
 
         b->server_id = peer;
 
-        /* And possibly check the third line, too */
+        /* And possibly check the third and fourth line, too */
 
         if (f)
                 b->can_fds =
@@ -241,6 +258,13 @@ static int bus_socket_auth_verify_client(sd_bus *b) {
                         memcmp(e + 2, "AGREE_UNIX_FD",
                                STRLEN("AGREE_UNIX_FD")) == 0;
 
+        if (g)
+                b->can_memfd =
+                        b->can_fds &&
+                        (g - f == STRLEN("\r\nAGREE_MEMFD")) &&
+                        memcmp(f + 2, "AGREE_MEMFD",
+                               STRLEN("AGREE_MEMFD")) == 0;
+
         b->rbuffer_size -= (start - (char*) b->rbuffer);
         memmove(b->rbuffer, start, b->rbuffer_size);
 
@@ -490,6 +514,14 @@ static int bus_socket_auth_verify_server(sd_bus *b) {
                                 b->can_fds = true;
                                 r = bus_socket_auth_write(b, "AGREE_UNIX_FD\r\n");
                         }
+                } else if (line_equals(line, l, "NEGOTIATE_MEMFD")) {
+                        /* Our own extension: pass large message bodies as sealed memfds */
+                        if (b->auth == _BUS_AUTH_INVALID || !b->can_fds || !b->accept_memfd)
+                                r = bus_socket_auth_write(b, "ERROR\r\n");
+                        else {
+                                b->can_memfd = true;
+                                r = bus_socket_auth_write(b, "AGREE_MEMFD\r\n");
+                        }
                 } else
                         r = bus_socket_auth_write(b, "ERROR\r\n");
 
@@ -656,6 +688,9 @@ static int bus_socket_start_auth_client(sd_bus *b) {
         static const char sasl_negotiate_unix_fd[] = {
                 "NEGOTIATE_UNIX_FD\r\n"
         };
+        static const char sasl_negotiate_memfd[] = {
+                "NEGOTIATE_MEMFD\r\n"
+        };
         static const char sasl_begin[] = {
                 "BEGIN\r\n"
         };
@@ -668,9 +703,13 @@ static int bus_socket_start_auth_client(sd_bus *b) {
         else
                 b->auth_iovec[i++] = IOVEC_MAKE((char*) sasl_auth_external, sizeof(sasl_auth_external) - 1);
 
-        if (b->accept_fd)
+        if (b->accept_fd) {
                 b->auth_iovec[i++] = IOVEC_MAKE_STRING(sasl_negotiate_unix_fd);
 
+                if (b->accept_memfd)
+                        b->auth_iovec[i++] = IOVEC_MAKE_STRING(sasl_negotiate_memfd);
+        }
+
         b->auth_iovec[i++] = IOVEC_MAKE_STRING(sasl_begin);
 
         return bus_socket_write_auth(b);
@@ -1021,7 +1060,7 @@ int bus_socket_write_message(sd_bus *bus, sd_bus_message *m, size_t *idx) {
         assert(idx);
         assert(IN_SET(bus->state, BUS_RUNNING, BUS_HELLO));
 
-        if (*idx >= BUS_MESSAGE_SIZE(m))
+        if (*idx >= BUS_MESSAGE_WIRE_SIZE(m))
                 return 0;
 
         r = bus_message_setup_iovec(m);
@@ -1069,16 +1108,15 @@ int bus_socket_write_message(sd_bus *bus, sd_bus_message *m, size_t *idx) {
         return 1;
 }
 
-static int bus_socket_read_message_need(sd_bus *bus, size_t *need) {
+static int bus_socket_message_need(const void *p, size_t size, size_t *need) {
         uint32_t a, b;
         uint8_t e;
         uint64_t sum;
 
-        assert(bus);
+        assert(p || size == 0);
         assert(need);
-        assert(IN_SET(bus->state, BUS_RUNNING, BUS_HELLO));
 
-        if (bus->rbuffer_size < sizeof(struct bus_header)) {
+        if (size < sizeof(struct bus_header)) {
                 *need = sizeof(struct bus_header) + 8;
 
                 /* Minimum message size:
@@ -1100,16 +1138,15 @@ static int bus_socket_read_message_need(sd_bus *bus, size_t *need) {
                 return 0;
         }
 
-        a = ((const uint32_t*) bus->rbuffer)[1];
-        b = ((const uint32_t*) bus->rbuffer)[3];
-
-        e = ((const uint8_t*) bus->rbuffer)[0];
+        /* Messages are not necessarily 8 byte aligned in the read buffer when we received more than one of
+         * them in one go, hence use unaligned accesses here. */
+        e = ((const uint8_t*) p)[0];
         if (e == BUS_LITTLE_ENDIAN) {
-                a = le32toh(a);
-                b = le32toh(b);
+                a = unaligned_read_le32((const uint8_t*) p + 4);
+                b = unaligned_read_le32((const uint8_t*) p + 12);
         } else if (e == BUS_BIG_ENDIAN) {
-                a = be32toh(a);
-                b = be32toh(b);
+                a = unaligned_read_be32((const uint8_t*) p + 4);
+                b = unaligned_read_be32((const uint8_t*) p + 12);
         } else
                 return -EBADMSG;
 
@@ -1121,46 +1158,69 @@ static int bus_socket_read_message_need(sd_bus *bus, size_t *need) {
         return 0;
 }
 
-static int bus_socket_make_message(sd_bus *bus, size_t size) {
+static int bus_socket_read_message_need(sd_bus *bus, size_t *need) {
+        assert(bus);
+        assert(IN_SET(bus->state, BUS_RUNNING, BUS_HELLO));
+
+        return bus_socket_message_need(bus->rbuffer, bus->rbuffer_size, need);
+}
+
+static int bus_socket_make_message(sd_bus *bus, size_t offset, size_t size, bool take_fds) {
         sd_bus_message *t = NULL;
         void *b;
         int r;
 
         assert(bus);
-        assert(bus->rbuffer_size >= size);
+        assert(bus->rbuffer_size >= offset + size);
         assert(IN_SET(bus->state, BUS_RUNNING, BUS_HELLO));
 
         r = bus_rqueue_make_room(bus);
         if (r < 0)
                 return r;
 
-        if (bus->rbuffer_size > size) {
-                b = memdup((const uint8_t*) bus->rbuffer + size,
-                           bus->rbuffer_size - size);
+        /* If the message is the only thing in the read buffer, and the buffer was sized for it, pass
+         * ownership of the buffer on to the message. Otherwise copy the message out, so that a small message
+         * doesn't pin the whole batch read buffer. */
+        if (offset == 0 && size == bus->rbuffer_size && size >= BUS_SOCKET_READ_BATCH)
+                b = bus->rbuffer;
+        else {
+                b = memdup((const uint8_t*) bus->rbuffer + offset, size);
                 if (!b)
                         return -ENOMEM;
-        } else
-                b = NULL;
+        }
 
         r = bus_message_from_malloc(bus,
-                                    bus->rbuffer, size,
-                                    bus->fds, bus->n_fds,
+                                    b, size,
+                                    take_fds ? bus->fds : NULL,
+                                    take_fds ? bus->n_fds : 0,
                                     NULL,
                                     &t);
+        if (r < 0 && r != -EBADMSG) {
+                if (b != bus->rbuffer)
+                        free(b);
+                return r;
+        }
         if (r == -EBADMSG) {
                 log_debug_errno(r, "Received invalid message from connection %s, dropping.", strna(bus->description));
-                free(bus->rbuffer); /* We want to drop current rbuffer and proceed with whatever remains in b */
-        } else if (r < 0) {
-                free(b);
-                return r;
+                free(b); /* We want to drop the current message and proceed with whatever remains */
+
+                if (take_fds)
+                        close_many(bus->fds, bus->n_fds);
         }
 
-        /* rbuffer ownership was either transferred to t, or we got EBADMSG and dropped it. */
-        bus->rbuffer = b;
-        bus->rbuffer_size -= size;
+        /* The buffer ownership was either transferred to t, or we got EBADMSG and dropped it. */
+        if (b == bus->rbuffer) {
+                bus->rbuffer = NULL;
+                bus->rbuffer_size = 0;
+        }
 
-        bus->fds = NULL;
-        bus->n_fds = 0;
+        if (take_fds) {
+                if (r == -EBADMSG)
+                        free(bus->fds);
+
+                bus->fds = NULL;
+                bus->n_fds = 0;
+        }
 
         if (t) {
                 t->read_counter = ++bus->read_counter;
@@ -1171,11 +1231,131 @@ static int bus_socket_make_message(sd_bus *bus, size_t size) {
         return 1;
 }
 
+static uint32_t bus_socket_read_uint32(const uint8_t *p, uint8_t endian) {
+        return endian == BUS_LITTLE_ENDIAN ? unaligned_read_le32(p) : unaligned_read_be32(p);
+}
+
+static bool bus_socket_message_wants_fds(const void *p, size_t size) {
+        const uint8_t *h = p;
+        size_t offset, end;
+
+        assert(p);
+        assert(size >= sizeof(struct bus_header));
+
+        /* Checks whether the complete message at p declares a UNIX_FDS header field, i.e. whether it is the
+         * one file descriptors we received belong to. This only looks at the fixed type header fields the
+         * specification defines. If we come across anything else we can't skip safely, we say yes, and leave
+         * it to the message parser to reject the message if the fds don't match. */
+
+        end = sizeof(struct bus_header) + bus_socket_read_uint32(h + 12, h[0]);
+        if (end > size)
+                return true;
+
+        for (offset = sizeof(struct bus_header); offset < end; ) {
+                const char *signature;
+                uint8_t code;
+                size_t n;
+                int sz;
+
+                offset = ALIGN_TO(offset, 8);
+                if (offset + 3 > end)
+                        break;
+
+                code = h[offset];
+                n = h[offset + 1];
+                signature = (const char*) h + offset + 2;
+                if (offset + 2 + n + 1 > end || n != 1 || signature[1] != 0)
+                        return true;
+
+                if (code == BUS_MESSAGE_HEADER_UNIX_FDS)
+                        return true;
+
+                offset += 2 + n + 1;
+
+                switch (signature[0]) {
+
+                case SD_BUS_TYPE_STRING:
+                case SD_BUS_TYPE_OBJECT_PATH:
+                        offset = ALIGN_TO(offset, 4);
+                        if (offset + 4 > end)
+                                return true;
+                        offset += 4 + (size_t) bus_socket_read_uint32(h + offset, h[0]) + 1;
+                        break;
+
+                case SD_BUS_TYPE_SIGNATURE:
+                        if (offset + 1 > end)
+                                return true;
+                        offset += 1 + (size_t) h[offset] + 1;
+                        break;
+
+                default:
+                        sz = bus_type_get_size(signature[0]);
+                        if (sz < 0)
+                                return true;
+                        offset = ALIGN_TO(offset, (size_t) bus_type_get_alignment(signature[0])) + sz;
+                }
+        }
+
+        return false;
+}
+
+static int bus_socket_make_messages(sd_bus *bus) {
+        size_t offset = 0;
+        bool made = false;
+        int r;
+
+        assert(bus);
+
+        /* Turns all complete messages in the read buffer into sd_bus_message objects. Any file descriptors
+         * we hold are attached to the first of them that declares a UNIX_FDS header field: fds are sent
+         * along with the first byte of their message, hence all messages in front of it don't carry any. If
+         * none of them does, the fds stay around for the partial message at the end of the buffer. */
+
+        for (;;) {
+                size_t need;
+
+                r = bus_socket_message_need((const uint8_t*) bus->rbuffer + offset, bus->rbuffer_size - offset, &need);
+                if (r < 0)
+                        break;
+
+                if (bus->rbuffer_size - offset < need)
+                        break;
+
+                r = bus_socket_make_message(bus, offset, need,
+                                            bus->n_fds > 0 &&
+                                            bus_socket_message_wants_fds((const uint8_t*) bus->rbuffer + offset, need));
+                if (r < 0)
+                        break;
+
+                made = true;
+
+                if (!bus->rbuffer) /* The buffer was passed on to the message */
+                        return 1;
+
+                offset += need;
+        }
+
+        /* Move the remaining partial message to the front, once for all messages we made */
+        if (offset > 0) {
+                bus->rbuffer_size -= offset;
+
+                if (bus->rbuffer_size > 0)
+                        memmove(bus->rbuffer, (const uint8_t*) bus->rbuffer + offset, bus->rbuffer_size);
+                else
+                        bus->rbuffer = mfree(bus->rbuffer);
+        }
+
+        if (r < 0)
+                return r;
+
+        return made;
+}
+
 int bus_socket_read_message(sd_bus *bus) {
         struct msghdr mh;
         struct iovec iov = {};
         ssize_t k;
-        size_t need;
+        size_t need, size;
         int r;
         void *b;
         CMSG_BUFFER_TYPE(CMSG_SPACE(sizeof(int) * BUS_FDS_MAX)) control;
@@ -1189,15 +1369,23 @@ int bus_socket_read_message(sd_bus *bus) {
                 return r;
 
         if (bus->rbuffer_size >= need)
-                return bus_socket_make_message(bus, need);
+                return bus_socket_make_messages(bus);
 
-        b = realloc(bus->rbuffer, need);
+        /* Read as much as is available in one go, so that a flood of small messages is taken from the
+         * socket with a single syscall. If we already hold file descriptors for the current message, read
+         * only the rest of it, so that the fds of the next message can't end up with the wrong one. */
+        if (bus->n_fds > 0)
+                size = need;
+        else
+                size = MAX(need, BUS_SOCKET_READ_BATCH);
+
+        b = realloc(bus->rbuffer, size);
         if (!b)
                 return -ENOMEM;
 
         bus->rbuffer = b;
 
-        iov = IOVEC_MAKE((uint8_t *)bus->rbuffer + bus->rbuffer_size, need - bus->rbuffer_size);
+        iov = IOVEC_MAKE((uint8_t *)bus->rbuffer + bus->rbuffer_size, size - bus->rbuffer_size);
 
         if (bus->prefer_readv) {
                 k = readv(bus->input_fd, &iov, 1);
@@ -1265,13 +1453,10 @@ int bus_socket_read_message(sd_bus *bus) {
                                           cmsg->cmsg_level, cmsg->cmsg_type);
         }
 
-        r = bus_socket_read_message_need(bus, &need);
+        r = bus_socket_make_messages(bus);
         if (r < 0)
                 return r;
 
-        if (bus->rbuffer_size >= need)
-                return bus_socket_make_message(bus, need);
-
         return 1;
 }
 
@@ -1301,7 +1486,7 @@ int bus_socket_process_opening(sd_bus *b) {
 }
 
 int bus_socket_process_authenticating(sd_bus *b) {
-        int r;
+        int r, q;
 
         assert(b);
         assert(b->state == BUS_AUTHENTICATING);
@@ -1310,10 +1495,18 @@ int bus_socket_process_authenticating(sd_bus *b) {
                 return -ETIMEDOUT;
 
         r = bus_socket_write_auth(b);
-        if (r != 0)
+        if (r < 0)
+                return r;
+        if (r > 0 && bus_socket_auth_needs_write(b))
                 return r;
 
-        return bus_socket_read_auth(b);
+        /* Once everything queued is written, continue with what we already read right away: the peer might
+         * have pipelined BEGIN behind its other lines, and won't send anything else until we are running. */
+        q = bus_socket_read_auth(b);
+        if (q != 0)
+                return q;
+
+        return r;
 }
 
 int bus_socket_process_watch_bind(sd_bus *b) {
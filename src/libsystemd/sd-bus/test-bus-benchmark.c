@@ -11,12 +11,22 @@
 #include "bus-util.h"
 #include "def.h"
 #include "fd-util.h"
+#include "json.h"
 #include "missing_resource.h"
+#include "sort-util.h"
+#include "strv.h"
 #include "time-util.h"
 #include "util.h"
+#include "varlink.h"
 
 #define MAX_SIZE (2*1024*1024)
 
+/* Parameters of the "suite" mode */
+#define N_SUBSCRIBERS 16U
+#define N_PROPERTIES 256U
+#define PIPELINE_DEPTH 64U
+#define SIGNAL_BATCH 16U
+
 static usec_t arg_loop_usec = 100 * USEC_PER_MSEC;
 
 typedef enum Type {
@@ -206,10 +216,533 @@ static void client_chart(Type type, const char *address, const char *server_name
         sd_bus_unref(b);
 }
 
+/* The "suite" mode measures a fixed set of IPC workloads over both sd-bus and Varlink, and writes one JSON
+ * object per workload to stdout, so that results can be collected and compared by scripts. */
+
+static int bus_pairs[N_SUBSCRIBERS][2] = { [0 ... N_SUBSCRIBERS-1] = { -1, -1 } };
+static int varlink_pairs[N_SUBSCRIBERS + 1][2] = { [0 ... N_SUBSCRIBERS] = { -1, -1 } };
+
+static sd_bus *suite_emitters[N_SUBSCRIBERS];
+static size_t suite_n_emitters;
+static Varlink *suite_subscribers[N_SUBSCRIBERS];
+static size_t suite_n_subscribers;
+
+static int sample_compare(const nsec_t *a, const nsec_t *b) {
+        return CMP(*a, *b);
+}
+
+static void report(
+                const char *transport,
+                const char *benchmark,
+                uint64_t n_operations,
+                nsec_t elapsed,
+                nsec_t *samples,
+                size_t n_samples) {
+
+        _cleanup_(json_variant_unrefp) JsonVariant *v = NULL;
+
+        assert(elapsed > 0);
+
+        typesafe_qsort(samples, n_samples, sample_compare);
+
+        assert_se(json_build(&v, JSON_BUILD_OBJECT(
+                        JSON_BUILD_PAIR("transport", JSON_BUILD_STRING(transport)),
+                        JSON_BUILD_PAIR("benchmark", JSON_BUILD_STRING(benchmark)),
+                        JSON_BUILD_PAIR("operations", JSON_BUILD_UNSIGNED(n_operations)),
+                        JSON_BUILD_PAIR("elapsedNSec", JSON_BUILD_UNSIGNED(elapsed)),
+                        JSON_BUILD_PAIR("operationsPerSec", JSON_BUILD_UNSIGNED(n_operations * NSEC_PER_SEC / elapsed)),
+                        JSON_BUILD_PAIR_CONDITION(n_samples > 0, "latencyP50NSec", JSON_BUILD_UNSIGNED(n_samples > 0 ? samples[n_samples / 2] : 0)),
+                        JSON_BUILD_PAIR_CONDITION(n_samples > 0, "latencyP99NSec", JSON_BUILD_UNSIGNED(n_samples > 0 ? samples[n_samples * 99 / 100] : 0)),
+                        JSON_BUILD_PAIR_CONDITION(n_samples > 0, "latencyMaxNSec", JSON_BUILD_UNSIGNED(n_samples > 0 ? samples[n_samples - 1] : 0)))) >= 0);
+
+        json_variant_dump(v, JSON_FORMAT_NEWLINE|JSON_FORMAT_FLUSH, stdout, NULL);
+}
+
+static int method_bus_ping(sd_bus_message *m, void *userdata, sd_bus_error *error) {
+        return sd_bus_reply_method_return(m, NULL);
+}
+
+static int method_bus_emit(sd_bus_message *m, void *userdata, sd_bus_error *error) {
+        uint32_t n;
+        int r;
+
+        r = sd_bus_message_read(m, "u", &n);
+        if (r < 0)
+                return r;
+
+        for (uint32_t i = 0; i < n; i++)
+                for (size_t j = 0; j < suite_n_emitters; j++) {
+                        r = sd_bus_emit_signal(suite_emitters[j], "/", "benchmark.server", "Signal", NULL);
+                        if (r < 0)
+                                return r;
+                }
+
+        return sd_bus_reply_method_return(m, NULL);
+}
+
+static int method_bus_exit(sd_bus_message *m, void *userdata, sd_bus_error *error) {
+        sd_event_exit(sd_bus_get_event(sd_bus_message_get_bus(m)), 0);
+        return sd_bus_reply_method_return(m, NULL);
+}
+
+static const sd_bus_vtable suite_vtable[] = {
+        SD_BUS_VTABLE_START(0),
+        SD_BUS_METHOD("Ping", NULL, NULL, method_bus_ping, 0),
+        SD_BUS_METHOD("Emit", "u", NULL, method_bus_emit, 0),
+        SD_BUS_METHOD("Exit", NULL, NULL, method_bus_exit, 0),
+        SD_BUS_VTABLE_END
+};
+
+static int method_varlink_ping(Varlink *link, JsonVariant *parameters, VarlinkMethodFlags flags, void *userdata) {
+        return varlink_reply(link, NULL);
+}
+
+static int method_varlink_get_all(Varlink *link, JsonVariant *parameters, VarlinkMethodFlags flags, void *userdata) {
+        _cleanup_(json_variant_unrefp) JsonVariant *v = NULL;
+        JsonVariant *fields[N_PROPERTIES * 2] = {};
+        char **names = userdata;
+        int r;
+
+        /* Build the reply from scratch on each call, like sd-bus has to for GetAll() */
+        for (unsigned i = 0; i < N_PROPERTIES; i++) {
+                r = json_variant_new_string(fields + i * 2, names[i]);
+                if (r < 0)
+                        goto finish;
+
+                r = json_variant_new_unsigned(fields + i * 2 + 1, i);
+                if (r < 0)
+                        goto finish;
+        }
+
+        r = json_variant_new_object(&v, fields, ELEMENTSOF(fields));
+
+finish:
+        json_variant_unref_many(fields, ELEMENTSOF(fields));
+        if (r < 0)
+                return r;
+
+        return varlink_reply(link, v);
+}
+
+static int method_varlink_subscribe(Varlink *link, JsonVariant *parameters, VarlinkMethodFlags flags, void *userdata) {
+        if (!FLAGS_SET(flags, VARLINK_METHOD_MORE))
+                return varlink_error_invalid_parameter(link, parameters);
+        if (suite_n_subscribers >= N_SUBSCRIBERS)
+                return varlink_error(link, "io.systemd.Benchmark.TooManySubscribers", NULL);
+
+        suite_subscribers[suite_n_subscribers++] = varlink_ref(link);
+
+        /* Let the subscriber know that it is registered, so that it doesn't race against Emit() */
+        return varlink_notify(link, NULL);
+}
+
+static int method_varlink_emit(Varlink *link, JsonVariant *parameters, VarlinkMethodFlags flags, void *userdata) {
+        JsonVariant *n;
+        int r;
+
+        n = json_variant_by_key(parameters, "count");
+        if (!n || !json_variant_is_unsigned(n))
+                return varlink_error_invalid_parameter(link, parameters);
+
+        for (uintmax_t i = 0; i < json_variant_unsigned(n); i++)
+                for (size_t j = 0; j < suite_n_subscribers; j++) {
+                        r = varlink_notify(suite_subscribers[j], NULL);
+                        if (r < 0)
+                                return r;
+                }
+
+        return varlink_reply(link, NULL);
+}
+
+static void suite_server(Type type, sd_bus *b) {
+        _cleanup_(varlink_server_unrefp) VarlinkServer *s = NULL;
+        _cleanup_(sd_event_unrefp) sd_event *e = NULL;
+        _cleanup_free_ sd_bus_vtable *properties = NULL;
+        _cleanup_free_ uint32_t *values = NULL;
+        _cleanup_strv_free_ char **names = NULL;
+        _cleanup_(sd_bus_slot_unrefp) sd_bus_slot *slot_methods = NULL, *slot_properties = NULL;
+
+        assert_se(sd_event_new(&e) >= 0);
+
+        /* A large vtable of constant properties, read via the default getter from the values array */
+        assert_se(properties = new(sd_bus_vtable, N_PROPERTIES + 2));
+        assert_se(values = new(uint32_t, N_PROPERTIES));
+        assert_se(names = new0(char*, N_PROPERTIES + 1));
+
+        properties[0] = (sd_bus_vtable) SD_BUS_VTABLE_START(0);
+        for (unsigned i = 0; i < N_PROPERTIES; i++) {
+                assert_se(asprintf(names + i, "Property%u", i) >= 0);
+                values[i] = i;
+                properties[i + 1] = (sd_bus_vtable) SD_BUS_PROPERTY(names[i], "u", NULL, i * sizeof(uint32_t), SD_BUS_VTABLE_PROPERTY_CONST);
+        }
+        properties[N_PROPERTIES + 1] = (sd_bus_vtable) SD_BUS_VTABLE_END;
+
+        assert_se(sd_bus_add_object_vtable(b, &slot_methods, "/", "benchmark.server", suite_vtable, NULL) >= 0);
+        assert_se(sd_bus_add_object_vtable(b, &slot_properties, "/", "benchmark.Properties", properties, values) >= 0);
+        assert_se(sd_bus_attach_event(b, e, 0) >= 0);
+
+        /* On a bus the broker does the fan-out, on direct connections we have to send to each peer */
+        if (type == TYPE_DIRECT)
+                for (unsigned i = 0; i < N_SUBSCRIBERS; i++) {
+                        sd_bus *emitter;
+
+                        assert_se(sd_bus_new(&emitter) >= 0);
+                        assert_se(sd_bus_set_fd(emitter, bus_pairs[i][0], bus_pairs[i][0]) >= 0);
+                        assert_se(sd_bus_set_server(emitter, true, SD_ID128_NULL) >= 0);
+                        assert_se(sd_bus_start(emitter) >= 0);
+                        assert_se(sd_bus_attach_event(emitter, e, 0) >= 0);
+
+                        suite_emitters[suite_n_emitters++] = emitter;
+                }
+        else
+                suite_emitters[suite_n_emitters++] = sd_bus_ref(b);
+
+        assert_se(varlink_server_new(&s, 0) >= 0);
+        varlink_server_set_userdata(s, names);
+        assert_se(varlink_server_bind_method_many(
+                        s,
+                        "io.systemd.Benchmark.Ping",      method_varlink_ping,
+                        "io.systemd.Benchmark.GetAll",    method_varlink_get_all,
+                        "io.systemd.Benchmark.Subscribe", method_varlink_subscribe,
+                        "io.systemd.Benchmark.Emit",      method_varlink_emit) >= 0);
+        assert_se(varlink_server_attach_event(s, e, 0) >= 0);
+
+        for (unsigned i = 0; i < ELEMENTSOF(varlink_pairs); i++) {
+                assert_se(varlink_server_add_connection(s, varlink_pairs[i][0], NULL) >= 0);
+                varlink_pairs[i][0] = -1;
+        }
+
+        assert_se(sd_event_loop(e) >= 0);
+
+        for (size_t i = 0; i < suite_n_subscribers; i++)
+                suite_subscribers[i] = varlink_unref(suite_subscribers[i]);
+        for (size_t i = 0; i < suite_n_emitters; i++)
+                suite_emitters[i] = sd_bus_unref(suite_emitters[i]);
+
+        sd_bus_detach_event(b);
+}
+
+static int suite_bus_reply(sd_bus_message *m, void *userdata, sd_bus_error *error) {
+        uint64_t *n = userdata;
+
+        assert_se(!sd_bus_message_is_method_error(m, NULL));
+
+        (*n)++;
+        return 0;
+}
+
+static int suite_bus_signal(sd_bus_message *m, void *userdata, sd_bus_error *error) {
+        uint64_t *n = userdata;
+
+        (*n)++;
+        return 0;
+}
+
+static int suite_varlink_reply(Varlink *link, JsonVariant *parameters, const char *error_id, VarlinkReplyFlags flags, void *userdata) {
+        uint64_t *n = userdata;
+
+        assert_se(!error_id);
+
+        (*n)++;
+        return 0;
+}
+
+static void bus_wait_for(sd_bus *b, const uint64_t *n, uint64_t target) {
+        while (*n < target) {
+                int r;
+
+                r = sd_bus_process(b, NULL);
+                assert_se(r >= 0);
+                if (r == 0)
+                        assert_se(sd_bus_wait(b, USEC_INFINITY) >= 0);
+        }
+}
+
+static void varlink_wait_for(Varlink *v, const uint64_t *n, uint64_t target) {
+        while (*n < target) {
+                int r;
+
+                r = varlink_process(v);
+                assert_se(r >= 0);
+                if (r == 0)
+                        assert_se(varlink_wait(v, USEC_INFINITY) >= 0);
+        }
+}
+
+static void suite_bus_latency(sd_bus *b, const char *server_name) {
+        _cleanup_free_ nsec_t *samples = NULL;
+        size_t n_samples = 0, n_allocated = 0;
+        nsec_t start, t;
+
+        start = t = now_nsec(CLOCK_MONOTONIC);
+        for (;;) {
+                nsec_t n;
+
+                assert_se(sd_bus_call_method(b, server_name, "/", "benchmark.server", "Ping", NULL, NULL, NULL) >= 0);
+
+                n = now_nsec(CLOCK_MONOTONIC);
+                assert_se(GREEDY_REALLOC(samples, n_allocated, n_samples + 1));
+                samples[n_samples++] = n - t;
+                t = n;
+
+                if (t >= start + arg_loop_usec * NSEC_PER_USEC)
+                        break;
+        }
+
+        report("sd-bus", "latency", n_samples, t - start, samples, n_samples);
+}
+
+static void suite_bus_pipelined(sd_bus *b, const char *server_name) {
+        uint64_t n_sent = 0, n_done = 0;
+        nsec_t start, end;
+
+        start = now_nsec(CLOCK_MONOTONIC);
+        end = start + arg_loop_usec * NSEC_PER_USEC;
+        for (;;) {
+                bool more;
+                int r;
+
+                more = now_nsec(CLOCK_MONOTONIC) < end;
+
+                for (; more && n_sent - n_done < PIPELINE_DEPTH; n_sent++)
+                        assert_se(sd_bus_call_method_async(b, NULL, server_name, "/", "benchmark.server", "Ping", suite_bus_reply, &n_done, NULL) >= 0);
+
+                if (!more && n_done == n_sent)
+                        break;
+
+                r = sd_bus_process(b, NULL);
+                assert_se(r >= 0);
+                if (r == 0)
+                        assert_se(sd_bus_wait(b, USEC_INFINITY) >= 0);
+        }
+
+        report("sd-bus", "pipelined", n_done, now_nsec(CLOCK_MONOTONIC) - start, NULL, 0);
+}
+
+static void suite_bus_get_all(sd_bus *b, const char *server_name) {
+        _cleanup_free_ nsec_t *samples = NULL;
+        size_t n_samples = 0, n_allocated = 0;
+        nsec_t start, t;
+
+        start = t = now_nsec(CLOCK_MONOTONIC);
+        for (;;) {
+                _cleanup_(sd_bus_message_unrefp) sd_bus_message *reply = NULL;
+                nsec_t n;
+
+                assert_se(sd_bus_call_method(b, server_name, "/", "org.freedesktop.DBus.Properties", "GetAll", NULL, &reply, "s", "benchmark.Properties") >= 0);
+                assert_se(sd_bus_message_skip(reply, "a{sv}") >= 0);
+
+                n = now_nsec(CLOCK_MONOTONIC);
+                assert_se(GREEDY_REALLOC(samples, n_allocated, n_samples + 1));
+                samples[n_samples++] = n - t;
+                t = n;
+
+                if (t >= start + arg_loop_usec * NSEC_PER_USEC)
+                        break;
+        }
+
+        report("sd-bus", "get-all", n_samples, t - start, samples, n_samples);
+}
+
+static void suite_bus_fan_out(Type type, sd_bus *b, const char *address, const char *server_name) {
+        sd_bus *subscribers[N_SUBSCRIBERS] = {};
+        uint64_t n_received[N_SUBSCRIBERS] = {}, n_emitted = 0;
+        nsec_t start, t;
+
+        for (unsigned i = 0; i < N_SUBSCRIBERS; i++) {
+                assert_se(sd_bus_new(subscribers + i) >= 0);
+
+                if (type == TYPE_DIRECT)
+                        assert_se(sd_bus_set_fd(subscribers[i], bus_pairs[i][1], bus_pairs[i][1]) >= 0);
+                else {
+                        assert_se(sd_bus_set_address(subscribers[i], address) >= 0);
+                        assert_se(sd_bus_set_bus_client(subscribers[i], true) >= 0);
+                }
+
+                assert_se(sd_bus_start(subscribers[i]) >= 0);
+                assert_se(sd_bus_match_signal(subscribers[i], NULL, server_name, "/", "benchmark.server", "Signal", suite_bus_signal, n_received + i) >= 0);
+        }
+
+        start = t = now_nsec(CLOCK_MONOTONIC);
+        for (;;) {
+                assert_se(sd_bus_call_method(b, server_name, "/", "benchmark.server", "Emit", NULL, NULL, "u", SIGNAL_BATCH) >= 0);
+                n_emitted += SIGNAL_BATCH;
+
+                for (unsigned i = 0; i < N_SUBSCRIBERS; i++)
+                        bus_wait_for(subscribers[i], n_received + i, n_emitted);
+
+                t = now_nsec(CLOCK_MONOTONIC);
+                if (t >= start + arg_loop_usec * NSEC_PER_USEC)
+                        break;
+        }
+
+        report("sd-bus", "fan-out", n_emitted * N_SUBSCRIBERS, t - start, NULL, 0);
+
+        for (unsigned i = 0; i < N_SUBSCRIBERS; i++)
+                sd_bus_flush_close_unref(subscribers[i]);
+}
+
+static void suite_varlink_latency(Varlink *v) {
+        _cleanup_free_ nsec_t *samples = NULL;
+        size_t n_samples = 0, n_allocated = 0;
+        nsec_t start, t;
+
+        start = t = now_nsec(CLOCK_MONOTONIC);
+        for (;;) {
+                JsonVariant *reply;
+                const char *error_id;
+                nsec_t n;
+
+                assert_se(varlink_call(v, "io.systemd.Benchmark.Ping", NULL, &reply, &error_id, NULL) >= 0);
+                assert_se(!error_id);
+
+                n = now_nsec(CLOCK_MONOTONIC);
+                assert_se(GREEDY_REALLOC(samples, n_allocated, n_samples + 1));
+                samples[n_samples++] = n - t;
+                t = n;
+
+                if (t >= start + arg_loop_usec * NSEC_PER_USEC)
+                        break;
+        }
+
+        report("varlink", "latency", n_samples, t - start, samples, n_samples);
+}
+
+static void suite_varlink_pipelined(Varlink *v) {
+        uint64_t n_sent = 0, n_done = 0;
+        nsec_t start, end;
+
+        start = now_nsec(CLOCK_MONOTONIC);
+        end = start + arg_loop_usec * NSEC_PER_USEC;
+        for (;;) {
+                bool more;
+                int r;
+
+                more = now_nsec(CLOCK_MONOTONIC) < end;
+
+                for (; more && n_sent - n_done < PIPELINE_DEPTH; n_sent++)
+                        assert_se(varlink_invoke_full(v, "io.systemd.Benchmark.Ping", NULL, suite_varlink_reply, &n_done) >= 0);
+
+                if (!more && n_done == n_sent)
+                        break;
+
+                r = varlink_process(v);
+                assert_se(r >= 0);
+                if (r == 0)
+                        assert_se(varlink_wait(v, USEC_INFINITY) >= 0);
+        }
+
+        report("varlink", "pipelined", n_done, now_nsec(CLOCK_MONOTONIC) - start, NULL, 0);
+}
+
+static void suite_varlink_get_all(Varlink *v) {
+        _cleanup_free_ nsec_t *samples = NULL;
+        size_t n_samples = 0, n_allocated = 0;
+        nsec_t start, t;
+
+        start = t = now_nsec(CLOCK_MONOTONIC);
+        for (;;) {
+                JsonVariant *reply;
+                const char *error_id;
+                nsec_t n;
+
+                assert_se(varlink_call(v, "io.systemd.Benchmark.GetAll", NULL, &reply, &error_id, NULL) >= 0);
+                assert_se(!error_id);
+                assert_se(json_variant_elements(reply) == N_PROPERTIES * 2);
+
+                n = now_nsec(CLOCK_MONOTONIC);
+                assert_se(GREEDY_REALLOC(samples, n_allocated, n_samples + 1));
+                samples[n_samples++] = n - t;
+                t = n;
+
+                if (t >= start + arg_loop_usec * NSEC_PER_USEC)
+                        break;
+        }
+
+        report("varlink", "get-all", n_samples, t - start, samples, n_samples);
+}
+
+static void suite_varlink_fan_out(Varlink *v) {
+        Varlink *subscribers[N_SUBSCRIBERS] = {};
+        uint64_t n_received[N_SUBSCRIBERS] = {}, n_emitted = 0;
+        nsec_t start, t;
+
+        for (unsigned i = 0; i < N_SUBSCRIBERS; i++) {
+                assert_se(varlink_connect_fd(subscribers + i, varlink_pairs[i + 1][1]) >= 0);
+                varlink_pairs[i + 1][1] = -1;
+
+                varlink_set_userdata(subscribers[i], n_received + i);
+                assert_se(varlink_bind_reply(subscribers[i], suite_varlink_reply) >= 0);
+                assert_se(varlink_observe(subscribers[i], "io.systemd.Benchmark.Subscribe", NULL) >= 0);
+
+                /* Wait for the confirmation that we are subscribed */
+                varlink_wait_for(subscribers[i], n_received + i, 1);
+                n_received[i] = 0;
+        }
+
+        start = t = now_nsec(CLOCK_MONOTONIC);
+        for (;;) {
+                JsonVariant *reply;
+                const char *error_id;
+
+                assert_se(varlink_callb(v, "io.systemd.Benchmark.Emit", &reply, &error_id, NULL,
+                                        JSON_BUILD_OBJECT(JSON_BUILD_PAIR("count", JSON_BUILD_UNSIGNED(SIGNAL_BATCH)))) >= 0);
+                assert_se(!error_id);
+                n_emitted += SIGNAL_BATCH;
+
+                for (unsigned i = 0; i < N_SUBSCRIBERS; i++)
+                        varlink_wait_for(subscribers[i], n_received + i, n_emitted);
+
+                t = now_nsec(CLOCK_MONOTONIC);
+                if (t >= start + arg_loop_usec * NSEC_PER_USEC)
+                        break;
+        }
+
+        report("varlink", "fan-out", n_emitted * N_SUBSCRIBERS, t - start, NULL, 0);
+
+        for (unsigned i = 0; i < N_SUBSCRIBERS; i++)
+                varlink_flush_close_unref(subscribers[i]);
+}
+
+static void client_suite(Type type, const char *address, const char *server_name, int fd) {
+        _cleanup_(varlink_flush_close_unrefp) Varlink *v = NULL;
+        sd_bus *b;
+
+        assert_se(sd_bus_new(&b) >= 0);
+
+        if (type == TYPE_DIRECT)
+                assert_se(sd_bus_set_fd(b, fd, fd) >= 0);
+        else {
+                assert_se(sd_bus_set_address(b, address) >= 0);
+                assert_se(sd_bus_set_bus_client(b, true) >= 0);
+        }
+
+        assert_se(sd_bus_start(b) >= 0);
+
+        assert_se(varlink_connect_fd(&v, varlink_pairs[0][1]) >= 0);
+        varlink_pairs[0][1] = -1;
+
+        suite_bus_latency(b, server_name);
+        suite_bus_pipelined(b, server_name);
+        suite_bus_get_all(b, server_name);
+        suite_bus_fan_out(type, b, address, server_name);
+
+        suite_varlink_latency(v);
+        suite_varlink_pipelined(v);
+        suite_varlink_get_all(v);
+        suite_varlink_fan_out(v);
+
+        /* Wait for the reply, since the server checks our credentials before dispatching the call */
+        assert_se(sd_bus_call_method(b, server_name, "/", "benchmark.server", "Exit", NULL, NULL, NULL) >= 0);
+
+        sd_bus_flush_close_unref(b);
+}
+
 int main(int argc, char *argv[]) {
         enum {
                 MODE_BISECT,
                 MODE_CHART,
+                MODE_SUITE,
         } mode = MODE_BISECT;
         Type type = TYPE_LEGACY;
         int i, pair[2] = { -1, -1 };
@@ -226,6 +759,9 @@ int main(int argc, char *argv[]) {
                 if (streq(argv[i], "chart")) {
                         mode = MODE_CHART;
                         continue;
+                } else if (streq(argv[i], "suite")) {
+                        mode = MODE_SUITE;
+                        continue;
                 } else if (streq(argv[i], "legacy")) {
                         type = TYPE_LEGACY;
                         continue;
@@ -279,6 +815,15 @@ int main(int argc, char *argv[]) {
                 assert_se(server_name);
         }
 
+        if (mode == MODE_SUITE) {
+                if (type == TYPE_DIRECT)
+                        for (i = 0; i < (int) N_SUBSCRIBERS; i++)
+                                assert_se(socketpair(AF_UNIX, SOCK_STREAM|SOCK_CLOEXEC, 0, bus_pairs[i]) >= 0);
+
+                for (i = 0; i < (int) ELEMENTSOF(varlink_pairs); i++)
+                        assert_se(socketpair(AF_UNIX, SOCK_STREAM|SOCK_CLOEXEC, 0, varlink_pairs[i]) >= 0);
+        }
+
         sync();
         setpriority(PRIO_PROCESS, 0, -19);
 
@@ -301,6 +846,15 @@ int main(int argc, char *argv[]) {
                 case MODE_CHART:
                         client_chart(type, address, server_name, pair[1]);
                         break;
+
+                case MODE_SUITE:
+                        for (i = 0; i < (int) N_SUBSCRIBERS; i++)
+                                bus_pairs[i][0] = safe_close(bus_pairs[i][0]);
+                        for (i = 0; i < (int) ELEMENTSOF(varlink_pairs); i++)
+                                varlink_pairs[i][0] = safe_close(varlink_pairs[i][0]);
+
+                        client_suite(type, address, server_name, pair[1]);
+                        break;
                 }
 
                 _exit(EXIT_SUCCESS);
@@ -310,7 +864,15 @@ int main(int argc, char *argv[]) {
         CPU_SET(1, &cpuset);
         pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &cpuset);
 
-        server(b, &result);
+        if (mode == MODE_SUITE) {
+                for (i = 0; i < (int) N_SUBSCRIBERS; i++)
+                        bus_pairs[i][1] = safe_close(bus_pairs[i][1]);
+                for (i = 0; i < (int) ELEMENTSOF(varlink_pairs); i++)
+                        varlink_pairs[i][1] = safe_close(varlink_pairs[i][1]);
+
+                suite_server(type, b);
+        } else
+                server(b, &result);
 
         if (mode == MODE_BISECT)
                 printf("Copying/memfd are equally fast at %zu bytes\n", result);
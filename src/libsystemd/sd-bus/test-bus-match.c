@@ -1,5 +1,6 @@
 /* SPDX-License-Identifier: LGPL-2.1-or-later */
 
+#include "alloc-util.h"
 #include "bus-match.h"
 #include "bus-message.h"
 #include "bus-slot.h"
@@ -7,7 +8,12 @@
 #include "log.h"
 #include "macro.h"
 #include "memory-util.h"
+#include "stdio-util.h"
 #include "tests.h"
+#include "time-util.h"
+
+#define N_BENCHMARK_MATCHES 3000U
+#define N_BENCHMARK_MESSAGES 50U
 
 static bool mask[32];
 
@@ -59,6 +65,109 @@ static int match_add(sd_bus_slot *slots, struct bus_match_node *root, const char
         return r;
 }
 
+static unsigned n_benchmark_hits;
+
+static int benchmark_filter(sd_bus_message *m, void *userdata, sd_bus_error *ret_error) {
+        n_benchmark_hits++;
+        return 0;
+}
+
+static void benchmark_add(sd_bus_slot *s, struct bus_match_node *root, const char *match) {
+        struct bus_match_component *components = NULL;
+        unsigned n_components = 0;
+
+        assert_se(bus_match_parse(match, &components, &n_components) >= 0);
+
+        zero(*s);
+        s->match_callback.callback = benchmark_filter;
+
+        assert_se(bus_match_add(root, components, n_components, &s->match_callback) >= 0);
+        bus_match_parse_free(components, n_components);
+}
+
+static void test_match_benchmark(sd_bus *bus) {
+        struct bus_match_node root = {
+                .type = BUS_MATCH_ROOT,
+        };
+        _cleanup_free_ struct bus_match_node *single = NULL;
+        _cleanup_free_ sd_bus_slot *slots = NULL;
+        char ta[FORMAT_TIMESPAN_MAX], tb[FORMAT_TIMESPAN_MAX];
+        unsigned hits_tree, hits_single;
+        usec_t t_tree = 0, t_single = 0;
+
+        log_info("/* %s */", __func__);
+
+        /* Installs many namespace and path matches, as is typical for services tracking lots of objects,
+         * and dispatches messages through the match tree. For comparison, the same messages are also
+         * dispatched by testing each match on its own, which is what walking the tree amounted to for these
+         * match types before they were indexed. */
+
+        slots = new(sd_bus_slot, N_BENCHMARK_MATCHES * 2);
+        single = new(struct bus_match_node, N_BENCHMARK_MATCHES);
+        assert_se(slots && single);
+
+        for (unsigned i = 0; i < N_BENCHMARK_MATCHES; i++) {
+                char match[STRLEN("type='signal',interface='org.example.Unit',arg0namespace='org.example.u'") + DECIMAL_STR_MAX(unsigned) + 1];
+
+                if (i % 3 == 0)
+                        xsprintf(match, "type='signal',path_namespace='/org/example/unit/u%u'", i);
+                else if (i % 3 == 1)
+                        xsprintf(match, "type='signal',interface='org.example.Unit',arg0namespace='org.example.u%u'", i);
+                else
+                        xsprintf(match, "type='signal',arg1path='/org/example/unit/u%u/'", i);
+
+                benchmark_add(slots + i, &root, match);
+
+                single[i] = (struct bus_match_node) {
+                        .type = BUS_MATCH_ROOT,
+                };
+                benchmark_add(slots + N_BENCHMARK_MATCHES + i, single + i, match);
+        }
+
+        n_benchmark_hits = 0;
+        for (unsigned i = 0; i < N_BENCHMARK_MESSAGES; i++) {
+                _cleanup_(sd_bus_message_unrefp) sd_bus_message *m = NULL;
+                char path[STRLEN("/org/example/unit/u/sub") + DECIMAL_STR_MAX(unsigned) + 1],
+                        arg0[STRLEN("org.example.u.x") + DECIMAL_STR_MAX(unsigned) + 1],
+                        arg1[STRLEN("/org/example/unit/u/y") + DECIMAL_STR_MAX(unsigned) + 1];
+                unsigned k = i * 7 % (N_BENCHMARK_MATCHES / 3) * 3;
+                usec_t n;
+
+                /* Pick one match of each kind */
+                xsprintf(path, "/org/example/unit/u%u/sub", k);
+                xsprintf(arg0, "org.example.u%u.x", k + 1);
+                xsprintf(arg1, "/org/example/unit/u%u/y", k + 2);
+
+                assert_se(sd_bus_message_new_signal(bus, &m, path, "org.example.Unit", "Changed") >= 0);
+                assert_se(sd_bus_message_append(m, "ss", arg0, arg1) >= 0);
+                assert_se(sd_bus_message_seal(m, 1, 0) >= 0);
+
+                n = now(CLOCK_MONOTONIC);
+                assert_se(bus_match_run(NULL, &root, m) == 0);
+                t_tree += now(CLOCK_MONOTONIC) - n;
+                hits_tree = n_benchmark_hits;
+
+                n = now(CLOCK_MONOTONIC);
+                for (unsigned j = 0; j < N_BENCHMARK_MATCHES; j++)
+                        assert_se(bus_match_run(NULL, single + j, m) == 0);
+                t_single += now(CLOCK_MONOTONIC) - n;
+                hits_single = n_benchmark_hits - hits_tree;
+
+                assert_se(hits_tree == 3);
+                assert_se(hits_single == 3);
+                n_benchmark_hits = 0;
+        }
+
+        log_info("%u matches, %u messages: match tree took %s, testing each match took %s",
+                 N_BENCHMARK_MATCHES, N_BENCHMARK_MESSAGES,
+                 format_timespan(ta, sizeof(ta), t_tree, 1),
+                 format_timespan(tb, sizeof(tb), t_single, 1));
+
+        bus_match_free(&root);
+        for (unsigned i = 0; i < N_BENCHMARK_MATCHES; i++)
+                bus_match_free(single + i);
+}
+
 static void test_match_scope(const char *match, enum bus_match_scope scope) {
         struct bus_match_component *components = NULL;
         unsigned n_components = 0;
@@ -137,6 +246,8 @@ int main(int argc, char *argv[]) {
 
         bus_match_free(&root);
 
+        test_match_benchmark(bus);
+
         test_match_scope("interface='foobar'", BUS_MATCH_GENERIC);
         test_match_scope("", BUS_MATCH_GENERIC);
         test_match_scope("interface='org.freedesktop.DBus.Local'", BUS_MATCH_LOCAL);
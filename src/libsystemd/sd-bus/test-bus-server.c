@@ -1,15 +1,24 @@
 /* SPDX-License-Identifier: LGPL-2.1-or-later */
 
+#include <fcntl.h>
 #include <pthread.h>
 #include <stdlib.h>
+#include <sys/stat.h>
 
 #include "sd-bus.h"
 
+#include "bus-dump.h"
 #include "bus-internal.h"
+#include "bus-message.h"
 #include "bus-util.h"
+#include "fd-util.h"
+#include "fileio.h"
 #include "log.h"
 #include "macro.h"
 #include "memory-util.h"
+#include "string-util.h"
+#include "strv.h"
+#include "unaligned.h"
 
 struct context {
         int fds[2];
@@ -17,10 +26,42 @@ struct context {
         bool client_negotiate_unix_fds;
         bool server_negotiate_unix_fds;
 
+        bool client_negotiate_memfd;
+        bool server_negotiate_memfd;
+
         bool client_anonymous_auth;
         bool server_anonymous_auth;
 };
 
+#define ECHO_SIZE (1024U*1024U)
+
+static void check_echo_blob(sd_bus_message *m) {
+        _cleanup_free_ char *pcap = NULL;
+        _cleanup_fclose_ FILE *f = NULL;
+        _cleanup_free_ void *blob = NULL;
+        size_t sz, pcap_sz;
+        const uint8_t *body;
+
+        /* Both the blob and the pcap frame carry the body inline, even if it is passed as memfd, and might
+         * not even be mapped yet */
+
+        assert_se(bus_message_get_blob(m, &blob, &sz) >= 0);
+        assert_se(sz == BUS_MESSAGE_SIZE(m));
+        assert_se(BUS_MESSAGE_BSWAP32(m, ((struct bus_header*) blob)->dbus1.body_size) == m->body_size);
+
+        /* The body is a single byte array, i.e. its length, followed by the bytes */
+        body = (const uint8_t*) blob + BUS_MESSAGE_BODY_BEGIN(m);
+        assert_se(BUS_MESSAGE_BSWAP32(m, unaligned_read_ne32(body)) == ECHO_SIZE);
+        for (size_t i = 0; i < ECHO_SIZE; i++)
+                assert_se(body[4 + i] == (uint8_t) i);
+
+        assert_se(f = open_memstream_unlocked(&pcap, &pcap_sz));
+        assert_se(bus_message_pcap_frame(m, sz, f) >= 0);
+        f = safe_fclose(f);
+        assert_se(pcap_sz > sz);
+        assert_se(memcmp(pcap + pcap_sz - sz, blob, sz) == 0);
+}
+
 static void *server(void *p) {
         struct context *c = p;
         sd_bus *bus = NULL;
@@ -35,6 +76,7 @@ static void *server(void *p) {
         assert_se(sd_bus_set_server(bus, 1, id) >= 0);
         assert_se(sd_bus_set_anonymous(bus, c->server_anonymous_auth) >= 0);
         assert_se(sd_bus_negotiate_fds(bus, c->server_negotiate_unix_fds) >= 0);
+        assert_se(sd_bus_negotiate_memfd(bus, c->server_negotiate_memfd) >= 0);
         assert_se(sd_bus_start(bus) >= 0);
 
         while (!quit) {
@@ -65,6 +107,9 @@ static void *server(void *p) {
 
                         assert_se((sd_bus_can_send(bus, 'h') >= 1) ==
                                   (c->server_negotiate_unix_fds && c->client_negotiate_unix_fds));
+                        assert_se(bus->can_memfd ==
+                                  (c->server_negotiate_unix_fds && c->client_negotiate_unix_fds &&
+                                   c->server_negotiate_memfd && c->client_negotiate_memfd));
 
                         r = sd_bus_message_new_method_return(m, &reply);
                         if (r < 0) {
@@ -74,6 +119,31 @@ static void *server(void *p) {
 
                         quit = true;
 
+                } else if (sd_bus_message_is_method_call(m, "org.freedesktop.systemd.test", "Echo") ||
+                           sd_bus_message_is_method_call(m, "org.freedesktop.systemd.test", "EchoSensitive")) {
+                        const void *data;
+                        size_t sz;
+
+                        /* Sensitive messages are never passed as memfd, as we couldn't erase them */
+                        assert_se((m->body.memfd >= 0) ==
+                                  (bus->can_memfd && streq(sd_bus_message_get_member(m), "Echo")));
+                        check_echo_blob(m);
+
+                        assert_se(sd_bus_message_read_array(m, 'y', &data, &sz) >= 0);
+                        assert_se(sz == ECHO_SIZE);
+
+                        r = sd_bus_message_new_method_return(m, &reply);
+                        if (r < 0) {
+                                log_error_errno(r, "Failed to allocate return: %m");
+                                goto fail;
+                        }
+
+                        r = sd_bus_message_append_array(reply, 'y', data, sz);
+                        if (r < 0) {
+                                log_error_errno(r, "Failed to append array: %m");
+                                goto fail;
+                        }
+
                 } else if (sd_bus_message_is_method_call(m, NULL, NULL)) {
                         r = sd_bus_message_new_method_error(
                                         m,
@@ -109,14 +179,58 @@ static int client(struct context *c) {
         _cleanup_(sd_bus_message_unrefp) sd_bus_message *m = NULL, *reply = NULL;
         _cleanup_(sd_bus_unrefp) sd_bus *bus = NULL;
         _cleanup_(sd_bus_error_free) sd_bus_error error = SD_BUS_ERROR_NULL;
+        _cleanup_free_ uint8_t *payload = NULL;
+        const char *member;
+        const void *p;
+        size_t sz;
         int r;
 
         assert_se(sd_bus_new(&bus) >= 0);
         assert_se(sd_bus_set_fd(bus, c->fds[1], c->fds[1]) >= 0);
         assert_se(sd_bus_negotiate_fds(bus, c->client_negotiate_unix_fds) >= 0);
+        assert_se(sd_bus_negotiate_memfd(bus, c->client_negotiate_memfd) >= 0);
         assert_se(sd_bus_set_anonymous(bus, c->client_anonymous_auth) >= 0);
         assert_se(sd_bus_start(bus) >= 0);
 
+        payload = malloc(ECHO_SIZE);
+        assert_se(payload);
+        for (size_t i = 0; i < ECHO_SIZE; i++)
+                payload[i] = (uint8_t) i;
+
+        FOREACH_STRING(member, "Echo", "EchoSensitive") {
+                _cleanup_(sd_bus_message_unrefp) sd_bus_message *echo = NULL, *echo_reply = NULL;
+
+                r = sd_bus_message_new_method_call(
+                                bus,
+                                &echo,
+                                "org.freedesktop.systemd.test",
+                                "/",
+                                "org.freedesktop.systemd.test",
+                                member);
+                if (r < 0)
+                        return log_error_errno(r, "Failed to allocate method call: %m");
+
+                if (streq(member, "EchoSensitive"))
+                        assert_se(sd_bus_message_sensitive(echo) >= 0);
+
+                r = sd_bus_message_append_array(echo, 'y', payload, ECHO_SIZE);
+                if (r < 0)
+                        return log_error_errno(r, "Failed to append array: %m");
+
+                r = sd_bus_call(bus, echo, 0, &error, &echo_reply);
+                if (r < 0)
+                        return log_error_errno(r, "Failed to issue method call: %s", bus_error_message(&error, r));
+
+                check_echo_blob(echo);
+
+                assert_se((echo_reply->body.memfd >= 0) == bus->can_memfd);
+                check_echo_blob(echo_reply);
+
+                assert_se(sd_bus_message_read_array(echo_reply, 'y', &p, &sz) >= 0);
+                assert_se(sz == ECHO_SIZE);
+                assert_se(memcmp(p, payload, ECHO_SIZE) == 0);
+        }
+
         r = sd_bus_message_new_method_call(
                         bus,
                         &m,
@@ -135,6 +249,7 @@ static int client(struct context *c) {
 }
 
 static int test_one(bool client_negotiate_unix_fds, bool server_negotiate_unix_fds,
+                    bool client_negotiate_memfd, bool server_negotiate_memfd,
                     bool client_anonymous_auth, bool server_anonymous_auth) {
 
         struct context c;
@@ -148,6 +263,8 @@ static int test_one(bool client_negotiate_unix_fds, bool server_negotiate_unix_f
 
         c.client_negotiate_unix_fds = client_negotiate_unix_fds;
         c.server_negotiate_unix_fds = server_negotiate_unix_fds;
+        c.client_negotiate_memfd = client_negotiate_memfd;
+        c.server_negotiate_memfd = server_negotiate_memfd;
         c.client_anonymous_auth = client_anonymous_auth;
         c.server_anonymous_auth = server_anonymous_auth;
 
@@ -170,29 +287,144 @@ static int test_one(bool client_negotiate_unix_fds, bool server_negotiate_unix_f
         return 0;
 }
 
+static void test_fd_attribution(void) {
+        /* Which of these messages carry an fd, and which one is big enough to need several reads */
+        static const char pattern[] = "PPFPPFMFPBFP";
+        _cleanup_(sd_bus_flush_close_unrefp) sd_bus *a = NULL, *b = NULL;
+        _cleanup_close_pair_ int pair[2] = { -1, -1 };
+        _cleanup_free_ uint8_t *big = NULL;
+        struct stat sent[ELEMENTSOF(pattern) - 1];
+        size_t received = 0;
+        sd_id128_t id;
+
+        log_info("/* %s */", __func__);
+
+        /* The client queues all messages before the server reads anything, so that the server gets
+         * several of them in one read, and has to figure out which one the fds belong to. */
+
+        assert_se(socketpair(AF_UNIX, SOCK_STREAM|SOCK_CLOEXEC, 0, pair) >= 0);
+        assert_se(sd_id128_randomize(&id) >= 0);
+
+        assert_se(sd_bus_new(&a) >= 0);
+        assert_se(sd_bus_set_fd(a, pair[0], pair[0]) >= 0);
+        TAKE_FD(pair[0]);
+        assert_se(sd_bus_set_server(a, true, id) >= 0);
+        assert_se(sd_bus_negotiate_fds(a, true) >= 0);
+        assert_se(sd_bus_start(a) >= 0);
+
+        assert_se(sd_bus_new(&b) >= 0);
+        assert_se(sd_bus_set_fd(b, pair[1], pair[1]) >= 0);
+        TAKE_FD(pair[1]);
+        assert_se(sd_bus_negotiate_fds(b, true) >= 0);
+        assert_se(sd_bus_start(b) >= 0);
+
+        while (sd_bus_is_ready(a) <= 0 || sd_bus_is_ready(b) <= 0) {
+                assert_se(sd_bus_process(a, NULL) >= 0);
+                assert_se(sd_bus_process(b, NULL) >= 0);
+                assert_se(sd_bus_wait(a, 10 * USEC_PER_MSEC) >= 0);
+        }
+        assert_se(sd_bus_can_send(b, SD_BUS_TYPE_UNIX_FD) > 0);
+
+        assert_se(big = malloc0(ECHO_SIZE));
+
+        for (size_t i = 0; i < ELEMENTSOF(pattern) - 1; i++) {
+                _cleanup_(sd_bus_message_unrefp) sd_bus_message *m = NULL;
+                _cleanup_close_pair_ int p[2] = { -1, -1 };
+
+                if (pattern[i] == 'M') {
+                        /* A method call, to have some more header fields in front of UNIX_FDS */
+                        assert_se(sd_bus_message_new_method_call(b, &m, "org.freedesktop.systemd.test", "/", "org.freedesktop.systemd.test", "Fd") >= 0);
+                        assert_se(sd_bus_message_set_expect_reply(m, false) >= 0);
+                } else
+                        assert_se(sd_bus_message_new_signal(b, &m, "/", "org.freedesktop.systemd.test", pattern[i] == 'P' ? "Plain" : "Fd") >= 0);
+
+                assert_se(sd_bus_message_append(m, "u", (uint32_t) i) >= 0);
+
+                if (pattern[i] == 'B')
+                        assert_se(sd_bus_message_append_array(m, 'y', big, ECHO_SIZE) >= 0);
+
+                if (pattern[i] != 'P') {
+                        assert_se(pipe2(p, O_CLOEXEC) >= 0);
+                        assert_se(fstat(p[0], sent + i) >= 0);
+                        assert_se(sd_bus_message_append(m, "h", p[0]) >= 0);
+                }
+
+                assert_se(sd_bus_send(b, m, NULL) >= 0);
+        }
+
+        while (received < ELEMENTSOF(pattern) - 1) {
+                _cleanup_(sd_bus_message_unrefp) sd_bus_message *m = NULL;
+                struct stat st;
+                uint32_t i;
+                int r, fd;
+
+                assert_se(sd_bus_process(b, NULL) >= 0);
+
+                r = sd_bus_process(a, &m);
+                assert_se(r >= 0);
+                if (r == 0) {
+                        assert_se(sd_bus_wait(a, 10 * USEC_PER_MSEC) >= 0);
+                        continue;
+                }
+                if (!m)
+                        continue;
+
+                assert_se(sd_bus_message_read(m, "u", &i) >= 0);
+                assert_se(i == received);
+                received++;
+
+                if (pattern[i] == 'P') {
+                        assert_se(m->n_fds == 0);
+                        continue;
+                }
+
+                if (pattern[i] == 'B')
+                        assert_se(sd_bus_message_skip(m, "ay") >= 0);
+
+                assert_se(m->n_fds == 1);
+                assert_se(sd_bus_message_read(m, "h", &fd) >= 0);
+                assert_se(fstat(fd, &st) >= 0);
+                assert_se(st.st_dev == sent[i].st_dev && st.st_ino == sent[i].st_ino);
+        }
+}
+
 int main(int argc, char *argv[]) {
         int r;
 
-        r = test_one(true, true, false, false);
+        test_fd_attribution();
+
+        r = test_one(true, true, false, false, false, false);
         assert_se(r >= 0);
 
-        r = test_one(true, false, false, false);
+        r = test_one(true, false, false, false, false, false);
         assert_se(r >= 0);
 
-        r = test_one(false, true, false, false);
+        r = test_one(false, true, false, false, false, false);
         assert_se(r >= 0);
 
-        r = test_one(false, false, false, false);
+        r = test_one(false, false, false, false, false, false);
         assert_se(r >= 0);
 
-        r = test_one(true, true, true, true);
+        r = test_one(true, true, false, false, true, true);
         assert_se(r >= 0);
 
-        r = test_one(true, true, false, true);
+        r = test_one(true, true, false, false, false, true);
         assert_se(r >= 0);
 
-        r = test_one(true, true, true, false);
+        r = test_one(true, true, false, false, true, false);
         assert_se(r == -EPERM);
 
+        r = test_one(true, true, true, true, false, false);
+        assert_se(r >= 0);
+
+        r = test_one(true, true, true, false, false, false);
+        assert_se(r >= 0);
+
+        r = test_one(true, true, false, true, false, false);
+        assert_se(r >= 0);
+
+        r = test_one(false, true, true, true, false, false);
+        assert_se(r >= 0);
+
         return EXIT_SUCCESS;
 }
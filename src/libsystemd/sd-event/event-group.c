@@ -0,0 +1,486 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include "alloc-util.h"
+#include "event-group.h"
+#include "fd-util.h"
+#include "list.h"
+#include "log.h"
+#include "pthread-util.h"
+
+/* Don't allow more loops than we could reasonably have CPUs for */
+#define EVENT_GROUP_LOOPS_MAX 1024U
+
+/* How many work items to dispatch per event loop iteration, before yielding to the loop's other sources */
+#define EVENT_GROUP_DISPATCH_MAX 64U
+
+typedef struct EventGroupWork EventGroupWork;
+
+struct EventGroupWork {
+        event_group_handler_t callback;
+        void *userdata;
+        bool stealable;
+
+        LIST_FIELDS(EventGroupWork, queue);
+};
+
+typedef struct EventGroupLoop {
+        EventGroup *group;
+        unsigned index;
+        int cpu; /* the CPU to bind the thread to, or -1 */
+
+        sd_event *event;
+        sd_event_source *wakeup_event_source;
+        int wakeup_fd;
+
+        pthread_t thread;
+        bool thread_started;
+
+        /* Protects everything below. The queue is appended to by arbitrary threads, and drained by the loop's own
+         * thread as well as by sibling loops stealing work from it. */
+        pthread_mutex_t mutex;
+        LIST_HEAD(EventGroupWork, queue);
+        EventGroupWork *queue_tail;
+        unsigned n_queued;
+        unsigned n_running; /* work items this loop is executing right now, its own or stolen ones */
+        bool exit_requested;
+} EventGroupLoop;
+
+struct EventGroup {
+        EventGroupFlags flags;
+        unsigned n_loops;
+        EventGroupLoop loops[];
+};
+
+static void event_group_loop_wakeup(EventGroupLoop *l) {
+        static const uint64_t one = 1;
+
+        assert(l);
+
+        /* The eventfd counter only saturates after 2^64-1 writes, hence this cannot fail in a way we need to care
+         * about. */
+        (void) write(l->wakeup_fd, &one, sizeof(one));
+}
+
+static void event_group_loop_unlink_work(EventGroupLoop *l, EventGroupWork *w) {
+        assert(l);
+        assert(w);
+        assert(l->n_queued > 0);
+
+        if (l->queue_tail == w)
+                l->queue_tail = w->queue_prev;
+
+        LIST_REMOVE(queue, l->queue, w);
+        l->n_queued--;
+}
+
+static void event_group_loop_enqueue(EventGroupLoop *l, EventGroupWork *w) {
+        _cleanup_(pthread_mutex_unlock_assertp) pthread_mutex_t *_l = NULL;
+
+        assert(l);
+        assert(w);
+
+        _l = pthread_mutex_lock_assert(&l->mutex);
+
+        LIST_INSERT_AFTER(queue, l->queue, l->queue_tail, w);
+        l->queue_tail = w;
+        l->n_queued++;
+}
+
+static EventGroupWork* event_group_loop_dequeue(EventGroupLoop *l, bool only_stealable) {
+        _cleanup_(pthread_mutex_unlock_assertp) pthread_mutex_t *_l = NULL;
+        EventGroupWork *w;
+
+        assert(l);
+
+        _l = pthread_mutex_lock_assert(&l->mutex);
+
+        LIST_FOREACH(queue, w, l->queue)
+                if (!only_stealable || w->stealable) {
+                        event_group_loop_unlink_work(l, w);
+                        return w;
+                }
+
+        return NULL;
+}
+
+static EventGroupWork* event_group_steal(EventGroup *g, EventGroupLoop *thief) {
+        assert(g);
+        assert(thief);
+
+        /* Start looking at our right-hand neighbour, so that idle loops don't all pounce on the same victim */
+        for (unsigned i = 1; i < g->n_loops; i++) {
+                EventGroupWork *w;
+
+                w = event_group_loop_dequeue(g->loops + (thief->index + i) % g->n_loops, true);
+                if (w)
+                        return w;
+        }
+
+        return NULL;
+}
+
+static unsigned event_group_loop_load(EventGroupLoop *l) {
+        _cleanup_(pthread_mutex_unlock_assertp) pthread_mutex_t *_l = NULL;
+
+        assert(l);
+
+        /* A loop busy with a long work item is not idle, even if its queue is empty */
+        _l = pthread_mutex_lock_assert(&l->mutex);
+        return l->n_queued + l->n_running;
+}
+
+static void event_group_loop_set_running(EventGroupLoop *l, bool b) {
+        _cleanup_(pthread_mutex_unlock_assertp) pthread_mutex_t *_l = NULL;
+
+        assert(l);
+
+        _l = pthread_mutex_lock_assert(&l->mutex);
+
+        if (b)
+                l->n_running++;
+        else {
+                assert(l->n_running > 0);
+                l->n_running--;
+        }
+}
+
+static bool event_group_loop_exit_requested(EventGroupLoop *l) {
+        _cleanup_(pthread_mutex_unlock_assertp) pthread_mutex_t *_l = NULL;
+
+        assert(l);
+
+        _l = pthread_mutex_lock_assert(&l->mutex);
+        return l->exit_requested;
+}
+
+static int on_wakeup(sd_event_source *s, int fd, uint32_t revents, void *userdata) {
+        EventGroupLoop *l = userdata;
+        sd_event *e = sd_event_source_get_event(s);
+        uint64_t counter;
+
+        assert(l);
+
+        /* Reset the counter, we process everything queued below anyway */
+        (void) read(fd, &counter, sizeof(counter));
+
+        for (unsigned n = 0; n < EVENT_GROUP_DISPATCH_MAX; n++) {
+                _cleanup_free_ EventGroupWork *w = NULL;
+                int r;
+
+                /* Check before each work item, so that the group can be freed without waiting for everything
+                 * queued to be processed first */
+                if (event_group_loop_exit_requested(l))
+                        return sd_event_exit(e, 0);
+
+                /* First process our own queue, and only when that's empty help out our siblings */
+                w = event_group_loop_dequeue(l, false);
+                if (!w)
+                        w = event_group_steal(l->group, l);
+                if (!w)
+                        return 0;
+
+                event_group_loop_set_running(l, true);
+                r = w->callback(e, w->userdata);
+                event_group_loop_set_running(l, false);
+                if (r < 0)
+                        log_debug_errno(r, "Work item on event loop %u of event group failed, ignoring: %m", l->index);
+        }
+
+        /* There might be more work pending than we want to process in one go. Let's give the other event sources
+         * of this loop a chance to run, and come back in the next iteration. */
+        event_group_loop_wakeup(l);
+        return 0;
+}
+
+static void* event_group_loop_thread(void *p) {
+        EventGroupLoop *l = p;
+        int r;
+
+        assert(l);
+
+        (void) pthread_setname_np(pthread_self(), "sd-event-group");
+
+        r = sd_event_loop(l->event);
+        if (r < 0)
+                log_debug_errno(r, "Event loop %u of event group failed: %m", l->index);
+
+        return NULL;
+}
+
+static int event_group_pick_cpus(EventGroup *g) {
+        cpu_set_t mask;
+        unsigned n_cpus, i = 0;
+
+        assert(g);
+
+        if (sched_getaffinity(0, sizeof(mask), &mask) < 0)
+                return -errno;
+
+        n_cpus = CPU_COUNT(&mask);
+        if (n_cpus == 0)
+                return -ENXIO;
+
+        /* Distribute the loops round-robin over the CPUs we may run on */
+        for (int cpu = 0; i < g->n_loops; cpu = (cpu + 1) % CPU_SETSIZE)
+                if (CPU_ISSET(cpu, &mask))
+                        g->loops[i++].cpu = cpu;
+
+        return 0;
+}
+
+static int event_group_loop_start(EventGroupLoop *l) {
+        pthread_attr_t a;
+        int r;
+
+        assert(l);
+
+        r = pthread_attr_init(&a);
+        if (r > 0)
+                return -r;
+
+        if (l->cpu >= 0) {
+                cpu_set_t s;
+
+                CPU_ZERO(&s);
+                CPU_SET(l->cpu, &s);
+
+                r = pthread_attr_setaffinity_np(&a, sizeof(s), &s);
+                if (r > 0) {
+                        r = -r;
+                        goto finish;
+                }
+        }
+
+        r = pthread_create(&l->thread, &a, event_group_loop_thread, l);
+        if (r > 0) {
+                r = -r;
+                goto finish;
+        }
+
+        l->thread_started = true;
+        r = 0;
+
+finish:
+        pthread_attr_destroy(&a);
+        return r;
+}
+
+static int event_group_loop_init(EventGroup *g, unsigned idx) {
+        EventGroupLoop *l = g->loops + idx;
+        int r;
+
+        *l = (EventGroupLoop) {
+                .group = g,
+                .index = idx,
+                .cpu = -1,
+                .wakeup_fd = -1,
+                .mutex = PTHREAD_MUTEX_INITIALIZER,
+        };
+
+        r = sd_event_new(&l->event);
+        if (r < 0)
+                return r;
+
+        l->wakeup_fd = eventfd(0, EFD_CLOEXEC|EFD_NONBLOCK);
+        if (l->wakeup_fd < 0)
+                return -errno;
+
+        r = sd_event_add_io(l->event, &l->wakeup_event_source, l->wakeup_fd, EPOLLIN, on_wakeup, l);
+        if (r < 0)
+                return r;
+
+        (void) sd_event_source_set_description(l->wakeup_event_source, "event-group-wakeup");
+
+        return 0;
+}
+
+int event_group_new(EventGroup **ret, unsigned n_loops, EventGroupFlags flags) {
+        _cleanup_(event_group_freep) EventGroup *g = NULL;
+        sigset_t ss, saved_ss;
+        int r, k;
+
+        assert(ret);
+
+        if (n_loops == 0 || n_loops > EVENT_GROUP_LOOPS_MAX)
+                return -EINVAL;
+
+        g = malloc0(offsetof(EventGroup, loops) + sizeof(EventGroupLoop) * n_loops);
+        if (!g)
+                return -ENOMEM;
+
+        g->flags = flags;
+
+        for (unsigned i = 0; i < n_loops; i++) {
+                /* Count the loop already, so that it is cleaned up properly even if initialization fails half-way */
+                g->n_loops++;
+
+                r = event_group_loop_init(g, i);
+                if (r < 0)
+                        return r;
+        }
+
+        if (FLAGS_SET(flags, EVENT_GROUP_PIN_CPU)) {
+                r = event_group_pick_cpus(g);
+                if (r < 0)
+                        return r;
+        }
+
+        assert_se(sigfillset(&ss) >= 0);
+
+        /* No signals in the loop threads please, signal event sources need the signals blocked in all threads
+         * anyway. We set the mask before forking, so that the threads never exist with a different mask than a
+         * fully blocked one. */
+        r = pthread_sigmask(SIG_BLOCK, &ss, &saved_ss);
+        if (r > 0)
+                return -r;
+
+        for (unsigned i = 0; i < n_loops; i++) {
+                r = event_group_loop_start(g->loops + i);
+                if (r < 0)
+                        break;
+        }
+
+        k = pthread_sigmask(SIG_SETMASK, &saved_ss, NULL);
+        if (r < 0)
+                return r;
+        if (k > 0)
+                return -k;
+
+        *ret = TAKE_PTR(g);
+        return 0;
+}
+
+EventGroup* event_group_free(EventGroup *g) {
+        if (!g)
+                return NULL;
+
+        /* First ask all loops to exit, so that they can wind down in parallel */
+        for (unsigned i = 0; i < g->n_loops; i++) {
+                EventGroupLoop *l = g->loops + i;
+
+                if (!l->thread_started)
+                        continue;
+
+                assert_se(pthread_mutex_lock(&l->mutex) == 0);
+                l->exit_requested = true;
+                assert_se(pthread_mutex_unlock(&l->mutex) == 0);
+
+                event_group_loop_wakeup(l);
+        }
+
+        /* Then wait for all of them, before releasing anything: a loop still running might be stealing work
+         * from any of its siblings, and hence access their queues. */
+        for (unsigned i = 0; i < g->n_loops; i++)
+                if (g->loops[i].thread_started)
+                        (void) pthread_join(g->loops[i].thread, NULL);
+
+        for (unsigned i = 0; i < g->n_loops; i++) {
+                EventGroupLoop *l = g->loops + i;
+                EventGroupWork *w;
+
+                /* Work that didn't get dispatched anymore is dropped */
+                while ((w = l->queue)) {
+                        event_group_loop_unlink_work(l, w);
+                        free(w);
+                }
+
+                sd_event_source_disable_unref(l->wakeup_event_source);
+                sd_event_unref(l->event);
+                safe_close(l->wakeup_fd);
+                (void) pthread_mutex_destroy(&l->mutex);
+        }
+
+        return mfree(g);
+}
+
+unsigned event_group_get_n_loops(EventGroup *g) {
+        assert(g);
+
+        return g->n_loops;
+}
+
+static int event_group_post_internal(
+                EventGroup *g,
+                EventGroupLoop *l,
+                bool stealable,
+                event_group_handler_t callback,
+                void *userdata) {
+
+        EventGroupWork *w;
+
+        assert(g);
+        assert(l);
+        assert(callback);
+
+        w = new(EventGroupWork, 1);
+        if (!w)
+                return -ENOMEM;
+
+        *w = (EventGroupWork) {
+                .callback = callback,
+                .userdata = userdata,
+                .stealable = stealable,
+        };
+
+        event_group_loop_enqueue(l, w);
+        event_group_loop_wakeup(l);
+
+        return 0;
+}
+
+int event_group_post_to(EventGroup *g, unsigned idx, event_group_handler_t callback, void *userdata) {
+        assert(g);
+        assert(callback);
+
+        if (idx >= g->n_loops)
+                return -ENXIO;
+
+        return event_group_post_internal(g, g->loops + idx, false, callback, userdata);
+}
+
+int event_group_post(EventGroup *g, event_group_handler_t callback, void *userdata) {
+        EventGroupLoop *best = NULL;
+        unsigned best_load = UINT_MAX;
+        int r;
+
+        assert(g);
+        assert(callback);
+
+        /* Queue on the least loaded loop. This is only a heuristic, the other loops will steal the item anyway
+         * once they run out of work of their own. */
+        for (unsigned i = 0; i < g->n_loops && best_load > 0; i++) {
+                EventGroupLoop *l = g->loops + i;
+                unsigned n;
+
+                n = event_group_loop_load(l);
+                if (n < best_load) {
+                        best = l;
+                        best_load = n;
+                }
+        }
+
+        r = event_group_post_internal(g, best, true, callback, userdata);
+        if (r < 0)
+                return r;
+
+        /* If the loop we picked has other work besides ours, wake a sibling that is idle now, and hence
+         * steals it. Siblings only steal when woken up, and one might have run out of work since we looked. */
+        if (event_group_loop_load(best) > 1)
+                for (unsigned i = 1; i < g->n_loops; i++) {
+                        EventGroupLoop *l = g->loops + (best->index + i) % g->n_loops;
+
+                        if (event_group_loop_load(l) == 0) {
+                                event_group_loop_wakeup(l);
+                                break;
+                        }
+                }
+
+        return 0;
+}
@@ -0,0 +1,30 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+#pragma once
+
+#include "sd-event.h"
+
+#include "macro.h"
+
+/* An EventGroup runs a fixed number of sd_event loops, each on its own thread. sd_event objects are not
+ * thread-safe, hence the only way to interact with a loop of the group is to post a work item to it, which
+ * is then executed on the loop's thread. Work items may either be pinned to a specific loop (for example to
+ * add event sources to it, which are then dispatched on that loop only), or be left stealable, in which
+ * case they are queued on the least loaded loop and may be taken over by any other loop of the group that
+ * runs out of work of its own. */
+
+typedef struct EventGroup EventGroup;
+
+typedef int (*event_group_handler_t)(sd_event *e, void *userdata);
+
+typedef enum EventGroupFlags {
+        EVENT_GROUP_PIN_CPU = 1 << 0, /* Bind each loop thread to one CPU of our affinity mask */
+} EventGroupFlags;
+
+int event_group_new(EventGroup **ret, unsigned n_loops, EventGroupFlags flags);
+EventGroup* event_group_free(EventGroup *g);
+DEFINE_TRIVIAL_CLEANUP_FUNC(EventGroup*, event_group_free);
+
+unsigned event_group_get_n_loops(EventGroup *g);
+
+int event_group_post_to(EventGroup *g, unsigned idx, event_group_handler_t callback, void *userdata);
+int event_group_post(EventGroup *g, event_group_handler_t callback, void *userdata);
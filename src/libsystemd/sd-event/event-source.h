@@ -63,6 +63,7 @@ struct sd_event_source {
         bool floating:1;
         bool exit_on_failure:1;
         bool ratelimited:1;
+        bool from_pool:1;
 
         int64_t priority;
         unsigned pending_index;
@@ -81,6 +82,13 @@ struct sd_event_source {
         unsigned earliest_index;
         unsigned latest_index;
 
+        /* Dispatch statistics, only collected while profiling is enabled (see $SD_EVENT_PROFILE_DELAYS) */
+        uint64_t n_dispatched;
+        usec_t pending_usec;
+        usec_t dispatch_usec_total;
+        usec_t dispatch_usec_max;
+        usec_t latency_usec_max;
+
         union {
                 struct {
                         sd_event_io_handler_t callback;
@@ -5,9 +5,28 @@
 
 #include "sd-event.h"
 
+#include "time-util.h"
+
 int event_reset_time(sd_event *e, sd_event_source **s,
                      clockid_t clock, uint64_t usec, uint64_t accuracy,
                      sd_event_time_handler_t callback, void *userdata,
                      int64_t priority, const char *description, bool force_reset);
 int event_source_disable(sd_event_source *s);
 int event_source_is_enabled(sd_event_source *s);
+
+/* Dispatch statistics of an event source, collected while profiling is enabled. The strings belong to the
+ * event source. */
+typedef struct EventSourceStatistics {
+        const char *description;
+        const char *type;
+        uint64_t n_dispatched;
+        usec_t dispatch_usec_total;
+        usec_t dispatch_usec_max;
+        usec_t latency_usec_max; /* between becoming pending and being dispatched */
+} EventSourceStatistics;
+
+/* These are implemented in sd-event.c, as they need access to the internals of the event loop */
+int event_set_profile_delays(sd_event *e, bool b);
+bool event_get_profile_delays(sd_event *e);
+int event_source_get_statistics(sd_event_source *s, EventSourceStatistics *ret);
+int event_get_statistics(sd_event *e, EventSourceStatistics **ret, size_t *ret_n);
@@ -11,17 +11,20 @@
 #include "alloc-util.h"
 #include "env-util.h"
 #include "event-source.h"
+#include "event-util.h"
 #include "fd-util.h"
 #include "fs-util.h"
 #include "hashmap.h"
 #include "list.h"
 #include "macro.h"
 #include "memory-util.h"
+#include "mempool.h"
 #include "missing_syscall.h"
 #include "prioq.h"
 #include "process-util.h"
 #include "set.h"
 #include "signal-util.h"
+#include "sort-util.h"
 #include "string-table.h"
 #include "string-util.h"
 #include "strxcpyx.h"
@@ -29,6 +32,9 @@
 
 #define DEFAULT_ACCURACY_USEC (250 * USEC_PER_MSEC)
 
+/* How many of the most expensive event sources to log when profiling */
+#define EVENT_PROFILE_SOURCES_MAX 10U
+
 static bool EVENT_SOURCE_WATCH_PIDFD(sd_event_source *s) {
         /* Returns true if this is a PID event source and can be implemented by watching EPOLLIN */
         return s &&
@@ -133,6 +139,7 @@ struct sd_event {
         bool need_process_child:1;
         bool watchdog:1;
         bool profile_delays:1;
+        bool profile_delays_env:1;
 
         int exit_code;
 
@@ -154,6 +161,8 @@ struct sd_event {
 
 static thread_local sd_event *default_event = NULL;
 
+DEFINE_MEMPOOL(source_pool, sd_event_source, 16);
+
 static void source_disconnect(sd_event_source *s);
 static void event_gc_inode_data(sd_event *e, struct inode_data *d);
 
@@ -407,8 +416,8 @@ _public_ int sd_event_new(sd_event** ret) {
         e->epoll_fd = fd_move_above_stdio(e->epoll_fd);
 
         if (secure_getenv("SD_EVENT_PROFILE_DELAYS")) {
-                log_debug("Event loop profiling enabled. Logarithmic histogram of event loop iterations in the range 2^0 ... 2^63 us will be logged every 5s.");
-                e->profile_delays = true;
+                e->profile_delays_env = true;
+                (void) event_set_profile_delays(e, true);
         }
 
         *ret = e;
@@ -993,7 +1002,11 @@ static void source_free(sd_event_source *s) {
                 s->destroy_callback(s->userdata);
 
         free(s->description);
-        free(s);
+
+        if (s->from_pool)
+                mempool_free_tile(&source_pool, s);
+        else
+                free(s);
 }
 DEFINE_TRIVIAL_CLEANUP_FUNC(sd_event_source*, source_free);
 
@@ -1011,6 +1024,9 @@ static int source_set_pending(sd_event_source *s, bool b) {
         if (b) {
                 s->pending_iteration = s->event->iteration;
 
+                if (s->event->profile_delays)
+                        s->pending_usec = now(CLOCK_MONOTONIC);
+
                 r = prioq_put(s->event->pending, s, &s->pending_index);
                 if (r < 0) {
                         s->pending = false;
@@ -1048,10 +1064,13 @@ static int source_set_pending(sd_event_source *s, bool b) {
 
 static sd_event_source *source_new(sd_event *e, bool floating, EventSourceType type) {
         sd_event_source *s;
+        bool up;
 
         assert(e);
 
-        s = new(sd_event_source, 1);
+        up = mempool_enabled();
+
+        s = up ? mempool_alloc_tile(&source_pool) : new(sd_event_source, 1);
         if (!s)
                 return NULL;
 
@@ -1062,6 +1081,7 @@ static sd_event_source *source_new(sd_event *e, bool floating, EventSourceType t
                 .type = type,
                 .pending_index = PRIOQ_IDX_NULL,
                 .prepare_index = PRIOQ_IDX_NULL,
+                .from_pool = up,
         };
 
         if (!floating)
@@ -3439,6 +3459,7 @@ static int process_inotify(sd_event *e) {
 static int source_dispatch(sd_event_source *s) {
         _cleanup_(sd_event_unrefp) sd_event *saved_event = NULL;
         EventSourceType saved_type;
+        usec_t before = 0;
         int r = 0;
 
         assert(s);
@@ -3490,6 +3511,14 @@ static int source_dispatch(sd_event_source *s) {
                         return r;
         }
 
+        if (s->event->profile_delays) {
+                before = now(CLOCK_MONOTONIC);
+
+                /* Defer and exit sources stay pending while enabled, the latency isn't meaningful for them */
+                if (!IN_SET(s->type, SOURCE_DEFER, SOURCE_EXIT) && s->pending_usec > 0 && before > s->pending_usec)
+                        s->latency_usec_max = MAX(s->latency_usec_max, before - s->pending_usec);
+        }
+
         s->dispatching = true;
 
         switch (s->type) {
@@ -3568,6 +3597,16 @@ static int source_dispatch(sd_event_source *s) {
 
         s->dispatching = false;
 
+        if (before > 0) {
+                usec_t t;
+
+                t = usec_sub_unsigned(now(CLOCK_MONOTONIC), before);
+
+                s->n_dispatched++;
+                s->dispatch_usec_total = usec_add(s->dispatch_usec_total, t);
+                s->dispatch_usec_max = MAX(s->dispatch_usec_max, t);
+        }
+
         if (r < 0) {
                 log_debug_errno(r, "Event source %s (type %s) returned error, %s: %m",
                                 strna(s->description),
@@ -3970,6 +4009,140 @@ static void event_log_delays(sd_event *e) {
         log_debug("Event loop iterations: %s", b);
 }
 
+static int source_dispatch_time_compare(sd_event_source * const *a, sd_event_source * const *b) {
+        /* Sources whose callbacks took the longest come first */
+        return CMP((*b)->dispatch_usec_total, (*a)->dispatch_usec_total);
+}
+
+static void event_log_sources(sd_event *e) {
+        _cleanup_free_ sd_event_source **sources = NULL;
+        sd_event_source *s;
+        size_t n = 0;
+
+        assert(e);
+
+        sources = new(sd_event_source*, e->n_sources);
+        if (!sources)
+                return;
+
+        LIST_FOREACH(sources, s, e->sources)
+                if (s->n_dispatched > 0)
+                        sources[n++] = s;
+
+        typesafe_qsort(sources, n, source_dispatch_time_compare);
+
+        for (size_t i = 0; i < MIN(n, EVENT_PROFILE_SOURCES_MAX); i++) {
+                char total[FORMAT_TIMESPAN_MAX], max[FORMAT_TIMESPAN_MAX], latency[FORMAT_TIMESPAN_MAX];
+
+                s = sources[i];
+
+                log_debug("Event source %s (type %s): dispatched %" PRIu64 " times since profiling was enabled, callbacks took %s (max %s), max latency %s",
+                          strna(s->description),
+                          event_source_type_to_string(s->type),
+                          s->n_dispatched,
+                          format_timespan(total, sizeof(total), s->dispatch_usec_total, 1),
+                          format_timespan(max, sizeof(max), s->dispatch_usec_max, 1),
+                          format_timespan(latency, sizeof(latency), s->latency_usec_max, 1));
+        }
+}
+
+int event_set_profile_delays(sd_event *e, bool b) {
+        sd_event_source *s;
+
+        assert_return(e, -EINVAL);
+        assert_return(e = event_resolve(e), -ENOPKG);
+        assert_return(!event_pid_changed(e), -ECHILD);
+
+        /* $SD_EVENT_PROFILE_DELAYS turns profiling on for good */
+        b = b || e->profile_delays_env;
+        if (b == e->profile_delays)
+                return 0;
+
+        e->profile_delays = b;
+        if (!b) {
+                log_debug("Event loop profiling disabled.");
+                return 1;
+        }
+
+        log_debug("Event loop profiling enabled. Logarithmic histogram of event loop iterations in the range 2^0 ... 2^63 us, "
+                  "and the event sources with the most expensive callbacks will be logged every 5s.");
+
+        /* Start from scratch, so that the statistics cover exactly the time profiling was enabled */
+        e->last_run_usec = 0;
+        e->last_log_usec = now(CLOCK_MONOTONIC);
+        zero(e->delays);
+
+        LIST_FOREACH(sources, s, e->sources) {
+                s->n_dispatched = 0;
+                s->pending_usec = 0;
+                s->dispatch_usec_total = s->dispatch_usec_max = s->latency_usec_max = 0;
+        }
+
+        return 1;
+}
+
+bool event_get_profile_delays(sd_event *e) {
+        assert_return(e, false);
+        assert_return(e = event_resolve(e), false);
+
+        return e->profile_delays;
+}
+
+int event_source_get_statistics(sd_event_source *s, EventSourceStatistics *ret) {
+        assert_return(s, -EINVAL);
+        assert_return(ret, -EINVAL);
+        assert_return(!event_pid_changed(s->event), -ECHILD);
+
+        if (!s->event->profile_delays)
+                return -ENODATA;
+
+        *ret = (EventSourceStatistics) {
+                .description = s->description,
+                .type = event_source_type_to_string(s->type),
+                .n_dispatched = s->n_dispatched,
+                .dispatch_usec_total = s->dispatch_usec_total,
+                .dispatch_usec_max = s->dispatch_usec_max,
+                .latency_usec_max = s->latency_usec_max,
+        };
+
+        return 0;
+}
+
+int event_get_statistics(sd_event *e, EventSourceStatistics **ret, size_t *ret_n) {
+        _cleanup_free_ sd_event_source **sources = NULL;
+        _cleanup_free_ EventSourceStatistics *st = NULL;
+        sd_event_source *s;
+        size_t n = 0;
+
+        assert_return(e, -EINVAL);
+        assert_return(e = event_resolve(e), -ENOPKG);
+        assert_return(ret, -EINVAL);
+        assert_return(ret_n, -EINVAL);
+        assert_return(!event_pid_changed(e), -ECHILD);
+
+        /* Returns the statistics of all event sources, those whose callbacks took the longest first */
+
+        if (!e->profile_delays)
+                return -ENODATA;
+
+        sources = new(sd_event_source*, e->n_sources);
+        st = new(EventSourceStatistics, e->n_sources);
+        if (!sources || !st)
+                return -ENOMEM;
+
+        LIST_FOREACH(sources, s, e->sources)
+                sources[n++] = s;
+
+        typesafe_qsort(sources, n, source_dispatch_time_compare);
+
+        for (size_t i = 0; i < n; i++)
+                assert_se(event_source_get_statistics(sources[i], st + i) >= 0);
+
+        *ret = TAKE_PTR(st);
+        *ret_n = n;
+        return 0;
+}
+
 _public_ int sd_event_run(sd_event *e, uint64_t timeout) {
         int r;
 
@@ -3991,6 +4164,7 @@ _public_ int sd_event_run(sd_event *e, uint64_t timeout) {
 
                 if (this_run - e->last_log_usec >= 5*USEC_PER_SEC) {
                         event_log_delays(e);
+                        event_log_sources(e);
                         e->last_log_usec = this_run;
                 }
         }
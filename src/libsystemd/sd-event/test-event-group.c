@@ -0,0 +1,256 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+
+#include <pthread.h>
+#include <unistd.h>
+
+#include "sd-event.h"
+
+#include "event-group.h"
+#include "log.h"
+#include "macro.h"
+#include "memory-util.h"
+#include "missing_syscall.h"
+#include "tests.h"
+#include "time-util.h"
+
+#define N_LOOPS 4U
+#define N_WORK 1000U
+
+static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t release_cond = PTHREAD_COND_INITIALIZER;
+static pid_t loop_tids[N_LOOPS];
+static unsigned n_stealable[N_LOOPS];
+static unsigned n_done;
+static unsigned n_releases, n_rendezvous;
+
+static void work_done(void) {
+        assert_se(pthread_mutex_lock(&mutex) == 0);
+        n_done++;
+        assert_se(pthread_cond_signal(&cond) == 0);
+        assert_se(pthread_mutex_unlock(&mutex) == 0);
+}
+
+static void wait_for_work(unsigned n) {
+        assert_se(pthread_mutex_lock(&mutex) == 0);
+        while (n_done < n)
+                assert_se(pthread_cond_wait(&cond, &mutex) == 0);
+        assert_se(pthread_mutex_unlock(&mutex) == 0);
+}
+
+static int record_tid(sd_event *e, void *userdata) {
+        unsigned idx = PTR_TO_UINT(userdata);
+
+        assert_se(e);
+        assert_se(idx < N_LOOPS);
+
+        loop_tids[idx] = gettid();
+        work_done();
+        return 0;
+}
+
+static int check_tid(sd_event *e, void *userdata) {
+        unsigned idx = PTR_TO_UINT(userdata);
+
+        assert_se(e);
+        assert_se(loop_tids[idx] == gettid());
+
+        work_done();
+        return 0;
+}
+
+static int stealable(sd_event *e, void *userdata) {
+        pid_t tid = gettid();
+        bool found = false;
+
+        assert_se(e);
+
+        assert_se(pthread_mutex_lock(&mutex) == 0);
+        for (unsigned i = 0; i < N_LOOPS; i++)
+                if (loop_tids[i] == tid) {
+                        n_stealable[i]++;
+                        found = true;
+                }
+        assert_se(pthread_mutex_unlock(&mutex) == 0);
+        assert_se(found);
+
+        work_done();
+        return 0;
+}
+
+static int rendezvous(sd_event *e, void *userdata) {
+        usec_t until = usec_add(now(CLOCK_REALTIME), 10 * USEC_PER_SEC);
+        struct timespec ts;
+
+        assert_se(pthread_mutex_lock(&mutex) == 0);
+        n_rendezvous++;
+        assert_se(pthread_cond_broadcast(&release_cond) == 0);
+        while (n_rendezvous < N_LOOPS - 1)
+                assert_se(pthread_cond_timedwait(&release_cond, &mutex, timespec_store(&ts, until)) == 0);
+        assert_se(pthread_mutex_unlock(&mutex) == 0);
+
+        return stealable(e, userdata);
+}
+
+static unsigned loops_used(void) {
+        unsigned n = 0;
+
+        for (unsigned i = 0; i < N_LOOPS; i++)
+                if (n_stealable[i] > 0)
+                        n++;
+
+        return n;
+}
+
+static int wait_for_release(sd_event *e, void *userdata) {
+        unsigned n;
+
+        /* Keep the loop busy until the main thread says otherwise */
+        assert_se(pthread_mutex_lock(&mutex) == 0);
+        n = n_releases;
+        assert_se(pthread_mutex_unlock(&mutex) == 0);
+
+        work_done();
+
+        assert_se(pthread_mutex_lock(&mutex) == 0);
+        while (n_releases == n)
+                assert_se(pthread_cond_wait(&release_cond, &mutex) == 0);
+        assert_se(pthread_mutex_unlock(&mutex) == 0);
+
+        return 0;
+}
+
+static void release(void) {
+        assert_se(pthread_mutex_lock(&mutex) == 0);
+        n_releases++;
+        assert_se(pthread_cond_broadcast(&release_cond) == 0);
+        assert_se(pthread_mutex_unlock(&mutex) == 0);
+}
+
+static int slow(sd_event *e, void *userdata) {
+        /* Keep one loop busy for a while, so that its queued stealable work has to be taken over */
+        usleep(100 * USEC_PER_MSEC);
+        work_done();
+        return 0;
+}
+
+static int blocking(sd_event *e, void *userdata) {
+        /* Tell the main thread we're running, and then keep the loop busy while it frees the group */
+        work_done();
+        usleep(100 * USEC_PER_MSEC);
+        return 0;
+}
+
+static int counted(sd_event *e, void *userdata) {
+        work_done();
+        return 0;
+}
+
+static int add_defer_handler(sd_event_source *s, void *userdata) {
+        work_done();
+        return 0;
+}
+
+static int add_defer(sd_event *e, void *userdata) {
+        /* Sources added from a work item are pinned to the loop the work item runs on */
+        assert_se(sd_event_add_defer(e, NULL, add_defer_handler, NULL) >= 0);
+        return 0;
+}
+
+static void test_event_group(EventGroupFlags flags) {
+        _cleanup_(event_group_freep) EventGroup *g = NULL;
+        unsigned n = 0;
+
+        log_info("/* %s(flags=%x) */", __func__, flags);
+
+        n_done = 0;
+        memzero(loop_tids, sizeof(loop_tids));
+        memzero(n_stealable, sizeof(n_stealable));
+
+        assert_se(event_group_new(&g, 0, flags) == -EINVAL);
+        assert_se(event_group_new(&g, N_LOOPS, flags) >= 0);
+        assert_se(event_group_get_n_loops(g) == N_LOOPS);
+
+        for (unsigned i = 0; i < N_LOOPS; i++)
+                assert_se(event_group_post_to(g, i, record_tid, UINT_TO_PTR(i)) >= 0);
+        wait_for_work(n += N_LOOPS);
+
+        for (unsigned i = 0; i < N_LOOPS; i++) {
+                assert_se(loop_tids[i] > 0);
+                assert_se(loop_tids[i] != gettid());
+
+                for (unsigned j = 0; j < i; j++)
+                        assert_se(loop_tids[i] != loop_tids[j]);
+        }
+
+        assert_se(event_group_post_to(g, N_LOOPS, check_tid, NULL) == -ENXIO);
+
+        for (unsigned i = 0; i < N_WORK; i++)
+                assert_se(event_group_post_to(g, i % N_LOOPS, check_tid, UINT_TO_PTR(i % N_LOOPS)) >= 0);
+        wait_for_work(n += N_WORK);
+
+        assert_se(event_group_post_to(g, 0, slow, NULL) >= 0);
+        for (unsigned i = 0; i < N_WORK; i++)
+                assert_se(event_group_post(g, stealable, NULL) >= 0);
+        wait_for_work(n += N_WORK + 1);
+
+        /* A loop busy with a long work item is not idle, hence stealable work is spread over the others. The
+         * work items only finish once all of them run at the same time. */
+        memzero(n_stealable, sizeof(n_stealable));
+        n_rendezvous = 0;
+        assert_se(event_group_post_to(g, 0, wait_for_release, NULL) >= 0);
+        wait_for_work(n += 1);
+        for (unsigned i = 0; i < N_LOOPS - 1; i++)
+                assert_se(event_group_post(g, rendezvous, NULL) >= 0);
+        wait_for_work(n += N_LOOPS - 1);
+        assert_se(n_stealable[0] == 0);
+        assert_se(loops_used() == N_LOOPS - 1);
+        release();
+
+        /* Work queued on busy loops is stolen by the first one that runs out of work */
+        memzero(n_stealable, sizeof(n_stealable));
+        for (unsigned i = 0; i < N_LOOPS; i++)
+                assert_se(event_group_post_to(g, i, i == 0 ? slow : wait_for_release, NULL) >= 0);
+        wait_for_work(n += N_LOOPS - 1);
+        for (unsigned i = 0; i < N_WORK; i++)
+                assert_se(event_group_post(g, stealable, NULL) >= 0);
+        wait_for_work(n += N_WORK + 1);
+        assert_se(n_stealable[0] == N_WORK);
+        release();
+
+        for (unsigned i = 0; i < N_LOOPS; i++)
+                assert_se(event_group_post_to(g, i, add_defer, NULL) >= 0);
+        wait_for_work(n += N_LOOPS);
+
+        /* Leave some work queued, freeing the group has to drop it cleanly */
+        for (unsigned i = 0; i < N_WORK; i++)
+                assert_se(event_group_post(g, stealable, NULL) >= 0);
+}
+
+static void test_free_with_queued_work(void) {
+        EventGroup *g;
+
+        log_info("/* %s */", __func__);
+
+        n_done = 0;
+
+        assert_se(event_group_new(&g, 1, 0) >= 0);
+        assert_se(event_group_post_to(g, 0, blocking, NULL) >= 0);
+        for (unsigned i = 0; i < N_WORK; i++)
+                assert_se(event_group_post_to(g, 0, counted, NULL) >= 0);
+        wait_for_work(1);
+
+        /* Freeing the group waits for the work item currently running, but not for the queued ones */
+        event_group_free(g);
+        assert_se(n_done == 1);
+}
+
+int main(int argc, char *argv[]) {
+        test_setup_logging(LOG_DEBUG);
+
+        test_event_group(0);
+        test_event_group(EVENT_GROUP_PIN_CPU);
+        test_free_with_queued_work();
+
+        return 0;
+}
@@ -5,6 +5,7 @@
 #include "sd-event.h"
 
 #include "alloc-util.h"
+#include "event-util.h"
 #include "fd-util.h"
 #include "fs-util.h"
 #include "log.h"
@@ -681,6 +682,78 @@ static void test_ratelimit(void) {
         assert_se(count == 20);
 }
 
+static int statistics_io_handler(sd_event_source *s, int fd, uint32_t revents, void *userdata) {
+        char c;
+
+        assert_se(read(fd, &c, 1) == 1);
+        assert_se(usleep(10 * USEC_PER_MSEC) >= 0);
+
+        return 0;
+}
+
+static void test_statistics(void) {
+        _cleanup_close_pair_ int p[2] = { -1, -1 };
+        _cleanup_(sd_event_unrefp) sd_event *e = NULL;
+        _cleanup_(sd_event_source_unrefp) sd_event_source *s = NULL;
+        EventSourceStatistics st;
+
+        log_info("/* %s */", __func__);
+
+        assert_se(sd_event_new(&e) >= 0);
+        assert_se(pipe2(p, O_CLOEXEC|O_NONBLOCK) >= 0);
+        assert_se(sd_event_add_io(e, &s, p[0], EPOLLIN, statistics_io_handler, NULL) >= 0);
+
+        /* Nothing is collected unless profiling is enabled */
+        if (!event_get_profile_delays(e)) {
+                assert_se(write(p[1], "x", 1) == 1);
+                assert_se(sd_event_run(e, UINT64_MAX) > 0);
+                assert_se(event_source_get_statistics(s, &st) == -ENODATA);
+        }
+
+        assert_se(event_set_profile_delays(e, true) >= 0);
+        assert_se(event_get_profile_delays(e));
+
+        for (unsigned i = 0; i < 3; i++) {
+                assert_se(write(p[1], "x", 1) == 1);
+                assert_se(sd_event_run(e, UINT64_MAX) > 0);
+        }
+
+        assert_se(event_source_get_statistics(s, &st) >= 0);
+        assert_se(st.n_dispatched == 3);
+        assert_se(st.dispatch_usec_total >= 30 * USEC_PER_MSEC);
+        assert_se(st.dispatch_usec_max >= 10 * USEC_PER_MSEC);
+        assert_se(st.dispatch_usec_max <= st.dispatch_usec_total);
+
+        /* The same is returned for all sources of the loop at once */
+        {
+                _cleanup_free_ EventSourceStatistics *all = NULL;
+                size_t n;
+
+                assert_se(event_get_statistics(e, &all, &n) >= 0);
+                assert_se(n == 1);
+                assert_se(streq(all[0].type, "io"));
+                assert_se(all[0].n_dispatched == 3);
+                assert_se(all[0].dispatch_usec_total == st.dispatch_usec_total);
+        }
+
+        /* Turning it on again doesn't reset anything */
+        assert_se(event_set_profile_delays(e, true) == 0);
+        assert_se(event_source_get_statistics(s, &st) >= 0);
+        assert_se(st.n_dispatched == 3);
+
+        if (!getenv("SD_EVENT_PROFILE_DELAYS")) {
+                assert_se(event_set_profile_delays(e, false) > 0);
+                assert_se(!event_get_profile_delays(e));
+                assert_se(event_source_get_statistics(s, &st) == -ENODATA);
+                assert_se(event_get_statistics(e, &(EventSourceStatistics*) { NULL }, &(size_t) { 0 }) == -ENODATA);
+
+                /* Turning it on starts from scratch */
+                assert_se(event_set_profile_delays(e, true) > 0);
+                assert_se(event_source_get_statistics(s, &st) >= 0);
+                assert_se(st.n_dispatched == 0);
+        }
+}
+
 int main(int argc, char *argv[]) {
         test_setup_logging(LOG_DEBUG);
 
@@ -697,5 +770,7 @@ int main(int argc, char *argv[]) {
 
         test_ratelimit();
 
+        test_statistics();
+
         return 0;
 }
@@ -82,8 +82,10 @@ static void vl_on_disconnect(VarlinkServer *s, Varlink *link, void *userdata) {
         assert(s);
         assert(link);
 
+        /* Every lookup is dispatched on a call object of its own, which carries the query. The connection
+         * itself just carries the Manager object, like any call before it starts a query. */
         q = varlink_get_userdata(link);
-        if (!q)
+        if (!q || q == userdata)
                 return;
 
         if (!DNS_TRANSACTION_IS_LIVE(q->state))
@@ -508,7 +510,8 @@ int manager_varlink_init(Manager *m) {
         if (m->varlink_server)
                 return 0;
 
-        r = varlink_server_new(&s, VARLINK_SERVER_ACCOUNT_UID);
+        /* Lookups take a while, let clients pipeline them on a single connection */
+        r = varlink_server_new(&s, VARLINK_SERVER_ACCOUNT_UID|VARLINK_SERVER_PIPELINE);
         if (r < 0)
                 return log_error_errno(r, "Failed to allocate varlink server object: %m");
 
@@ -4,6 +4,7 @@
 #include "bus-get-properties.h"
 #include "bus-log-control-api.h"
 #include "bus-util.h"
+#include "event-util.h"
 #include "log.h"
 #include "sd-bus.h"
 #include "syslog-util.h"
@@ -94,12 +95,117 @@ int bus_property_set_log_target(
 
 BUS_DEFINE_PROPERTY_GET_GLOBAL(bus_property_get_syslog_identifier, "s", program_invocation_short_name);
 
+int bus_property_get_event_loop_profiling(
+                sd_bus *bus,
+                const char *path,
+                const char *interface,
+                const char *property,
+                sd_bus_message *reply,
+                void *userdata,
+                sd_bus_error *error) {
+
+        sd_event *e;
+
+        assert(bus);
+        assert(reply);
+
+        e = sd_bus_get_event(bus);
+
+        return sd_bus_message_append(reply, "b", e && event_get_profile_delays(e));
+}
+
+int bus_property_set_event_loop_profiling(
+                sd_bus *bus,
+                const char *path,
+                const char *interface,
+                const char *property,
+                sd_bus_message *value,
+                void *userdata,
+                sd_bus_error *error) {
+
+        sd_event *e;
+        int b, r;
+
+        assert(bus);
+        assert(value);
+
+        r = sd_bus_message_read(value, "b", &b);
+        if (r < 0)
+                return r;
+
+        e = sd_bus_get_event(bus);
+        if (!e)
+                return sd_bus_error_set(error, SD_BUS_ERROR_NOT_SUPPORTED, "Not running an event loop.");
+
+        r = event_set_profile_delays(e, b);
+        if (r < 0)
+                return r;
+        if (r > 0)
+                log_info("%s event loop profiling.", b ? "Enabling" : "Disabling");
+
+        return 0;
+}
+
+int bus_method_get_event_source_statistics(sd_bus_message *message, void *userdata, sd_bus_error *error) {
+        _cleanup_(sd_bus_message_unrefp) sd_bus_message *reply = NULL;
+        _cleanup_free_ EventSourceStatistics *st = NULL;
+        sd_event *e;
+        size_t n;
+        int r;
+
+        assert(message);
+
+        e = sd_bus_get_event(sd_bus_message_get_bus(message));
+        if (!e)
+                return sd_bus_error_set(error, SD_BUS_ERROR_NOT_SUPPORTED, "Not running an event loop.");
+
+        r = event_get_statistics(e, &st, &n);
+        if (r == -ENODATA)
+                return sd_bus_error_set(error, SD_BUS_ERROR_NOT_SUPPORTED, "Event loop profiling is not enabled.");
+        if (r < 0)
+                return r;
+
+        r = sd_bus_message_new_method_return(message, &reply);
+        if (r < 0)
+                return r;
+
+        r = sd_bus_message_open_container(reply, 'a', "(sstttt)");
+        if (r < 0)
+                return r;
+
+        for (size_t i = 0; i < n; i++) {
+                r = sd_bus_message_append(reply, "(sstttt)",
+                                          strempty(st[i].description),
+                                          st[i].type,
+                                          st[i].n_dispatched,
+                                          st[i].dispatch_usec_total,
+                                          st[i].dispatch_usec_max,
+                                          st[i].latency_usec_max);
+                if (r < 0)
+                        return r;
+        }
+
+        r = sd_bus_message_close_container(reply);
+        if (r < 0)
+                return r;
+
+        return sd_bus_send(NULL, reply, NULL);
+}
+
 static const sd_bus_vtable log_control_vtable[] = {
         SD_BUS_VTABLE_START(0),
 
         SD_BUS_WRITABLE_PROPERTY("LogLevel", "s", bus_property_get_log_level, bus_property_set_log_level, 0, 0),
         SD_BUS_WRITABLE_PROPERTY("LogTarget", "s", bus_property_get_log_target, bus_property_set_log_target, 0, 0),
         SD_BUS_PROPERTY("SyslogIdentifier", "s", bus_property_get_syslog_identifier, 0, 0),
+        SD_BUS_WRITABLE_PROPERTY("EventLoopProfiling", "b", bus_property_get_event_loop_profiling, bus_property_set_event_loop_profiling, 0, 0),
+
+        SD_BUS_METHOD_WITH_NAMES("GetEventSourceStatistics",
+                                 NULL,,
+                                 "a(sstttt)",
+                                 SD_BUS_PARAM(statistics),
+                                 bus_method_get_event_source_statistics,
+                                 0),
 
         /* One of those days we might want to add a similar, second interface to cover common service
          * operations such as Reload(), Reexecute(), Exit() …  and maybe some properties exposing version
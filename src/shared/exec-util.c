@@ -9,6 +9,7 @@
 
 #include "alloc-util.h"
 #include "conf-files.h"
+#include "cpu-set-util.h"
 #include "env-file.h"
 #include "env-util.h"
 #include "errno-util.h"
@@ -73,6 +74,76 @@ static int do_spawn(const char *path, char *argv[], int stdout_fd, pid_t *pid) {
         return 1;
 }
 
+typedef struct ExecChild {
+        char *path;
+        size_t index;
+        usec_t start;
+} ExecChild;
+
+static ExecChild* exec_child_free(ExecChild *c) {
+        if (!c)
+                return NULL;
+
+        free(c->path);
+        return mfree(c);
+}
+
+DEFINE_TRIVIAL_CLEANUP_FUNC(ExecChild*, exec_child_free);
+DEFINE_PRIVATE_HASH_OPS_WITH_VALUE_DESTRUCTOR(exec_child_hash_ops, void, trivial_hash_func, trivial_compare_func, ExecChild, exec_child_free);
+
+static unsigned exec_max_parallel(void) {
+        int n;
+
+        /* The executables are usually short-lived and mostly wait for I/O, hence allow a couple of them per CPU
+         * to run at the same time, but don't fork off all of them at once. */
+
+        n = cpus_in_affinity_mask();
+        if (n <= 0)
+                n = 1;
+
+        return 2U * (unsigned) n;
+}
+
+static int exec_child_reap(const ExecChild *c, pid_t pid, int *statuses) {
+        char ts[FORMAT_TIMESPAN_MAX];
+        int r;
+
+        assert(c);
+        assert(pid > 0);
+
+        r = wait_for_terminate_and_check(c->path, pid, WAIT_LOG);
+
+        log_debug("%s finished after %s.", c->path,
+                  format_timespan(ts, sizeof(ts), usec_sub_unsigned(now(CLOCK_MONOTONIC), c->start), USEC_PER_MSEC));
+
+        if (statuses)
+                statuses[c->index] = r;
+
+        return r;
+}
+
+static int exec_child_reap_any(Hashmap *pids, int *statuses) {
+        _cleanup_(exec_child_freep) ExecChild *c = NULL;
+        siginfo_t si = {};
+        pid_t pid;
+
+        assert(!hashmap_isempty(pids));
+
+        /* Find out which child is done first, but leave the reaping (and logging) to
+         * wait_for_terminate_and_check(). We are the only one forking off children in this process, hence
+         * any child that exits is one of ours. If that doesn't work out, just wait for any of them. */
+
+        if (waitid(P_ALL, 0, &si, WEXITED|WNOWAIT) >= 0 && hashmap_contains(pids, PID_TO_PTR(si.si_pid)))
+                pid = si.si_pid;
+        else
+                pid = PTR_TO_PID(hashmap_first_key(pids));
+
+        c = hashmap_remove(pids, PID_TO_PTR(pid));
+        assert(c);
+
+        return exec_child_reap(c, pid, statuses);
+}
+
 static int do_execute(
                 char **directories,
                 usec_t timeout,
@@ -81,11 +152,14 @@ static int do_execute(
                 int output_fd,
                 char *argv[],
                 char *envp[],
+                const ExecDirHooks *hooks,
                 ExecDirFlags flags) {
 
-        _cleanup_hashmap_free_free_ Hashmap *pids = NULL;
+        _cleanup_hashmap_free_ Hashmap *pids = NULL;
         _cleanup_strv_free_ char **paths = NULL;
+        _cleanup_free_ int *statuses = NULL;
         char **path, **e;
+        unsigned max_parallel = 1;
         int r;
         bool parallel_execution;
 
@@ -93,7 +167,8 @@ static int do_execute(
          * use of SIGALRM to set a time limit.
          *
          * We attempt to perform parallel execution if configured by the user, however
-         * if `callbacks` is nonnull, execution must be serial.
+         * if `callbacks` is nonnull, execution must be serial. At most max_parallel
+         * executables are running at the same time.
          */
         parallel_execution = FLAGS_SET(flags, EXEC_DIR_PARALLEL) && !callbacks;
 
@@ -102,9 +177,19 @@ static int do_execute(
                 return log_error_errno(r, "Failed to enumerate executables: %m");
 
         if (parallel_execution) {
-                pids = hashmap_new(NULL);
+                pids = hashmap_new(&exec_child_hash_ops);
                 if (!pids)
                         return log_oom();
+
+                max_parallel = exec_max_parallel();
+        }
+
+        /* The exit status of each executable, so that finish() can be called in the order they are listed,
+         * rather than in the order they happen to finish */
+        if (hooks && hooks->finish) {
+                statuses = new0(int, strv_length(paths));
+                if (!statuses)
+                        return log_oom();
         }
 
         /* Abort execution of this process after the timeout. We simply rely on SIGALRM as
@@ -118,12 +203,28 @@ static int do_execute(
                         return log_error_errno(errno, "Failed to set environment variable: %m");
 
         STRV_FOREACH(path, paths) {
-                _cleanup_free_ char *t = NULL;
+                _cleanup_(exec_child_freep) ExecChild *c = NULL;
+                _cleanup_strv_free_ char **private_argv = NULL;
                 _cleanup_close_ int fd = -1;
                 pid_t pid;
 
-                t = strdup(*path);
-                if (!t)
+                if (hooks && hooks->prepare) {
+                        r = hooks->prepare(*path, &private_argv, hooks->userdata);
+                        if (r < 0)
+                                log_warning_errno(r, "Failed to prepare execution of %s, ignoring: %m", *path);
+                        else if (r > 0)
+                                continue;
+                }
+
+                c = new(ExecChild, 1);
+                if (!c)
+                        return log_oom();
+
+                *c = (ExecChild) {
+                        .path = strdup(*path),
+                        .index = path - paths,
+                };
+                if (!c->path)
                         return log_oom();
 
                 if (callbacks) {
@@ -132,17 +233,29 @@ static int do_execute(
                                 return log_error_errno(fd, "Failed to open serialization file: %m");
                 }
 
-                r = do_spawn(t, argv, fd, &pid);
-                if (r <= 0)
+                /* Make room in the pool first, so that the time we log covers only the execution itself */
+                while (hashmap_size(pids) >= max_parallel) {
+                        r = exec_child_reap_any(pids, statuses);
+                        if (!FLAGS_SET(flags, EXEC_DIR_IGNORE_ERRORS) && r > 0)
+                                return r;
+                }
+
+                c->start = now(CLOCK_MONOTONIC);
+
+                r = do_spawn(c->path, private_argv ?: argv, fd, &pid);
+                if (r <= 0) {
+                        if (statuses)
+                                statuses[c->index] = r;
                         continue;
+                }
 
                 if (parallel_execution) {
-                        r = hashmap_put(pids, PID_TO_PTR(pid), t);
+                        r = hashmap_put(pids, PID_TO_PTR(pid), c);
                         if (r < 0)
                                 return log_oom();
-                        t = NULL;
+                        c = NULL;
                 } else {
-                        r = wait_for_terminate_and_check(t, pid, WAIT_LOG);
+                        r = exec_child_reap(c, pid, statuses);
                         if (FLAGS_SET(flags, EXEC_DIR_IGNORE_ERRORS)) {
                                 if (r < 0)
                                         continue;
@@ -168,30 +281,26 @@ static int do_execute(
         }
 
         while (!hashmap_isempty(pids)) {
-                _cleanup_free_ char *t = NULL;
-                pid_t pid;
-
-                pid = PTR_TO_PID(hashmap_first_key(pids));
-                assert(pid > 0);
-
-                t = hashmap_remove(pids, PID_TO_PTR(pid));
-                assert(t);
-
-                r = wait_for_terminate_and_check(t, pid, WAIT_LOG);
+                r = exec_child_reap_any(pids, statuses);
                 if (!FLAGS_SET(flags, EXEC_DIR_IGNORE_ERRORS) && r > 0)
                         return r;
         }
 
+        if (statuses)
+                STRV_FOREACH(path, paths)
+                        hooks->finish(*path, statuses[path - paths], hooks->userdata);
+
         return 0;
 }
 
-int execute_directories(
+int execute_directories_full(
                 const char* const* directories,
                 usec_t timeout,
                 gather_stdout_callback_t const callbacks[_STDOUT_CONSUME_MAX],
                 void* const callback_args[_STDOUT_CONSUME_MAX],
                 char *argv[],
                 char *envp[],
+                const ExecDirHooks *hooks,
                 ExecDirFlags flags) {
 
         char **dirs = (char**) directories;
@@ -224,7 +333,7 @@ int execute_directories(
         if (r < 0)
                 return r;
         if (r == 0) {
-                r = do_execute(dirs, timeout, callbacks, callback_args, fd, argv, envp, flags);
+                r = do_execute(dirs, timeout, callbacks, callback_args, fd, argv, envp, hooks, flags);
                 _exit(r < 0 ? EXIT_FAILURE : r);
         }
 
@@ -247,6 +356,18 @@ int execute_directories(
         return 0;
 }
 
+int execute_directories(
+                const char* const* directories,
+                usec_t timeout,
+                gather_stdout_callback_t const callbacks[_STDOUT_CONSUME_MAX],
+                void* const callback_args[_STDOUT_CONSUME_MAX],
+                char *argv[],
+                char *envp[],
+                ExecDirFlags flags) {
+
+        return execute_directories_full(directories, timeout, callbacks, callback_args, argv, envp, NULL, flags);
+}
+
 static int gather_environment_generate(int fd, void *arg) {
         char ***env = arg, **x, **y;
         _cleanup_fclose_ FILE *f = NULL;
@@ -20,6 +20,16 @@ typedef enum {
         EXEC_DIR_IGNORE_ERRORS = 1 << 1, /* Ignore non-zero exit status of scripts */
 } ExecDirFlags;
 
+/* Optional hooks called in the executor process around each executable found. If prepare() returns > 0
+ * the executable is not run, otherwise it may return an argv to use instead of the common one. Once all of
+ * them are done, finish() is called for each executable in the order they are listed, with its exit status
+ * or a negative errno. Those that prepare() skipped count as successful. */
+typedef struct ExecDirHooks {
+        int (*prepare)(const char *path, char ***ret_argv, void *userdata);
+        void (*finish)(const char *path, int status, void *userdata);
+        void *userdata;
+} ExecDirHooks;
+
 typedef enum ExecCommandFlags {
         EXEC_COMMAND_IGNORE_FAILURE   = 1 << 0,
         EXEC_COMMAND_FULLY_PRIVILEGED = 1 << 1,
@@ -37,6 +47,15 @@ int execute_directories(
                 char *argv[],
                 char *envp[],
                 ExecDirFlags flags);
+int execute_directories_full(
+                const char* const* directories,
+                usec_t timeout,
+                gather_stdout_callback_t const callbacks[_STDOUT_CONSUME_MAX],
+                void* const callback_args[_STDOUT_CONSUME_MAX],
+                char *argv[],
+                char *envp[],
+                const ExecDirHooks *hooks,
+                ExecDirFlags flags);
 
 int exec_command_flags_from_strv(char **ex_opts, ExecCommandFlags *flags);
 int exec_command_flags_to_strv(ExecCommandFlags flags, char ***ex_opts);
@@ -7,6 +7,7 @@
 #include "cgroup-util.h"
 #include "dropin.h"
 #include "escape.h"
+#include "extract-word.h"
 #include "fd-util.h"
 #include "fileio.h"
 #include "fstab-util.h"
@@ -144,6 +145,9 @@ int generator_write_fsck_deps(
         }
 
         if (!isempty(fstype) && !streq(fstype, "auto")) {
+                /* Whether the checker is installed changes our output */
+                (void) generator_add_input_search_path();
+
                 r = fsck_exists(fstype);
                 if (r < 0)
                         log_warning_errno(r, "Checking was requested for %s, but couldn't detect if fsck.%s may be used, proceeding: %m", what, fstype);
@@ -620,6 +624,70 @@ int generator_write_cryptsetup_service_section(
         return 0;
 }
 
+int generator_add_input(const char *path) {
+        _cleanup_fclose_ FILE *f = NULL;
+        const char *e;
+        int r;
+
+        assert(path);
+
+        e = getenv(GENERATOR_INPUTS_ENV);
+        if (!e)
+                return 0;
+
+        r = fopen_unlocked(e, "ae", &f);
+        if (r < 0)
+                return log_debug_errno(r, "Failed to open %s: %m", e);
+
+        fputs(path, f);
+        fputc('\n', f);
+
+        r = fflush_and_check(f);
+        if (r < 0)
+                return log_debug_errno(r, "Failed to declare input %s: %m", path);
+
+        return 1;
+}
+
+int generator_add_input_search_path(void) {
+        const char *p;
+        int r;
+
+        /* Declares the directories binaries are looked up in, for generators whose output depends on whether
+         * some binary is installed */
+
+        p = getenv("PATH") ?: DEFAULT_PATH;
+
+        for (;;) {
+                _cleanup_free_ char *element = NULL;
+
+                r = extract_first_word(&p, &element, ":", EXTRACT_DONT_COALESCE_SEPARATORS);
+                if (r < 0)
+                        return r;
+                if (r == 0)
+                        return 0;
+
+                if (!path_is_absolute(element))
+                        continue;
+
+                r = generator_add_input(element);
+                if (r <= 0)
+                        return r;
+        }
+}
+
+int generator_add_input_proc_cmdline(void) {
+        int r;
+
+        /* The kernel command line, and whether the rd. prefixed options apply to us */
+
+        r = generator_add_input("/proc/cmdline");
+        if (r <= 0)
+                return r;
+
+        return generator_add_input("/etc/initrd-release");
+}
+
 void log_setup_generator(void) {
         /* Disable talking to syslog/journal (i.e. the two IPC-based loggers) if we run in system context. */
         if (cg_pid_get_owner_uid(0, NULL) == -ENXIO /* not running in a per-user slice */)
@@ -67,6 +67,15 @@ int generator_hook_up_growfs(
 
 int generator_enable_remount_fs_service(const char *dir);
 
+/* Generators may declare the files their output is derived from. The service manager then reuses the
+ * previous output of a generator instead of running it again, as long as none of them changed. A generator
+ * which declares any input must declare all of them. */
+#define GENERATOR_INPUTS_ENV "SYSTEMD_GENERATOR_INPUTS"
+
+int generator_add_input(const char *path);
+int generator_add_input_search_path(void);
+int generator_add_input_proc_cmdline(void);
+
 void log_setup_generator(void);
 
 /* Similar to DEFINE_MAIN_FUNCTION, but initializes logging and assigns positional arguments. */
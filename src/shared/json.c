@@ -19,6 +19,8 @@
 #include "json.h"
 #include "macro.h"
 #include "memory-util.h"
+#include "mempool.h"
+#include "stdio-util.h"
 #include "string-table.h"
 #include "string-util.h"
 #include "strv.h"
@@ -39,6 +41,10 @@
 #define DEPTH_MAX (2U*1024U)
 assert_cc(DEPTH_MAX <= UINT16_MAX);
 
+/* With JSON_PARSE_LAZY, nested objects and arrays whose JSON text is at least this long are only parsed when their
+ * elements are first accessed. Smaller ones aren't worth the trouble. */
+#define LAZY_SIZE_MIN 256U
+
 typedef struct JsonSource {
         /* When we parse from a file or similar, encodes the filename, to indicate the source of a json variant */
         size_t n_ref;
@@ -75,6 +81,12 @@ struct JsonVariant {
          * this bool is set, and the external object is referenced through the .reference field below. */
         bool is_reference:1;
 
+        /* If this is an object or array parsed with JSON_PARSE_LAZY, its contents might not have been turned into
+         * variants yet. In that case this bool is set, and the (already validated) JSON text is stored in .string
+         * below. On first access to the elements the text is parsed, and the variant is turned into a reference to
+         * the result. */
+        bool is_lazy:1;
+
         /* While comparing two arrays, we use this for marking what we already have seen */
         bool is_marked:1;
 
@@ -87,6 +99,9 @@ struct JsonVariant {
         /* If in addition to this object all objects referenced by it are also ordered strictly by name */
         bool normalized:1;
 
+        /* Whether this stand-alone variant was allocated from the mempool */
+        bool from_pool:1;
+
         /* The current 'depth' of the JsonVariant, i.e. how many levels of member variants this has */
         uint16_t depth;
 
@@ -200,6 +215,8 @@ static bool json_variant_is_regular(const JsonVariant *v) {
         return (((uintptr_t) v) & 1) == 0;
 }
 
+static int json_variant_materialize_lazy(JsonVariant *v);
+
 static JsonVariant *json_variant_dereference(JsonVariant *v) {
 
         /* Recursively dereference variants that are references to other variants */
@@ -216,6 +233,12 @@ static JsonVariant *json_variant_dereference(JsonVariant *v) {
         return json_variant_dereference(v->reference);
 }
 
+static bool json_variant_is_lazy(JsonVariant *v) {
+        v = json_variant_dereference(v);
+
+        return json_variant_is_regular(v) && v->is_lazy;
+}
+
 static uint16_t json_variant_depth(JsonVariant *v) {
 
         v = json_variant_dereference(v);
@@ -238,6 +261,10 @@ static JsonVariant *json_variant_formalize(JsonVariant *v) {
 
         v = json_variant_dereference(v);
 
+        /* Lazy objects and arrays are never empty, hence don't need to be parsed to tell */
+        if (json_variant_is_lazy(v))
+                return v;
+
         switch (json_variant_type(v)) {
 
         case JSON_VARIANT_BOOLEAN:
@@ -288,13 +315,32 @@ static JsonVariant *json_variant_conservative_formalize(JsonVariant *v) {
         return json_variant_formalize(v);
 }
 
+DEFINE_MEMPOOL(variant_pool, JsonVariant, 64);
+
+static JsonVariant* json_variant_alloc0(size_t size) {
+        JsonVariant *v;
+        bool up;
+
+        /* Stand-alone numbers, short strings and references fit into a single JsonVariant, take those from the
+         * pool */
+
+        size = MAX(sizeof(JsonVariant), size);
+        up = size == sizeof(JsonVariant) && mempool_enabled();
+
+        v = up ? mempool_alloc0_tile(&variant_pool) : malloc0(size);
+        if (!v)
+                return NULL;
+
+        v->from_pool = up;
+        return v;
+}
+
 static int json_variant_new(JsonVariant **ret, JsonVariantType type, size_t space) {
         JsonVariant *v;
 
         assert_return(ret, -EINVAL);
 
-        v = malloc0(MAX(sizeof(JsonVariant),
-                        offsetof(JsonVariant, value) + space));
+        v = json_variant_alloc0(offsetof(JsonVariant, value) + space);
         if (!v)
                 return -ENOMEM;
 
@@ -725,6 +771,9 @@ static size_t json_variant_size(JsonVariant* v) {
         if (v->is_reference)
                 return offsetof(JsonVariant, reference) + sizeof(JsonVariant*);
 
+        if (v->is_lazy)
+                return offsetof(JsonVariant, string) + strlen(v->string) + 1;
+
         switch (v->type) {
 
         case JSON_VARIANT_STRING:
@@ -774,7 +823,7 @@ static void json_variant_free_inner(JsonVariant *v, bool force_sensitive) {
                 return;
         }
 
-        if (IN_SET(v->type, JSON_VARIANT_ARRAY, JSON_VARIANT_OBJECT)) {
+        if (IN_SET(v->type, JSON_VARIANT_ARRAY, JSON_VARIANT_OBJECT) && !v->is_lazy) {
                 size_t i;
 
                 for (i = 0; i < v->n_elements; i++)
@@ -814,8 +863,15 @@ JsonVariant *json_variant_unref(JsonVariant *v) {
                 v->n_ref--;
 
                 if (v->n_ref == 0) {
+                        /* Sensitive variants are erased by json_variant_free_inner(), remember where it came from */
+                        bool from_pool = v->from_pool;
+
                         json_variant_free_inner(v, false);
-                        free(v);
+
+                        if (from_pool)
+                                mempool_free_tile(&variant_pool, v);
+                        else
+                                free(v);
                 }
         }
 
@@ -1172,6 +1228,8 @@ size_t json_variant_elements(JsonVariant *v) {
                 goto mismatch;
         if (!IN_SET(v->type, JSON_VARIANT_ARRAY, JSON_VARIANT_OBJECT))
                 goto mismatch;
+        if (v->is_lazy && json_variant_materialize_lazy(v) < 0)
+                return 0;
         if (v->is_reference)
                 return json_variant_elements(v->reference);
 
@@ -1192,6 +1250,8 @@ JsonVariant *json_variant_by_index(JsonVariant *v, size_t idx) {
                 goto mismatch;
         if (!IN_SET(v->type, JSON_VARIANT_ARRAY, JSON_VARIANT_OBJECT))
                 goto mismatch;
+        if (v->is_lazy && json_variant_materialize_lazy(v) < 0)
+                return NULL;
         if (v->is_reference)
                 return json_variant_by_index(v->reference, idx);
         if (idx >= v->n_elements)
@@ -1217,8 +1277,10 @@ JsonVariant *json_variant_by_key_full(JsonVariant *v, const char *key, JsonVaria
                 goto mismatch;
         if (v->type != JSON_VARIANT_OBJECT)
                 goto mismatch;
+        if (v->is_lazy && json_variant_materialize_lazy(v) < 0)
+                goto not_found;
         if (v->is_reference)
-                return json_variant_by_key(v->reference, key);
+                return json_variant_by_key_full(v->reference, key, ret_key);
 
         if (v->sorted) {
                 size_t a = 0, b = v->n_elements/2;
@@ -1489,6 +1551,12 @@ static int print_source(FILE *f, JsonVariant *v, JsonFormatFlags flags, bool whi
         return 0;
 }
 
+static bool json_string_char_is_plain(char c) {
+        /* Characters that can be taken over verbatim, both when parsing and when formatting strings: printable
+         * ASCII, except for the quote and the escape character */
+        return c >= ' ' && c < 0x7f && !IN_SET(c, '"', '\\');
+}
+
 static void json_format_string(FILE *f, const char *q, JsonFormatFlags flags) {
         assert(q);
 
@@ -1742,6 +1810,214 @@ static int json_format(FILE *f, JsonVariant *v, JsonFormatFlags flags, const cha
         return 0;
 }
 
+typedef struct JsonBuffer {
+        char *data;
+        size_t size, allocated;
+} JsonBuffer;
+
+static void json_buffer_done(JsonBuffer *b) {
+        assert(b);
+
+        b->data = mfree(b->data);
+}
+
+static int json_buffer_put(JsonBuffer *b, const char *p, size_t n) {
+        assert(b);
+        assert(p || n == 0);
+
+        /* Always keep room for the trailing NUL */
+        if (!GREEDY_REALLOC(b->data, b->allocated, b->size + n + 1))
+                return -ENOMEM;
+
+        memcpy_safe(b->data + b->size, p, n);
+        b->size += n;
+        return 0;
+}
+
+static int json_buffer_puts(JsonBuffer *b, const char *p) {
+        return json_buffer_put(b, p, strlen(p));
+}
+
+static int json_buffer_putc(JsonBuffer *b, char c) {
+        return json_buffer_put(b, &c, 1);
+}
+
+static int json_buffer_format_string(JsonBuffer *b, const char *q) {
+        int r;
+
+        assert(b);
+        assert(q);
+
+        r = json_buffer_putc(b, '"');
+        if (r < 0)
+                return r;
+
+        for (;;) {
+                const char *e;
+
+                /* Copy runs of characters that need no escaping in one go. Unlike the parser we take
+                 * non-ASCII and DEL characters over as they are, like json_format_string() does. */
+                for (e = q; json_string_char_is_plain(*e) || (signed char) *e < 0 || *e == 0x7f; e++)
+                        ;
+
+                r = json_buffer_put(b, q, e - q);
+                if (r < 0)
+                        return r;
+
+                if (*e == 0)
+                        break;
+
+                switch (*e) {
+                case '"':
+                        r = json_buffer_puts(b, "\\\"");
+                        break;
+
+                case '\\':
+                        r = json_buffer_puts(b, "\\\\");
+                        break;
+
+                case '\b':
+                        r = json_buffer_puts(b, "\\b");
+                        break;
+
+                case '\f':
+                        r = json_buffer_puts(b, "\\f");
+                        break;
+
+                case '\n':
+                        r = json_buffer_puts(b, "\\n");
+                        break;
+
+                case '\r':
+                        r = json_buffer_puts(b, "\\r");
+                        break;
+
+                case '\t':
+                        r = json_buffer_puts(b, "\\t");
+                        break;
+
+                default: {
+                        char buf[STRLEN("\\u0000") + 1];
+
+                        xsprintf(buf, "\\u%04x", *e);
+                        r = json_buffer_puts(b, buf);
+                        break;
+                }}
+                if (r < 0)
+                        return r;
+
+                q = e + 1;
+        }
+
+        return json_buffer_putc(b, '"');
+}
+
+/* A fast path for json_format(), for compact output without colors, that writes directly into a memory buffer
+ * instead of going through stdio. This is what we use for IPC, hence it matters. Must generate the exact same
+ * output as json_format() for the flags it supports. */
+static int json_format_buffer(JsonBuffer *b, JsonVariant *v) {
+        char buf[DECIMAL_DIG + 16]; /* Large enough for any long double in %Le notation, and hence for integers too */
+        int r;
+
+        assert(b);
+        assert(v);
+
+        switch (json_variant_type(v)) {
+
+        case JSON_VARIANT_REAL:
+                xsprintf(buf, "%.*Le", DECIMAL_DIG, json_variant_real(v));
+                return json_buffer_puts(b, buf);
+
+        case JSON_VARIANT_INTEGER:
+                xsprintf(buf, "%" PRIdMAX, json_variant_integer(v));
+                return json_buffer_puts(b, buf);
+
+        case JSON_VARIANT_UNSIGNED:
+                xsprintf(buf, "%" PRIuMAX, json_variant_unsigned(v));
+                return json_buffer_puts(b, buf);
+
+        case JSON_VARIANT_BOOLEAN:
+                return json_buffer_puts(b, json_variant_boolean(v) ? "true" : "false");
+
+        case JSON_VARIANT_NULL:
+                return json_buffer_puts(b, "null");
+
+        case JSON_VARIANT_STRING:
+                return json_buffer_format_string(b, json_variant_string(v));
+
+        case JSON_VARIANT_ARRAY:
+        case JSON_VARIANT_OBJECT: {
+                bool object = json_variant_is_object(v);
+                size_t n;
+
+                n = json_variant_elements(v);
+
+                r = json_buffer_putc(b, object ? '{' : '[');
+                if (r < 0)
+                        return r;
+
+                for (size_t i = 0; i < n; i++) {
+                        if (i > 0) {
+                                r = json_buffer_putc(b, object && i % 2 != 0 ? ':' : ',');
+                                if (r < 0)
+                                        return r;
+                        }
+
+                        r = json_format_buffer(b, json_variant_by_index(v, i));
+                        if (r < 0)
+                                return r;
+                }
+
+                return json_buffer_putc(b, object ? '}' : ']');
+        }
+
+        default:
+                assert_not_reached("Unexpected variant type.");
+        }
+}
+
+static int json_variant_format_buffer(JsonVariant *v, JsonFormatFlags flags, char **ret) {
+        _cleanup_(json_buffer_done) JsonBuffer b = {};
+        int r;
+
+        assert(v);
+        assert(ret);
+
+        /* Prefixes and suffixes are added the same way as json_variant_dump() does */
+
+        if (flags & JSON_FORMAT_SSE) {
+                r = json_buffer_puts(&b, "data: ");
+                if (r < 0)
+                        return r;
+        }
+        if (flags & JSON_FORMAT_SEQ) {
+                r = json_buffer_putc(&b, '\x1e'); /* ASCII Record Separator */
+                if (r < 0)
+                        return r;
+        }
+
+        r = json_format_buffer(&b, v);
+        if (r < 0)
+                return r;
+
+        if (flags & (JSON_FORMAT_SEQ|JSON_FORMAT_SSE|JSON_FORMAT_NEWLINE)) {
+                r = json_buffer_putc(&b, '\n');
+                if (r < 0)
+                        return r;
+        }
+        if (flags & JSON_FORMAT_SSE) { /* In case of SSE add a second newline */
+                r = json_buffer_putc(&b, '\n');
+                if (r < 0)
+                        return r;
+        }
+
+        assert(b.data);
+        b.data[b.size] = 0;
+
+        *ret = TAKE_PTR(b.data);
+        return (int) b.size;
+}
+
 int json_variant_format(JsonVariant *v, JsonFormatFlags flags, char **ret) {
         _cleanup_free_ char *s = NULL;
         size_t sz = 0;
@@ -1753,6 +2029,9 @@ int json_variant_format(JsonVariant *v, JsonFormatFlags flags, char **ret) {
         assert_return(v, -EINVAL);
         assert_return(ret, -EINVAL);
 
+        if ((flags & (JSON_FORMAT_PRETTY|JSON_FORMAT_PRETTY_AUTO|JSON_FORMAT_COLOR|JSON_FORMAT_COLOR_AUTO)) == 0)
+                return json_variant_format_buffer(v, flags, ret);
+
         {
                 _cleanup_fclose_ FILE *f = NULL;
 
@@ -2213,8 +2492,7 @@ static int json_variant_copy(JsonVariant **nv, JsonVariant *v) {
         default:
                 /* Everything else copy by reference */
 
-                c = malloc0(MAX(sizeof(JsonVariant),
-                                offsetof(JsonVariant, reference) + sizeof(JsonVariant*)));
+                c = json_variant_alloc0(offsetof(JsonVariant, reference) + sizeof(JsonVariant*));
                 if (!c)
                         return -ENOMEM;
 
@@ -2227,8 +2505,7 @@ static int json_variant_copy(JsonVariant **nv, JsonVariant *v) {
                 return 0;
         }
 
-        c = malloc0(MAX(sizeof(JsonVariant),
-                        offsetof(JsonVariant, value) + k));
+        c = json_variant_alloc0(offsetof(JsonVariant, value) + k);
         if (!c)
                 return -ENOMEM;
 
@@ -2381,6 +2658,31 @@ static int unhex_ucs2(const char *c, uint16_t *ret) {
         return 0;
 }
 
+static const char *json_string_skip_plain(const char *c) {
+        int len;
+
+        assert(c);
+
+        /* Skips over the run of characters that need no special processing when parsing a string, i.e. plain
+         * ASCII and valid UTF-8 sequences. Returns NULL on invalid UTF-8. */
+
+        for (;;) {
+                if (json_string_char_is_plain(*c)) {
+                        c++;
+                        continue;
+                }
+
+                if ((signed char) *c >= 0)
+                        return c;
+
+                len = utf8_encoded_valid_unichar(c, (size_t) -1);
+                if (len < 0)
+                        return NULL;
+
+                c += len;
+        }
+}
+
 static int json_parse_string(const char **p, char **ret) {
         _cleanup_free_ char *s = NULL;
         size_t n = 0, allocated = 0;
@@ -2398,7 +2700,32 @@ static int json_parse_string(const char **p, char **ret) {
         c++;
 
         for (;;) {
-                int len;
+                const char *e;
+
+                /* Take over everything up to the next character that needs special handling in one go. Strings
+                 * without any escapes are copied out directly. */
+                e = json_string_skip_plain(c);
+                if (!e)
+                        return -EINVAL;
+
+                if (e > c) {
+                        if (!s && *e == '"') {
+                                s = strndup(c, e - c);
+                                if (!s)
+                                        return -ENOMEM;
+
+                                *p = e + 1;
+                                *ret = TAKE_PTR(s);
+                                return JSON_TOKEN_STRING;
+                        }
+
+                        if (!GREEDY_REALLOC(s, allocated, n + (e - c) + 1))
+                                return -ENOMEM;
+
+                        memcpy(s + n, c, e - c);
+                        n += e - c;
+                        c = e;
+                }
 
                 /* Check for EOF */
                 if (*c == 0)
@@ -2492,16 +2819,7 @@ static int json_parse_string(const char **p, char **ret) {
                         continue;
                 }
 
-                len = utf8_encoded_valid_unichar(c, (size_t) -1);
-                if (len < 0)
-                        return len;
-
-                if (!GREEDY_REALLOC(s, allocated, n + len + 1))
-                        return -ENOMEM;
-
-                memcpy(s + n, c, len);
-                n += len;
-                c += len;
+                assert_not_reached("Unexpected character in string");
         }
 }
 
@@ -2610,6 +2928,74 @@ static int json_parse_number(const char **p, JsonValue *ret) {
         }
 }
 
+static int json_skip_string(const char **p) {
+        const char *c;
+        int r;
+
+        assert(p);
+        assert(*p);
+
+        /* Validates a string the same way json_parse_string() does, but without copying it out */
+
+        c = *p;
+
+        if (*c != '"')
+                return -EINVAL;
+
+        c++;
+
+        for (;;) {
+                c = json_string_skip_plain(c);
+                if (!c)
+                        return -EINVAL;
+
+                if (*c == '"') {
+                        *p = c + 1;
+                        return 0;
+                }
+
+                if (*c != '\\') /* EOF or a control character */
+                        return -EINVAL;
+
+                c++;
+
+                if (IN_SET(*c, '"', '\\', '/', 'b', 'f', 'n', 'r', 't'))
+                        c++;
+                else if (*c == 'u') {
+                        char16_t x, y;
+
+                        r = unhex_ucs2(c + 1, &x);
+                        if (r < 0)
+                                return r;
+
+                        c += 5;
+
+                        if (!utf16_is_surrogate(x))
+                                continue;
+                        if (utf16_is_trailing_surrogate(x))
+                                return -EINVAL;
+
+                        if (c[0] != '\\' || c[1] != 'u')
+                                return -EINVAL;
+
+                        r = unhex_ucs2(c + 2, &y);
+                        if (r < 0)
+                                return r;
+                        if (!utf16_is_trailing_surrogate(y))
+                                return -EINVAL;
+
+                        c += 6;
+                } else
+                        return -EINVAL;
+        }
+}
+
+enum {
+        STATE_NULL,
+        STATE_VALUE,
+        STATE_VALUE_POST,
+};
+
 int json_tokenize(
                 const char **p,
                 char **ret_string,
@@ -2625,12 +3011,6 @@ int json_tokenize(
         size_t n;
         int t, r;
 
-        enum {
-                STATE_NULL,
-                STATE_VALUE,
-                STATE_VALUE_POST,
-        };
-
         assert(p);
         assert(*p);
         assert(ret_string);
@@ -2806,6 +3186,133 @@ typedef enum JsonExpect {
         EXPECT_OBJECT_KEY,
 } JsonExpect;
 
+typedef struct JsonSkipLevel {
+        JsonExpect expect;
+        uint16_t depth; /* The depth of the deepest element seen so far on this level, plus one */
+} JsonSkipLevel;
+
+static int json_skip_container(const char **p, uint16_t *ret_depth) {
+        _cleanup_free_ JsonSkipLevel *stack = NULL;
+        size_t n_stack = 0, n_stack_allocated = 0;
+        const char *c;
+        int r;
+
+        assert(p);
+        assert(*p);
+        assert(ret_depth);
+
+        /* Validates the object or array at *p exactly as json_parse() would, but without building any variants,
+         * and returns its depth as json_variant_depth() would report it. On success *p points right behind the
+         * container afterwards. */
+
+        c = *p;
+        assert(IN_SET(*c, '{', '['));
+
+        for (;;) {
+                JsonSkipLevel *current;
+                uint16_t d = 0;
+
+                c += strspn(c, WHITESPACE);
+                current = n_stack > 0 ? stack + n_stack - 1 : NULL;
+
+                if (current && IN_SET(current->expect, EXPECT_OBJECT_COLON, EXPECT_OBJECT_COMMA, EXPECT_ARRAY_COMMA)) {
+
+                        if (*c == ':' && current->expect == EXPECT_OBJECT_COLON) {
+                                current->expect = EXPECT_OBJECT_VALUE;
+                                c++;
+                                continue;
+                        }
+
+                        if (*c == ',' && current->expect != EXPECT_OBJECT_COLON) {
+                                current->expect = current->expect == EXPECT_OBJECT_COMMA ? EXPECT_OBJECT_NEXT_KEY : EXPECT_ARRAY_NEXT_ELEMENT;
+                                c++;
+                                continue;
+                        }
+
+                        if ((*c == '}' && current->expect == EXPECT_OBJECT_COMMA) ||
+                            (*c == ']' && current->expect == EXPECT_ARRAY_COMMA))
+                                goto close;
+
+                        return -EINVAL;
+                }
+
+                if (current && IN_SET(current->expect, EXPECT_OBJECT_FIRST_KEY, EXPECT_OBJECT_NEXT_KEY)) {
+
+                        if (*c == '}' && current->expect == EXPECT_OBJECT_FIRST_KEY)
+                                goto close;
+
+                        r = json_skip_string(&c);
+                        if (r < 0)
+                                return r;
+
+                        current->expect = EXPECT_OBJECT_COLON;
+                        continue;
+                }
+
+                if (current && *c == ']' && current->expect == EXPECT_ARRAY_FIRST_ELEMENT)
+                        goto close;
+
+                /* We expect a value now */
+
+                if (IN_SET(*c, '{', '[')) {
+                        if (n_stack > DEPTH_MAX) /* Refuse too deep nesting */
+                                return -ELNRNG;
+
+                        if (!GREEDY_REALLOC(stack, n_stack_allocated, n_stack + 1))
+                                return -ENOMEM;
+
+                        stack[n_stack++] = (JsonSkipLevel) {
+                                .expect = *c == '{' ? EXPECT_OBJECT_FIRST_KEY : EXPECT_ARRAY_FIRST_ELEMENT,
+                        };
+
+                        c++;
+                        continue;
+                }
+
+                if (*c == '"')
+                        r = json_skip_string(&c);
+                else if (*c != 0 && strchr("-0123456789", *c)) {
+                        JsonValue value;
+
+                        r = json_parse_number(&c, &value);
+                } else if (startswith(c, "true") || startswith(c, "null")) {
+                        c += 4;
+                        r = 0;
+                } else if (startswith(c, "false")) {
+                        c += 5;
+                        r = 0;
+                } else
+                        r = -EINVAL;
+                if (r < 0)
+                        return r;
+
+                goto element;
+
+        close:
+                /* Empty objects and arrays are turned into magic variants, which have a depth of 0 */
+                d = current->depth;
+                c++;
+                n_stack--;
+
+                if (n_stack == 0) {
+                        *p = c;
+                        *ret_depth = d;
+                        return 0;
+                }
+
+                current = stack + n_stack - 1;
+
+        element:
+                assert(current);
+
+                if (d >= DEPTH_MAX)
+                        return -ELNRNG;
+                current->depth = MAX(current->depth, (uint16_t) (d + 1));
+
+                current->expect = current->expect == EXPECT_OBJECT_VALUE ? EXPECT_OBJECT_COMMA : EXPECT_ARRAY_COMMA;
+        }
+}
+
 typedef struct JsonStack {
         JsonExpect expect;
         JsonVariant **elements;
@@ -2822,6 +3329,155 @@ static void json_stack_release(JsonStack *s) {
         s->elements = mfree(s->elements);
 }
 
+static int json_variant_new_lazy(JsonVariant **ret, JsonVariantType type, const char *text, size_t n, uint16_t depth) {
+        JsonVariant *v;
+        int r;
+
+        assert(ret);
+        assert(IN_SET(type, JSON_VARIANT_ARRAY, JSON_VARIANT_OBJECT));
+        assert(text);
+
+        r = json_variant_new(&v, type, n + 1);
+        if (r < 0)
+                return r;
+
+        memcpy(v->string, text, n);
+        v->string[n] = 0;
+        v->is_lazy = true;
+        v->depth = depth;
+
+        *ret = v;
+        return 0;
+}
+
+static int json_skip_container_validated(const char **p, uint16_t *ret_depth) {
+        _cleanup_free_ uint16_t *stack = NULL;
+        size_t n_stack = 0, n_stack_allocated = 0;
+        const char *c;
+
+        assert(p);
+        assert(*p);
+        assert(ret_depth);
+
+        /* Like json_skip_container(), but for text that is already known to be valid, i.e. when parsing the
+         * contents of a lazy variant. Only looks at brackets and strings, and is hence a lot quicker. */
+
+        c = *p;
+        assert(IN_SET(*c, '{', '['));
+
+        for (;;) {
+                c += strcspn(c, "\"[]{}");
+
+                switch (*c) {
+
+                case '"':
+                        for (c++;; c++) {
+                                c += strcspn(c, "\"\\");
+                                if (*c == '"')
+                                        break;
+
+                                assert(*c == '\\');
+                                c++;
+                        }
+
+                        c++;
+                        break;
+
+                case '[':
+                case '{': {
+                        size_t k;
+
+                        c++;
+
+                        /* Empty objects and arrays are turned into magic variants, which have a depth of 0, and
+                         * hence don't add to the depth of the surrounding variant */
+                        k = strspn(c, WHITESPACE);
+                        if (IN_SET(c[k], ']', '}')) {
+                                c += k + 1;
+
+                                if (n_stack == 0) {
+                                        *p = c;
+                                        *ret_depth = 0;
+                                        return 0;
+                                }
+
+                                break;
+                        }
+
+                        if (!GREEDY_REALLOC(stack, n_stack_allocated, n_stack + 1))
+                                return -ENOMEM;
+
+                        stack[n_stack++] = 1;
+                        break;
+                }
+
+                case ']':
+                case '}':
+                        assert(n_stack > 0);
+                        c++;
+
+                        n_stack--;
+                        if (n_stack == 0) {
+                                *p = c;
+                                *ret_depth = stack[0];
+                                return 0;
+                        }
+
+                        stack[n_stack - 1] = MAX(stack[n_stack - 1], (uint16_t) (stack[n_stack] + 1));
+                        break;
+
+                default:
+                        assert_not_reached("Unexpected end of validated JSON");
+                }
+        }
+}
+
+static int json_parse_lazy(
+                const char **p,
+                JsonVariantType type,
+                bool validated,
+                JsonVariant **ret,
+                const char **ret_end,
+                unsigned *line,
+                unsigned *column) {
+
+        const char *start, *e;
+        uint16_t depth;
+        int r;
+
+        assert(p);
+        assert(*p);
+        assert(ret);
+        assert(ret_end);
+
+        /* Returns > 0 and a lazy variant if the object or array at *p is large enough to be worth it, and 0 if
+         * it should be parsed right away. In the latter case *ret_end is set to the end of the container. */
+
+        /* The tokenizer already consumed the opening bracket */
+        start = e = *p - 1;
+
+        if (validated)
+                r = json_skip_container_validated(&e, &depth);
+        else
+                r = json_skip_container(&e, &depth);
+        if (r < 0)
+                return r;
+
+        if ((size_t) (e - start) < LAZY_SIZE_MIN) {
+                *ret_end = e;
+                return 0;
+        }
+
+        r = json_variant_new_lazy(ret, type, start, e - start, depth);
+        if (r < 0)
+                return r;
+
+        inc_lines_columns(line, column, *p, e - *p);
+        *p = e;
+
+        return 1;
+}
+
 static int json_parse_internal(
                 const char **input,
                 JsonSource *source,
@@ -2829,19 +3485,20 @@ static int json_parse_internal(
                 JsonVariant **ret,
                 unsigned *line,
                 unsigned *column,
-                bool continue_end) {
+                bool continue_end,
+                JsonVariant *lazy) {    /* if non-NULL, we are parsing the contents of this lazy variant */
 
         size_t n_stack = 1, n_stack_allocated = 0, i;
         unsigned line_buffer = 0, column_buffer = 0;
         void *tokenizer_state = NULL;
         JsonStack *stack = NULL;
-        const char *p;
+        const char *p, *eager_end;
         int r;
 
         assert_return(input, -EINVAL);
         assert_return(ret, -EINVAL);
 
-        p = *input;
+        p = eager_end = *input;
 
         if (!GREEDY_REALLOC(stack, n_stack_allocated, n_stack))
                 return -ENOMEM;
@@ -2855,6 +3512,13 @@ static int json_parse_internal(
         if (!column)
                 column = &column_buffer;
 
+        if (lazy && lazy->line > 0) {
+                /* Continue counting where the text of the lazy variant was found originally */
+                *line = lazy->line;
+                *column = lazy->column;
+                tokenizer_state = INT_TO_PTR(STATE_VALUE);
+        }
+
         for (;;) {
                 _cleanup_(json_variant_unrefp) JsonVariant *add = NULL;
                 _cleanup_free_ char *string = NULL;
@@ -2917,6 +3581,25 @@ static int json_parse_internal(
                                 goto finish;
                         }
 
+                        /* Anything nested in a container that was too small to be lazy is even smaller */
+                        if (FLAGS_SET(flags, JSON_PARSE_LAZY) && current->expect != EXPECT_TOPLEVEL && p >= eager_end) {
+                                r = json_parse_lazy(&p, JSON_VARIANT_OBJECT, !!lazy, &add, &eager_end, line, column);
+                                if (r < 0)
+                                        goto finish;
+                                if (r > 0) {
+                                        tokenizer_state = INT_TO_PTR(STATE_VALUE_POST);
+
+                                        if (current->expect == EXPECT_OBJECT_VALUE)
+                                                current->expect = EXPECT_OBJECT_COMMA;
+                                        else {
+                                                assert(IN_SET(current->expect, EXPECT_ARRAY_FIRST_ELEMENT, EXPECT_ARRAY_NEXT_ELEMENT));
+                                                current->expect = EXPECT_ARRAY_COMMA;
+                                        }
+
+                                        break;
+                                }
+                        }
+
                         if (!GREEDY_REALLOC(stack, n_stack_allocated, n_stack+1)) {
                                 r = -ENOMEM;
                                 goto finish;
@@ -2968,6 +3651,25 @@ static int json_parse_internal(
                                 goto finish;
                         }
 
+                        /* Anything nested in a container that was too small to be lazy is even smaller */
+                        if (FLAGS_SET(flags, JSON_PARSE_LAZY) && current->expect != EXPECT_TOPLEVEL && p >= eager_end) {
+                                r = json_parse_lazy(&p, JSON_VARIANT_ARRAY, !!lazy, &add, &eager_end, line, column);
+                                if (r < 0)
+                                        goto finish;
+                                if (r > 0) {
+                                        tokenizer_state = INT_TO_PTR(STATE_VALUE_POST);
+
+                                        if (current->expect == EXPECT_OBJECT_VALUE)
+                                                current->expect = EXPECT_OBJECT_COMMA;
+                                        else {
+                                                assert(IN_SET(current->expect, EXPECT_ARRAY_FIRST_ELEMENT, EXPECT_ARRAY_NEXT_ELEMENT));
+                                                current->expect = EXPECT_ARRAY_COMMA;
+                                        }
+
+                                        break;
+                                }
+                        }
+
                         if (!GREEDY_REALLOC(stack, n_stack_allocated, n_stack+1)) {
                                 r = -ENOMEM;
                                 goto finish;
@@ -3178,12 +3880,55 @@ finish:
         return r;
 }
 
+static int json_variant_materialize_lazy(JsonVariant *v) {
+        _cleanup_(json_variant_unrefp) JsonVariant *w = NULL;
+        const char *p;
+        int r;
+
+        assert(json_variant_is_regular(v));
+        assert(v->is_lazy);
+
+        /* Parses the text of a lazy object or array, and turns the variant into a reference to the result. Objects
+         * and arrays nested in it are left lazy in turn. The text was already validated when the variant was
+         * created, hence this can only fail on OOM. The accessors that call this have no way to return that,
+         * hence complain loudly: the caller sees an empty container or a missing key instead. Code that must
+         * tell the difference calls json_variant_materialize() first. */
+
+        p = v->string;
+        r = json_parse_internal(&p, v->source, JSON_PARSE_LAZY | (v->sensitive ? JSON_PARSE_SENSITIVE : 0),
+                                &w, NULL, NULL, false, v);
+        if (r < 0)
+                return log_error_errno(r, "Failed to parse lazily parsed JSON variant, treating it as empty: %m");
+
+        assert(json_variant_type(w) == v->type);
+
+        if (v->sensitive)
+                explicit_bzero_safe(v->string, strlen(v->string));
+
+        v->is_lazy = false;
+        v->is_reference = true;
+        v->reference = TAKE_PTR(w);
+
+        return 0;
+}
+
+int json_variant_materialize(JsonVariant *v) {
+        if (!json_variant_is_regular(v))
+                return 0;
+        if (v->is_reference)
+                return json_variant_materialize(v->reference);
+        if (!v->is_lazy)
+                return 0;
+
+        return json_variant_materialize_lazy(v);
+}
+
 int json_parse(const char *input, JsonParseFlags flags, JsonVariant **ret, unsigned *ret_line, unsigned *ret_column) {
-        return json_parse_internal(&input, NULL, flags, ret, ret_line, ret_column, false);
+        return json_parse_internal(&input, NULL, flags, ret, ret_line, ret_column, false, NULL);
 }
 
 int json_parse_continue(const char **p, JsonParseFlags flags, JsonVariant **ret, unsigned *ret_line, unsigned *ret_column) {
-        return json_parse_internal(p, NULL, flags, ret, ret_line, ret_column, true);
+        return json_parse_internal(p, NULL, flags, ret, ret_line, ret_column, true, NULL);
 }
 
 int json_parse_file_at(FILE *f, int dir_fd, const char *path, JsonParseFlags flags, JsonVariant **ret, unsigned *ret_line, unsigned *ret_column) {
@@ -3208,7 +3953,7 @@ int json_parse_file_at(FILE *f, int dir_fd, const char *path, JsonParseFlags fla
         }
 
         p = text;
-        return json_parse_internal(&p, source, flags, ret, ret_line, ret_column, false);
+        return json_parse_internal(&p, source, flags, ret, ret_line, ret_column, false, NULL);
 }
 
 int json_buildv(JsonVariant **ret, va_list ap) {
@@ -3884,6 +4629,11 @@ int json_dispatch(JsonVariant *v, const JsonDispatch table[], JsonDispatchCallba
 
         found = newa0(bool, m);
 
+        /* Don't mistake an object we failed to build lazily for an empty one */
+        r = json_variant_materialize(v);
+        if (r < 0)
+                return json_log(v, flags, r, "Failed to parse JSON object: %m");
+
         n = json_variant_elements(v);
         for (i = 0; i < n; i += 2) {
                 JsonVariant *key, *value;
@@ -4367,6 +5117,11 @@ bool json_variant_is_normalized(JsonVariant *v) {
         if (!json_variant_is_object(v) && !json_variant_is_array(v))
                 return true;
 
+        /* We don't know anything about the contents of lazy objects/arrays without parsing them, and we don't
+         * want to parse them just for this, hence be conservative */
+        if (json_variant_is_lazy(v))
+                return false;
+
         /* Empty objects/arrays don't include any other variant, hence are always normalized too */
         if (json_variant_elements(v) == 0)
                 return true;
@@ -4381,6 +5136,8 @@ bool json_variant_is_sorted(JsonVariant *v) {
 
         if (!json_variant_is_object(v))
                 return true;
+        if (json_variant_is_lazy(v))
+                return false;
         if (json_variant_elements(v) <= 1)
                 return true;
 
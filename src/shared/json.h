@@ -130,6 +130,10 @@ bool json_variant_is_blank_array(JsonVariant *v);
 bool json_variant_is_normalized(JsonVariant *v);
 bool json_variant_is_sorted(JsonVariant *v);
 
+/* Builds an object or array that was parsed with JSON_PARSE_LAZY, so that errors can be told apart from an
+ * empty one. The accessors below do the same on first access, but can't report failure. */
+int json_variant_materialize(JsonVariant *v);
+
 size_t json_variant_elements(JsonVariant *v);
 JsonVariant *json_variant_by_index(JsonVariant *v, size_t index);
 JsonVariant *json_variant_by_key(JsonVariant *v, const char *key);
@@ -199,6 +203,7 @@ int json_variant_normalize(JsonVariant **v);
 
 typedef enum JsonParseFlags {
         JSON_PARSE_SENSITIVE = 1 << 0, /* mark variant as "sensitive", i.e. something containing secret key material or such */
+        JSON_PARSE_LAZY      = 1 << 1, /* only validate larger nested objects/arrays, and build them on first access */
 } JsonParseFlags;
 
 int json_parse(const char *string, JsonParseFlags flags, JsonVariant **ret, unsigned *ret_line, unsigned *ret_column);
@@ -4,10 +4,12 @@
 
 #include "dirent-util.h"
 #include "fd-util.h"
+#include "fileio.h"
 #include "fs-util.h"
 #include "macro.h"
 #include "path-lookup.h"
 #include "set.h"
+#include "siphash24.h"
 #include "special.h"
 #include "stat-util.h"
 #include "string-util.h"
@@ -556,6 +558,276 @@ int unit_file_find_fragment(
         return 0;
 }
 
+typedef enum UnitFileStampKind {
+        UNIT_FILE_STAMP_UNIT,       /* A unit file or alias symlink directly in a search path directory */
+        UNIT_FILE_STAMP_DROPIN,     /* Anything in a .d/ directory */
+        UNIT_FILE_STAMP_DEPENDENCY, /* Anything in a .wants/ or .requires/ directory */
+} UnitFileStampKind;
+
+typedef struct UnitFileStamp {
+        char *path;
+        UnitFileStampKind kind;
+        mode_t type;         /* The file type of the path itself, i.e. S_IFLNK for symlinks */
+        char *target;        /* The symlink target, if this is a symlink */
+
+        /* The following fields refer to what the path points to, after following symlinks */
+        bool generated;
+        dev_t dev;
+        ino_t ino;
+        uint64_t size;
+        nsec_t mtime;
+        nsec_t ctime;
+        uint64_t hash;       /* For generated files only, see below */
+} UnitFileStamp;
+
+static UnitFileStamp* unit_file_stamp_free(UnitFileStamp *s) {
+        if (!s)
+                return NULL;
+
+        free(s->path);
+        free(s->target);
+        return mfree(s);
+}
+
+DEFINE_TRIVIAL_CLEANUP_FUNC(UnitFileStamp*, unit_file_stamp_free);
+
+DEFINE_PRIVATE_HASH_OPS_WITH_VALUE_DESTRUCTOR(unit_file_stamp_hash_ops, char, path_hash_func, path_compare,
+                                              UnitFileStamp, unit_file_stamp_free);
+
+static int unit_file_stamp_add(Hashmap *h, const char *path, UnitFileStampKind kind, bool generated) {
+        _cleanup_(unit_file_stamp_freep) UnitFileStamp *s = NULL;
+        struct stat st;
+        int r;
+
+        assert(h);
+        assert(path);
+
+        if (lstat(path, &st) < 0) {
+                if (errno == ENOENT) /* Removed while we were looking */
+                        return 0;
+
+                return log_debug_errno(errno, "Failed to stat \"%s\": %m", path);
+        }
+
+        s = new(UnitFileStamp, 1);
+        if (!s)
+                return -ENOMEM;
+
+        *s = (UnitFileStamp) {
+                .kind = kind,
+                .type = st.st_mode & S_IFMT,
+                .generated = generated,
+        };
+
+        s->path = strdup(path);
+        if (!s->path)
+                return -ENOMEM;
+
+        if (S_ISLNK(st.st_mode)) {
+                r = readlink_malloc(path, &s->target);
+                if (r < 0)
+                        return log_debug_errno(r, "Failed to read symlink \"%s\": %m", path);
+
+                /* Dangling symlinks are fine, they are compared by their target only */
+                if (stat(path, &st) < 0)
+                        goto finish;
+        }
+
+        if (generated) {
+                /* Generator output is flushed and recreated on each reload, hence inode and timestamps always
+                 * differ. Compare the contents instead, generated files are small and were only just written. */
+                if (S_ISREG(st.st_mode)) {
+                        _cleanup_free_ char *contents = NULL;
+                        size_t size;
+
+                        r = read_full_file(path, &contents, &size);
+                        if (r < 0)
+                                return log_debug_errno(r, "Failed to read \"%s\": %m", path);
+
+                        s->size = size;
+                        s->hash = siphash24(contents, size, HASH_KEY.bytes);
+                }
+        } else {
+                s->dev = st.st_dev;
+                s->ino = st.st_ino;
+                s->size = st.st_size;
+                s->mtime = timespec_load_nsec(&st.st_mtim);
+                s->ctime = timespec_load_nsec(&st.st_ctim);
+        }
+
+finish:
+        r = hashmap_put(h, s->path, s);
+        if (r == -EEXIST) /* Seen through two different search path entries */
+                return 0;
+        if (r < 0)
+                return r;
+
+        TAKE_PTR(s);
+        return 0;
+}
+
+static bool unit_file_stamp_equal(const UnitFileStamp *a, const UnitFileStamp *b) {
+        assert(a);
+        assert(b);
+
+        return a->type == b->type &&
+                streq_ptr(a->target, b->target) &&
+                a->generated == b->generated &&
+                a->dev == b->dev &&
+                a->ino == b->ino &&
+                a->size == b->size &&
+                a->mtime == b->mtime &&
+                a->ctime == b->ctime &&
+                a->hash == b->hash;
+}
+
+int unit_file_snapshot_take(const LookupPaths *lp, Hashmap **ret) {
+        _cleanup_hashmap_free_ Hashmap *h = NULL;
+        char **dir;
+        int r;
+
+        /* Records the identity of every unit file, drop-in and dependency symlink in the search path, so that
+         * unit_file_snapshot_diff() can later tell which of them changed. Transient units are not covered:
+         * their files are written by the manager itself from the in-memory state. */
+
+        assert(lp);
+        assert(ret);
+
+        h = hashmap_new(&unit_file_stamp_hash_ops);
+        if (!h)
+                return -ENOMEM;
+
+        STRV_FOREACH(dir, (char**) lp->search_path) {
+                _cleanup_closedir_ DIR *d = NULL;
+                struct dirent *de;
+                bool generated;
+
+                if (streq_ptr(*dir, lp->transient))
+                        continue;
+
+                generated = streq_ptr(*dir, lp->generator) ||
+                            streq_ptr(*dir, lp->generator_early) ||
+                            streq_ptr(*dir, lp->generator_late);
+
+                d = opendir(*dir);
+                if (!d) {
+                        if (errno == ENOENT)
+                                continue;
+
+                        return log_debug_errno(errno, "Failed to open \"%s\": %m", *dir);
+                }
+
+                FOREACH_DIRENT_ALL(de, d, return log_debug_errno(errno, "Failed to read \"%s\": %m", *dir)) {
+                        _cleanup_closedir_ DIR *sub = NULL;
+                        _cleanup_free_ char *p = NULL;
+                        UnitFileStampKind kind;
+                        struct dirent *sde;
+
+                        if (unit_name_is_valid(de->d_name, UNIT_NAME_ANY))
+                                kind = UNIT_FILE_STAMP_UNIT;
+                        else if (endswith(de->d_name, ".d"))
+                                kind = UNIT_FILE_STAMP_DROPIN;
+                        else if (ENDSWITH_SET(de->d_name, ".wants", ".requires"))
+                                kind = UNIT_FILE_STAMP_DEPENDENCY;
+                        else
+                                continue;
+
+                        p = path_join(*dir, de->d_name);
+                        if (!p)
+                                return -ENOMEM;
+
+                        if (kind == UNIT_FILE_STAMP_UNIT) {
+                                r = unit_file_stamp_add(h, p, kind, generated);
+                                if (r < 0)
+                                        return r;
+
+                                continue;
+                        }
+
+                        sub = opendir(p);
+                        if (!sub) {
+                                if (IN_SET(errno, ENOENT, ENOTDIR))
+                                        continue;
+
+                                return log_debug_errno(errno, "Failed to open \"%s\": %m", p);
+                        }
+
+                        FOREACH_DIRENT(sde, sub, return log_debug_errno(errno, "Failed to read \"%s\": %m", p)) {
+                                _cleanup_free_ char *q = NULL;
+
+                                q = path_join(p, sde->d_name);
+                                if (!q)
+                                        return -ENOMEM;
+
+                                r = unit_file_stamp_add(h, q, kind, generated);
+                                if (r < 0)
+                                        return r;
+                        }
+                }
+        }
+
+        *ret = TAKE_PTR(h);
+        return 0;
+}
+
+int unit_file_snapshot_diff(Hashmap *old, Hashmap *new, Set **ret_changed, bool *ret_dropins_changed) {
+        _cleanup_set_free_ Set *changed = NULL;
+        bool dropins_changed = false;
+        UnitFileStamp *a, *b;
+        int r;
+
+        /* Compares two snapshots taken by unit_file_snapshot_take(). Returns > 0 if unit files or aliases were
+         * added or removed, or any dependency symlink changed, i.e. if the set of units or the dependencies
+         * between them may have changed. Otherwise returns 0, and the set of paths of unit files and drop-ins
+         * whose contents changed. ret_dropins_changed is set if drop-ins were added or removed. */
+
+        assert(ret_changed);
+        assert(ret_dropins_changed);
+
+        HASHMAP_FOREACH(b, new) {
+                a = hashmap_get(old, b->path);
+                if (a && unit_file_stamp_equal(a, b))
+                        continue;
+
+                if (b->kind == UNIT_FILE_STAMP_DEPENDENCY)
+                        goto structural;
+
+                if (b->kind == UNIT_FILE_STAMP_UNIT &&
+                    (!a || a->type != b->type || !streq_ptr(a->target, b->target)))
+                        goto structural;
+
+                if (!a)
+                        dropins_changed = true;
+
+                r = set_put_strdup_full(&changed, &path_hash_ops_free, b->path);
+                if (r < 0)
+                        return r;
+        }
+
+        HASHMAP_FOREACH(a, old) {
+                if (hashmap_contains(new, a->path))
+                        continue;
+
+                if (a->kind != UNIT_FILE_STAMP_DROPIN)
+                        goto structural;
+
+                dropins_changed = true;
+
+                r = set_put_strdup_full(&changed, &path_hash_ops_free, a->path);
+                if (r < 0)
+                        return r;
+        }
+
+        *ret_changed = TAKE_PTR(changed);
+        *ret_dropins_changed = dropins_changed;
+        return 0;
+
+structural:
+        *ret_changed = NULL;
+        *ret_dropins_changed = false;
+        return 1;
+}
+
 static const char * const rlmap[] = {
         "emergency", SPECIAL_EMERGENCY_TARGET,
         "-b",        SPECIAL_EMERGENCY_TARGET,
@@ -58,4 +58,7 @@ int unit_file_find_fragment(
                 const char **ret_fragment_path,
                 Set **ret_names);
 
+int unit_file_snapshot_take(const LookupPaths *lp, Hashmap **ret);
+int unit_file_snapshot_diff(Hashmap *old, Hashmap *new, Set **ret_changed, bool *ret_dropins_changed);
+
 const char* runlevel_to_target(const char *rl);
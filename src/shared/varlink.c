@@ -1,14 +1,18 @@
 /* SPDX-License-Identifier: LGPL-2.1-or-later */
 
+#include <pthread.h>
+#include <sys/eventfd.h>
 #include <sys/poll.h>
 
 #include "alloc-util.h"
 #include "errno-util.h"
+#include "event-group.h"
 #include "fd-util.h"
 #include "hashmap.h"
 #include "io-util.h"
 #include "list.h"
 #include "process-util.h"
+#include "pthread-util.h"
 #include "selinux-util.h"
 #include "set.h"
 #include "socket-util.h"
@@ -22,6 +26,8 @@
 
 #define VARLINK_DEFAULT_CONNECTIONS_MAX 4096U
 #define VARLINK_DEFAULT_CONNECTIONS_PER_UID_MAX 1024U
+#define VARLINK_DEFAULT_WORKERS_MAX 4U
+#define VARLINK_CALLS_PER_CONNECTION_MAX 64U
 
 #define VARLINK_DEFAULT_TIMEOUT_USEC (45U*USEC_PER_SEC)
 #define VARLINK_BUFFER_MAX (16U*1024U*1024U)
@@ -57,6 +63,17 @@ typedef enum VarlinkState {
         _VARLINK_STATE_INVALID = -1
 } VarlinkState;
 
+typedef struct VarlinkReplySlot VarlinkReplySlot;
+
+/* One for each method call enqueued with varlink_invoke_full(), in the order they were enqueued. The server
+ * replies in the same order, hence that's all we need to route each reply to the right callback. */
+struct VarlinkReplySlot {
+        VarlinkReply callback;
+        void *userdata;
+
+        LIST_FIELDS(VarlinkReplySlot, slots);
+};
+
 /* Tests whether we are not yet disconnected. Note that this is true during all states where the connection
  * is still good for something, and false only when it's dead for good. This means: when we are
  * asynchronously connecting to a peer and the connect() is still pending, then this will return 'true', as
@@ -82,6 +99,14 @@ struct Varlink {
 
         VarlinkServer *server;
 
+        /* With VARLINK_SERVER_PIPELINE, every method call is dispatched on a call object of its own, that
+         * points to the connection it was received on. The connection keeps the calls that haven't been
+         * fully answered yet, in the order they were received, as that's the order the replies go out in. */
+        Varlink *connection;
+        LIST_HEAD(Varlink, calls);
+        unsigned n_calls;
+        LIST_FIELDS(Varlink, calls);
+
         VarlinkState state;
         bool connecting; /* This boolean indicates whether the socket fd we are operating on is currently
                           * processing an asynchronous connect(). In that state we watch the socket for
@@ -125,6 +150,9 @@ struct Varlink {
 
         VarlinkReply reply_callback;
 
+        LIST_HEAD(VarlinkReplySlot, reply_slots);
+        VarlinkReplySlot *reply_slots_tail;
+
         JsonVariant *current;
         JsonVariant *reply;
 
@@ -162,6 +190,31 @@ struct VarlinkServerSocket {
         LIST_FIELDS(VarlinkServerSocket, sockets);
 };
 
+typedef struct VarlinkWork VarlinkWork;
+
+/* A method call that is executed on one of the server's worker threads. Everything but the results is only
+ * accessed from the event loop thread. */
+struct VarlinkWork {
+        VarlinkServer *server;
+        Varlink *link;
+
+        VarlinkWorkerMethod callback;
+        void *userdata;
+        VarlinkMethodFlags flags;
+        char *method;
+
+        /* JsonVariant objects are not thread-safe, hence pass the parameters on in serialized form */
+        char *parameters;
+
+        /* Filled in by the worker thread, and then handed back to the event loop thread via the server's done list */
+        JsonVariant *reply;
+        const char *error_id;
+        int result;
+
+        LIST_FIELDS(VarlinkWork, works);
+        LIST_FIELDS(VarlinkWork, done);
+};
+
 struct VarlinkServer {
         unsigned n_ref;
         VarlinkServerFlags flags;
@@ -169,6 +222,7 @@ struct VarlinkServer {
         LIST_HEAD(VarlinkServerSocket, sockets);
 
         Hashmap *methods;
+        Hashmap *worker_methods;
         VarlinkConnect connect_callback;
         VarlinkDisconnect disconnect_callback;
 
@@ -183,6 +237,17 @@ struct VarlinkServer {
 
         unsigned connections_max;
         unsigned connections_per_uid_max;
+
+        /* The worker thread pool, created on first use */
+        unsigned workers_max;
+        EventGroup *workers;
+        int workers_fd;
+        sd_event_source *workers_event_source;
+        LIST_HEAD(VarlinkWork, works);
+
+        /* Protects the list of finished work items, which the worker threads append to */
+        pthread_mutex_t workers_mutex;
+        LIST_HEAD(VarlinkWork, works_done);
 };
 
 static const char* const varlink_state_table[_VARLINK_STATE_MAX] = {
@@ -270,6 +335,60 @@ static int varlink_new(Varlink **ret) {
         return 0;
 }
 
+static int varlink_acquire_ucred(Varlink *v) {
+        int r;
+
+        assert(v);
+
+        if (v->ucred_acquired)
+                return 0;
+
+        r = getpeercred(v->fd, &v->ucred);
+        if (r < 0)
+                return r;
+
+        v->ucred_acquired = true;
+        return 0;
+}
+
+static int varlink_new_call(Varlink *v, Varlink **ret) {
+        _cleanup_(varlink_unrefp) Varlink *call = NULL;
+        int r;
+
+        assert(v);
+        assert(v->current);
+        assert(ret);
+
+        r = varlink_new(&call);
+        if (r < 0)
+                return r;
+
+        /* The call has no socket of its own to query the peer from */
+        if (varlink_acquire_ucred(v) >= 0) {
+                call->ucred = v->ucred;
+                call->ucred_acquired = true;
+        }
+
+        if (v->description) {
+                call->description = strdup(v->description);
+                if (!call->description)
+                        return -ENOMEM;
+        }
+
+        call->userdata = v->userdata;
+        call->event = sd_event_ref(v->event);
+        call->current = json_variant_ref(v->current);
+
+        /* The connection's list of calls holds a reference, the call doesn't hold one on the connection */
+        call->connection = v;
+        LIST_APPEND(calls, v->calls, call);
+        varlink_ref(call);
+        v->n_calls++;
+
+        *ret = TAKE_PTR(call);
+        return 0;
+}
+
 int varlink_connect_address(Varlink **ret, const char *address) {
         _cleanup_(varlink_unrefp) Varlink *v = NULL;
         union sockaddr_union sockaddr;
@@ -353,9 +472,24 @@ static void varlink_detach_event_sources(Varlink *v) {
         v->defer_event_source = sd_event_source_disable_unref(v->defer_event_source);
 }
 
+static void varlink_clear_reply_slots(Varlink *v) {
+        VarlinkReplySlot *slot;
+
+        assert(v);
+
+        while ((slot = v->reply_slots)) {
+                LIST_REMOVE(slots, v->reply_slots, slot);
+                free(slot);
+        }
+
+        v->reply_slots_tail = NULL;
+}
+
 static void varlink_clear(Varlink *v) {
         assert(v);
 
+        varlink_clear_reply_slots(v);
+
         varlink_detach_event_sources(v);
 
         v->fd = safe_close(v->fd);
@@ -374,8 +508,11 @@ static Varlink* varlink_destroy(Varlink *v) {
                 return NULL;
 
         /* If this is called the server object must already been unreffed here. Why that? because when we
-         * linked up the varlink connection with the server object we took one ref in each direction */
+         * linked up the varlink connection with the server object we took one ref in each direction. The
+         * same goes for pipelined calls and their connection. */
         assert(!v->server);
+        assert(!v->connection);
+        assert(!v->calls);
 
         varlink_clear(v);
 
@@ -408,8 +545,9 @@ static int varlink_test_disconnect(Varlink *v) {
         if (v->read_disconnected && v->write_disconnected)
                 goto disconnect;
 
-        /* If we are waiting for incoming data but the read side is shut down, disconnect. */
-        if (IN_SET(v->state, VARLINK_AWAITING_REPLY, VARLINK_AWAITING_REPLY_MORE, VARLINK_CALLING, VARLINK_IDLE_SERVER) && v->read_disconnected)
+        /* If we are waiting for incoming data but the read side is shut down, disconnect. Unless pipelined
+         * calls still need to be answered, see below. */
+        if (IN_SET(v->state, VARLINK_AWAITING_REPLY, VARLINK_AWAITING_REPLY_MORE, VARLINK_CALLING, VARLINK_IDLE_SERVER) && v->read_disconnected && !v->calls)
                 goto disconnect;
 
         /* Similar, if are a client that hasn't written anything yet but the write side is dead, also
@@ -418,9 +556,11 @@ static int varlink_test_disconnect(Varlink *v) {
         if (IN_SET(v->state, VARLINK_IDLE_CLIENT) && (v->write_disconnected || v->got_pollhup))
                 goto disconnect;
 
-        /* The server is still expecting to write more, but its write end is disconnected and it got a POLLHUP
-         * (i.e. from a disconnected client), so disconnect. */
-        if (IN_SET(v->state, VARLINK_PENDING_METHOD, VARLINK_PENDING_METHOD_MORE) && v->write_disconnected && v->got_pollhup)
+        /* The server is still expecting to write more, but its write end is disconnected or it got a POLLHUP
+         * (i.e. from a disconnected client), so disconnect. Note that we have nothing queued for writing at
+         * this point, hence we wouldn't notice the write side being down before the next reply, and would
+         * keep waking up for POLLHUP until then. */
+        if ((IN_SET(v->state, VARLINK_PENDING_METHOD, VARLINK_PENDING_METHOD_MORE) || v->calls) && (v->write_disconnected || v->got_pollhup))
                 goto disconnect;
 
         return 0;
@@ -589,7 +729,7 @@ static int varlink_parse_message(Varlink *v) {
                                                             * This may produce a non-printable journal entry if the message
                                                             * is invalid. We may also expose privileged information. */
 
-        r = json_parse(begin, 0, &v->current, NULL, NULL);
+        r = json_parse(begin, JSON_PARSE_LAZY, &v->current, NULL, NULL);
         if (r < 0) {
                 /* If we encounter a parse failure flush all data. We cannot possibly recover from this,
                  * hence drop all buffered data now. */
@@ -625,11 +765,29 @@ static int varlink_test_timeout(Varlink *v) {
 }
 
 static int varlink_dispatch_local_error(Varlink *v, const char *error) {
+        VarlinkReplySlot *slot;
         int r;
 
         assert(v);
         assert(error);
 
+        /* Calls with their own reply callback learn about the failure individually… */
+        while ((slot = v->reply_slots)) {
+                _cleanup_free_ VarlinkReplySlot *s = slot;
+
+                LIST_REMOVE(slots, v->reply_slots, slot);
+                if (!v->reply_slots)
+                        v->reply_slots_tail = NULL;
+
+                if (!s->callback)
+                        continue;
+
+                r = s->callback(v, NULL, error, VARLINK_REPLY_ERROR|VARLINK_REPLY_LOCAL, s->userdata);
+                if (r < 0)
+                        log_debug_errno(r, "Reply callback returned error, ignoring: %m");
+        }
+
+        /* …and the connection-wide one once, as before */
         if (!v->reply_callback)
                 return 0;
 
@@ -675,7 +833,9 @@ static int varlink_sanitize_parameters(JsonVariant **v) {
         else if (!json_variant_is_object(*v))
                 return -EINVAL;
 
-        return 0;
+        /* Messages are parsed lazily, build the parameters now so that running out of memory is noticed
+         * here, rather than the method or reply callback seeing no parameters */
+        return json_variant_materialize(*v);
 }
 
 static int varlink_dispatch_reply(Varlink *v) {
@@ -739,14 +899,34 @@ static int varlink_dispatch_reply(Varlink *v) {
                 goto invalid;
 
         r = varlink_sanitize_parameters(&parameters);
+        if (r == -ENOMEM)
+                goto fail;
         if (r < 0)
                 goto invalid;
 
         if (IN_SET(v->state, VARLINK_AWAITING_REPLY, VARLINK_AWAITING_REPLY_MORE)) {
+                _cleanup_free_ VarlinkReplySlot *slot = NULL;
+                VarlinkReply callback = v->reply_callback;
+                void *userdata = v->userdata;
+
+                /* Replies to varlink_invoke_full() calls are routed to the callback passed there. Take the
+                 * slot off the queue before calling it, in case the callback closes the connection. */
+                if (v->state == VARLINK_AWAITING_REPLY && v->reply_slots) {
+                        slot = v->reply_slots;
+                        LIST_REMOVE(slots, v->reply_slots, slot);
+                        if (!v->reply_slots)
+                                v->reply_slots_tail = NULL;
+
+                        if (slot->callback) {
+                                callback = slot->callback;
+                                userdata = slot->userdata;
+                        }
+                }
+
                 varlink_set_state(v, VARLINK_PROCESSING_REPLY);
 
-                if (v->reply_callback) {
-                        r = v->reply_callback(v, parameters, error, flags, v->userdata);
+                if (callback) {
+                        r = callback(v, parameters, error, flags, userdata);
                         if (r < 0)
                                 log_debug_errno(r, "Reply callback returned error, ignoring: %m");
                 }
@@ -772,19 +952,329 @@ static int varlink_dispatch_reply(Varlink *v) {
         return 1;
 
 invalid:
+        r = 1;
+
+fail:
         varlink_set_state(v, VARLINK_PROCESSING_FAILURE);
         varlink_dispatch_local_error(v, VARLINK_ERROR_PROTOCOL);
         varlink_close(v);
 
-        return 1;
+        return r;
+}
+
+static int varlink_enqueue_output(Varlink *v, char **text, size_t size) {
+        assert(v);
+        assert(text);
+        assert(*text);
+
+        /* Appends the specified data to the output buffer, taking possession of it if that's empty */
+
+        if (v->output_buffer_size + size > VARLINK_BUFFER_MAX)
+                return -ENOBUFS;
+
+        if (v->output_buffer_size == 0) {
+
+                free_and_replace(v->output_buffer, *text);
+
+                v->output_buffer_size = v->output_buffer_allocated = size;
+                v->output_buffer_index = 0;
+
+        } else if (v->output_buffer_index == 0) {
+
+                if (!GREEDY_REALLOC(v->output_buffer, v->output_buffer_allocated, v->output_buffer_size + size))
+                        return -ENOMEM;
+
+                memcpy(v->output_buffer + v->output_buffer_size, *text, size);
+                v->output_buffer_size += size;
+
+        } else {
+                char *n;
+                const size_t new_size = v->output_buffer_size + size;
+
+                n = new(char, new_size);
+                if (!n)
+                        return -ENOMEM;
+
+                memcpy(mempcpy(n, v->output_buffer + v->output_buffer_index, v->output_buffer_size), *text, size);
+
+                free_and_replace(v->output_buffer, n);
+                v->output_buffer_allocated = v->output_buffer_size = new_size;
+                v->output_buffer_index = 0;
+        }
+
+        return 0;
+}
+
+static int varlink_dispatch_calls(Varlink *v) {
+        Varlink *call;
+        int r, ret = 0;
+
+        assert(v);
+
+        /* Passes the output of pipelined calls on to the connection, in the order the calls were received:
+         * all of the first one's, and once that's fully answered, the next one's, and so on. */
+
+        while ((call = v->calls)) {
+                if (call->output_buffer_size > 0) {
+                        assert(call->output_buffer_index == 0);
+
+                        r = varlink_enqueue_output(v, &call->output_buffer, call->output_buffer_size);
+                        if (r < 0)
+                                return r;
+
+                        call->output_buffer = mfree(call->output_buffer);
+                        call->output_buffer_size = call->output_buffer_allocated = 0;
+                }
+
+                if (call->state != VARLINK_IDLE_SERVER)
+                        break;
+
+                LIST_REMOVE(calls, v->calls, call);
+                v->n_calls--;
+                call->connection = NULL;
+                varlink_unref(call);
+
+                ret = 1;
+        }
+
+        /* There's room for more calls now, make sure we get to the next one, in case it was held back */
+        if (ret > 0 && v->defer_event_source) {
+                r = sd_event_source_set_enabled(v->defer_event_source, SD_EVENT_ON);
+                if (r < 0)
+                        return r;
+        }
+
+        return ret;
+}
+
+static void varlink_call_answered(Varlink *v) {
+        Varlink *connection;
+        int r;
+
+        assert(v);
+
+        /* Invoked whenever a pipelined call was answered outside of varlink_dispatch_method(), to get the
+         * reply going */
+
+        connection = v->connection;
+        if (!connection)
+                return;
+
+        r = varlink_dispatch_calls(connection);
+        if (r >= 0)
+                return;
+
+        varlink_log_errno(connection, r, "Failed to pass on reply to pipelined call, disconnecting: %m");
+        varlink_set_state(connection, VARLINK_PENDING_DISCONNECT);
+        if (connection->defer_event_source)
+                (void) sd_event_source_set_enabled(connection->defer_event_source, SD_EVENT_ON);
+}
+
+static VarlinkWork* varlink_work_free(VarlinkWork *w) {
+        if (!w)
+                return NULL;
+
+        varlink_unref(w->link);
+        json_variant_unref(w->reply);
+        free(w->method);
+        free(w->parameters);
+
+        return mfree(w);
+}
+
+DEFINE_TRIVIAL_CLEANUP_FUNC(VarlinkWork*, varlink_work_free);
+
+static void varlink_work_run(VarlinkWork *w) {
+        _cleanup_(json_variant_unrefp) JsonVariant *parameters = NULL;
+        int r;
+
+        assert(w);
+
+        r = json_parse(w->parameters, 0, &parameters, NULL, NULL);
+        if (r >= 0)
+                r = w->callback(parameters, w->flags, &w->reply, &w->error_id, w->userdata);
+
+        w->result = r;
+}
+
+static int varlink_work_complete(VarlinkWork *w) {
+        Varlink *v;
+
+        assert(w);
+
+        v = w->link;
+
+        /* Nobody is waiting for the result of a oneway call, and if the connection went away in the meantime
+         * there's nobody to reply to either. */
+        if (FLAGS_SET(w->flags, VARLINK_METHOD_ONEWAY))
+                return 0;
+        if (!IN_SET(v->state, VARLINK_PROCESSING_METHOD, VARLINK_PROCESSING_METHOD_MORE,
+                              VARLINK_PENDING_METHOD, VARLINK_PENDING_METHOD_MORE))
+                return 0;
+
+        if (w->result < 0) {
+                log_debug_errno(w->result, "Worker callback for %s returned error: %m", w->method);
+                return varlink_error_errno(v, w->result);
+        }
+
+        if (w->error_id)
+                return varlink_error(v, w->error_id, w->reply);
+
+        return varlink_reply(v, w->reply);
+}
+
+static int varlink_server_worker_handler(sd_event *e, void *userdata) {
+        _cleanup_(pthread_mutex_unlock_assertp) pthread_mutex_t *_l = NULL;
+        static const uint64_t one = 1;
+        VarlinkWork *w = userdata;
+        VarlinkServer *s;
+
+        assert(w);
+
+        /* Runs on one of the worker threads */
+
+        s = w->server;
+        varlink_work_run(w);
+
+        _l = pthread_mutex_lock_assert(&s->workers_mutex);
+        LIST_PREPEND(done, s->works_done, w);
+
+        (void) write(s->workers_fd, &one, sizeof(one));
+        return 0;
+}
+
+static int varlink_server_workers_callback(sd_event_source *source, int fd, uint32_t revents, void *userdata) {
+        LIST_HEAD(VarlinkWork, done);
+        VarlinkServer *s = userdata;
+        VarlinkWork *w;
+        int r;
+
+        assert(s);
+
+        (void) flush_fd(fd);
+
+        assert_se(pthread_mutex_lock(&s->workers_mutex) == 0);
+        done = TAKE_PTR(s->works_done);
+        assert_se(pthread_mutex_unlock(&s->workers_mutex) == 0);
+
+        while ((w = done)) {
+                LIST_REMOVE(done, done, w);
+                LIST_REMOVE(works, s->works, w);
+
+                r = varlink_work_complete(w);
+                if (r < 0)
+                        varlink_log_errno(w->link, r, "Failed to send reply for %s, ignoring: %m", w->method);
+
+                varlink_work_free(w);
+        }
+
+        return 0;
+}
+
+static int varlink_server_workers_attach_event(VarlinkServer *s) {
+        int r;
+
+        assert(s);
+        assert(s->event);
+        assert(s->workers_fd >= 0);
+
+        if (s->workers_event_source)
+                return 0;
+
+        r = sd_event_add_io(s->event, &s->workers_event_source, s->workers_fd, EPOLLIN, varlink_server_workers_callback, s);
+        if (r < 0)
+                return r;
+
+        r = sd_event_source_set_priority(s->workers_event_source, s->event_priority);
+        if (r < 0) {
+                s->workers_event_source = sd_event_source_unref(s->workers_event_source);
+                return r;
+        }
+
+        (void) sd_event_source_set_description(s->workers_event_source, "varlink-server-workers");
+        return 0;
+}
+
+static int varlink_server_start_workers(VarlinkServer *s) {
+        int r;
+
+        assert(s);
+
+        if (s->workers)
+                return 0;
+
+        /* Results are marshalled back onto the server's event loop, hence we need one */
+        if (!s->event)
+                return -ENOMEDIUM;
+
+        if (s->workers_fd < 0) {
+                s->workers_fd = eventfd(0, EFD_CLOEXEC|EFD_NONBLOCK);
+                if (s->workers_fd < 0)
+                        return -errno;
+        }
+
+        r = varlink_server_workers_attach_event(s);
+        if (r < 0)
+                return r;
+
+        return event_group_new(&s->workers, s->workers_max, 0);
+}
+
+static int varlink_server_queue_work(VarlinkServer *s, Varlink *v, const char *method, VarlinkWorkerMethod callback, JsonVariant *parameters, VarlinkMethodFlags flags) {
+        _cleanup_(varlink_work_freep) VarlinkWork *w = NULL;
+        int r;
+
+        assert(s);
+        assert(v);
+        assert(method);
+        assert(callback);
+
+        w = new(VarlinkWork, 1);
+        if (!w)
+                return -ENOMEM;
+
+        *w = (VarlinkWork) {
+                .server = s,
+                .link = varlink_ref(v),
+                .callback = callback,
+                .userdata = v->userdata,
+                .flags = flags,
+        };
+
+        w->method = strdup(method);
+        if (!w->method)
+                return -ENOMEM;
+
+        r = json_variant_format(parameters, 0, &w->parameters);
+        if (r < 0)
+                return r;
+
+        r = varlink_server_start_workers(s);
+        if (r < 0) {
+                /* No event loop or no threads available: run the method right here, synchronously */
+                varlink_log_errno(v, r, "Failed to start worker threads, running %s synchronously: %m", method);
+
+                varlink_work_run(w);
+                return varlink_work_complete(w);
+        }
+
+        r = event_group_post(s->workers, varlink_server_worker_handler, w);
+        if (r < 0)
+                return r;
+
+        LIST_PREPEND(works, s->works, TAKE_PTR(w));
+        return 0;
 }
 
 static int varlink_dispatch_method(Varlink *v) {
         _cleanup_(json_variant_unrefp) JsonVariant *parameters = NULL;
+        _cleanup_(varlink_unrefp) Varlink *pipelined = NULL;
         VarlinkMethodFlags flags = 0;
         const char *method = NULL, *error;
         JsonVariant *e;
+        VarlinkWorkerMethod worker_callback = NULL;
         VarlinkMethod callback;
+        Varlink *call;
         const char *k;
         int r;
 
@@ -794,6 +1284,8 @@ static int varlink_dispatch_method(Varlink *v) {
                 return 0;
         if (!v->current)
                 return 0;
+        if (v->n_calls >= VARLINK_CALLS_PER_CONNECTION_MAX) /* Wait until earlier calls are answered */
+                return 0;
 
         if (!json_variant_is_object(v->current))
                 goto invalid;
@@ -849,12 +1341,23 @@ static int varlink_dispatch_method(Varlink *v) {
         if (r < 0)
                 goto fail;
 
-        varlink_set_state(v, (flags & VARLINK_METHOD_MORE)   ? VARLINK_PROCESSING_METHOD_MORE :
-                             (flags & VARLINK_METHOD_ONEWAY) ? VARLINK_PROCESSING_METHOD_ONEWAY :
-                                                               VARLINK_PROCESSING_METHOD);
-
         assert(v->server);
 
+        if (FLAGS_SET(v->server->flags, VARLINK_SERVER_PIPELINE)) {
+                /* Dispatch the call on an object of its own, so that the connection is free to receive the
+                 * next one while this one is still being processed */
+                r = varlink_new_call(v, &pipelined);
+                if (r < 0)
+                        return r;
+
+                call = pipelined;
+        } else
+                call = v;
+
+        varlink_set_state(call, (flags & VARLINK_METHOD_MORE)   ? VARLINK_PROCESSING_METHOD_MORE :
+                                (flags & VARLINK_METHOD_ONEWAY) ? VARLINK_PROCESSING_METHOD_ONEWAY :
+                                                                  VARLINK_PROCESSING_METHOD);
+
         if (STR_IN_SET(method, "org.varlink.service.GetInfo", "org.varlink.service.GetInterface")) {
                 /* For now, we don't implement a single of varlink's own methods */
                 callback = NULL;
@@ -864,17 +1367,30 @@ static int varlink_dispatch_method(Varlink *v) {
                 error = VARLINK_ERROR_METHOD_NOT_FOUND;
         } else {
                 callback = hashmap_get(v->server->methods, method);
+                if (!callback)
+                        worker_callback = hashmap_get(v->server->worker_methods, method);
                 error = VARLINK_ERROR_METHOD_NOT_FOUND;
         }
 
-        if (callback) {
-                r = callback(v, parameters, flags, v->userdata);
+        if (worker_callback) {
+                r = varlink_server_queue_work(v->server, call, method, worker_callback, parameters, flags);
+                if (r < 0) {
+                        log_debug_errno(r, "Failed to queue %s on worker thread: %m", method);
+
+                        if (!FLAGS_SET(flags, VARLINK_METHOD_ONEWAY)) {
+                                r = varlink_error_errno(call, r);
+                                if (r < 0)
+                                        return r;
+                        }
+                }
+        } else if (callback) {
+                r = callback(call, parameters, flags, call->userdata);
                 if (r < 0) {
                         log_debug_errno(r, "Callback for %s returned error: %m", method);
 
                         /* We got an error back from the callback. Propagate it to the client if the method call remains unanswered. */
                         if (!FLAGS_SET(flags, VARLINK_METHOD_ONEWAY)) {
-                                r = varlink_error_errno(v, r);
+                                r = varlink_error_errno(call, r);
                                 if (r < 0)
                                         return r;
                         }
@@ -882,25 +1398,25 @@ static int varlink_dispatch_method(Varlink *v) {
         } else if (!FLAGS_SET(flags, VARLINK_METHOD_ONEWAY)) {
                 assert(error);
 
-                r = varlink_errorb(v, error, JSON_BUILD_OBJECT(JSON_BUILD_PAIR("method", JSON_BUILD_STRING(method))));
+                r = varlink_errorb(call, error, JSON_BUILD_OBJECT(JSON_BUILD_PAIR("method", JSON_BUILD_STRING(method))));
                 if (r < 0)
                         return r;
         }
 
-        switch (v->state) {
+        switch (call->state) {
 
         case VARLINK_PROCESSED_METHOD: /* Method call is fully processed */
         case VARLINK_PROCESSING_METHOD_ONEWAY: /* ditto */
-                v->current = json_variant_unref(v->current);
-                varlink_set_state(v, VARLINK_IDLE_SERVER);
+                call->current = json_variant_unref(call->current);
+                varlink_set_state(call, VARLINK_IDLE_SERVER);
                 break;
 
         case VARLINK_PROCESSING_METHOD: /* Method call wasn't replied to, will be replied to later */
-                varlink_set_state(v, VARLINK_PENDING_METHOD);
+                varlink_set_state(call, VARLINK_PENDING_METHOD);
                 break;
 
         case VARLINK_PROCESSING_METHOD_MORE: /* No reply for a "more" message was sent, more to come */
-                varlink_set_state(v, VARLINK_PENDING_METHOD_MORE);
+                varlink_set_state(call, VARLINK_PENDING_METHOD_MORE);
                 break;
 
         default:
@@ -908,6 +1424,17 @@ static int varlink_dispatch_method(Varlink *v) {
 
         }
 
+        if (pipelined) {
+                int q;
+
+                /* The connection is ready for the next call, and the reply to this one might be ready to go */
+                v->current = json_variant_unref(v->current);
+
+                q = varlink_dispatch_calls(v);
+                if (q < 0)
+                        return q;
+        }
+
         return r;
 
 invalid:
@@ -1121,6 +1648,10 @@ int varlink_flush(Varlink *v) {
         if (v->state == VARLINK_DISCONNECTED)
                 return -ENOTCONN;
 
+        /* A pipelined call has no socket of its own, its output is written by the connection */
+        if (v->connection)
+                return varlink_flush(v->connection);
+
         for (;;) {
                 if (v->output_buffer_size == 0)
                         break;
@@ -1184,6 +1715,31 @@ static void varlink_detach_server(Varlink *v) {
         varlink_unref(v);
 }
 
+static void varlink_close_calls(Varlink *v) {
+        Varlink *call;
+
+        assert(v);
+
+        /* The connection goes away, and with it all pipelined calls. Those that weren't answered yet are
+         * reported to the disconnect callback, just like the connection itself, so that whatever is still
+         * being done for them can be aborted. */
+
+        while ((call = v->calls)) {
+                bool answered = call->state == VARLINK_IDLE_SERVER;
+
+                LIST_REMOVE(calls, v->calls, call);
+                v->n_calls--;
+                call->connection = NULL;
+
+                (void) varlink_close(call);
+
+                if (!answered && v->server && v->server->disconnect_callback)
+                        v->server->disconnect_callback(v->server, call, v->server->userdata);
+
+                varlink_unref(call);
+        }
+}
+
 int varlink_close(Varlink *v) {
 
         assert_return(v, -EINVAL);
@@ -1191,11 +1747,22 @@ int varlink_close(Varlink *v) {
         if (v->state == VARLINK_DISCONNECTED)
                 return 0;
 
+        if (v->connection) {
+                /* A pipelined call that is answered has nothing left to close, its reply goes out when it's
+                 * its turn. Otherwise the connection is closed, just like when the call had been dispatched
+                 * on it directly, as later replies can't go out before this one. */
+                if (v->state == VARLINK_IDLE_SERVER)
+                        return 0;
+
+                return varlink_close(v->connection);
+        }
+
         varlink_set_state(v, VARLINK_DISCONNECTED);
 
         /* Let's take a reference first, since varlink_detach_server() might drop the final (dangling) ref
          * which would destroy us before we can call varlink_clear() */
         varlink_ref(v);
+        varlink_close_calls(v);
         varlink_detach_server(v);
         varlink_clear(v);
         varlink_unref(v);
@@ -1234,42 +1801,14 @@ static int varlink_enqueue_json(Varlink *v, JsonVariant *m) {
                 return r;
         assert(text[r] == '\0');
 
-        if (v->output_buffer_size + r + 1 > VARLINK_BUFFER_MAX)
-                return -ENOBUFS;
-
         varlink_log(v, "Sending message: %s", text);
 
-        if (v->output_buffer_size == 0) {
-
-                free_and_replace(v->output_buffer, text);
+        /* The output of a pipelined call goes straight to the connection if the call is first in line, and
+         * is held back until it is otherwise */
+        if (v->connection && v->connection->calls == v)
+                v = v->connection;
 
-                v->output_buffer_size = v->output_buffer_allocated = r + 1;
-                v->output_buffer_index = 0;
-
-        } else if (v->output_buffer_index == 0) {
-
-                if (!GREEDY_REALLOC(v->output_buffer, v->output_buffer_allocated, v->output_buffer_size + r + 1))
-                        return -ENOMEM;
-
-                memcpy(v->output_buffer + v->output_buffer_size, text, r + 1);
-                v->output_buffer_size += r + 1;
-
-        } else {
-                char *n;
-                const size_t new_size = v->output_buffer_size + r + 1;
-
-                n = new(char, new_size);
-                if (!n)
-                        return -ENOMEM;
-
-                memcpy(mempcpy(n, v->output_buffer + v->output_buffer_index, v->output_buffer_size), text, r + 1);
-
-                free_and_replace(v->output_buffer, n);
-                v->output_buffer_allocated = v->output_buffer_size = new_size;
-                v->output_buffer_index = 0;
-        }
-
-        return 0;
+        return varlink_enqueue_output(v, &text, r + 1);
 }
 
 int varlink_send(Varlink *v, const char *method, JsonVariant *parameters) {
@@ -1323,8 +1862,9 @@ int varlink_sendb(Varlink *v, const char *method, ...) {
         return varlink_send(v, method, parameters);
 }
 
-int varlink_invoke(Varlink *v, const char *method, JsonVariant *parameters) {
+int varlink_invoke_full(Varlink *v, const char *method, JsonVariant *parameters, VarlinkReply callback, void *userdata) {
         _cleanup_(json_variant_unrefp) JsonVariant *m = NULL;
+        _cleanup_free_ VarlinkReplySlot *slot = NULL;
         int r;
 
         assert_return(v, -EINVAL);
@@ -1347,10 +1887,22 @@ int varlink_invoke(Varlink *v, const char *method, JsonVariant *parameters) {
         if (r < 0)
                 return r;
 
+        slot = new(VarlinkReplySlot, 1);
+        if (!slot)
+                return -ENOMEM;
+
+        *slot = (VarlinkReplySlot) {
+                .callback = callback,
+                .userdata = userdata,
+        };
+
         r = varlink_enqueue_json(v, m);
         if (r < 0)
                 return r;
 
+        LIST_INSERT_AFTER(slots, v->reply_slots, v->reply_slots_tail, slot);
+        v->reply_slots_tail = TAKE_PTR(slot);
+
         varlink_set_state(v, VARLINK_AWAITING_REPLY);
         v->n_pending++;
         v->timestamp = now(CLOCK_MONOTONIC);
@@ -1358,6 +1910,10 @@ int varlink_invoke(Varlink *v, const char *method, JsonVariant *parameters) {
         return 0;
 }
 
+int varlink_invoke(Varlink *v, const char *method, JsonVariant *parameters) {
+        return varlink_invoke_full(v, method, parameters, NULL, NULL);
+}
+
 int varlink_invokeb(Varlink *v, const char *method, ...) {
         _cleanup_(json_variant_unrefp) JsonVariant *parameters = NULL;
         va_list ap;
@@ -1568,6 +2124,7 @@ int varlink_reply(Varlink *v, JsonVariant *parameters) {
                  * process further messages. */
                 v->current = json_variant_unref(v->current);
                 varlink_set_state(v, VARLINK_IDLE_SERVER);
+                varlink_call_answered(v);
         } else
                 /* We replied to a method call from within the varlink_dispatch_method() stack frame), which
                  * means we should it handle the rest of the state engine. */
@@ -1624,6 +2181,7 @@ int varlink_error(Varlink *v, const char *error_id, JsonVariant *parameters) {
         if (IN_SET(v->state, VARLINK_PENDING_METHOD, VARLINK_PENDING_METHOD_MORE)) {
                 v->current = json_variant_unref(v->current);
                 varlink_set_state(v, VARLINK_IDLE_SERVER);
+                varlink_call_answered(v);
         } else
                 varlink_set_state(v, VARLINK_PROCESSED_METHOD);
 
@@ -1750,22 +2308,6 @@ void* varlink_get_userdata(Varlink *v) {
         return v->userdata;
 }
 
-static int varlink_acquire_ucred(Varlink *v) {
-        int r;
-
-        assert(v);
-
-        if (v->ucred_acquired)
-                return 0;
-
-        r = getpeercred(v->fd, &v->ucred);
-        if (r < 0)
-                return r;
-
-        v->ucred_acquired = true;
-        return 0;
-}
-
 int varlink_get_peer_uid(Varlink *v, uid_t *ret) {
         int r;
 
@@ -1811,6 +2353,9 @@ int varlink_set_relative_timeout(Varlink *v, usec_t timeout) {
 VarlinkServer *varlink_get_server(Varlink *v) {
         assert_return(v, NULL);
 
+        if (v->connection)
+                return v->connection->server;
+
         return v->server;
 }
 
@@ -1994,6 +2539,9 @@ int varlink_server_new(VarlinkServer **ret, VarlinkServerFlags flags) {
                 .flags = flags,
                 .connections_max = varlink_server_connections_max(NULL),
                 .connections_per_uid_max = varlink_server_connections_per_uid_max(NULL),
+                .workers_max = varlink_server_workers_max(NULL),
+                .workers_fd = -1,
+                .workers_mutex = PTHREAD_MUTEX_INITIALIZER,
         };
 
         *ret = s;
@@ -2001,6 +2549,7 @@ int varlink_server_new(VarlinkServer **ret, VarlinkServerFlags flags) {
 }
 
 static VarlinkServer* varlink_server_destroy(VarlinkServer *s) {
+        VarlinkWork *w;
         char *m;
 
         if (!s)
@@ -2008,10 +2557,26 @@ static VarlinkServer* varlink_server_destroy(VarlinkServer *s) {
 
         varlink_server_shutdown(s);
 
+        /* Join the worker threads first, so that nobody touches the work items anymore. Work items that were
+         * still queued are dropped unprocessed. */
+        event_group_free(s->workers);
+        while ((w = s->works)) {
+                LIST_REMOVE(works, s->works, w);
+                varlink_work_free(w);
+        }
+        s->works_done = NULL;
+
+        sd_event_source_disable_unref(s->workers_event_source);
+        safe_close(s->workers_fd);
+        (void) pthread_mutex_destroy(&s->workers_mutex);
+
         while ((m = hashmap_steal_first_key(s->methods)))
                 free(m);
+        while ((m = hashmap_steal_first_key(s->worker_methods)))
+                free(m);
 
         hashmap_free(s->methods);
+        hashmap_free(s->worker_methods);
         hashmap_free(s->by_uid);
 
         sd_event_unref(s->event);
@@ -2337,6 +2902,14 @@ int varlink_server_attach_event(VarlinkServer *s, sd_event *e, int64_t priority)
         }
 
         s->event_priority = priority;
+
+        /* Pick up results of work items that finished while we weren't attached to any event loop */
+        if (s->workers) {
+                r = varlink_server_workers_attach_event(s);
+                if (r < 0)
+                        goto fail;
+        }
+
         return 0;
 
 fail:
@@ -2358,7 +2931,9 @@ int varlink_server_detach_event(VarlinkServer *s) {
                 ss->event_source = sd_event_source_unref(ss->event_source);
         }
 
-        sd_event_unref(s->event);
+        s->workers_event_source = sd_event_source_disable_unref(s->workers_event_source);
+
+        s->event = sd_event_unref(s->event);
         return 0;
 }
 
@@ -2379,6 +2954,9 @@ int varlink_server_bind_method(VarlinkServer *s, const char *method, VarlinkMeth
         if (startswith(method, "org.varlink.service."))
                 return -EEXIST;
 
+        if (hashmap_contains(s->worker_methods, method))
+                return -EEXIST;
+
         r = hashmap_ensure_allocated(&s->methods, &string_hash_ops);
         if (r < 0)
                 return r;
@@ -2396,6 +2974,37 @@ int varlink_server_bind_method(VarlinkServer *s, const char *method, VarlinkMeth
         return 0;
 }
 
+int varlink_server_bind_method_worker(VarlinkServer *s, const char *method, VarlinkWorkerMethod callback) {
+        _cleanup_free_ char *m = NULL;
+        int r;
+
+        assert_return(s, -EINVAL);
+        assert_return(method, -EINVAL);
+        assert_return(callback, -EINVAL);
+
+        if (startswith(method, "org.varlink.service."))
+                return -EEXIST;
+
+        /* A method may either run on the event loop or on the worker threads, not both */
+        if (hashmap_contains(s->methods, method))
+                return -EEXIST;
+
+        r = hashmap_ensure_allocated(&s->worker_methods, &string_hash_ops);
+        if (r < 0)
+                return r;
+
+        m = strdup(method);
+        if (!m)
+                return -ENOMEM;
+
+        r = hashmap_put(s->worker_methods, m, callback);
+        if (r < 0)
+                return r;
+
+        TAKE_PTR(m);
+        return 0;
+}
+
 int varlink_server_bind_method_many_internal(VarlinkServer *s, ...) {
         va_list ap;
         int r = 0;
@@ -2489,6 +3098,26 @@ int varlink_server_set_connections_max(VarlinkServer *s, unsigned m) {
         return 0;
 }
 
+unsigned varlink_server_workers_max(VarlinkServer *s) {
+        /* If a server is specified, return the setting for that server, otherwise the default value */
+        if (s)
+                return s->workers_max;
+
+        return VARLINK_DEFAULT_WORKERS_MAX;
+}
+
+int varlink_server_set_workers_max(VarlinkServer *s, unsigned m) {
+        assert_return(s, -EINVAL);
+        assert_return(m > 0, -EINVAL);
+
+        /* The pool is sized when it is started, i.e. when the first worker method is called */
+        if (s->workers)
+                return -EBUSY;
+
+        s->workers_max = m;
+        return 0;
+}
+
 unsigned varlink_server_current_connections(VarlinkServer *s) {
         assert_return(s, UINT_MAX);
 
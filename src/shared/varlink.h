@@ -44,8 +44,9 @@ typedef enum VarlinkServerFlags {
         VARLINK_SERVER_ROOT_ONLY   = 1 << 0, /* Only accessible by root */
         VARLINK_SERVER_MYSELF_ONLY = 1 << 1, /* Only accessible by our own UID */
         VARLINK_SERVER_ACCOUNT_UID = 1 << 2, /* Do per user accounting */
+        VARLINK_SERVER_PIPELINE    = 1 << 3, /* Process multiple method calls per connection at the same time */
 
-        _VARLINK_SERVER_FLAGS_ALL = (1 << 3) - 1,
+        _VARLINK_SERVER_FLAGS_ALL = (1 << 4) - 1,
 } VarlinkServerFlags;
 
 typedef int (*VarlinkMethod)(Varlink *link, JsonVariant *parameters, VarlinkMethodFlags flags, void *userdata);
@@ -53,6 +54,13 @@ typedef int (*VarlinkReply)(Varlink *link, JsonVariant *parameters, const char *
 typedef int (*VarlinkConnect)(VarlinkServer *server, Varlink *link, void *userdata);
 typedef void (*VarlinkDisconnect)(VarlinkServer *server, Varlink *link, void *userdata);
 
+/* A method callback that is run on a worker thread of the server, instead of on its event loop. It gets no access to
+ * the Varlink connection object (which is not thread-safe), but returns the reply parameters in *ret_parameters
+ * instead. To reply with an error, set *ret_error_id to a static error string (*ret_parameters are then used as
+ * error parameters), or return a negative errno-style error. It may only use state that is safe to access from
+ * other threads, and replies exactly once, i.e. it can't stream multiple replies to a call with the "more" flag. */
+typedef int (*VarlinkWorkerMethod)(JsonVariant *parameters, VarlinkMethodFlags flags, JsonVariant **ret_parameters, const char **ret_error_id, void *userdata);
+
 int varlink_connect_address(Varlink **ret, const char *address);
 int varlink_connect_fd(Varlink **ret, int fd);
 
@@ -88,6 +96,10 @@ int varlink_callb(Varlink *v, const char *method, JsonVariant **ret_parameters,
 int varlink_invoke(Varlink *v, const char *method, JsonVariant *parameters);
 int varlink_invokeb(Varlink *v, const char *method, ...);
 
+/* Same, but deliver the reply to the specified callback and userdata instead, if one is specified. Multiple
+ * calls may be in flight on the same connection at the same time, replies are delivered in call order. */
+int varlink_invoke_full(Varlink *v, const char *method, JsonVariant *parameters, VarlinkReply callback, void *userdata);
+
 /* Enqueue method call, expect a reply now, and possibly more later, which are all delivered to the reply callback */
 int varlink_observe(Varlink *v, const char *method, JsonVariant *parameters);
 int varlink_observeb(Varlink *v, const char *method, ...);
@@ -121,7 +133,12 @@ VarlinkServer* varlink_get_server(Varlink *v);
 
 int varlink_set_description(Varlink *v, const char *d);
 
-/* Create a varlink server */
+/* Create a varlink server. With VARLINK_SERVER_PIPELINE, the server reads further method calls from a
+ * connection while earlier ones are still waiting for their reply. Each call is then dispatched on a Varlink
+ * object of its own, that shares the connection's peer credentials, event loop and initial userdata, and is
+ * answered like any other. Since the protocol has no request IDs, the replies go out in call order. If the
+ * connection goes away while calls are still unanswered, the disconnect callback is invoked for each of
+ * them, too. */
 int varlink_server_new(VarlinkServer **ret, VarlinkServerFlags flags);
 VarlinkServer *varlink_server_ref(VarlinkServer *s);
 VarlinkServer *varlink_server_unref(VarlinkServer *s);
@@ -135,6 +152,7 @@ int varlink_server_add_connection(VarlinkServer *s, int fd, Varlink **ret);
 int varlink_server_bind_method(VarlinkServer *s, const char *method, VarlinkMethod callback);
 int varlink_server_bind_method_many_internal(VarlinkServer *s, ...);
 #define varlink_server_bind_method_many(s, ...) varlink_server_bind_method_many_internal(s, __VA_ARGS__, NULL)
+int varlink_server_bind_method_worker(VarlinkServer *s, const char *method, VarlinkWorkerMethod callback);
 int varlink_server_bind_connect(VarlinkServer *s, VarlinkConnect connect);
 int varlink_server_bind_disconnect(VarlinkServer *s, VarlinkDisconnect disconnect);
 
@@ -153,6 +171,9 @@ unsigned varlink_server_connections_per_uid_max(VarlinkServer *s);
 int varlink_server_set_connections_per_uid_max(VarlinkServer *s, unsigned m);
 int varlink_server_set_connections_max(VarlinkServer *s, unsigned m);
 
+unsigned varlink_server_workers_max(VarlinkServer *s);
+int varlink_server_set_workers_max(VarlinkServer *s, unsigned m);
+
 unsigned varlink_server_current_connections(VarlinkServer *s);
 
 int varlink_server_set_description(VarlinkServer *s, const char *description);
@@ -0,0 +1,163 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+
+#include "cgroup.h"
+#include "cgroup-util.h"
+#include "hashmap.h"
+#include "manager.h"
+#include "rm-rf.h"
+#include "service.h"
+#include "string-util.h"
+#include "tests.h"
+#include "unit.h"
+
+static Unit* make_unit(Manager *m, const char *name) {
+        CGroupContext *c;
+        Unit *u;
+
+        assert_se(unit_new_for_name(m, sizeof(Service), name, &u) >= 0);
+        u->load_state = UNIT_LOADED;
+
+        assert_se(c = unit_get_cgroup_context(u));
+        c->tasks_accounting = c->memory_accounting = true;
+        c->tasks_max = (TasksMax) { .value = 100 };
+
+        return u;
+}
+
+static void realize(Unit *u, CGroupMask invalidate, uint64_t *ret_written, uint64_t *ret_skipped) {
+        uint64_t written = u->manager->n_cgroup_attribute_writes,
+                skipped = u->manager->n_cgroup_attribute_writes_skipped;
+
+        unit_invalidate_cgroup(u, invalidate);
+        assert_se(unit_realize_cgroup(u) >= 0);
+        assert_se(u->cgroup_path);
+
+        *ret_written = u->manager->n_cgroup_attribute_writes - written;
+        *ret_skipped = u->manager->n_cgroup_attribute_writes_skipped - skipped;
+
+        log_debug("%s: %" PRIu64 " attribute writes, %" PRIu64 " skipped", u->id, *ret_written, *ret_skipped);
+}
+
+static bool has_memory_attribute(Unit *u) {
+        const char *name;
+        void *v;
+
+        HASHMAP_FOREACH_KEY(v, name, u->cgroup_attribute_cache)
+                if (startswith(name, "memory."))
+                        return true;
+
+        return false;
+}
+
+static void test_unchanged(Manager *m) {
+        uint64_t written, skipped;
+        Unit *u;
+
+        log_info("/* %s */", __func__);
+
+        u = make_unit(m, "attribute-unchanged.service");
+
+        realize(u, 0, &written, &skipped);
+        assert_se(written > 0);
+        assert_se(hashmap_contains(u->cgroup_attribute_cache, "pids.max"));
+
+        /* Nothing changed, hence realizing it once more writes nothing */
+        realize(u, CGROUP_MASK_PIDS|CGROUP_MASK_MEMORY, &written, &skipped);
+        assert_se(written == 0);
+        assert_se(skipped > 0);
+}
+
+static void test_changed(Manager *m) {
+        uint64_t written, skipped;
+        CGroupContext *c;
+        Unit *u;
+        _cleanup_free_ char *v = NULL;
+
+        log_info("/* %s */", __func__);
+
+        u = make_unit(m, "attribute-changed.service");
+        realize(u, 0, &written, &skipped);
+
+        /* A changed value is written, and only that one */
+        assert_se(c = unit_get_cgroup_context(u));
+        c->tasks_max.value = 200;
+        realize(u, CGROUP_MASK_PIDS, &written, &skipped);
+        assert_se(written == 1);
+
+        assert_se(cg_get_attribute("pids", u->cgroup_path, "pids.max", &v) >= 0);
+        assert_se(streq(v, "200"));
+}
+
+static void test_invalidated(Manager *m) {
+        uint64_t written, skipped;
+        CGroupContext *c;
+        Unit *u;
+
+        log_info("/* %s */", __func__);
+
+        u = make_unit(m, "attribute-invalidated.service");
+        assert_se(c = unit_get_cgroup_context(u));
+        realize(u, 0, &written, &skipped);
+
+        /* When the pids controller goes away, what we wrote to it is forgotten, but not what we wrote to
+         * the other controllers */
+        c->tasks_accounting = false;
+        c->tasks_max = TASKS_MAX_UNSET;
+        realize(u, CGROUP_MASK_PIDS, &written, &skipped);
+        if (FLAGS_SET(u->cgroup_realized_mask, CGROUP_MASK_PIDS))
+                log_notice("pids controller still realized, as some other unit needs it, skipping part of the test.");
+        else {
+                assert_se(!hashmap_contains(u->cgroup_attribute_cache, "pids.max"));
+                assert_se(has_memory_attribute(u));
+
+                /* And when it comes back, the same value is written again */
+                c->tasks_accounting = true;
+                c->tasks_max = (TasksMax) { .value = 100 };
+                realize(u, CGROUP_MASK_PIDS, &written, &skipped);
+                assert_se(written > 0);
+                assert_se(hashmap_contains(u->cgroup_attribute_cache, "pids.max"));
+        }
+
+        /* When the cgroup is removed, everything is forgotten, and written again when it is recreated */
+        unit_prune_cgroup(u);
+        assert_se(!u->cgroup_attribute_cache);
+        realize(u, 0, &written, &skipped);
+        assert_se(written > 0);
+        assert_se(skipped == 0);
+        assert_se(hashmap_contains(u->cgroup_attribute_cache, "pids.max"));
+        assert_se(has_memory_attribute(u));
+}
+
+int main(int argc, char *argv[]) {
+        _cleanup_(rm_rf_physical_and_freep) char *runtime_dir = NULL;
+        _cleanup_(manager_freep) Manager *m = NULL;
+        _cleanup_free_ char *unit_dir = NULL;
+        int r;
+
+        test_setup_logging(LOG_DEBUG);
+
+        if (getuid() != 0)
+                return log_tests_skipped("not root");
+        r = enter_cgroup_subroot(NULL);
+        if (r == -ENOMEDIUM)
+                return log_tests_skipped("cgroupfs not available");
+
+        assert_se(get_testdata_dir("units", &unit_dir) >= 0);
+        assert_se(set_unit_path(unit_dir) >= 0);
+        assert_se(runtime_dir = setup_fake_runtime_dir());
+
+        r = manager_new(UNIT_FILE_SYSTEM, MANAGER_TEST_RUN_BASIC, &m);
+        if (manager_errno_skip_test(r))
+                return log_tests_skipped_errno(r, "manager_new");
+        assert_se(r >= 0);
+        assert_se(manager_startup(m, NULL, NULL) >= 0);
+
+        if ((m->cgroup_supported & (CGROUP_MASK_PIDS|CGROUP_MASK_MEMORY)) != (CGROUP_MASK_PIDS|CGROUP_MASK_MEMORY))
+                return log_tests_skipped("pids or memory controller not available");
+
+        test_unchanged(m);
+        test_changed(m);
+        test_invalidated(m);
+
+        return 0;
+}
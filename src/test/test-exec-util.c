@@ -413,6 +413,85 @@ static void test_error_catching(void) {
         assert_se(r == 42);
 }
 
+static int hooks_prepare(const char *path, char ***ret_argv, void *userdata) {
+        const char *dir = userdata;
+
+        if (endswith(path, "/20-skipped"))
+                return 1;
+
+        if (endswith(path, "/10-private")) {
+                *ret_argv = strv_new(path, strjoina(dir, "/private-argv"));
+                assert_se(*ret_argv);
+        }
+
+        return 0;
+}
+
+static void hooks_finish(const char *path, int status, void *userdata) {
+        _cleanup_fclose_ FILE *f = NULL;
+        const char *dir = userdata, *p;
+
+        p = strjoina(dir, "/finished-", basename(path), "-", status == 0 ? "ok" : "failed");
+        assert_se(touch(p) >= 0);
+
+        p = strjoina(dir, "/order");
+        assert_se(f = fopen(p, "ae"));
+        fprintf(f, "%s\n", basename(path));
+}
+
+static void test_execute_directory_hooks(void) {
+        _cleanup_free_ char *order = NULL;
+        char template[] = "/tmp/test-exec-util.XXXXXXX";
+        const char *dirs[] = {template, NULL};
+        ExecDirHooks hooks = {
+                .prepare = hooks_prepare,
+                .finish = hooks_finish,
+                .userdata = template,
+        };
+        const char *name, *name2, *name3;
+
+        log_info("/* %s */", __func__);
+
+        assert_se(mkdtemp(template));
+
+        name = strjoina(template, "/10-private");
+        name2 = strjoina(template, "/20-skipped");
+        name3 = strjoina(template, "/30-failing");
+
+        /* The first one finishes last, but finish() is still called in order */
+        assert_se(write_string_file(name,
+                                    "#!/bin/sh\nsleep 0.5\ntouch \"$1\"",
+                                    WRITE_STRING_FILE_CREATE) == 0);
+        assert_se(write_string_file(name2,
+                                    "#!/bin/sh\ntouch $(dirname $0)/failed",
+                                    WRITE_STRING_FILE_CREATE) == 0);
+        assert_se(write_string_file(name3,
+                                    "#!/bin/sh\nexit 1",
+                                    WRITE_STRING_FILE_CREATE) == 0);
+
+        assert_se(chmod(name, 0755) == 0);
+        assert_se(chmod(name2, 0755) == 0);
+        assert_se(chmod(name3, 0755) == 0);
+
+        if (access(name, X_OK) < 0 && ERRNO_IS_PRIVILEGE(errno))
+                goto finish;
+
+        assert_se(execute_directories_full(dirs, DEFAULT_TIMEOUT_USEC, NULL, NULL, NULL, NULL, &hooks,
+                                           EXEC_DIR_PARALLEL | EXEC_DIR_IGNORE_ERRORS) == 0);
+
+        assert_se(access(strjoina(template, "/private-argv"), F_OK) >= 0);
+        assert_se(access(strjoina(template, "/failed"), F_OK) < 0);
+        assert_se(access(strjoina(template, "/finished-10-private-ok"), F_OK) >= 0);
+        assert_se(access(strjoina(template, "/finished-20-skipped-ok"), F_OK) >= 0);
+        assert_se(access(strjoina(template, "/finished-30-failing-failed"), F_OK) >= 0);
+
+        assert_se(read_full_file(strjoina(template, "/order"), &order, NULL) >= 0);
+        assert_se(streq(order, "10-private\n20-skipped\n30-failing\n"));
+
+finish:
+        (void) rm_rf(template, REMOVE_ROOT|REMOVE_PHYSICAL);
+}
+
 static void test_exec_command_flags_from_strv(void) {
         ExecCommandFlags flags = 0;
         char **valid_strv = STRV_MAKE("no-env-expand", "no-setuid", "ignore-failure");
@@ -466,6 +545,7 @@ int main(int argc, char *argv[]) {
         test_stdout_gathering();
         test_environment_gathering();
         test_error_catching();
+        test_execute_directory_hooks();
         test_exec_command_flags_from_strv();
         test_exec_command_flags_to_strv();
 
@@ -0,0 +1,192 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+
+#include <stdio.h>
+#include <unistd.h>
+
+#include "alloc-util.h"
+#include "execute-serialize.h"
+#include "fd-util.h"
+#include "fdset.h"
+#include "fileio.h"
+#include "fs-util.h"
+#include "manager.h"
+#include "path-util.h"
+#include "rm-rf.h"
+#include "serialize.h"
+#include "service.h"
+#include "string-util.h"
+#include "strv.h"
+#include "tests.h"
+#include "tmpfile-util.h"
+
+static const char unit_contents[] =
+        "[Service]\n"
+        "ExecStart=/bin/echo \"foo bar\" baz\n"
+        "Environment=A=1 \"B=2 3\"\n"
+        "UnsetEnvironment=C\n"
+        "WorkingDirectory=-/tmp\n"
+        "RootDirectory=/\n"
+        "UMask=0027\n"
+        "Nice=5\n"
+        "OOMScoreAdjust=100\n"
+        "CPUAffinity=0 2-3\n"
+        "LimitNOFILE=1024:4096\n"
+        "LimitCORE=infinity\n"
+        "StandardInputText=hello\n"
+        "StandardInputText=world\n"
+        "StandardOutput=journal\n"
+        "SyslogIdentifier=foo\n"
+        "LogExtraFields=FOO=bar\n"
+        "User=nobody\n"
+        "SupplementaryGroups=wheel adm\n"
+        "CapabilityBoundingSet=CAP_NET_BIND_SERVICE CAP_SYS_ADMIN\n"
+        "NoNewPrivileges=yes\n"
+        "ProtectSystem=strict\n"
+        "ProtectHome=read-only\n"
+        "PrivateTmp=yes\n"
+        "ReadWritePaths=/var/lib/foo -/var/lib/bar\n"
+        "BindPaths=/var/tmp:/mnt/bind\n"
+        "BindReadOnlyPaths=-/foo:/bar:norbind\n"
+        "TemporaryFileSystem=/var:ro\n"
+        "MountImages=/img.raw:/mnt/img root:ro,nosuid\n"
+        "RootImageOptions=root:nodev\n"
+        "StateDirectory=foo bar\n"
+        "StateDirectoryMode=0700\n"
+        "RuntimeDirectory=baz\n"
+        "SetCredential=cred:secret\\x00value\n"
+        "LoadCredential=other:/etc/hostname\n"
+#if HAVE_SECCOMP
+        "SystemCallFilter=@system-service\n"
+        "SystemCallFilter=~@mount\n"
+        "SystemCallErrorNumber=EPERM\n"
+        "SystemCallArchitectures=native\n"
+        "RestrictAddressFamilies=AF_UNIX AF_INET\n"
+#endif
+        "RestrictNamespaces=net ipc\n";
+
+static char *dump_context(const ExecContext *c) {
+        _cleanup_free_ char *buf = NULL;
+        _cleanup_fclose_ FILE *f = NULL;
+        size_t size;
+
+        assert_se(f = open_memstream_unlocked(&buf, &size));
+        exec_context_dump(c, f, "");
+        assert_se(fflush_and_check(f) >= 0);
+        f = safe_fclose(f);
+
+        return TAKE_PTR(buf);
+}
+
+static void test_roundtrip(Manager *m) {
+        _cleanup_(exec_invocation_done) ExecInvocation i = EXEC_INVOCATION_NULL;
+        _cleanup_free_ char *a = NULL, *b = NULL;
+        _cleanup_fdset_free_ FDSet *fds = NULL;
+        _cleanup_fclose_ FILE *f = NULL;
+        _cleanup_close_ int serialization_fd = -1;
+        _cleanup_close_pair_ int p[2] = { -1, -1 };
+        char x;
+        const char *prefix[_EXEC_DIRECTORY_TYPE_MAX] = {
+                "/run", "/var/lib", "/var/cache", "/var/log", "/etc",
+        };
+        ExecParameters params = {
+                .environment = STRV_MAKE("X=1", "Y=2"),
+                .flags = EXEC_APPLY_SANDBOXING|EXEC_PASS_LOG_UNIT,
+                .cgroup_path = "/system.slice/foo.service",
+                .prefix = (char**) prefix,
+                .watchdog_usec = 5 * USEC_PER_SEC,
+                .stdin_fd = -1,
+                .stdout_fd = -1,
+                .stderr_fd = -1,
+                .exec_fd = -1,
+        };
+        ExecCommand *command;
+        ExecContext *c;
+        Unit *u;
+
+        log_info("/* %s */", __func__);
+
+        assert_se(manager_load_startable_unit_or_warn(m, "serialize.service", NULL, &u) >= 0);
+        assert_se(c = unit_get_exec_context(u));
+        assert_se(command = SERVICE(u)->exec_command[SERVICE_EXEC_START]);
+        assert_se(exec_invocation_supported(&params));
+
+        assert_se(pipe2(p, O_CLOEXEC) >= 0);
+        params.stdout_fd = p[1];
+
+        assert_se((serialization_fd = open_serialization_fd("test")) >= 0);
+        assert_se(f = take_fdopen(&serialization_fd, "w+"));
+        assert_se(fds = fdset_new());
+
+        assert_se(exec_invocation_serialize(f, fds, u, command, c, &params, NULL, NULL,
+                                            STRV_MAKE("FILE=1"), p[0]) >= 0);
+        assert_se(fdset_size(fds) == 2);
+        rewind(f);
+
+        assert_se(exec_invocation_deserialize(f, fds, &i) >= 0);
+        assert_se(fdset_isempty(fds));
+
+        /* The execution context is unchanged */
+        assert_se(a = dump_context(c));
+        assert_se(b = dump_context(&i.context));
+        log_debug("%s", b);
+        assert_se(streq(a, b));
+        assert_se(i.context.stdin_data_size == c->stdin_data_size);
+        assert_se(memcmp(i.context.stdin_data, c->stdin_data, c->stdin_data_size) == 0);
+        assert_se(hashmap_size(i.context.set_credentials) == 1);
+
+        /* And so are the rest of the parameters */
+        assert_se(streq(i.unit.id, "serialize.service"));
+        assert_se(i.unit.manager == &i.manager);
+        assert_se(!MANAGER_IS_SYSTEM(&i.manager));
+        assert_se(streq(i.manager.unit_log_field, "USER_UNIT="));
+        assert_se(streq(i.command.path, command->path));
+        assert_se(strv_equal(i.command.argv, command->argv));
+        assert_se(i.command.flags == command->flags);
+        assert_se(strv_equal(i.params.environment, params.environment));
+        assert_se(i.params.flags == params.flags);
+        assert_se(streq(i.params.cgroup_path, params.cgroup_path));
+        for (ExecDirectoryType t = 0; t < _EXEC_DIRECTORY_TYPE_MAX; t++)
+                assert_se(streq(i.params.prefix[t], params.prefix[t]));
+        assert_se(i.params.watchdog_usec == params.watchdog_usec);
+        assert_se(!i.params.idle_pipe);
+        assert_se(!i.have_runtime);
+        assert_se(!i.dcreds.user && !i.dcreds.group);
+        assert_se(strv_equal(i.files_env, STRV_MAKE("FILE=1")));
+
+        /* File descriptors are passed as copies */
+        assert_se(i.params.stdout_fd >= 0 && i.params.stdout_fd != p[1]);
+        assert_se(i.params.stdin_fd < 0 && i.params.stderr_fd < 0);
+        assert_se(i.user_lookup_fd >= 0 && i.user_lookup_fd != p[0]);
+        assert_se(write(i.params.stdout_fd, "x", 1) == 1);
+        assert_se(read(i.user_lookup_fd, &x, 1) == 1);
+        assert_se(x == 'x');
+}
+
+int main(int argc, char *argv[]) {
+        _cleanup_(rm_rf_physical_and_freep) char *runtime_dir = NULL, *unit_dir = NULL;
+        _cleanup_(manager_freep) Manager *m = NULL;
+        const char *path;
+        int r;
+
+        test_setup_logging(LOG_DEBUG);
+
+        r = enter_cgroup_subroot(NULL);
+        if (r == -ENOMEDIUM)
+                return log_tests_skipped("cgroupfs not available");
+
+        assert_se(runtime_dir = setup_fake_runtime_dir());
+        assert_se(mkdtemp_malloc("/tmp/test-execute-serialize-XXXXXX", &unit_dir) >= 0);
+        path = prefix_roota(unit_dir, "serialize.service");
+        assert_se(write_string_file(path, unit_contents, WRITE_STRING_FILE_CREATE) >= 0);
+        assert_se(set_unit_path(unit_dir) >= 0);
+
+        r = manager_new(UNIT_FILE_USER, MANAGER_TEST_RUN_MINIMAL, &m);
+        if (manager_errno_skip_test(r))
+                return log_tests_skipped_errno(r, "manager_new");
+        assert_se(r >= 0);
+        assert_se(manager_startup(m, NULL, NULL) >= 0);
+
+        test_roundtrip(m);
+
+        return 0;
+}
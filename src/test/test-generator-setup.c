@@ -0,0 +1,190 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+
+#include <unistd.h>
+
+#include "alloc-util.h"
+#include "errno-util.h"
+#include "exec-util.h"
+#include "fileio.h"
+#include "fs-util.h"
+#include "generator-setup.h"
+#include "path-util.h"
+#include "rm-rf.h"
+#include "string-util.h"
+#include "strv.h"
+#include "tests.h"
+#include "tmpfile-util.h"
+
+static char *dir = NULL, *generator_dir = NULL;
+static LookupPaths lp = {};
+
+static void write_generator(const char *name, const char *script) {
+        _cleanup_free_ char *p = NULL;
+
+        assert_se(p = path_join(generator_dir, name));
+        assert_se(write_string_file(p, script, WRITE_STRING_FILE_CREATE) >= 0);
+        assert_se(chmod(p, 0755) >= 0);
+}
+
+static void run_generators(void) {
+        const char *dirs[] = { generator_dir, NULL };
+        char *argv[] = { NULL, lp.generator, lp.generator_early, lp.generator_late, NULL };
+        ExecDirHooks hooks;
+
+        /* Like manager_run_generators() does it, on every daemon-reload */
+        lookup_paths_flush_generator(&lp);
+        assert_se(lookup_paths_mkdir_generator(&lp) >= 0);
+        lookup_paths_generator_hooks(&lp, &hooks);
+
+        assert_se(execute_directories_full(dirs, DEFAULT_TIMEOUT_USEC, NULL, NULL, argv, NULL, &hooks,
+                                           EXEC_DIR_PARALLEL | EXEC_DIR_IGNORE_ERRORS) == 0);
+}
+
+static unsigned runs(const char *name) {
+        _cleanup_free_ char *p = NULL, *contents = NULL;
+
+        assert_se(p = strjoin(dir, "/runs-", name));
+        if (read_full_file(p, &contents, NULL) == -ENOENT)
+                return 0;
+
+        return strlen(contents);
+}
+
+static bool generated(const char *d, const char *name, const char *contents) {
+        _cleanup_free_ char *p = NULL, *s = NULL;
+
+        assert_se(p = path_join(d, name));
+        if (read_one_line_file(p, &s) < 0)
+                return false;
+
+        return streq(s, contents);
+}
+
+static bool cached(const char *name) {
+        _cleanup_free_ char *p = NULL;
+
+        assert_se(p = strjoin(lp.generator, ".cache/", name, "/normal"));
+        return access(p, F_OK) >= 0;
+}
+
+static void test_generator_cache(void) {
+        _cleanup_free_ char *opted = NULL, *other = NULL, *plain = NULL, *racy = NULL, *input = NULL, *link = NULL;
+
+        log_info("/* %s */", __func__);
+
+        assert_se(input = path_join(dir, "input"));
+        assert_se(write_string_file(input, "one", WRITE_STRING_FILE_CREATE) >= 0);
+
+        /* Declares its input, writes a file that conflicts with 20-other, and links from one directory into
+         * another. It finishes last, but its output is still merged first. */
+        assert_se(asprintf(&opted,
+                           "#!/bin/sh\n"
+                           "echo -n x >>%1$s/runs-opted\n"
+                           "echo %1$s/input >>\"$SYSTEMD_GENERATOR_INPUTS\"\n"
+                           "sleep 0.5\n"
+                           "cat %1$s/input >\"$1/opted.service\"\n"
+                           "echo late >\"$3/late.service\"\n"
+                           "mkdir \"$1/foo.target.wants\"\n"
+                           "ln -s \"$3/late.service\" \"$1/foo.target.wants/late.service\"\n"
+                           "echo 10 >\"$1/conflict.service\"\n",
+                           dir) >= 0);
+        write_generator("10-opted", opted);
+
+        assert_se(asprintf(&other,
+                           "#!/bin/sh\n"
+                           "echo -n x >>%1$s/runs-other\n"
+                           "echo %1$s/input >>\"$SYSTEMD_GENERATOR_INPUTS\"\n"
+                           "echo 20 >\"$1/conflict.service\"\n",
+                           dir) >= 0);
+        write_generator("20-other", other);
+
+        /* Doesn't declare any inputs, hence always runs and writes into the real directories */
+        assert_se(asprintf(&plain,
+                           "#!/bin/sh\n"
+                           "echo -n x >>%1$s/runs-plain\n"
+                           "echo plain >\"$1/plain.service\"\n",
+                           dir) >= 0);
+        write_generator("30-plain", plain);
+
+        /* Changes its own input while running, which must not be mistaken for the input it read */
+        assert_se(asprintf(&racy,
+                           "#!/bin/sh\n"
+                           "echo -n x >>%1$s/runs-racy\n"
+                           "echo %1$s/runs-racy >>\"$SYSTEMD_GENERATOR_INPUTS\"\n",
+                           dir) >= 0);
+        write_generator("40-racy", racy);
+
+        if (access(strjoina(generator_dir, "/10-opted"), X_OK) < 0 && ERRNO_IS_PRIVILEGE(errno))
+                return;
+
+        /* The first time round nobody declared any inputs yet, hence all write into the real directories */
+        run_generators();
+        assert_se(runs("opted") == 1);
+        assert_se(!cached("10-opted"));
+        assert_se(generated(lp.generator, "opted.service", "one"));
+        assert_se(generated(lp.generator, "plain.service", "plain"));
+
+        /* Now those which declared their inputs write into their private directories */
+        run_generators();
+        assert_se(runs("opted") == 2);
+        assert_se(cached("10-opted"));
+        assert_se(cached("20-other"));
+        assert_se(!cached("30-plain"));
+        assert_se(generated(lp.generator, "opted.service", "one"));
+        assert_se(generated(lp.generator, "plain.service", "plain"));
+
+        /* Merged in the order the generators are run in, not the one they finish in */
+        assert_se(generated(lp.generator, "conflict.service", "10"));
+
+        /* Absolute symlinks into another private directory point into the real one */
+        assert_se(readlink_malloc(strjoina(lp.generator, "/foo.target.wants/late.service"), &link) >= 0);
+        assert_se(path_equal(link, strjoina(lp.generator_late, "/late.service")));
+        assert_se(generated(lp.generator, "foo.target.wants/late.service", "late"));
+
+        /* Nothing changed, hence the previous output is reused */
+        run_generators();
+        assert_se(runs("opted") == 2);
+        assert_se(runs("other") == 2);
+        assert_se(runs("plain") == 3);
+        assert_se(generated(lp.generator, "opted.service", "one"));
+        assert_se(generated(lp.generator, "conflict.service", "10"));
+        assert_se(generated(lp.generator, "foo.target.wants/late.service", "late"));
+
+        /* The input changed while the generator ran, hence it is never reused */
+        assert_se(runs("racy") == 3);
+
+        /* Until the input changes */
+        assert_se(write_string_file(input, "two", WRITE_STRING_FILE_CREATE|WRITE_STRING_FILE_TRUNCATE) >= 0);
+        run_generators();
+        assert_se(runs("opted") == 3);
+        assert_se(runs("other") == 3);
+        assert_se(generated(lp.generator, "opted.service", "two"));
+
+        run_generators();
+        assert_se(runs("opted") == 3);
+        assert_se(runs("racy") == 5);
+        assert_se(generated(lp.generator, "opted.service", "two"));
+}
+
+int main(int argc, char *argv[]) {
+        _cleanup_(rm_rf_physical_and_freep) char *d = NULL;
+
+        test_setup_logging(LOG_DEBUG);
+
+        assert_se(mkdtemp_malloc("/tmp/test-generator-setup-XXXXXX", &d) >= 0);
+        dir = d;
+
+        assert_se(generator_dir = path_join(dir, "generators"));
+        assert_se(mkdir(generator_dir, 0755) >= 0);
+
+        assert_se(lp.generator = path_join(dir, "generator"));
+        assert_se(lp.generator_early = path_join(dir, "generator.early"));
+        assert_se(lp.generator_late = path_join(dir, "generator.late"));
+
+        test_generator_cache();
+
+        lookup_paths_free(&lp);
+        free(generator_dir);
+
+        return 0;
+}
@@ -744,8 +744,9 @@ static void test_hashmap_many(void) {
                 const struct hash_ops *ops;
                 unsigned n_entries;
         } tests[] = {
-                { "trivial_hashmap_ops",  NULL,                  slow ? 1 << 20 : 240 },
-                { "crippled_hashmap_ops", &crippled_hashmap_ops, slow ? 1 << 14 : 140 },
+                { "trivial_hashmap_ops",      NULL,                      slow ? 1 << 20 : 240 },
+                { "trusted_pointer_hash_ops", &trusted_pointer_hash_ops, slow ? 1 << 20 : 240 },
+                { "crippled_hashmap_ops",     &crippled_hashmap_ops,     slow ? 1 << 14 : 140 },
         };
 
         log_info("/* %s (%s) */", __func__, slow ? "slow" : "fast");
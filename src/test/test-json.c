@@ -8,6 +8,7 @@
 #include "fileio.h"
 #include "json-internal.h"
 #include "json.h"
+#include "stdio-util.h"
 #include "string-util.h"
 #include "strv.h"
 #include "tests.h"
@@ -102,6 +103,20 @@ static void test_variant(const char *data, Test test) {
 
         log_info("formatted normally: %s\n", s);
 
+        {
+                /* The buffer based formatter must generate the same output as the stdio based one */
+                _cleanup_free_ char *t = NULL;
+                size_t sz = 0;
+
+                _cleanup_fclose_ FILE *f = NULL;
+                assert_se(f = open_memstream_unlocked(&t, &sz));
+                json_variant_dump(v, 0, f, NULL);
+                assert_se(fflush_and_check(f) >= 0);
+                f = safe_fclose(f);
+
+                assert_se(streq(s, t));
+        }
+
         r = json_parse(data, JSON_PARSE_SENSITIVE, &w, NULL, NULL);
         assert_se(r == 0);
         assert_se(w);
@@ -431,6 +446,67 @@ static void test_depth(void) {
         fputs("\n", stdout);
 }
 
+static void test_lazy(void) {
+        _cleanup_(json_variant_unrefp) JsonVariant *v = NULL, *w = NULL;
+        _cleanup_free_ char *text = NULL, *a = NULL, *b = NULL;
+        JsonVariant *e;
+        size_t n = 0, allocated = 0;
+        unsigned line, column;
+
+        log_info("/* %s */", __func__);
+
+        /* Build a document with nested containers large enough to be parsed lazily */
+        assert_se(GREEDY_REALLOC(text, allocated, 1));
+        text[n++] = '{';
+        for (unsigned i = 0; i < 16; i++) {
+                char buf[128];
+
+                xsprintf(buf, "%s\"key%u\": { \"index\": %u, \"list\": [", i > 0 ? ", " : "", i, i);
+                assert_se(GREEDY_REALLOC(text, allocated, n + strlen(buf) + 32 * 16 + 8));
+                n = stpcpy(text + n, buf) - text;
+                for (unsigned j = 0; j < 32; j++)
+                        n += sprintf(text + n, "%s{ \"v\": \"x\\n%u\" }", j > 0 ? ", " : "", j);
+                n = stpcpy(text + n, "] }") - text;
+        }
+        assert_se(GREEDY_REALLOC(text, allocated, n + 2));
+        text[n++] = '}';
+        text[n] = 0;
+
+        assert_se(json_parse(text, 0, &v, NULL, NULL) >= 0);
+        assert_se(json_parse(text, JSON_PARSE_LAZY, &w, NULL, NULL) >= 0);
+
+        assert_se(json_variant_elements(w) == 32);
+        assert_se(e = json_variant_by_key(w, "key7"));
+        assert_se(json_variant_unsigned(json_variant_by_key(e, "index")) == 7);
+        assert_se(e = json_variant_by_key(e, "list"));
+        assert_se(json_variant_elements(e) == 32);
+        assert_se(streq(json_variant_string(json_variant_by_key(json_variant_by_index(e, 3), "v")), "x\n3"));
+
+        /* Building explicitly reports errors, and is a NOP for anything that is already built */
+        assert_se(e = json_variant_by_key(w, "key9"));
+        assert_se(json_variant_materialize(e) >= 0);
+        assert_se(json_variant_materialize(e) >= 0);
+        assert_se(json_variant_elements(e) == 4);
+        assert_se(json_variant_materialize(v) >= 0);
+        assert_se(json_variant_materialize(NULL) >= 0);
+
+        assert_se(json_variant_equal(v, w));
+        assert_se(json_variant_format(v, 0, &a) >= 0);
+        assert_se(json_variant_format(w, 0, &b) >= 0);
+        assert_se(streq(a, b));
+
+        w = json_variant_unref(w);
+        assert_se(json_parse(text, JSON_PARSE_LAZY|JSON_PARSE_SENSITIVE, &w, NULL, NULL) >= 0);
+        assert_se(json_variant_is_sensitive(json_variant_by_key(json_variant_by_key(w, "key15"), "list")));
+        assert_se(json_variant_equal(v, w));
+
+        /* Nested containers are still validated up front */
+        text[n - 20] = ':';
+        w = json_variant_unref(w);
+        assert_se(json_parse(text, JSON_PARSE_LAZY, &w, &line, &column) == -EINVAL);
+        assert_se(line == 1);
+}
+
 static void test_normalize(void) {
         log_info("/* %s */", __func__);
 
@@ -558,6 +634,11 @@ int main(int argc, char *argv[]) {
         test_tokenizer("\"\\ud800a\"", -EINVAL);
         test_tokenizer("\"\\udc00\\udc00\"", -EINVAL);
         test_tokenizer("\"\\ud801\\udc37\"", JSON_TOKEN_STRING, "\xf0\x90\x90\xb7", JSON_TOKEN_END);
+        test_tokenizer("\"foo\\\"bar\xc3\xa4\\tbaz\\\\\"", JSON_TOKEN_STRING, "foo\"bar\xc3\xa4\tbaz\\", JSON_TOKEN_END);
+        test_tokenizer("\"foo\xc3\"", -EINVAL);
+        test_tokenizer("\"foo\x7f\"", -EINVAL);
+        test_tokenizer("\"foo\nbar\"", -EINVAL);
+        test_tokenizer("\"foo", -EINVAL);
 
         test_tokenizer("[1, 2, -3]", JSON_TOKEN_ARRAY_OPEN, JSON_TOKEN_UNSIGNED, (uintmax_t) 1, JSON_TOKEN_COMMA, JSON_TOKEN_UNSIGNED, (uintmax_t) 2, JSON_TOKEN_COMMA, JSON_TOKEN_INTEGER, (intmax_t) -3, JSON_TOKEN_ARRAY_CLOSE, JSON_TOKEN_END);
 
@@ -565,11 +646,13 @@ int main(int argc, char *argv[]) {
         test_variant("{\"mutant\": [1, null, \"1\", {\"1\": [1, \"1\"]}], \"thisisaverylongproperty\": 1.27}", test_2);
         test_variant("{\"foo\" : \"\\u0935\\u093f\\u0935\\u0947\\u0915\\u0916\\u094d\\u092f\\u093e\\u0924\\u093f\\u0930\\u0935\\u093f\\u092a\\u094d\\u0932\\u0935\\u093e\\u0020\\u0939\\u093e\\u0928\\u094b\\u092a\\u093e\\u092f\\u0903\\u0964\"}", NULL);
 
+        test_variant("[ \"\\u0001\\u001f\\b\\f\\n\\r\\t\\\"\\\\/\\u007f\xc3\xa4\", \"x\\ny\", -1, 18446744073709551615, 3.5e-7, true, false, null, {}, [] ]", NULL);
         test_variant("[ 0, -0, 0.0, -0.0, 0.000, -0.000, 0e0, -0e0, 0e+0, -0e-0, 0e-0, -0e000, 0e+000 ]", test_zeroes);
 
         test_build();
         test_source();
         test_depth();
+        test_lazy();
 
         test_normalize();
         test_bisect();
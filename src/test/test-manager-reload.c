@@ -0,0 +1,223 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+
+#include "alloc-util.h"
+#include "fileio.h"
+#include "fs-util.h"
+#include "manager.h"
+#include "mkdir.h"
+#include "path-util.h"
+#include "rm-rf.h"
+#include "service.h"
+#include "socket.h"
+#include "string-util.h"
+#include "strv.h"
+#include "tests.h"
+#include "tmpfile-util.h"
+#include "unit.h"
+
+static char *unit_dir = NULL;
+
+static void write_unit(const char *name, const char *contents) {
+        _cleanup_free_ char *p = NULL;
+
+        assert_se(p = path_join(unit_dir, name));
+        assert_se(mkdir_parents(p, 0755) >= 0);
+        assert_se(write_string_file(p, contents, WRITE_STRING_FILE_CREATE|WRITE_STRING_FILE_ATOMIC) >= 0);
+}
+
+static Unit *load_unit(Manager *m, const char *name) {
+        Unit *u;
+
+        assert_se(manager_load_startable_unit_or_warn(m, name, NULL, &u) >= 0);
+        return u;
+}
+
+/* Units which are not loaded again keep whatever we set in memory, which is not serialized */
+static void mark_unit(Unit *u) {
+        assert_se(free_and_strdup(&u->description, "marker") >= 0);
+}
+
+static bool unit_marked(Manager *m, const char *name) {
+        Unit *u;
+
+        assert_se(u = manager_get_unit(m, name));
+        return streq_ptr(u->description, "marker");
+}
+
+static void reload(Manager *m) {
+        /* Like the main loop does it, see invoke_main_loop() */
+        m->objective = MANAGER_RELOAD;
+        assert_se(manager_reload(m) >= 0);
+        assert_se(m->objective == MANAGER_OK);
+        assert_se(m->n_reloading == 0);
+}
+
+static void test_unchanged(Manager *m) {
+        log_info("/* %s */", __func__);
+
+        /* Adding unit files always reloads everything, after that we are where the tests start off */
+        write_unit("unchanged.service", "[Service]\nExecStart=/bin/true\n");
+        reload(m);
+
+        mark_unit(load_unit(m, "unchanged.service"));
+        reload(m);
+
+        /* Nothing changed, nothing is loaded again */
+        assert_se(unit_marked(m, "unchanged.service"));
+}
+
+static void test_changed(Manager *m) {
+        Unit *a, *b;
+
+        log_info("/* %s */", __func__);
+
+        write_unit("changed-a.service", "[Unit]\nDescription=a\n[Service]\nExecStart=/bin/true\n");
+        write_unit("changed-b.service", "[Unit]\nAfter=changed-a.service\n[Service]\nExecStart=/bin/true\n");
+        reload(m);
+
+        a = load_unit(m, "changed-a.service");
+        b = load_unit(m, "changed-b.service");
+        assert_se(unit_has_dependency(a, UNIT_BEFORE, b));
+        mark_unit(a);
+        mark_unit(b);
+
+        /* Only the changed unit is loaded again, and the dependencies others configured on it are kept */
+        write_unit("changed-a.service", "[Unit]\nDescription=changed\n[Service]\nExecStart=/bin/true\n");
+        reload(m);
+
+        assert_se(a = manager_get_unit(m, "changed-a.service"));
+        assert_se(streq(a->description, "changed"));
+        assert_se(unit_marked(m, "changed-b.service"));
+        assert_se(b = manager_get_unit(m, "changed-b.service"));
+        assert_se(unit_has_dependency(a, UNIT_BEFORE, b));
+        assert_se(unit_has_dependency(b, UNIT_AFTER, a));
+
+        /* Same for drop-ins that were added */
+        write_unit("changed-a.service.d/description.conf", "[Unit]\nDescription=drop-in\n");
+        mark_unit(a);
+        reload(m);
+
+        assert_se(a = manager_get_unit(m, "changed-a.service"));
+        assert_se(streq(a->description, "drop-in"));
+        assert_se(unit_marked(m, "changed-b.service"));
+}
+
+static void test_references(Manager *m) {
+        Unit *s, *u;
+
+        log_info("/* %s */", __func__);
+
+        write_unit("reference.service", "[Service]\nExecStart=/bin/true\n");
+        write_unit("reference.socket", "[Socket]\nListenStream=/run/test-manager-reload.sock\n");
+        reload(m);
+
+        s = load_unit(m, "reference.socket");
+        assert_se(u = UNIT_DEREF(SOCKET(s)->service));
+        assert_se(streq(u->id, "reference.service"));
+
+        /* The socket keeps referencing its service once that is loaded again */
+        write_unit("reference.service", "[Unit]\nDescription=changed\n[Service]\nExecStart=/bin/true\n");
+        reload(m);
+
+        assert_se(u = manager_get_unit(m, "reference.service"));
+        assert_se(streq(u->description, "changed"));
+        assert_se(manager_get_unit(m, "reference.socket") == s);
+        assert_se(UNIT_DEREF(SOCKET(s)->service) == u);
+        assert_se(u->refs_by_target);
+}
+
+static void test_running(Manager *m) {
+        _cleanup_(sd_bus_error_free) sd_bus_error error = SD_BUS_ERROR_NULL;
+        usec_t timeout;
+        Unit *u;
+        Job *j;
+
+        log_info("/* %s */", __func__);
+
+        write_unit("running.target", "[Unit]\nDescription=running\n");
+        reload(m);
+
+        u = load_unit(m, "running.target");
+        mark_unit(load_unit(m, "unchanged.service"));
+
+        assert_se(manager_add_job(m, JOB_START, u, JOB_REPLACE, NULL, &error, &j) >= 0);
+        timeout = now(CLOCK_MONOTONIC) + 10 * USEC_PER_SEC;
+        while (u->job) {
+                assert_se(now(CLOCK_MONOTONIC) < timeout);
+                assert_se(sd_event_run(m->event, 100 * USEC_PER_MSEC) >= 0);
+        }
+        assert_se(unit_active_state(u) == UNIT_ACTIVE);
+
+        /* Running units are loaded again on their own, and keep running */
+        write_unit("running.target.d/description.conf", "[Unit]\nDescription=changed\n");
+        reload(m);
+
+        assert_se(u = manager_get_unit(m, "running.target"));
+        assert_se(streq(u->description, "changed"));
+        assert_se(unit_active_state(u) == UNIT_ACTIVE);
+        assert_se(unit_marked(m, "unchanged.service"));
+}
+
+static void test_defaults_changed(Manager *m) {
+        Unit *u;
+
+        log_info("/* %s */", __func__);
+
+        write_unit("defaults.service", "[Service]\nExecStart=/bin/true\n");
+        reload(m);
+
+        mark_unit(load_unit(m, "unchanged.service"));
+        (void) load_unit(m, "defaults.service");
+
+        /* When the defaults changed, as after reading system.conf again, all units are loaded again, so that
+         * they pick them up, not just those whose unit files changed */
+        m->default_timeout_start_usec += USEC_PER_SEC;
+        write_unit("defaults.service", "[Unit]\nDescription=changed\n[Service]\nExecStart=/bin/true\n");
+        reload(m);
+
+        assert_se(!unit_marked(m, "unchanged.service"));
+        assert_se(u = manager_get_unit(m, "unchanged.service"));
+        assert_se(SERVICE(u)->timeout_start_usec == m->default_timeout_start_usec);
+        assert_se(u = manager_get_unit(m, "defaults.service"));
+        assert_se(streq(u->description, "changed"));
+
+        /* And the same for the environment */
+        mark_unit(load_unit(m, "unchanged.service"));
+        assert_se(manager_transient_environment_add(m, STRV_MAKE("TEST_MANAGER_RELOAD=1")) >= 0);
+        reload(m);
+
+        assert_se(!unit_marked(m, "unchanged.service"));
+}
+
+int main(int argc, char *argv[]) {
+        _cleanup_(rm_rf_physical_and_freep) char *runtime_dir = NULL, *dir = NULL;
+        _cleanup_(manager_freep) Manager *m = NULL;
+        int r;
+
+        test_setup_logging(LOG_DEBUG);
+
+        r = enter_cgroup_subroot(NULL);
+        if (r == -ENOMEDIUM)
+                return log_tests_skipped("cgroupfs not available");
+
+        assert_se(mkdtemp_malloc("/tmp/test-manager-reload-XXXXXX", &dir) >= 0);
+        unit_dir = dir;
+        assert_se(set_unit_path(unit_dir) >= 0);
+        assert_se(runtime_dir = setup_fake_runtime_dir());
+
+        assert_se(unsetenv("SYSTEMD_INCREMENTAL_RELOAD") >= 0);
+
+        r = manager_new(UNIT_FILE_USER, MANAGER_TEST_RUN_BASIC, &m);
+        if (manager_errno_skip_test(r))
+                return log_tests_skipped_errno(r, "manager_new");
+        assert_se(r >= 0);
+        assert_se(manager_startup(m, NULL, NULL) >= 0);
+
+        test_unchanged(m);
+        test_changed(m);
+        test_references(m);
+        test_running(m);
+        test_defaults_changed(m);
+
+        return 0;
+}
@@ -0,0 +1,105 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+
+#include <pthread.h>
+
+#include "macro.h"
+#include "memory-util.h"
+#include "mempool.h"
+#include "tests.h"
+
+#define N_THREADS 4U
+#define N_TILES 1000U
+
+typedef struct Tile {
+        uint64_t payload[4];
+} Tile;
+
+DEFINE_MEMPOOL(tile_pool, Tile, 8);
+
+static void test_alloc_free(void) {
+        Tile *tiles[N_TILES];
+
+        log_info("/* %s */", __func__);
+
+        for (unsigned i = 0; i < N_TILES; i++) {
+                assert_se(tiles[i] = mempool_alloc0_tile(&tile_pool));
+                assert_se(memeqzero(tiles[i], sizeof(Tile)));
+
+                for (unsigned j = 0; j < i; j++)
+                        assert_se(tiles[i] != tiles[j]);
+
+                tiles[i]->payload[0] = i;
+        }
+
+        for (unsigned i = 0; i < N_TILES; i++)
+                assert_se(tiles[i]->payload[0] == i);
+
+        /* Free in a different order than allocated, and reuse */
+        for (unsigned i = 0; i < N_TILES; i += 2)
+                mempool_free_tile(&tile_pool, tiles[i]);
+        for (unsigned i = 1; i < N_TILES; i += 2)
+                mempool_free_tile(&tile_pool, tiles[i]);
+
+        for (unsigned i = 0; i < N_TILES; i++)
+                assert_se(tiles[i] = mempool_alloc_tile(&tile_pool));
+        for (unsigned i = 0; i < N_TILES; i++)
+                mempool_free_tile(&tile_pool, tiles[i]);
+}
+
+static void* thread_alloc(void *p) {
+        Tile **tiles = p;
+
+        for (unsigned i = 0; i < N_TILES; i++) {
+                assert_se(tiles[i] = mempool_alloc0_tile(&tile_pool));
+                tiles[i]->payload[0] = i;
+                tiles[i]->payload[3] = PTR_TO_UINT64(tiles);
+        }
+
+        return NULL;
+}
+
+static void* thread_free(void *p) {
+        Tile **tiles = p;
+
+        /* Frees tiles allocated by another thread */
+        for (unsigned i = 0; i < N_TILES; i++) {
+                assert_se(tiles[i]->payload[0] == i);
+                assert_se(tiles[i]->payload[3] == PTR_TO_UINT64(tiles));
+                mempool_free_tile(&tile_pool, tiles[i]);
+        }
+
+        return NULL;
+}
+
+static void test_threads(void) {
+        static Tile *tiles[N_THREADS][N_TILES];
+        pthread_t t[N_THREADS];
+
+        log_info("/* %s */", __func__);
+
+        for (unsigned round = 0; round < 3; round++) {
+                for (unsigned i = 0; i < N_THREADS; i++)
+                        assert_se(pthread_create(t + i, NULL, thread_alloc, tiles[i]) == 0);
+                for (unsigned i = 0; i < N_THREADS; i++)
+                        assert_se(pthread_join(t[i], NULL) == 0);
+
+                for (unsigned i = 0; i < N_THREADS; i++)
+                        for (unsigned j = 0; j < N_TILES; j++)
+                                for (unsigned k = 0; k < i; k++)
+                                        assert_se(tiles[i][j] != tiles[k][j]);
+
+                for (unsigned i = 0; i < N_THREADS; i++)
+                        assert_se(pthread_create(t + i, NULL, thread_free, tiles[(i + 1) % N_THREADS]) == 0);
+                for (unsigned i = 0; i < N_THREADS; i++)
+                        assert_se(pthread_join(t[i], NULL) == 0);
+        }
+}
+
+int main(int argc, char *argv[]) {
+        test_setup_logging(LOG_DEBUG);
+
+        test_alloc_free();
+        test_threads();
+
+        return 0;
+}
@@ -0,0 +1,136 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+
+#include <stdio.h>
+
+#include "alloc-util.h"
+#include "fd-util.h"
+#include "fileio.h"
+#include "hashmap.h"
+#include "libmount-util.h"
+#include "mount.h"
+#include "string-util.h"
+#include "tests.h"
+#include "time-util.h"
+
+/* Generates a synthetic /proc/self/mountinfo with n entries. If 'remount' is specified, that entry is made
+ * read-only, if 'skip' is specified that entry is left out, and if 'extra' is set another entry is added. */
+static char *make_mountinfo(unsigned n, unsigned remount, unsigned skip, bool extra) {
+        _cleanup_free_ char *buf = NULL;
+        _cleanup_fclose_ FILE *f = NULL;
+        size_t size;
+
+        assert_se(f = open_memstream_unlocked(&buf, &size));
+
+        for (unsigned i = 0; i < n; i++)
+                if (i != skip)
+                        fprintf(f, "%u 1 0:%u / /run/test/%u %s,relatime shared:%u - tmpfs tmpfs rw\n",
+                                100 + i, 100 + i, i, i == remount ? "ro" : "rw", 100 + i);
+        if (extra)
+                fprintf(f, "%u 1 0:%u / /run/test/extra rw,relatime - tmpfs tmpfs rw\n", 100 + n, 100 + n);
+
+        assert_se(fflush_and_check(f) >= 0);
+        f = safe_fclose(f);
+
+        return TAKE_PTR(buf);
+}
+
+static void apply(Hashmap **entries, unsigned *generation, const char *mountinfo, unsigned *ret_changed, unsigned *ret_gone) {
+        _cleanup_(mnt_free_tablep) struct libmnt_table *table = NULL;
+        _cleanup_(mnt_free_iterp) struct libmnt_iter *iter = NULL;
+        _cleanup_fclose_ FILE *f = NULL;
+        char ts[FORMAT_TIMESPAN_MAX], td[FORMAT_TIMESPAN_MAX];
+        unsigned n_changed = 0;
+        usec_t t0, t1, t2;
+
+        assert_se(f = fmemopen((char*) mountinfo, strlen(mountinfo), "re"));
+
+        t0 = now(CLOCK_MONOTONIC);
+        assert_se(libmount_parse("/proc/self/mountinfo", f, &table, &iter) >= 0);
+        t1 = now(CLOCK_MONOTONIC);
+
+        (*generation)++;
+
+        for (;;) {
+                struct libmnt_fs *fs;
+                MountInfoEntry *e;
+                int r;
+
+                r = mnt_table_next_fs(table, iter, &fs);
+                if (r == 1)
+                        break;
+                assert_se(r == 0);
+
+                r = mount_info_entry_update(entries,
+                                            mnt_fs_get_id(fs),
+                                            mnt_fs_get_source(fs),
+                                            mnt_fs_get_target(fs),
+                                            mnt_fs_get_options(fs),
+                                            mnt_fs_get_fstype(fs),
+                                            *generation,
+                                            &e);
+                assert_se(r >= 0);
+                assert_se(e->id == mnt_fs_get_id(fs));
+                if (r > 0) {
+                        assert_se(!e->unit);
+                        assert_se(e->unit = strdup("foo.mount"));
+                        n_changed++;
+                } else
+                        assert_se(streq(e->unit, "foo.mount"));
+        }
+
+        *ret_gone = mount_info_entries_prune(*entries, *generation);
+        *ret_changed = n_changed;
+        t2 = now(CLOCK_MONOTONIC);
+
+        log_info("    parse %s, diff %s: %u new or changed, %u gone",
+                 format_timespan(ts, sizeof(ts), t1 - t0, 1),
+                 format_timespan(td, sizeof(td), t2 - t1, 1),
+                 n_changed, *ret_gone);
+}
+
+static void test_mount_info_entries(unsigned n) {
+        _cleanup_free_ char *a = NULL, *b = NULL;
+        Hashmap *entries = NULL;
+        unsigned generation = 0, changed, gone;
+
+        log_info("/* %s(%u) */", __func__, n);
+
+        assert_se(a = make_mountinfo(n, UINT_MAX, UINT_MAX, false));
+        assert_se(b = make_mountinfo(n, n / 2, n / 3, true));
+
+        /* Everything is new on the first pass */
+        apply(&entries, &generation, a, &changed, &gone);
+        assert_se(changed == n && gone == 0);
+        assert_se(hashmap_size(entries) == n);
+
+        /* Nothing changed */
+        apply(&entries, &generation, a, &changed, &gone);
+        assert_se(changed == 0 && gone == 0);
+
+        /* One remount, one unmount, one new mount */
+        apply(&entries, &generation, b, &changed, &gone);
+        assert_se(changed == 2 && gone == 1);
+        assert_se(hashmap_size(entries) == n);
+        assert_se(!hashmap_get(entries, INT_TO_PTR(100 + n / 3)));
+        assert_se(hashmap_get(entries, INT_TO_PTR(100 + n)));
+
+        /* And back */
+        apply(&entries, &generation, a, &changed, &gone);
+        assert_se(changed == 2 && gone == 1);
+
+        hashmap_free(entries);
+}
+
+int main(int argc, char *argv[]) {
+        test_setup_logging(LOG_INFO);
+
+        /* Doubles as a benchmark: with growing tables the cost of the diff should stay a small fraction of
+         * the parsing */
+        test_mount_info_entries(10);
+        test_mount_info_entries(1000);
+        test_mount_info_entries(10000);
+        if (slow_tests_enabled())
+                test_mount_info_entries(100000);
+
+        return 0;
+}
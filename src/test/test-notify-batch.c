@@ -0,0 +1,139 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "fd-util.h"
+#include "io-util.h"
+#include "manager.h"
+#include "process-util.h"
+#include "socket-util.h"
+#include "string-util.h"
+#include "tests.h"
+
+static int fds[2] = { -1, -1 };
+
+static void send_message(const char *text, bool with_fd) {
+        CMSG_BUFFER_TYPE(CMSG_SPACE(sizeof(int))) control = {};
+        struct iovec iovec = IOVEC_MAKE_STRING(text);
+        struct msghdr mh = {
+                .msg_iov = &iovec,
+                .msg_iovlen = 1,
+        };
+
+        if (with_fd) {
+                struct cmsghdr *cmsg;
+
+                mh.msg_control = &control;
+                mh.msg_controllen = sizeof(control);
+
+                cmsg = CMSG_FIRSTHDR(&mh);
+                cmsg->cmsg_level = SOL_SOCKET;
+                cmsg->cmsg_type = SCM_RIGHTS;
+                cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+                memcpy(CMSG_DATA(cmsg), &fds[1], sizeof(int));
+        }
+
+        assert_se(sendmsg(fds[1], &mh, MSG_NOSIGNAL) >= 0);
+}
+
+static void send_message_from_child(const char *text) {
+        int r;
+
+        /* Sent by another process, which hence has another PID */
+        r = safe_fork("(notify)", FORK_WAIT|FORK_LOG, NULL);
+        assert_se(r >= 0);
+        if (r == 0) {
+                send_message(text, false);
+                _exit(EXIT_SUCCESS);
+        }
+}
+
+static void receive(NotifyBatch *b, size_t n, const char *superseded) {
+        int k;
+
+        /* superseded is a string of '0' and '1', one for each message */
+        assert_se(strlen(superseded) == n);
+
+        k = notify_batch_receive(b, fds[0]);
+        assert_se(k >= 0);
+        assert_se((size_t) k == n);
+
+        for (size_t i = 0; i < n; i++) {
+                log_debug("Message %zu, superseded: %c", i, superseded[i]);
+                assert_se(notify_batch_superseded(b, n, i) == (superseded[i] == '1'));
+        }
+
+        assert_se(notify_batch_receive(b, fds[0]) == -EAGAIN);
+}
+
+static void test_same_pid(NotifyBatch *b) {
+        log_info("/* %s */", __func__);
+
+        send_message("WATCHDOG=1", false);
+        send_message("WATCHDOG=1\n", false);
+        send_message("STATUS=one", false);
+        send_message("STATUS=two", false);
+        send_message("WATCHDOG=1", false);
+        receive(b, 5, "10100");
+
+        /* Only messages of another process come between these two */
+        send_message("STATUS=one", false);
+        send_message_from_child("STATUS=child");
+        send_message_from_child("READY=1");
+        send_message("STATUS=two", false);
+        receive(b, 4, "1000");
+}
+
+static void test_other_message(NotifyBatch *b) {
+        log_info("/* %s */", __func__);
+
+        /* Messages with anything else are processed in order, and hence stop the search */
+        send_message("STATUS=one", false);
+        send_message("READY=1", false);
+        send_message("STATUS=two", false);
+        send_message("STATUS=three\nREADY=1", false);
+        send_message("STATUS=four", false);
+        receive(b, 5, "00000");
+
+        send_message("WATCHDOG=1", false);
+        send_message("STATUS=one", false);
+        send_message("WATCHDOG=1", false);
+        receive(b, 3, "000");
+}
+
+static void test_fds(NotifyBatch *b) {
+        log_info("/* %s */", __func__);
+
+        /* Messages carrying fds are neither superseded nor supersede others */
+        send_message("WATCHDOG=1", true);
+        send_message("WATCHDOG=1", false);
+        send_message("STATUS=one", false);
+        send_message("STATUS=two", true);
+        send_message("STATUS=three", false);
+        receive(b, 5, "00000");
+
+        send_message("WATCHDOG=1", false);
+        send_message("WATCHDOG=1", true);
+        send_message("WATCHDOG=1", false);
+        receive(b, 3, "000");
+}
+
+int main(int argc, char *argv[]) {
+        _cleanup_free_ NotifyBatch *b = NULL;
+
+        test_setup_logging(LOG_DEBUG);
+
+        assert_se(socketpair(AF_UNIX, SOCK_DGRAM|SOCK_CLOEXEC|SOCK_NONBLOCK, 0, fds) >= 0);
+        assert_se(setsockopt_int(fds[0], SOL_SOCKET, SO_PASSCRED, true) >= 0);
+
+        assert_se(b = notify_batch_new());
+
+        test_same_pid(b);
+        test_other_message(b);
+        test_fds(b);
+
+        safe_close_pair(fds);
+
+        return 0;
+}
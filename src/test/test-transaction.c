@@ -0,0 +1,110 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+
+#include <stdio.h>
+
+#include "bus-error.h"
+#include "manager.h"
+#include "rm-rf.h"
+#include "stdio-util.h"
+#include "target.h"
+#include "tests.h"
+#include "time-util.h"
+#include "unit.h"
+
+/* Creates n targets, all pulled in by bench.target. Each is ordered after the one before it, so that the
+ * ordering graph has a chain as deep as the transaction is large, and after a few others. If 'cycle' is
+ * set, three more targets are added, which are ordered after each other in a ring. */
+static Unit *make_targets(Manager *m, unsigned n, bool cycle, Unit ***ret, unsigned *ret_n) {
+        _cleanup_free_ Unit **units = NULL;
+        unsigned n_units = n + (cycle ? 3 : 0);
+        Unit *root;
+
+        assert_se(units = new(Unit*, n_units));
+        assert_se(unit_new_for_name(m, sizeof(Target), "bench.target", &root) >= 0);
+        root->load_state = UNIT_LOADED;
+
+        for (unsigned i = 0; i < n_units; i++) {
+                char name[STRLEN("bench-.target") + DECIMAL_STR_MAX(unsigned)];
+
+                xsprintf(name, "bench-%u.target", i);
+                assert_se(unit_new_for_name(m, sizeof(Target), name, &units[i]) >= 0);
+                units[i]->load_state = UNIT_LOADED;
+
+                assert_se(unit_add_dependency(root, UNIT_WANTS, units[i], true, UNIT_DEPENDENCY_FILE) >= 0);
+        }
+
+        for (unsigned i = 1; i < n; i++) {
+                assert_se(unit_add_dependency(units[i], UNIT_AFTER, units[i-1], true, UNIT_DEPENDENCY_FILE) >= 0);
+
+                if (i > 10)
+                        for (unsigned k = 1; k <= 3; k++)
+                                assert_se(unit_add_dependency(units[i], UNIT_AFTER, units[(i * 7919 * k) % (i - 1)], true, UNIT_DEPENDENCY_FILE) >= 0);
+        }
+
+        for (unsigned i = n; i < n_units; i++)
+                assert_se(unit_add_dependency(units[i], UNIT_AFTER, units[i + 1 < n_units ? i + 1 : n], true, UNIT_DEPENDENCY_FILE) >= 0);
+
+        *ret = TAKE_PTR(units);
+        *ret_n = n_units;
+        return root;
+}
+
+static void test_transaction_order(unsigned n, bool cycle) {
+        _cleanup_(sd_bus_error_free) sd_bus_error error = SD_BUS_ERROR_NULL;
+        _cleanup_(rm_rf_physical_and_freep) char *runtime_dir = NULL;
+        _cleanup_(manager_freep) Manager *m = NULL;
+        _cleanup_free_ Unit **units = NULL;
+        char ts[FORMAT_TIMESPAN_MAX];
+        unsigned n_units, n_jobs = 0;
+        usec_t t;
+        Unit *root;
+        Job *j;
+        int r;
+
+        log_info("/* %s(%u, %s) */", __func__, n, yes_no(cycle));
+
+        assert_se(runtime_dir = setup_fake_runtime_dir());
+        assert_se(manager_new(UNIT_FILE_USER, MANAGER_TEST_RUN_MINIMAL, &m) >= 0);
+        assert_se(manager_startup(m, NULL, NULL) >= 0);
+
+        root = make_targets(m, n, cycle, &units, &n_units);
+
+        t = now(CLOCK_MONOTONIC);
+        r = manager_add_job(m, JOB_START, root, JOB_REPLACE, NULL, &error, &j);
+        t = now(CLOCK_MONOTONIC) - t;
+        if (r < 0)
+                log_error_errno(r, "Failed to add job: %s", bus_error_message(&error, r));
+        assert_se(r >= 0);
+
+        for (unsigned i = 0; i < n_units; i++)
+                if (units[i]->job)
+                        n_jobs++;
+
+        log_info("Transaction with %u jobs took %s", n_jobs + 1, format_timespan(ts, sizeof(ts), t, 1));
+
+        /* With a cycle, exactly one job has to go to break it */
+        assert_se(n_jobs == (cycle ? n_units - 1 : n_units));
+}
+
+int main(int argc, char *argv[]) {
+        int r;
+
+        test_setup_logging(LOG_INFO);
+
+        r = enter_cgroup_subroot(NULL);
+        if (r == -ENOMEDIUM)
+                return log_tests_skipped("cgroupfs not available");
+
+        /* Doubles as a benchmark: checking the ordering of the transaction should stay linear in the size of
+         * the graph, and must not recurse along the ordering chains */
+        test_transaction_order(100, false);
+        test_transaction_order(100, true);
+        test_transaction_order(10000, false);
+        test_transaction_order(10000, true);
+        if (slow_tests_enabled()) {
+                test_transaction_order(50000, false);
+                test_transaction_order(50000, true);
+        }
+
+        return 0;
+}
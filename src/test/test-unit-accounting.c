@@ -0,0 +1,236 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+
+#include <pthread.h>
+#include <sys/socket.h>
+
+#include "sd-bus.h"
+
+#include "bus-error.h"
+#include "cgroup.h"
+#include "dbus-manager.h"
+#include "fd-util.h"
+#include "manager.h"
+#include "rm-rf.h"
+#include "service.h"
+#include "strv.h"
+#include "tests.h"
+#include "unit.h"
+#include "varlink.h"
+
+typedef struct Client {
+        int fd;
+        const char *unit;
+        bool done;
+} Client;
+
+static Unit* make_unit(Manager *m, const char *name) {
+        CGroupContext *c;
+        Unit *u;
+
+        assert_se(unit_new_for_name(m, sizeof(Service), name, &u) >= 0);
+        u->load_state = UNIT_LOADED;
+
+        assert_se(c = unit_get_cgroup_context(u));
+        c->cpu_accounting = c->memory_accounting = c->tasks_accounting = true;
+
+        assert_se(unit_realize_cgroup(u) >= 0);
+        assert_se(u->cgroup_path);
+
+        return u;
+}
+
+static void test_unit_get_accounting(Manager *m) {
+        UnitAccounting a, b;
+        Unit *u;
+
+        log_info("/* %s */", __func__);
+
+        u = make_unit(m, "accounting-cache.service");
+
+        assert_se(!u->accounting_cache);
+        assert_se(unit_get_accounting(u, true, &a) >= 0);
+        assert_se(a.timestamp > 0);
+        assert_se(u->accounting_cache);
+
+        /* Within the caching period, the previous readout is returned. Mark it, so that we can tell. */
+        u->accounting_cache->tasks_current = 4711;
+        assert_se(unit_get_accounting(u, true, &b) >= 0);
+        assert_se(b.timestamp == a.timestamp);
+        assert_se(b.tasks_current == 4711);
+
+        /* Unless the caller insists on fresh data */
+        assert_se(unit_get_accounting(u, false, &b) >= 0);
+        assert_se(b.timestamp >= a.timestamp);
+        assert_se(b.tasks_current != 4711);
+
+        /* After the caching period, the counters are read again */
+        u->accounting_cache->timestamp -= UNIT_ACCOUNTING_CACHE_USEC;
+        u->accounting_cache->tasks_current = 4711;
+        a = *u->accounting_cache;
+        assert_se(unit_get_accounting(u, true, &b) >= 0);
+        assert_se(b.timestamp > a.timestamp);
+        assert_se(b.tasks_current != 4711);
+
+        /* Resetting any counter drops the cache */
+        assert_se(u->accounting_cache);
+        (void) unit_reset_cpu_accounting(u);
+        assert_se(!u->accounting_cache);
+        assert_se(unit_get_accounting(u, true, &a) >= 0);
+        assert_se(u->accounting_cache);
+        (void) unit_reset_io_accounting(u);
+        assert_se(!u->accounting_cache);
+}
+
+static void* bus_client(void *p) {
+        _cleanup_(sd_bus_error_free) sd_bus_error error = SD_BUS_ERROR_NULL;
+        _cleanup_(sd_bus_message_unrefp) sd_bus_message *reply = NULL;
+        _cleanup_(sd_bus_flush_close_unrefp) sd_bus *bus = NULL;
+        Client *c = p;
+        unsigned n = 0;
+        const char *id;
+
+        assert_se(sd_bus_new(&bus) >= 0);
+        assert_se(sd_bus_set_fd(bus, c->fd, c->fd) >= 0);
+        assert_se(sd_bus_start(bus) >= 0);
+
+        /* Units that don't exist are skipped */
+        assert_se(sd_bus_call_method(bus,
+                                     "org.freedesktop.systemd1",
+                                     "/org/freedesktop/systemd1",
+                                     "org.freedesktop.systemd1.Manager",
+                                     "GetUnitsAccounting",
+                                     &error,
+                                     &reply,
+                                     "as", 2, c->unit, "nonexistent.service") >= 0);
+
+        assert_se(sd_bus_message_enter_container(reply, 'a', "(sttttttttttt)") >= 0);
+        while (sd_bus_message_read(reply, "(sttttttttttt)", &id, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL) > 0) {
+                assert_se(streq(id, c->unit));
+                n++;
+        }
+        assert_se(n == 1);
+
+        c->done = true;
+        return NULL;
+}
+
+static void test_get_units_accounting_bus(Manager *m) {
+        _cleanup_(sd_bus_flush_close_unrefp) sd_bus *bus = NULL;
+        _cleanup_close_pair_ int pair[2] = { -1, -1 };
+        Client c = {
+                .unit = "accounting-bus.service",
+        };
+        pthread_t t;
+        sd_id128_t id;
+
+        log_info("/* %s */", __func__);
+
+        (void) make_unit(m, c.unit);
+
+        assert_se(socketpair(AF_UNIX, SOCK_STREAM|SOCK_CLOEXEC|SOCK_NONBLOCK, 0, pair) >= 0);
+        assert_se(sd_id128_randomize(&id) >= 0);
+
+        assert_se(sd_bus_new(&bus) >= 0);
+        assert_se(sd_bus_set_fd(bus, pair[0], pair[0]) >= 0);
+        TAKE_FD(pair[0]);
+        assert_se(sd_bus_set_server(bus, true, id) >= 0);
+        assert_se(sd_bus_add_object_vtable(bus, NULL, "/org/freedesktop/systemd1", "org.freedesktop.systemd1.Manager", bus_manager_vtable, m) >= 0);
+        assert_se(sd_bus_start(bus) >= 0);
+        assert_se(sd_bus_attach_event(bus, m->event, SD_EVENT_PRIORITY_NORMAL) >= 0);
+
+        c.fd = TAKE_FD(pair[1]);
+        assert_se(pthread_create(&t, NULL, bus_client, &c) == 0);
+
+        while (!c.done)
+                assert_se(sd_event_run(m->event, 100 * USEC_PER_MSEC) >= 0);
+
+        assert_se(pthread_join(t, NULL) == 0);
+}
+
+static void* varlink_client(void *p) {
+        _cleanup_(varlink_flush_close_unrefp) Varlink *v = NULL;
+        JsonVariant *reply = NULL, *units;
+        const char *error_id = NULL;
+        Client *c = p;
+        char **names = STRV_MAKE(c->unit, "nonexistent.service");
+        bool found = false;
+
+        assert_se(varlink_connect_fd(&v, c->fd) >= 0);
+
+        assert_se(varlink_callb(v, "io.systemd.Manager.GetUnitsAccounting", &reply, &error_id, NULL,
+                                JSON_BUILD_OBJECT(JSON_BUILD_PAIR("units", JSON_BUILD_STRV(names)))) >= 0);
+        assert_se(!error_id);
+        assert_se(units = json_variant_by_key(reply, "units"));
+        assert_se(json_variant_elements(units) == 1);
+        assert_se(streq(json_variant_string(json_variant_by_key(json_variant_by_index(units, 0), "name")), c->unit));
+
+        /* No names means all units with a cgroup */
+        assert_se(varlink_callb(v, "io.systemd.Manager.GetUnitsAccounting", &reply, &error_id, NULL,
+                                JSON_BUILD_OBJECT(JSON_BUILD_PAIR("units", JSON_BUILD_EMPTY_ARRAY))) >= 0);
+        assert_se(!error_id);
+        assert_se(units = json_variant_by_key(reply, "units"));
+        for (size_t i = 0; i < json_variant_elements(units); i++)
+                if (streq(json_variant_string(json_variant_by_key(json_variant_by_index(units, i), "name")), c->unit))
+                        found = true;
+        assert_se(found);
+
+        c->done = true;
+        return NULL;
+}
+
+static void test_get_units_accounting_varlink(Manager *m) {
+        _cleanup_close_pair_ int pair[2] = { -1, -1 };
+        Client c = {
+                .unit = "accounting-varlink.service",
+        };
+        pthread_t t;
+
+        log_info("/* %s */", __func__);
+
+        (void) make_unit(m, c.unit);
+
+        assert_se(m->varlink_server);
+        assert_se(socketpair(AF_UNIX, SOCK_STREAM|SOCK_CLOEXEC, 0, pair) >= 0);
+        assert_se(varlink_server_add_connection(m->varlink_server, pair[0], NULL) >= 0);
+        TAKE_FD(pair[0]);
+
+        c.fd = TAKE_FD(pair[1]);
+        assert_se(pthread_create(&t, NULL, varlink_client, &c) == 0);
+
+        while (!c.done)
+                assert_se(sd_event_run(m->event, 100 * USEC_PER_MSEC) >= 0);
+
+        assert_se(pthread_join(t, NULL) == 0);
+}
+
+int main(int argc, char *argv[]) {
+        _cleanup_(rm_rf_physical_and_freep) char *runtime_dir = NULL;
+        _cleanup_(manager_freep) Manager *m = NULL;
+        _cleanup_free_ char *unit_dir = NULL;
+        int r;
+
+        test_setup_logging(LOG_DEBUG);
+
+        if (getuid() != 0)
+                return log_tests_skipped("not root");
+        r = enter_cgroup_subroot(NULL);
+        if (r == -ENOMEDIUM)
+                return log_tests_skipped("cgroupfs not available");
+
+        assert_se(get_testdata_dir("units", &unit_dir) >= 0);
+        assert_se(set_unit_path(unit_dir) >= 0);
+        assert_se(runtime_dir = setup_fake_runtime_dir());
+
+        /* The Varlink server is only set up by the system manager */
+        r = manager_new(UNIT_FILE_SYSTEM, MANAGER_TEST_RUN_BASIC, &m);
+        if (manager_errno_skip_test(r))
+                return log_tests_skipped_errno(r, "manager_new");
+        assert_se(r >= 0);
+        assert_se(manager_startup(m, NULL, NULL) >= 0);
+
+        test_unit_get_accounting(m);
+        test_get_units_accounting_bus(m);
+        test_get_units_accounting_varlink(m);
+
+        return 0;
+}
@@ -0,0 +1,242 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+
+#include "manager.h"
+#include "rm-rf.h"
+#include "service.h"
+#include "stdio-util.h"
+#include "tests.h"
+#include "unit.h"
+
+static Unit *make_unit(Manager *m, const char *prefix, unsigned n, unsigned i) {
+        char name[STRLEN("--.service") + 32 + DECIMAL_STR_MAX(unsigned) * 2];
+        Unit *u;
+
+        /* Every test makes its own set of units, named after the test and its number of units */
+        xsprintf(name, "%s-%u-%u.service", prefix, n, i);
+        assert_se(unit_new_for_name(m, sizeof(Service), name, &u) >= 0);
+
+        return u;
+}
+
+static Unit **make_units(Manager *m, const char *prefix, unsigned n) {
+        Unit **units;
+
+        assert_se(units = new(Unit*, n));
+        for (unsigned i = 0; i < n; i++)
+                units[i] = make_unit(m, prefix, n, i);
+
+        return units;
+}
+
+static unsigned unit_index(Unit **units, unsigned n, Unit *u) {
+        for (unsigned i = 0; i < n; i++)
+                if (units[i] == u)
+                        return i;
+
+        assert_not_reached("unit not found");
+}
+
+static void check_dependencies(Unit *u) {
+        size_t n = 0, end = u->n_dependencies_allocated;
+
+        /* The ranges of all types are in order, don't overlap, and their entries are all found by lookup */
+
+        for (UnitDependency d = _UNIT_DEPENDENCY_MAX; d > 0; d--) {
+                UnitDependencyRange *r = u->dependency_ranges + d - 1;
+
+                assert_se(r->offset <= end);
+                assert_se(r->n <= end - r->offset);
+                end = r->offset;
+
+                for (UnitDependencyEntry *e = unit_dependencies_begin(u, d - 1); e < unit_dependencies_end(u, d - 1); e++) {
+                        assert_se(e->type == d - 1);
+                        assert_se(unit_dependency_find(u, d - 1, e->other) == e);
+                }
+
+                assert_se(unit_count_dependencies(u, d - 1) == r->n);
+                n += r->n;
+        }
+
+        assert_se(end == 0);
+        assert_se(n == u->n_dependencies);
+        assert_se(u->dependencies_index || n < 32);
+}
+
+static void test_add_while_iterating(Manager *m, unsigned n) {
+        _cleanup_free_ Unit **units = NULL, **extra = NULL;
+        _cleanup_free_ bool *seen = NULL;
+        unsigned n_seen = 0;
+        Unit *u, *other;
+
+        log_info("/* %s(%u) */", __func__, n);
+
+        u = make_unit(m, "add", n, 0);
+        units = make_units(m, "add-wanted", n);
+        extra = make_units(m, "add-extra", n);
+        assert_se(seen = new0(bool, n));
+
+        for (unsigned i = 0; i < n; i++)
+                assert_se(unit_add_dependency(u, UNIT_WANTS, units[i], false, UNIT_DEPENDENCY_FILE) >= 0);
+        check_dependencies(u);
+
+        /* Adding entries of other types moves the array around, which the iteration has to survive. Entries of
+         * the type we iterate over are visited as well. */
+        UNIT_FOREACH_DEPENDENCY(other, u, UNIT_WANTS) {
+                unsigned i;
+
+                if (n_seen < n) {
+                        i = unit_index(units, n, other);
+                        assert_se(!seen[i]);
+                        seen[i] = true;
+
+                        assert_se(unit_add_dependency(u, UNIT_AFTER, units[i], false, UNIT_DEPENDENCY_DEFAULT) >= 0);
+                        assert_se(unit_add_dependency(u, UNIT_WANTS, extra[n_seen], false, UNIT_DEPENDENCY_DEFAULT) >= 0);
+                } else
+                        assert_se(other == extra[n_seen - n]);
+
+                n_seen++;
+        }
+
+        assert_se(n_seen == 2 * n);
+        assert_se(unit_count_dependencies(u, UNIT_WANTS) == 2 * n);
+        assert_se(unit_count_dependencies(u, UNIT_AFTER) == n);
+        assert_se(unit_count_dependencies(units[0], UNIT_WANTED_BY) == 1);
+        assert_se(unit_count_dependencies(units[0], UNIT_BEFORE) == 1);
+        check_dependencies(u);
+}
+
+static void test_remove_while_iterating(Manager *m, unsigned n) {
+        _cleanup_free_ Unit **units = NULL;
+        _cleanup_free_ bool *seen = NULL;
+        unsigned n_seen = 0;
+        Unit *u, *other;
+
+        log_info("/* %s(%u) */", __func__, n);
+
+        u = make_unit(m, "remove", n, 0);
+        units = make_units(m, "remove-wanted", n);
+        assert_se(seen = new0(bool, n));
+
+        for (unsigned i = 0; i < n; i++) {
+                assert_se(unit_add_dependency(u, UNIT_WANTS, units[i], false, UNIT_DEPENDENCY_FILE) >= 0);
+                assert_se(unit_add_dependency(u, UNIT_AFTER, units[i], false, UNIT_DEPENDENCY_FILE) >= 0);
+        }
+        check_dependencies(u);
+
+        /* Freeing the other unit drops the current entry, and the last one is moved into its place */
+        UNIT_FOREACH_DEPENDENCY(other, u, UNIT_WANTS) {
+                unsigned i;
+
+                i = unit_index(units, n, other);
+                assert_se(!seen[i]);
+                seen[i] = true;
+                n_seen++;
+
+                if (i % 2 == 0) {
+                        unit_free(other);
+                        units[i] = NULL;
+                        assert_se(!unit_dependency_find(u, UNIT_WANTS, other));
+                        assert_se(!unit_dependency_find(u, UNIT_AFTER, other));
+                }
+        }
+
+        assert_se(n_seen == n);
+        assert_se(unit_count_dependencies(u, UNIT_WANTS) == n / 2);
+        assert_se(unit_count_dependencies(u, UNIT_AFTER) == n / 2);
+        for (unsigned i = 1; i < n; i += 2)
+                assert_se(unit_has_dependency(u, UNIT_WANTS, units[i]));
+        check_dependencies(u);
+
+        /* And when the masks are dropped, the entries go away entirely */
+        unit_remove_dependencies(u, UNIT_DEPENDENCY_FILE);
+        assert_se(u->n_dependencies == 0);
+        for (unsigned i = 1; i < n; i += 2)
+                assert_se(units[i]->n_dependencies == 0);
+        check_dependencies(u);
+}
+
+static void test_merge(Manager *m, unsigned n) {
+        _cleanup_free_ Unit **units = NULL;
+        Unit *u, *alias, *x;
+        UnitDependencyEntry *e;
+
+        log_info("/* %s(%u) */", __func__, n);
+
+        u = make_unit(m, "merge", n, 0);
+        alias = make_unit(m, "merge-alias", n, 0);
+        x = make_unit(m, "merge-other", n, 0);
+        units = make_units(m, "merge-wanted", n);
+
+        /* u and its alias share half of their dependencies, with different masks */
+        for (unsigned i = 0; i < n; i++) {
+                if (i < n / 2)
+                        assert_se(unit_add_dependency(u, UNIT_WANTS, units[i], false, UNIT_DEPENDENCY_FILE) >= 0);
+                if (i >= n / 4)
+                        assert_se(unit_add_dependency(alias, UNIT_WANTS, units[i], false, UNIT_DEPENDENCY_DEFAULT) >= 0);
+                assert_se(unit_add_dependency(alias, UNIT_BEFORE, units[i], false, UNIT_DEPENDENCY_DEFAULT) >= 0);
+        }
+
+        /* Dependencies between the two are dropped, those of other units on the alias are moved over */
+        assert_se(unit_add_dependency(alias, UNIT_AFTER, u, false, UNIT_DEPENDENCY_FILE) >= 0);
+        assert_se(unit_add_dependency(x, UNIT_REQUIRES, alias, false, UNIT_DEPENDENCY_FILE) >= 0);
+        assert_se(unit_add_dependency(x, UNIT_REQUIRES, u, false, UNIT_DEPENDENCY_DEFAULT) >= 0);
+
+        assert_se(unit_merge(u, alias) >= 0);
+        assert_se(alias->merged_into == u);
+        assert_se(alias->n_dependencies == 0);
+
+        assert_se(unit_count_dependencies(u, UNIT_WANTS) == n);
+        assert_se(unit_count_dependencies(u, UNIT_BEFORE) == n);
+        assert_se(!unit_has_dependency(u, UNIT_AFTER, u));
+        assert_se(!unit_has_dependency(u, UNIT_BEFORE, u));
+        assert_se(!unit_has_dependency(u, UNIT_AFTER, alias));
+        for (unsigned i = 0; i < n; i++) {
+                assert_se(e = unit_dependency_find(u, UNIT_WANTS, units[i]));
+                assert_se(e->origin_mask == (i < n / 2 ? UNIT_DEPENDENCY_FILE : UNIT_DEPENDENCY_DEFAULT));
+
+                assert_se(unit_has_dependency(units[i], UNIT_WANTED_BY, u));
+                assert_se(!unit_has_dependency(units[i], UNIT_WANTED_BY, alias));
+                assert_se(unit_has_dependency(units[i], UNIT_AFTER, u));
+        }
+        check_dependencies(u);
+
+        assert_se(e = unit_dependency_find(x, UNIT_REQUIRES, u));
+        assert_se(e->origin_mask == (UNIT_DEPENDENCY_FILE|UNIT_DEPENDENCY_DEFAULT));
+        assert_se(!unit_has_dependency(x, UNIT_REQUIRES, alias));
+        assert_se(unit_count_dependencies(x, UNIT_REQUIRES) == 1);
+        check_dependencies(x);
+
+        assert_se(unit_has_dependency(u, UNIT_REQUIRED_BY, x));
+        assert_se(!unit_has_dependency(x, UNIT_REQUIRED_BY, alias));
+        for (unsigned i = 0; i < n; i++)
+                check_dependencies(units[i]);
+}
+
+int main(int argc, char *argv[]) {
+        _cleanup_(rm_rf_physical_and_freep) char *runtime_dir = NULL;
+        _cleanup_(manager_freep) Manager *m = NULL;
+        int r;
+
+        test_setup_logging(LOG_INFO);
+
+        r = enter_cgroup_subroot(NULL);
+        if (r == -ENOMEDIUM)
+                return log_tests_skipped("cgroupfs not available");
+
+        assert_se(runtime_dir = setup_fake_runtime_dir());
+        r = manager_new(UNIT_FILE_USER, MANAGER_TEST_RUN_MINIMAL, &m);
+        if (manager_errno_skip_test(r))
+                return log_tests_skipped_errno(r, "manager_new");
+        assert_se(r >= 0);
+        assert_se(manager_startup(m, NULL, NULL) >= 0);
+
+        /* Few dependencies are looked up by walking the array, many through the index */
+        test_add_while_iterating(m, 5);
+        test_add_while_iterating(m, 100);
+        test_remove_while_iterating(m, 5);
+        test_remove_while_iterating(m, 100);
+        test_merge(m, 4);
+        test_merge(m, 100);
+
+        return 0;
+}
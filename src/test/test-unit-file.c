@@ -1,10 +1,16 @@
 /* SPDX-License-Identifier: LGPL-2.1-or-later */
 
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "fileio.h"
 #include "path-lookup.h"
+#include "rm-rf.h"
 #include "set.h"
 #include "special.h"
 #include "strv.h"
 #include "tests.h"
+#include "tmpfile-util.h"
 #include "unit-file.h"
 
 static void test_unit_validate_alias_symlink_and_warn(void) {
@@ -73,6 +79,73 @@ static void test_unit_file_build_name_map(char **ids) {
         }
 }
 
+static void test_unit_file_snapshot(void) {
+        _cleanup_(rm_rf_physical_and_freep) char *d = NULL;
+        _cleanup_hashmap_free_ Hashmap *a = NULL, *b = NULL, *c = NULL;
+        _cleanup_set_free_ Set *changed = NULL;
+        LookupPaths lp = {};
+        bool dropins_changed;
+        const char *unit, *dropin;
+
+        log_info("/* %s */", __func__);
+
+        assert_se(mkdtemp_malloc(NULL, &d) >= 0);
+        lp.search_path = STRV_MAKE(d);
+
+        unit = strjoina(d, "/a.service");
+        dropin = strjoina(d, "/a.service.d/50-foo.conf");
+        assert_se(write_string_file(unit, "[Service]\nExecStart=/bin/true\n", WRITE_STRING_FILE_CREATE) >= 0);
+        assert_se(write_string_file(strjoina(d, "/b.service"), "[Service]\nExecStart=/bin/true\n", WRITE_STRING_FILE_CREATE) >= 0);
+
+        assert_se(unit_file_snapshot_take(&lp, &a) >= 0);
+        assert_se(hashmap_size(a) == 2);
+
+        assert_se(unit_file_snapshot_take(&lp, &b) >= 0);
+        assert_se(unit_file_snapshot_diff(a, b, &changed, &dropins_changed) == 0);
+        assert_se(set_isempty(changed));
+        assert_se(!dropins_changed);
+
+        /* Changed contents are reported per file */
+        assert_se(write_string_file(unit, "[Service]\nExecStart=/bin/false\nUser=nobody\n", 0) >= 0);
+        b = hashmap_free(b);
+        assert_se(unit_file_snapshot_take(&lp, &b) >= 0);
+        assert_se(unit_file_snapshot_diff(a, b, &changed, &dropins_changed) == 0);
+        assert_se(set_size(changed) == 1);
+        assert_se(set_contains(changed, unit));
+        assert_se(!dropins_changed);
+        changed = set_free(changed);
+
+        /* So are new drop-ins */
+        assert_se(write_string_file(dropin, "[Unit]\nDescription=foo\n", WRITE_STRING_FILE_CREATE|WRITE_STRING_FILE_MKDIR_0755) >= 0);
+        assert_se(unit_file_snapshot_take(&lp, &c) >= 0);
+        assert_se(unit_file_snapshot_diff(b, c, &changed, &dropins_changed) == 0);
+        assert_se(set_size(changed) == 1);
+        assert_se(set_contains(changed, dropin));
+        assert_se(dropins_changed);
+        changed = set_free(changed);
+
+        /* … and removed ones */
+        assert_se(unit_file_snapshot_diff(c, b, &changed, &dropins_changed) == 0);
+        assert_se(set_contains(changed, dropin));
+        assert_se(dropins_changed);
+        changed = set_free(changed);
+
+        /* New units, aliases and dependency symlinks change the structure */
+        assert_se(symlink("a.service", strjoina(d, "/c.service")) >= 0);
+        b = hashmap_free(b);
+        assert_se(unit_file_snapshot_take(&lp, &b) >= 0);
+        assert_se(unit_file_snapshot_diff(c, b, &changed, &dropins_changed) > 0);
+        assert_se(unit_file_snapshot_diff(b, c, &changed, &dropins_changed) > 0);
+        assert_se(!changed);
+
+        assert_se(mkdir(strjoina(d, "/b.service.wants"), 0755) >= 0);
+        assert_se(symlink("../a.service", strjoina(d, "/b.service.wants/a.service")) >= 0);
+        c = hashmap_free(c);
+        assert_se(unit_file_snapshot_take(&lp, &c) >= 0);
+        assert_se(unit_file_snapshot_diff(b, c, &changed, &dropins_changed) > 0);
+        assert_se(!changed);
+}
+
 static void test_runlevel_to_target(void) {
         log_info("/* %s */", __func__);
 
@@ -96,6 +169,7 @@ int main(int argc, char **argv) {
 
         test_unit_validate_alias_symlink_and_warn();
         test_unit_file_build_name_map(strv_skip(argv, 1));
+        test_unit_file_snapshot();
         test_runlevel_to_target();
 
         return 0;
@@ -20,8 +20,21 @@
    should cover any auxiliary fds, the listener server fds, stdin/stdout/stderr and whatever else. */
 #define OVERLOAD_CONNECTIONS 333
 
+/* Method calls pipelined on the main client connection, each with its own reply callback userdata */
+static const intmax_t pipelined[] = { 1, 10, 100, 1000 };
+
+/* The two regular calls, plus the pipelined ones */
+#define N_DONE (2 + (int) ELEMENTSOF(pipelined))
+
 static int n_done = 0;
+static int n_pipelined = 0;
 static int block_write_fd = -1;
+static pthread_t main_thread;
+
+/* Oneway calls queued on a single worker thread, that take long enough so that most of them are still queued
+ * when the server goes away */
+#define N_SLOW 16
+static unsigned n_slow = 0;
 
 static int method_something(Varlink *link, JsonVariant *parameters, VarlinkMethodFlags flags, void *userdata) {
         _cleanup_(json_variant_unrefp) JsonVariant *ret = NULL;
@@ -48,9 +61,217 @@ static int method_something(Varlink *link, JsonVariant *parameters, VarlinkMetho
         return varlink_reply(link, ret);
 }
 
+static int method_multiply(JsonVariant *parameters, VarlinkMethodFlags flags, JsonVariant **ret_parameters, const char **ret_error_id, void *userdata) {
+        JsonVariant *a, *b;
+
+        /* Worker methods must not run on the event loop thread */
+        assert_se(!pthread_equal(pthread_self(), main_thread));
+
+        a = json_variant_by_key(parameters, "a");
+        b = json_variant_by_key(parameters, "b");
+        if (!a || !b) {
+                *ret_error_id = "io.test.BadParameters";
+                return 0;
+        }
+
+        return json_build(ret_parameters, JSON_BUILD_OBJECT(JSON_BUILD_PAIR("product", JSON_BUILD_INTEGER(json_variant_integer(a) * json_variant_integer(b)))));
+}
+
+static int method_slow(JsonVariant *parameters, VarlinkMethodFlags flags, JsonVariant **ret_parameters, const char **ret_error_id, void *userdata) {
+        (void) usleep(20 * USEC_PER_MSEC);
+        __atomic_add_fetch(&n_slow, 1, __ATOMIC_SEQ_CST);
+
+        return 0;
+}
+
+static void on_disconnect_slow(VarlinkServer *s, Varlink *link, void *userdata) {
+        bool *disconnected = userdata;
+
+        *disconnected = true;
+}
+
+static void test_destroy_with_queued_work(void) {
+        _cleanup_(varlink_flush_close_unrefp) Varlink *c = NULL;
+        _cleanup_(varlink_server_unrefp) VarlinkServer *s = NULL;
+        _cleanup_(sd_event_unrefp) sd_event *e = NULL;
+        _cleanup_close_pair_ int pair[2] = { -1, -1 };
+        bool disconnected = false;
+        unsigned n;
+
+        log_info("/* %s */", __func__);
+
+        assert_se(sd_event_new(&e) >= 0);
+
+        assert_se(varlink_server_new(&s, 0) >= 0);
+        assert_se(varlink_server_bind_method_worker(s, "io.test.Slow", method_slow) >= 0);
+        assert_se(varlink_server_bind_disconnect(s, on_disconnect_slow) >= 0);
+        assert_se(varlink_server_set_workers_max(s, 1) >= 0);
+        varlink_server_set_userdata(s, &disconnected);
+        assert_se(varlink_server_attach_event(s, e, 0) >= 0);
+
+        assert_se(socketpair(AF_UNIX, SOCK_STREAM|SOCK_CLOEXEC, 0, pair) >= 0);
+        assert_se(varlink_server_add_connection(s, pair[0], NULL) >= 0);
+        TAKE_FD(pair[0]);
+        assert_se(varlink_connect_fd(&c, pair[1]) >= 0);
+        TAKE_FD(pair[1]);
+
+        for (unsigned i = 0; i < N_SLOW; i++)
+                assert_se(varlink_send(c, "io.test.Slow", NULL) >= 0);
+        assert_se(varlink_flush(c) >= 0);
+
+        /* Let the server read and queue all calls, which takes much less time than running the first one */
+        for (unsigned i = 0; i < 10 * N_SLOW; i++)
+                assert_se(sd_event_run(e, 0) >= 0);
+        assert_se(__atomic_load_n(&n_slow, __ATOMIC_SEQ_CST) < N_SLOW);
+
+        /* Now drop our reference to the server, and hang up, so that the connection drops the last one */
+        s = varlink_server_unref(s);
+        c = varlink_flush_close_unref(c);
+
+        while (!disconnected)
+                assert_se(sd_event_run(e, UINT64_MAX) >= 0);
+
+        /* The server is gone now, the worker thread was joined, and the remaining calls were dropped */
+        n = __atomic_load_n(&n_slow, __ATOMIC_SEQ_CST);
+        assert_se(n < N_SLOW);
+        (void) usleep(100 * USEC_PER_MSEC);
+        assert_se(__atomic_load_n(&n_slow, __ATOMIC_SEQ_CST) == n);
+        assert_se(sd_event_run(e, 0) >= 0);
+}
+
+/* Calls pipelined on a connection to a server with VARLINK_SERVER_PIPELINE: every other one is held back
+ * until all of them were received, and they are then answered in reverse order. The others run on worker
+ * threads, and are answered as soon as they are done. */
+#define N_HOLD 4U
+
+typedef struct PipelineTest {
+        VarlinkServer *server;
+        Varlink *held[N_HOLD];
+        unsigned n_held;
+        unsigned n_replies;
+        Varlink *hanging;
+        bool hanging_disconnected;
+        unsigned n_disconnected;
+} PipelineTest;
+
+static int method_hold(Varlink *link, JsonVariant *parameters, VarlinkMethodFlags flags, void *userdata) {
+        PipelineTest *t = varlink_server_get_userdata(varlink_get_server(link));
+        uid_t uid;
+
+        /* Every call gets an object of its own, with the connection's properties */
+        assert_se(varlink_get_server(link) == t->server);
+        assert_se(varlink_get_peer_uid(link, &uid) >= 0);
+        assert_se(uid == getuid());
+        assert_se(varlink_get_event(link));
+
+        if (t->n_held >= N_HOLD) {
+                /* Beyond the first round, leave the call hanging until the connection goes away */
+                t->hanging = varlink_ref(link);
+                return 0;
+        }
+
+        for (unsigned i = 0; i < t->n_held; i++)
+                assert_se(t->held[i] != link);
+
+        t->held[t->n_held++] = varlink_ref(link);
+        if (t->n_held < N_HOLD)
+                return 0;
+
+        for (unsigned i = N_HOLD; i > 0; i--) {
+                assert_se(varlink_replyb(t->held[i-1], JSON_BUILD_OBJECT(JSON_BUILD_PAIR("index", JSON_BUILD_UNSIGNED(i-1)))) >= 0);
+                t->held[i-1] = varlink_unref(t->held[i-1]);
+        }
+
+        return 0;
+}
+
+static void on_disconnect_pipelined(VarlinkServer *s, Varlink *link, void *userdata) {
+        PipelineTest *t = userdata;
+
+        /* Unanswered calls are reported, too */
+        if (link == t->hanging)
+                t->hanging_disconnected = true;
+
+        t->n_disconnected++;
+}
+
+static int reply_pipelined_server(Varlink *link, JsonVariant *parameters, const char *error_id, VarlinkReplyFlags flags, void *userdata) {
+        PipelineTest *t = varlink_get_userdata(link);
+        unsigned i = PTR_TO_UINT(userdata);
+
+        assert_se(!error_id);
+
+        /* Replies arrive in call order, even though the server answered them in a different one */
+        assert_se(i == t->n_replies++);
+
+        if (i % 2 == 0)
+                assert_se(json_variant_unsigned(json_variant_by_key(parameters, "index")) == i / 2);
+        else
+                assert_se(json_variant_integer(json_variant_by_key(parameters, "product")) == (intmax_t) i * 3);
+
+        return 0;
+}
+
+static void test_pipelined_server(void) {
+        _cleanup_(varlink_server_unrefp) VarlinkServer *s = NULL;
+        _cleanup_(varlink_close_unrefp) Varlink *c = NULL;
+        _cleanup_(sd_event_unrefp) sd_event *e = NULL;
+        _cleanup_close_pair_ int pair[2] = { -1, -1 };
+        PipelineTest t = {};
+
+        log_info("/* %s */", __func__);
+
+        assert_se(sd_event_new(&e) >= 0);
+
+        assert_se(varlink_server_new(&s, VARLINK_SERVER_PIPELINE) >= 0);
+        assert_se(varlink_server_bind_method(s, "io.test.Hold", method_hold) >= 0);
+        assert_se(varlink_server_bind_method_worker(s, "io.test.Multiply", method_multiply) >= 0);
+        assert_se(varlink_server_bind_disconnect(s, on_disconnect_pipelined) >= 0);
+        varlink_server_set_userdata(s, &t);
+        assert_se(varlink_server_attach_event(s, e, 0) >= 0);
+        t.server = s;
+
+        assert_se(socketpair(AF_UNIX, SOCK_STREAM|SOCK_CLOEXEC, 0, pair) >= 0);
+        assert_se(varlink_server_add_connection(s, pair[0], NULL) >= 0);
+        TAKE_FD(pair[0]);
+        assert_se(varlink_connect_fd(&c, pair[1]) >= 0);
+        TAKE_FD(pair[1]);
+        varlink_set_userdata(c, &t);
+        assert_se(varlink_attach_event(c, e, 0) >= 0);
+
+        for (unsigned i = 0; i < 2 * N_HOLD; i++) {
+                _cleanup_(json_variant_unrefp) JsonVariant *p = NULL;
+
+                if (i % 2 == 0)
+                        assert_se(varlink_invoke_full(c, "io.test.Hold", NULL, reply_pipelined_server, UINT_TO_PTR(i)) >= 0);
+                else {
+                        assert_se(json_build(&p, JSON_BUILD_OBJECT(JSON_BUILD_PAIR("a", JSON_BUILD_INTEGER(i)),
+                                                                   JSON_BUILD_PAIR("b", JSON_BUILD_INTEGER(3)))) >= 0);
+                        assert_se(varlink_invoke_full(c, "io.test.Multiply", p, reply_pipelined_server, UINT_TO_PTR(i)) >= 0);
+                }
+        }
+
+        while (t.n_replies < 2 * N_HOLD)
+                assert_se(sd_event_run(e, UINT64_MAX) >= 0);
+
+        /* Now leave one call unanswered, and hang up */
+        assert_se(varlink_invoke(c, "io.test.Hold", NULL) >= 0);
+        while (!t.hanging)
+                assert_se(sd_event_run(e, UINT64_MAX) >= 0);
+        c = varlink_close_unref(c);
+
+        while (t.n_disconnected < 2)
+                assert_se(sd_event_run(e, UINT64_MAX) >= 0);
+
+        /* Both the call and the connection were reported, and the call can't be answered anymore */
+        assert_se(t.hanging_disconnected);
+        assert_se(varlink_reply(t.hanging, NULL) == -ENOTCONN);
+        t.hanging = varlink_unref(t.hanging);
+}
+
 static int method_done(Varlink *link, JsonVariant *parameters, VarlinkMethodFlags flags, void *userdata) {
 
-        if (++n_done == 2)
+        if (++n_done == N_DONE)
                 sd_event_exit(varlink_get_event(link), EXIT_FAILURE);
 
         return 0;
@@ -63,7 +284,23 @@ static int reply(Varlink *link, JsonVariant *parameters, const char *error_id, V
 
         assert_se(json_variant_integer(sum) == 7+22);
 
-        if (++n_done == 2)
+        if (++n_done == N_DONE)
+                sd_event_exit(varlink_get_event(link), EXIT_FAILURE);
+
+        return 0;
+}
+
+static int reply_pipelined(Varlink *link, JsonVariant *parameters, const char *error_id, VarlinkReplyFlags flags, void *userdata) {
+        const intmax_t *x = userdata;
+        JsonVariant *sum;
+
+        /* Replies are delivered in call order */
+        assert_se(x == pipelined + n_pipelined++);
+
+        sum = json_variant_by_key(parameters, "sum");
+        assert_se(json_variant_integer(sum) == *x + 1);
+
+        if (++n_done == N_DONE)
                 sd_event_exit(varlink_get_event(link), EXIT_FAILURE);
 
         return 0;
@@ -160,6 +397,13 @@ static void *thread(void *arg) {
         assert_se(streq_ptr(json_variant_string(json_variant_by_key(o, "method")), "io.test.IDontExist"));
         assert_se(streq(e, VARLINK_ERROR_METHOD_NOT_FOUND));
 
+        assert_se(varlink_call(c, "io.test.Multiply", i, &o, &e, NULL) >= 0);
+        assert_se(json_variant_integer(json_variant_by_key(o, "product")) == 88 * 99);
+        assert_se(!e);
+
+        assert_se(varlink_callb(c, "io.test.Multiply", &o, &e, NULL, JSON_BUILD_OBJECT(JSON_BUILD_PAIR("a", JSON_BUILD_INTEGER(1)))) >= 0);
+        assert_se(streq(e, "io.test.BadParameters"));
+
         flood_test(arg);
 
         assert_se(varlink_send(c, "io.test.Done", NULL) >= 0);
@@ -198,6 +442,11 @@ int main(int argc, char *argv[]) {
         log_set_max_level(LOG_DEBUG);
         log_open();
 
+        main_thread = pthread_self();
+
+        test_destroy_with_queued_work();
+        test_pipelined_server();
+
         assert_se(mkdtemp_malloc("/tmp/varlink-test-XXXXXX", &tmpdir) >= 0);
         sp = strjoina(tmpdir, "/socket");
 
@@ -213,6 +462,9 @@ int main(int argc, char *argv[]) {
 
         assert_se(varlink_server_bind_method(s, "io.test.DoSomething", method_something) >= 0);
         assert_se(varlink_server_bind_method(s, "io.test.Done", method_done) >= 0);
+        assert_se(varlink_server_bind_method_worker(s, "io.test.Multiply", method_multiply) >= 0);
+        assert_se(varlink_server_bind_method_worker(s, "io.test.Done", method_multiply) == -EEXIST);
+        assert_se(varlink_server_set_workers_max(s, 2) >= 0);
         assert_se(varlink_server_bind_connect(s, on_connect) >= 0);
         assert_se(varlink_server_listen_address(s, sp, 0600) >= 0);
         assert_se(varlink_server_attach_event(s, e, 0) >= 0);
@@ -227,6 +479,14 @@ int main(int argc, char *argv[]) {
 
         assert_se(varlink_invoke(c, "io.test.DoSomething", v) >= 0);
 
+        for (size_t i = 0; i < ELEMENTSOF(pipelined); i++) {
+                _cleanup_(json_variant_unrefp) JsonVariant *p = NULL;
+
+                assert_se(json_build(&p, JSON_BUILD_OBJECT(JSON_BUILD_PAIR("a", JSON_BUILD_INTEGER(pipelined[i])),
+                                                           JSON_BUILD_PAIR("b", JSON_BUILD_INTEGER(1)))) >= 0);
+                assert_se(varlink_invoke_full(c, "io.test.DoSomething", p, reply_pipelined, (void*) (pipelined + i)) >= 0);
+        }
+
         assert_se(varlink_attach_event(c, e, 0) >= 0);
 
         assert_se(pthread_create(&t, NULL, thread, (void*) sp) == 0);
@@ -235,5 +495,7 @@ int main(int argc, char *argv[]) {
 
         assert_se(pthread_join(t, NULL) == 0);
 
+        assert_se(n_pipelined == (int) ELEMENTSOF(pipelined));
+
         return 0;
 }
@@ -1,11 +1,56 @@
 /* SPDX-License-Identifier: LGPL-2.1-or-later */
 
+#include <sys/wait.h>
+#include <unistd.h>
+
 #include "log.h"
 #include "manager.h"
+#include "process-util.h"
 #include "rm-rf.h"
 #include "service.h"
 #include "tests.h"
 
+static void test_reap_race(Manager *m, Unit *u, bool sigchld_first) {
+        siginfo_t si = {};
+        unsigned gen;
+        pid_t pid;
+
+        log_info("/* %s(sigchld_first=%s) */", __func__, yes_no(sigchld_first));
+
+        pid = fork();
+        assert_se(pid >= 0);
+        if (pid == 0)
+                _exit(EXIT_SUCCESS);
+
+        assert_se(unit_watch_pid(u, pid, true) >= 0);
+        if (!hashmap_get(m->watch_pidfds, PID_TO_PTR(pid))) {
+                log_notice("pidfds not supported, skipping.");
+                unit_unwatch_pid(u, pid);
+                assert_se(waitid(P_PID, pid, &si, WEXITED) >= 0);
+                return;
+        }
+
+        /* Wait for the child to exit without reaping it, so that the pidfd and the SIGCHLD logic both see
+         * the exit in the same event loop iteration. Their relative order is determined by priority. */
+        assert_se(waitid(P_PID, pid, &si, WEXITED|WNOWAIT) >= 0);
+        assert_se(sd_event_source_set_priority(m->sigchld_event_source,
+                                               SD_EVENT_PRIORITY_NORMAL + (sigchld_first ? -8 : -6)) >= 0);
+        assert_se(sd_event_source_set_enabled(m->sigchld_event_source, SD_EVENT_ON) >= 0);
+
+        gen = m->sigchldgen;
+        for (unsigned i = 0; i < 16; i++)
+                assert_se(sd_event_run(m->event, 0) >= 0);
+
+        /* The exit was dispatched exactly once, to the unit, and the child is gone together with its pidfd */
+        assert_se(m->sigchldgen == gen + 1);
+        assert_se(u->sigchldgen == m->sigchldgen);
+        assert_se(!hashmap_get(m->watch_pidfds, PID_TO_PTR(pid)));
+        assert_se(manager_get_unit_by_pid(m, pid) == NULL);
+        assert_se(waitid(P_PID, pid, &si, WEXITED|WNOHANG) < 0 && errno == ECHILD);
+
+        assert_se(sd_event_source_set_priority(m->sigchld_event_source, SD_EVENT_PRIORITY_NORMAL-7) >= 0);
+}
+
 int main(int argc, char *argv[]) {
         _cleanup_(rm_rf_physical_and_freep) char *runtime_dir = NULL;
         _cleanup_(manager_freep) Manager *m = NULL;
@@ -86,5 +131,8 @@ int main(int argc, char *argv[]) {
         unit_unwatch_pid(c, 4711);
         assert_se(manager_get_unit_by_pid(m, 4711) == NULL);
 
+        test_reap_race(m, a, false);
+        test_reap_race(m, a, true);
+
         return 0;
 }
@@ -0,0 +1,88 @@
+#!/usr/bin/env python3
+# SPDX-License-Identifier: LGPL-2.1-or-later
+
+# Checks that every field of ExecContext and ExecParameters is passed on to systemd-executor, i.e. both
+# serialized and deserialized in src/core/execute-serialize.c, or explicitly listed there as not needed.
+# Otherwise a field added later would silently be dropped on that path, and with it maybe a sandboxing
+# setting.
+
+import re
+import sys
+
+def strip_comments(text):
+    return re.sub(r'/\*.*?\*/', '', text, flags=re.S)
+
+def struct_fields(header, name):
+    m = re.search(r'^struct %s \{\n(.*?)^\};' % name, header, re.S | re.M)
+    if not m:
+        sys.exit(f'struct {name} not found')
+
+    fields = []
+    for decl in strip_comments(m.group(1)).split(';'):
+        decl = ' '.join(decl.split())
+        if not decl:
+            continue
+
+        m = re.fullmatch(r'LIST_HEAD\(\w+, (\w+)\)', decl)
+        if m:
+            fields.append(m.group(1))
+            continue
+
+        for declarator in decl.split(','):
+            declarator = re.sub(r'\[.*?\]|:\s*\d+', '', declarator)
+            fields.append(re.findall(r'\w+', declarator)[-1])
+
+    return fields
+
+def function_body(source, name):
+    m = re.search(r'^\w.*\b%s\(.*?^\}$' % name, source, re.S | re.M)
+    if not m:
+        sys.exit(f'{name}() not found')
+    return m.group(0)
+
+def check(struct, fields, not_needed, users):
+    ok = True
+
+    for field in fields:
+        if field in not_needed:
+            continue
+
+        for function, body, pattern in users:
+            if not re.search(pattern % re.escape(field), body):
+                print(f'{struct}.{field} is not handled in {function}()')
+                ok = False
+
+    return ok
+
+def main(root):
+    header = open(f'{root}/src/core/execute.h').read()
+    source = strip_comments(open(f'{root}/src/core/execute-serialize.c').read())
+    raw = open(f'{root}/src/core/execute-serialize.c').read()
+
+    # "Not needed by systemd-executor: ExecParameters.foo, ..." comments in execute-serialize.c
+    not_needed = set(re.findall(r'\b(\w+\.\w+)\b', ' '.join(re.findall(r'Not needed by systemd-executor:([^*]*)', raw))))
+
+    table = re.search(r'exec_context_fields\[\] = \{(.*?)\};', source, re.S).group(1)
+    context_ser = function_body(source, 'exec_context_serialize') + table
+    context_deser = function_body(source, 'exec_context_deserialize_item') + table
+    params_ser = function_body(source, 'exec_invocation_serialize')
+    params_deser = function_body(source, 'exec_invocation_deserialize_item') + function_body(source, 'exec_invocation_deserialize')
+
+    ok = check('ExecContext',
+               struct_fields(header, 'ExecContext'),
+               {f.split('.')[1] for f in not_needed if f.startswith('ExecContext.')},
+               [('exec_context_serialize', context_ser, r'(c->|, *)%s\b'),
+                ('exec_context_deserialize_item', context_deser, r'(c->|, *)%s\b')])
+
+    ok = check('ExecParameters',
+               struct_fields(header, 'ExecParameters'),
+               {f.split('.')[1] for f in not_needed if f.startswith('ExecParameters.')},
+               [('exec_invocation_serialize', params_ser, r'params->%s\b'),
+                ('exec_invocation_deserialize', params_deser, r'(p->|params\.)%s\b')]) and ok
+
+    if not ok:
+        print('Update src/core/execute-serialize.c to pass the field(s) above on to systemd-executor.')
+        sys.exit(1)
+
+if __name__ == '__main__':
+    main(sys.argv[1])